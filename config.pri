@@ -11,3 +11,9 @@ EXTRALIBS += -lrdf
 #QMAKE_CXXFLAGS += -I/usr/include/sord-0 -I/usr/include/serd-0 -Werror
 #EXTRALIBS += -lsord-0 -lserd-0
 
+# Define this to use Dataquay's own in-memory datastore, which needs
+# only Serd (http://drobilla.net/software/serd/) for import and export
+#DEFINES += USE_NATIVE
+#QMAKE_CXXFLAGS += -I/usr/include/serd-0 -Werror
+#EXTRALIBS += -lserd-0
+
@@ -35,6 +35,7 @@
 #define DATAQUAY_BASIC_STORE_H
 
 #include "Store.h"
+#include "Statistics.h"
 
 namespace Dataquay
 {
@@ -46,11 +47,23 @@ namespace Dataquay
  * interface, providing add, remove, matching and query operations for
  * RDF triples and SPARQL, as well as export and import.
  *
- * BasicStore uses a Redland or Sord datastore internally, depending
- * on whether USE_REDLAND or USE_SORD was defined when Dataquay was
- * built.
+ * BasicStore uses a Redland or Sord datastore internally, or
+ * Dataquay's own dictionary-encoded in-memory datastore, depending on
+ * whether USE_REDLAND, USE_SORD or USE_NATIVE was defined when
+ * Dataquay was built.
  *
- * All operations are thread safe.
+ * All operations are thread safe.  Readers of a store share its
+ * lock, and so may proceed in parallel, except with Redland.
+ *
+ * Redland is not thread-safe itself, and it makes no promise that
+ * separate librdf worlds may be used from separate threads at once,
+ * so every Redland store in a process uses one world, and all of
+ * them take turns in every call to Redland.  With Redland, then,
+ * reads get no concurrency at all, whether in one store or across
+ * several: adding reader threads will not raise the rate of reads,
+ * and a long read or write in any store holds up reads in every
+ * other.  Use Sord or the native datastore where concurrent reads
+ * matter.
  */
 class BasicStore : public Store
 {
@@ -94,16 +107,120 @@ public:
      */
     void addPrefix(QString prefix, Uri uri);
 
+    /**
+     * Set the maximum number of URIs for which the store keeps a
+     * ready-converted node from the underlying RDF library, so that
+     * URIs in frequent use (such as common predicates) need not be
+     * converted afresh on every access.  The least recently used
+     * URIs are dropped first.  The default is 1024.  Set 0 to disable
+     * the cache.
+     *
+     * The native datastore (USE_NATIVE) converts nothing that it
+     * could cache, so there the size has no effect and the hit and
+     * miss counts are always zero.
+     */
+    void setUriCacheSize(int uris);
+
+    /**
+     * Retrieve the maximum number of URIs held in the URI cache.
+     */
+    int getUriCacheSize() const;
+
+    /**
+     * Return the number of URI conversions satisfied from the URI
+     * cache since the store was constructed.  Compare with
+     * getUriCacheMisses() to see whether the cache is large enough.
+     */
+    quint64 getUriCacheHits() const;
+
+    /**
+     * Return the number of URI conversions that could not be
+     * satisfied from the URI cache since the store was constructed.
+     */
+    quint64 getUriCacheMisses() const;
+
+    /**
+     * Set the number of threads used to parse N-Triples documents.
+     * When import() or importString() is called with format
+     * "ntriples", the document is split into chunks at line
+     * boundaries and the chunks are parsed in parallel, without the
+     * store being locked, before all of the resulting triples are
+     * added in a single pass.  (Only local files are read this way
+     * by import(); other URLs go to the RDF library as before.)  The
+     * default, 0, uses one thread per processor core.  Set 1 to
+     * parse on the calling thread only.
+     */
+    void setImportThreads(int threads);
+
+    /**
+     * Retrieve the number of threads used to parse N-Triples
+     * documents, or 0 for one per processor core.
+     */
+    int getImportThreads() const;
+
+    /**
+     * Test whether each of the given triples is in the store, as
+     * contains() would, returning one result for each in the same
+     * order.  The store is locked once for the whole list, and nodes
+     * common to several triples are converted only once, so this is
+     * much cheaper than calling contains() for each.  Throws
+     * RDFException if any triple is incomplete.
+     */
+    QList<bool> containsAll(Triples ts) const;
+
+    /**
+     * Set whether the store gathers statistics about its operations
+     * and its internal lock, for getStatistics().  The default is
+     * false, in which case gathering them costs next to nothing.
+     * Gathering resumes where it left off when re-enabled; call
+     * resetStatistics() to start afresh.
+     */
+    void setStatisticsEnabled(bool enabled);
+
+    /**
+     * Return true if the store is gathering statistics.
+     */
+    bool getStatisticsEnabled() const;
+
+    /**
+     * Return a snapshot of the statistics gathered so far.  These are:
+     *
+     *  - for each Store operation (by name, such as "add", "match" or
+     *    "importString"): a count, and a duration histogram under the
+     *    same name;
+     *
+     *  - for addAll, removeAll, containsAll, change and revert: a
+     *    size histogram of the number of triples or changes given,
+     *    under the same name;
+     *
+     *  - for the lock that protects the underlying datastore: wait
+     *    and hold duration histograms named "backend read wait",
+     *    "backend read hold", "backend write wait" and "backend write
+     *    hold".  Hold times are close to the time spent in the
+     *    datastore itself.
+     */
+    Statistics getStatistics() const;
+
+    /**
+     * Discard the statistics gathered so far.
+     */
+    void resetStatistics();
+
     // Store interface
 
     bool add(Triple t);
     bool remove(Triple t);
+    int addAll(Triples ts);
+    int removeAll(Triples ts);
 
     void change(ChangeSet changes);
     void revert(ChangeSet changes);
 
     bool contains(Triple t) const;
     Triples match(Triple t) const;
+    void match(Triple t, TripleVisitor visitor) const;
+    int count(Triple t) const;
+    int size() const;
     ResultSet query(QString sparql) const;
 
     Node complete(Triple t) const;
@@ -154,6 +271,29 @@ public:
      */
     static BasicStore *loadString(QString encodedRdf, Uri baseUri, QString format = "");
 
+    /**
+     * Write the whole store, with its base URI and prefixes, to a
+     * binary snapshot file with the given filename (not a URL).  A
+     * snapshot holds the triples already encoded as a dictionary of
+     * terms and a table of term IDs, so that loadSnapshot can read it
+     * back without any RDF parsing, far more quickly than import()
+     * can read the equivalent Turtle.  The format is the same for
+     * every datastore backend.  If the file already exists, it will
+     * be replaced.  May throw RDFException.
+     */
+    void saveSnapshot(QString filename) const;
+
+    /**
+     * Construct a new BasicStore from the snapshot file with the
+     * given filename, as written by saveSnapshot.  The store takes
+     * its base URI and prefixes from the snapshot.  May throw
+     * RDFException, for example if the file is not a valid snapshot.
+     * The returned BasicStore is owned by the caller and must be
+     * deleted using delete when finished with.  The return value is
+     * never NULL; all errors result in exceptions.
+     */
+    static BasicStore *loadSnapshot(QString filename);
+
 private:
     class D;
     D *m_d;
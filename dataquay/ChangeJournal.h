@@ -0,0 +1,161 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef DATAQUAY_CHANGE_JOURNAL_H
+#define DATAQUAY_CHANGE_JOURNAL_H
+
+#include "Store.h"
+
+namespace Dataquay
+{
+
+class BasicStore;
+
+/**
+ * \class ChangeJournal ChangeJournal.h <dataquay/ChangeJournal.h>
+ *
+ * ChangeJournal persists a BasicStore as a base snapshot (see
+ * BasicStore::saveSnapshot) plus a journal of the ChangeSets applied
+ * to it since the snapshot was written.  Saving a change appends it
+ * to the journal, at a cost that depends only on the size of the
+ * change rather than, as with BasicStore::save, on the size of the
+ * whole store.  The base snapshot is rewritten only when compact()
+ * is called.
+ *
+ * A typical use is to load the store with load(), wrap it in a
+ * TransactionalStore, and pass each committed transaction's
+ * Transaction::getCommittedChanges() to append(), calling compact()
+ * from time to time when the journal has grown large.
+ *
+ * A ChangeJournal may also serve as the write-ahead log of a
+ * TransactionalStore, which appends and syncs each transaction's
+ * changes as it commits (see sync()) and replays the journal into its
+ * store on construction.
+ *
+ * ChangeSets must be appended in the order in which they were
+ * applied to the store.  A change that was only partly written to
+ * the journal (for example because the process was killed during
+ * append) is discarded when the journal is next read.
+ *
+ * All operations are thread safe.
+ */
+class ChangeJournal
+{
+public:
+    /**
+     * Create a ChangeJournal for the base snapshot file with the
+     * given filename (not a URL).  The journal itself is kept in a
+     * file of the same name with ".journal" appended.  Neither file
+     * need exist yet.  Throw RDFException if the journal exists but
+     * is not a valid journal, or cannot be opened for writing.
+     */
+    ChangeJournal(QString filename);
+    ~ChangeJournal();
+
+    /**
+     * Construct a new BasicStore from the base snapshot, or an empty
+     * store if there is no snapshot yet, and replay the journal into
+     * it.  May throw RDFException.  The returned BasicStore is owned
+     * by the caller and must be deleted using delete when finished
+     * with.
+     */
+    BasicStore *load();
+
+    /**
+     * Replay the journal into the given store, without reference to
+     * the base snapshot.  Replay is idempotent: a change that the
+     * store already reflects has no effect.  May throw RDFException.
+     */
+    void replay(Store *store);
+
+    /**
+     * Append the given ChangeSet to the journal, and return its entry
+     * number, which may be passed to sync().  The change has been
+     * handed to the operating system when this returns, but it is
+     * not synced to disc.  May throw RDFException.
+     */
+    quint64 append(const ChangeSet &changes);
+
+    /**
+     * Return once the journal entry with the given number, and every
+     * entry before it, has been synced to disc.  May throw
+     * RDFException.
+     *
+     * With group sync (the default), threads calling sync() at the
+     * same time share a single sync of the file: one thread syncs
+     * every entry appended so far, while the others wait for it
+     * rather than each syncing in turn.  Other threads may go on
+     * appending while a sync is under way.
+     */
+    void sync(quint64 entry);
+
+    /**
+     * Set whether threads calling sync() at the same time share a
+     * single sync of the file (the default).  If not, every call
+     * syncs the file itself, holding up appends meanwhile.
+     */
+    void setGroupSync(bool group);
+
+    /**
+     * Write the whole of the given store as the new base snapshot and
+     * empty the journal.  The store must be the one loaded from this
+     * journal, with every change to it appended.  May throw
+     * RDFException.
+     *
+     * Don't call this on the write-ahead log of a TransactionalStore,
+     * whose commits and queries may change the store while the
+     * snapshot is being written: call TransactionalStore::compact()
+     * instead.
+     */
+    void compact(const BasicStore *store);
+
+    /**
+     * Return the number of ChangeSets in the journal, that is, those
+     * that would be replayed by load().
+     */
+    int getEntryCount() const;
+
+    /**
+     * Return the size in bytes of the journal file.
+     */
+    qint64 getJournalSize() const;
+
+private:
+    class D;
+    D *m_d;
+};
+
+}
+
+#endif
@@ -0,0 +1,104 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef DATAQUAY_CHANGE_SUBSCRIPTION_H
+#define DATAQUAY_CHANGE_SUBSCRIPTION_H
+
+#include "Store.h"
+
+#include <QObject>
+
+namespace Dataquay
+{
+
+class TransactionalStore;
+
+/**
+ * \class ChangeSubscription ChangeSubscription.h <dataquay/ChangeSubscription.h>
+ *
+ * ChangeSubscription delivers the changes committed to a
+ * TransactionalStore that match a single triple pattern, such as
+ * (:track1, (any), (any)) for everything said about one subject or
+ * ((any), rdf:type, :Track) for the addition and removal of tracks.
+ * Obtain one from TransactionalStore::subscribe().
+ *
+ * Whereas every receiver of TransactionalStore::transactionCommitted
+ * is given the whole of every change set to pick through, the store
+ * routes each change only to the subscriptions whose patterns match
+ * it, through an index of their patterns.  The cost of notification
+ * therefore depends on the number of changes that are of interest,
+ * not on the number of subscribers.
+ *
+ * The changesCommitted signal is emitted from the same thread as
+ * TransactionalStore::transactionCommitted would be for the same
+ * transaction, and before it.  Delete the ChangeSubscription to
+ * unsubscribe.  A subscription that outlives its store simply
+ * receives nothing further.
+ */
+class ChangeSubscription : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Delete the subscription, and so unsubscribe.
+     */
+    ~ChangeSubscription();
+
+    /**
+     * Return the pattern that changes must match to be delivered.
+     * Nothing nodes in the pattern are wildcards.
+     */
+    Triple getPattern() const;
+
+signals:
+    /**
+     * Emitted after a transaction has been committed that included
+     * changes matching the pattern.  The change set contains those
+     * changes only, in the order in which the transaction made them.
+     */
+    void changesCommitted(const ChangeSet &cs);
+
+private:
+    friend class TransactionalStore;
+    ChangeSubscription(TransactionalStore *ts, Triple pattern, QObject *parent);
+    ChangeSubscription(const ChangeSubscription &);
+    ChangeSubscription &operator=(const ChangeSubscription &);
+    TransactionalStore *m_ts;
+    Triple m_pattern;
+};
+
+}
+
+#endif
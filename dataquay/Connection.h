@@ -51,10 +51,10 @@ class Transaction;
  * 
  * Each processing thread may construct a Connection to a central
  * TransactionalStore.  The Connection will start a new Transaction on
- * the store when the first modifying function (add, remove, change or
- * revert) is called and will continue to use this Transaction for all
- * accesses to the store until either commit() or rollback() is called
- * on the Connection.
+ * the store when the first modifying function (add, remove, addAll,
+ * removeAll, change or revert) is called and will continue to use
+ * this Transaction for all accesses to the store until either
+ * commit() or rollback() is called on the Connection.
  *
  * Any read-only functions called on this class between a commit() or
  * rollback() and the next modifying function will be passed directly
@@ -93,10 +93,15 @@ public:
     // Store interface
     bool add(Triple t);
     bool remove(Triple t);
+    int addAll(Triples ts);
+    int removeAll(Triples ts);
     void change(ChangeSet changes);
     void revert(ChangeSet changes);
     bool contains(Triple t) const;
     Triples match(Triple t) const;
+    void match(Triple t, TripleVisitor visitor) const;
+    int count(Triple t) const;
+    int size() const;
     ResultSet query(QString sparql) const;
     Node complete(Triple t) const;
     Triple matchOnce(Triple t) const;
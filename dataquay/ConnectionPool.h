@@ -0,0 +1,207 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef DATAQUAY_CONNECTION_POOL_H
+#define DATAQUAY_CONNECTION_POOL_H
+
+#include "Statistics.h"
+
+namespace Dataquay
+{
+
+class TransactionalStore;
+class Connection;
+
+/**
+ * \class ConnectionPool ConnectionPool.h <dataquay/ConnectionPool.h>
+ *
+ * ConnectionPool hands out Connection objects to a single
+ * TransactionalStore, and takes them back again for reuse, so that a
+ * pool of worker threads handling a stream of requests need not
+ * construct and destroy a Connection for each one.
+ *
+ * Call acquire() to obtain a Connection and release() to return it
+ * once the request is done, or use PooledConnection to do both.  A
+ * Connection obtained from the pool must be used by one thread at a
+ * time only, but may be acquired by a different thread each time.
+ * Alternatively, getThreadConnection() gives each thread a
+ * Connection of its own, reused for as long as the thread keeps it.
+ *
+ * Unlike deleting a Connection, releasing one to the pool does not
+ * commit its outstanding transaction: any transaction that has been
+ * neither committed nor rolled back is rolled back on release.
+ *
+ * Connections obtained from the pool should not be used for their
+ * transactionCommitted signals, which are delivered according to the
+ * thread that first created the Connection.  Connect to the
+ * TransactionalStore's signals instead.
+ *
+ * All ConnectionPool functions are thread-safe.
+ */
+class ConnectionPool
+{
+public:
+    /**
+     * Construct a pool of Connections to the given store.  If
+     * maxConnections is greater than zero, no more than that many
+     * Connections will be handed out at once, and acquire() will
+     * wait for one to be released when they are all in use.
+     * Otherwise the number is not limited.
+     */
+    ConnectionPool(TransactionalStore *ts, int maxConnections = 0);
+
+    /**
+     * Destroy the pool and all of its Connections, rolling back any
+     * outstanding transactions on them.  No Connection from the
+     * pool may be used after this.
+     */
+    ~ConnectionPool();
+
+    /**
+     * Obtain a Connection that is not in use by anyone else, reusing
+     * a released one if there is one.  The Connection remains owned
+     * by the pool, and should be returned to it with release() when
+     * finished with.
+     */
+    Connection *acquire();
+
+    /**
+     * Return a Connection obtained from acquire() to the pool, rolling
+     * back any transaction on it that has been neither committed nor
+     * rolled back.  Throws RDFException if the Connection was not
+     * obtained from this pool or has already been released.
+     */
+    void release(Connection *c);
+
+    /**
+     * Return the calling thread's own Connection, acquiring one from
+     * the pool on the first call in each thread and returning the
+     * same one on subsequent calls.  The Connection counts as in use
+     * until the thread calls releaseThreadConnection(), which it
+     * should do before it finishes.
+     */
+    Connection *getThreadConnection();
+
+    /**
+     * Return the calling thread's own Connection (if it has one) to
+     * the pool, as release() does.
+     */
+    void releaseThreadConnection();
+
+    /**
+     * Retrieve the maximum number of Connections handed out at once,
+     * or 0 if not limited.
+     */
+    int getMaxConnections() const;
+
+    /**
+     * Return the number of Connections currently handed out.
+     */
+    int getActiveConnections() const;
+
+    /**
+     * Return the number of released Connections waiting to be reused.
+     */
+    int getIdleConnections() const;
+
+    /**
+     * Set whether the pool gathers statistics, for getStatistics().
+     * The default is false.
+     */
+    void setStatisticsEnabled(bool enabled);
+
+    /**
+     * Return true if the pool is gathering statistics.
+     */
+    bool getStatisticsEnabled() const;
+
+    /**
+     * Return a snapshot of the statistics gathered so far.  These are:
+     *
+     *  - for "acquire", "release" and "create" (a Connection being
+     *    constructed because none was idle): a count, and a duration
+     *    histogram under the same name.  The duration of "acquire"
+     *    is the time spent waiting for a Connection;
+     *
+     *  - a size histogram named "active", of the number of
+     *    Connections in use after each acquire.
+     *
+     * The time that transactions on the pooled Connections spend
+     * waiting for the store's own locks is gathered by the store: see
+     * TransactionalStore::getStatistics().
+     */
+    Statistics getStatistics() const;
+
+    /**
+     * Discard the statistics gathered so far.
+     */
+    void resetStatistics();
+
+private:
+    class D;
+    D *m_d;
+
+    ConnectionPool(const ConnectionPool &);
+    ConnectionPool &operator=(const ConnectionPool &);
+};
+
+/**
+ * \class PooledConnection ConnectionPool.h <dataquay/ConnectionPool.h>
+ *
+ * PooledConnection acquires a Connection from a ConnectionPool on
+ * construction and releases it on destruction, rolling back any
+ * transaction that has not been committed.
+ */
+class PooledConnection
+{
+public:
+    PooledConnection(ConnectionPool *pool) :
+        m_pool(pool), m_connection(pool->acquire()) { }
+    ~PooledConnection() { m_pool->release(m_connection); }
+
+    Connection *get() const { return m_connection; }
+    Connection *operator->() const { return m_connection; }
+    Connection &operator*() const { return *m_connection; }
+
+private:
+    ConnectionPool *m_pool;
+    Connection *m_connection;
+
+    PooledConnection(const PooledConnection &);
+    PooledConnection &operator=(const PooledConnection &);
+};
+
+}
+
+#endif
@@ -0,0 +1,133 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef DATAQUAY_LIVE_MATCH_H
+#define DATAQUAY_LIVE_MATCH_H
+
+#include "Store.h"
+
+#include <QObject>
+
+namespace Dataquay
+{
+
+class TransactionalStore;
+
+/**
+ * \class LiveMatch LiveMatch.h <dataquay/LiveMatch.h>
+ *
+ * LiveMatch holds the triples in a TransactionalStore that match a
+ * given pattern, and keeps them up to date as transactions are
+ * committed to the store, without matching again.  It receives only
+ * the changes that match its pattern (see ChangeSubscription) and
+ * applies them to the triples it holds, emitting signals to report
+ * which triples each commit has added to and removed from the match.
+ *
+ * For example, a LiveMatch on ((any), rdf:type, :Track) always holds
+ * the type triples for every track in the store, and reports tracks
+ * as they are added and removed.
+ *
+ * The triplesAdded and triplesRemoved signals are emitted from the
+ * thread that notifies the store's subscribers of the commit (see
+ * TransactionalStore::transactionCommitted), after the LiveMatch has
+ * been updated.  LiveMatch is thread-safe.
+ *
+ * A commit that takes place on another thread while a LiveMatch is
+ * being constructed may be reflected both in its initial matches and
+ * in its first signals.  The matches are correct once construction is
+ * complete and that commit's notification has been delivered.
+ */
+class LiveMatch : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Construct a LiveMatch holding the triples in the given store
+     * that match the given pattern.  Any Nothing node in the pattern
+     * is a wildcard.  The store must outlive the LiveMatch.
+     */
+    LiveMatch(TransactionalStore *store, Triple pattern, QObject *parent = 0);
+    ~LiveMatch();
+
+    /**
+     * Return the pattern that the triples match.
+     */
+    Triple getPattern() const;
+
+    /**
+     * Return the triples currently matching the pattern, in no
+     * particular order.
+     */
+    Triples getMatches() const;
+
+    /**
+     * Return the number of triples currently matching the pattern.
+     */
+    int getMatchCount() const;
+
+    /**
+     * Return true if the given triple currently matches the pattern
+     * and is in the store.
+     */
+    bool contains(Triple t) const;
+
+signals:
+    /**
+     * Emitted after a commit that added triples matching the pattern,
+     * with those triples.  A triple that the same commit both added
+     * and removed is not reported.
+     */
+    void triplesAdded(const Triples &ts);
+
+    /**
+     * Emitted after a commit that removed triples matching the
+     * pattern, with those triples.  Emitted before triplesAdded for
+     * the same commit.
+     */
+    void triplesRemoved(const Triples &ts);
+
+private slots:
+    void changesCommitted(const ChangeSet &cs);
+
+private:
+    LiveMatch(const LiveMatch &);
+    LiveMatch &operator=(const LiveMatch &);
+    class D;
+    D *m_d;
+};
+
+}
+
+#endif
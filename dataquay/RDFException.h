@@ -135,6 +135,23 @@ public:
     virtual ~RDFTransactionError() throw() { }
 };
 
+/**
+ * \class RDFTransactionConflict RDFException.h <dataquay/RDFException.h>
+ *
+ * RDFTransactionConflict is an exception that results from committing
+ * a Transaction that has read or written triples that another
+ * transaction has changed since the first one began.  The transaction
+ * has been rolled back, and may be retried from the start in a new
+ * Transaction.
+ */
+class RDFTransactionConflict : virtual public RDFTransactionError
+{
+public:
+    RDFTransactionConflict(QString message, QString data = "") throw() :
+        RDFException(message, data), RDFTransactionError(message, data) { }
+    virtual ~RDFTransactionConflict() throw() { }
+};
+
 /**
  * \class RDFDuplicateImportException RDFException.h <dataquay/RDFException.h>
  *
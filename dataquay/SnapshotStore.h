@@ -0,0 +1,121 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef DATAQUAY_SNAPSHOT_STORE_H
+#define DATAQUAY_SNAPSHOT_STORE_H
+
+#include "Store.h"
+
+namespace Dataquay
+{
+	
+/**
+ * \class SnapshotStore SnapshotStore.h <dataquay/SnapshotStore.h>
+ *
+ * SnapshotStore is a read-only RDF data store implementing the Store
+ * interface, which answers matching operations directly from a
+ * snapshot file written by BasicStore::saveSnapshot.  The file is
+ * mapped into memory rather than loaded, so opening a store takes
+ * the same short time however large it is, and processes that open
+ * the same snapshot share its memory through the operating system's
+ * file cache.  This suits large reference datasets that never change.
+ *
+ * SnapshotStore does not support ModifyFeature: add, remove, change,
+ * revert, addBlankNode and the import functions all throw
+ * RDFUnsupportedError.  Nor does it support SPARQL queries.
+ *
+ * The snapshot file must not be modified or replaced while a store
+ * has it open.
+ *
+ * All operations are thread safe.
+ */
+class SnapshotStore : public Store
+{
+public:
+    /**
+     * Open the snapshot file with the given filename (not a URL).
+     * Throw RDFException if it cannot be opened or is not a valid
+     * snapshot.
+     */
+    SnapshotStore(QString filename);
+    ~SnapshotStore();
+
+    /**
+     * Retrieve the base URI of the store, as recorded in the
+     * snapshot.
+     */
+    Uri getBaseUri() const;
+
+    // Store interface
+
+    bool add(Triple t);
+    bool remove(Triple t);
+    int addAll(Triples ts);
+    int removeAll(Triples ts);
+
+    void change(ChangeSet changes);
+    void revert(ChangeSet changes);
+
+    bool contains(Triple t) const;
+    Triples match(Triple t) const;
+    void match(Triple t, TripleVisitor visitor) const;
+    int count(Triple t) const;
+    int size() const;
+    ResultSet query(QString sparql) const;
+
+    Node complete(Triple t) const;
+
+    Triple matchOnce(Triple t) const;
+    Node queryOnce(QString sparql, QString bindingName) const;
+
+    Uri getUniqueUri(QString prefix) const;
+    Node addBlankNode();
+    Uri expand(QString uri) const;
+
+    void save(QString filename) const;
+    void import(QUrl url, ImportDuplicatesMode idm, QString format = "");
+    void importString(QString encodedRdf, Uri baseUri,
+                      ImportDuplicatesMode idm, QString format = "");
+
+    Features getSupportedFeatures() const;
+
+private:
+    class D;
+    D *m_d;
+};
+
+}
+
+#endif
+    
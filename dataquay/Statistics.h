@@ -0,0 +1,184 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef DATAQUAY_STATISTICS_H
+#define DATAQUAY_STATISTICS_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include <QVector>
+
+namespace Dataquay
+{
+
+class StatisticsCollector;
+
+/**
+ * \class Statistics Statistics.h <dataquay/Statistics.h>
+ *
+ * Statistics is a snapshot of the counts, durations and sizes
+ * gathered by a store while its statistics are enabled (see
+ * BasicStore::setStatisticsEnabled() and
+ * TransactionalStore::setStatisticsEnabled()).  Each is identified by
+ * name; the names a store records are listed in the documentation of
+ * its getStatistics() function.
+ *
+ * Durations are in nanoseconds.  Lock wait and hold times are
+ * recorded for each lock under the names "<lock> wait" and "<lock>
+ * hold", so that time spent waiting for a lock can be told apart from
+ * time spent in the work it protects.
+ */
+class Statistics
+{
+public:
+    /**
+     * \class Histogram Statistics.h <dataquay/Statistics.h>
+     *
+     * Histogram counts non-negative values, such as durations or
+     * sizes, in buckets by power of two: bucket 0 counts zeros, and
+     * bucket i (for i > 0) counts the values v for which 2^(i-1) <= v
+     * < 2^i.
+     */
+    class Histogram
+    {
+    public:
+        Histogram();
+
+        void add(quint64 value);
+        Histogram &operator+=(const Histogram &h);
+
+        /**
+         * Return the number of values added.
+         */
+        quint64 getCount() const { return m_count; }
+
+        /**
+         * Return the sum of the values added.
+         */
+        quint64 getTotal() const { return m_total; }
+
+        /**
+         * Return the greatest value added, or 0 if none has been.
+         */
+        quint64 getMax() const { return m_max; }
+
+        /**
+         * Return the mean of the values added, or 0 if none has been.
+         */
+        double getMean() const;
+
+        /**
+         * Return an estimate of the value below which the given
+         * fraction (from 0 to 1) of the values added fall: the upper
+         * limit of the bucket in which that value falls, or the
+         * greatest value added if that is lower.
+         */
+        quint64 getPercentile(double fraction) const;
+
+        /**
+         * Return the number of values in bucket i.
+         */
+        quint64 getBucket(int i) const { return m_buckets[i]; }
+
+        /**
+         * Return the number of buckets, one more than the number of
+         * bits in a quint64.
+         */
+        static int getBucketCount() { return 65; }
+
+        /**
+         * Return the lowest value that is too great for bucket i.
+         * The last bucket has no such limit; this returns the
+         * greatest quint64 for it.
+         */
+        static quint64 getBucketLimit(int i);
+
+    private:
+        quint64 m_count;
+        quint64 m_total;
+        quint64 m_max;
+        QVector<quint64> m_buckets;
+    };
+
+    Statistics();
+
+    /**
+     * Return the names of the operations counted, in alphabetical
+     * order.
+     */
+    QStringList getOperations() const;
+
+    /**
+     * Return the number of times the named operation was carried out.
+     */
+    quint64 getOperationCount(QString operation) const;
+
+    /**
+     * Return the names of the durations recorded, in alphabetical
+     * order.
+     */
+    QStringList getTimings() const;
+
+    /**
+     * Return the histogram of the named duration, in nanoseconds.
+     */
+    Histogram getTiming(QString name) const;
+
+    /**
+     * Return the names of the sizes recorded, in alphabetical order.
+     */
+    QStringList getSizes() const;
+
+    /**
+     * Return the histogram of the named size.
+     */
+    Histogram getSize(QString name) const;
+
+    /**
+     * Return a human-readable summary, one line per count, duration
+     * or size.
+     */
+    QString toString() const;
+
+private:
+    friend class StatisticsCollector;
+    QMap<QString, quint64> m_operations;
+    QMap<QString, Histogram> m_timings;
+    QMap<QString, Histogram> m_sizes;
+};
+
+}
+
+#endif
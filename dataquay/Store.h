@@ -42,6 +42,8 @@
 #include <QPair>
 #include <QSet>
 
+#include <functional>
+
 namespace Dataquay
 {
 
@@ -62,6 +64,9 @@ typedef QPair<ChangeType, Triple> Change;
 /// A sequence of add/remove operations such as may be enacted by a transaction.
 typedef QList<Change> ChangeSet;
 
+/// A function called for each triple found by Store::match; return false to stop.
+typedef std::function<bool(const Triple &)> TripleVisitor;
+
 
 /**
  * \class Store Store.h <dataquay/Store.h>
@@ -87,6 +92,29 @@ public:
      */
     virtual bool remove(Triple t) = 0;
 
+    /**
+     * Add all of the given triples to the store, as a single
+     * operation.  Return the number of triples that were actually
+     * added, i.e. excluding any that were already in the store or
+     * that appear more than once in the list.  Throw RDFException if
+     * any triple is incomplete or cannot be added for some other
+     * reason; in that case nothing is added.
+     *
+     * This is much quicker than calling add() for each triple when
+     * loading a large number of triples.
+     */
+    virtual int addAll(Triples ts) = 0;
+
+    /**
+     * Remove all of the given triples from the store, as a single
+     * operation.  Unlike remove(), this does not accept wildcard
+     * triples: every triple must be complete.  Return the number of
+     * triples that were actually found and removed.  Throw
+     * RDFException if any triple is incomplete or cannot be removed
+     * for some other reason; in that case nothing is removed.
+     */
+    virtual int removeAll(Triples ts) = 0;
+
     /**
      * Atomically apply the sequence of add/remove changes described
      * in the given ChangeSet.  Throw RDFException if any operation
@@ -117,6 +145,39 @@ public:
      */
     virtual Triples match(Triple t) const = 0;
 
+    /**
+     * Call the given visitor once for each triple matching the given
+     * wildcard triple, in no particular order, stopping as soon as
+     * the visitor returns false.  This reads matches from the store
+     * one at a time, so it is much cheaper than the list form of
+     * match() when there are many matches but only one pass (or part
+     * of one) is needed.  May throw RDFException; any exception
+     * thrown by the visitor ends the match and is passed through.
+     *
+     * The store remains locked while the visitor runs, so the
+     * visitor must not call back into this store (or any Transaction
+     * or Connection on it) and should return quickly.  It may use
+     * other stores.  (BasicStore with the Redland datastore reads the
+     * matches a batch at a time, and calls the visitor between
+     * batches without holding the lock that Redland needs for every
+     * store, so that the visitor can use another store without
+     * deadlocking.)
+     */
+    virtual void match(Triple t, TripleVisitor visitor) const = 0;
+
+    /**
+     * Return the number of triples matching the given wildcard
+     * triple, as match(t).size() would, but without retrieving the
+     * triples themselves.  May throw RDFException.
+     */
+    virtual int count(Triple t) const = 0;
+
+    /**
+     * Return the number of triples in the store.  May throw
+     * RDFException.
+     */
+    virtual int size() const = 0;
+
     /**
      * Run a SPARQL query against the store and return its results.
      * Any prefixes added previously using addQueryPrefix will be
@@ -266,7 +327,10 @@ public:
      * make use of them.
      *
      * ModifyFeature: The store can be modified (triples can be added
-     * to it).  All current Store implementations support this feature.
+     * to it).  All current Store implementations support this feature
+     * except SnapshotStore, which is read-only.  A store that does not
+     * support it will throw RDFUnsupportedError from any function
+     * that would modify it.
      *
      * QueryFeature: The store supports SPARQL queries through the
      * query and queryOnce methods.  A store that does not support
@@ -36,6 +36,8 @@
 
 #include "Store.h"
 
+#include <QFuture>
+
 namespace Dataquay
 {
 
@@ -68,12 +70,34 @@ public:
      * will be committed to the store, atomically with respect to
      * other active transactions.
      *
+     * If the store supports concurrent transactions, this may throw
+     * RDFTransactionConflict, in which case the transaction has been
+     * rolled back instead and may be retried.
+     *
      * You should not attempt to use the Transaction object again
      * (except to call getChanges or to delete it) after this call is
      * made.  Any further call to the transaction's Store interface
      * will throw an RDFTransactionError.
      */
     virtual void commit() = 0;
+
+    /**
+     * Commit this transaction as commit() does, but without waiting
+     * for anything beyond the changes being applied to the store.
+     *
+     * Any failure to apply the changes (including a conflict) is
+     * thrown from this call, just as it would be from commit().  Once
+     * it returns, the changes are visible in the store, and the
+     * returned future completes when they are also durable (if the
+     * store keeps a write-ahead log) -- with result true, or false if
+     * they could not be synced to disc.  Listeners are notified of
+     * the commit afterwards, from a separate thread, so that they
+     * need not hold up the committing thread.
+     *
+     * The same restrictions apply to the Transaction object after
+     * this call as after commit().
+     */
+    virtual QFuture<bool> commitAsync() = 0;
     
     /**
      * Roll back this transaction.  All changes made during the
@@ -86,6 +110,32 @@ public:
      */
     virtual void rollback() = 0;
 
+    /**
+     * Mark the current point in this transaction, so that the
+     * changes made after it can later be undone with rollbackTo()
+     * while those made before it are kept.  This is cheap: it records
+     * only how many changes have been made so far.  Savepoints may be
+     * nested, by taking a further savepoint before rolling back to
+     * (or abandoning) an earlier one.
+     *
+     * Return an identifier for the savepoint, to pass to
+     * rollbackTo().
+     */
+    virtual int savepoint() = 0;
+
+    /**
+     * Undo every change made in this transaction since the given
+     * savepoint was taken, leaving the transaction in progress as it
+     * was at that point.  Only the changes since the savepoint are
+     * touched, so this costs nothing for the changes before it.
+     *
+     * The savepoint itself remains, and may be rolled back to again.
+     * Any savepoints taken after it are discarded, and must not be
+     * used again.  Throws RDFTransactionError if the savepoint is not
+     * known.
+     */
+    virtual void rollbackTo(int savepoint) = 0;
+
     /**
      * Return the ChangeSet committed in this transaction.  If the
      * transaction has not yet been committed (or has been rolled
@@ -35,9 +35,13 @@
 #define DATAQUAY_TRANSACTIONAL_STORE_H
 
 #include "Transaction.h"
+#include "Statistics.h"
 
 namespace Dataquay
 {
+
+class ChangeJournal;
+class ChangeSubscription;
 	
 /**
  * \class TransactionalStore TransactionalStore.h <dataquay/TransactionalStore.h>
@@ -49,16 +53,40 @@ namespace Dataquay
  * Write access to the store is permitted only in the context of a
  * transaction.  If you call a modifying function directly on
  * TransactionalStore, the store will either throw RDFException (if
- * set to NoAutoTransaction) or create a single-use Transaction object
- * for the duration of that modification (if set to AutoTransaction).
- * Note that the latter behaviour will deadlock if a transaction is in
- * progress already.
+ * set to NoAutoTransaction) or carry out that modification in a
+ * single-use Transaction, committed before the function returns (if
+ * set to AutoTransaction).
+ * Note that the latter behaviour will fail with RDFTransactionError
+ * if the calling thread has a transaction in progress already.
  *
  * Read access may be carried out through a Transaction, in which case
  * the read state will reflect the changes made so far in that
  * transaction, or directly on the TransactionalStore, in which case
  * the read will be isolated from any pending transaction.
  *
+ * A transaction's changes are kept apart from the underlying store
+ * until it commits, so a direct read goes straight to the underlying
+ * store and costs the same however many changes are pending.  Only
+ * SPARQL queries and save() carried out through a Transaction need
+ * its changes to be applied to the underlying store, which they are
+ * for the duration of the call, holding off direct reads meanwhile.
+ *
+ * Any number of transactions may be in progress at once, one per
+ * thread.  They do not lock one another out: each keeps its changes
+ * to itself and applies them to the store only on commit.  Their
+ * reads go to the store as it stands at the time, together with their
+ * own pending changes.  A transaction therefore may read triples that
+ * another transaction has changed since it began.  So when a
+ * transaction that has made changes commits, it is checked against
+ * every transaction committed since it began.  If any of those added
+ * or removed a triple that this transaction read or wrote, the commit
+ * fails with RDFTransactionConflict.  In that case the transaction
+ * has been rolled back and should be retried from the start.  SPARQL
+ * queries and the number of triples in the store count as reads of
+ * every triple, so a transaction that makes them will conflict with
+ * any other commit.  A transaction that has made no changes always
+ * commits.
+ *
  * Call startTransaction to obtain a new Transaction object and start
  * its transaction; use the Transaction's Store interface for all
  * accesses associated with that transaction; call commit on the
@@ -66,9 +94,18 @@ namespace Dataquay
  * delete the object; or call Transaction::rollback() if you decide
  * you do not wish to commit it.
  *
- * TransactionalStore is thread-safe.
- *
- *!!! ... but the individual Transactions that you get from it are _not_ thread-safe -- document this (it's probably acceptable) or fix it
+ * TransactionalStore is thread-safe, and so are the Transactions
+ * that you get from it: several threads may work in one transaction
+ * at once, for example to divide a large import between them while
+ * keeping it atomic.  Each operation through the Transaction is
+ * atomic with respect to the others, and its changes are recorded in
+ * the order the operations took place.  Only the thread that started
+ * a transaction counts as having it in progress (see
+ * startTransaction).  Other threads should have finished with it
+ * before it is committed or rolled back: an operation that races
+ * with the commit is either committed with the rest or fails with
+ * RDFTransactionError, and only one of two threads committing the
+ * same transaction will succeed.
  */
 class TransactionalStore : public QObject, public Store
 {
@@ -78,16 +115,18 @@ public:
     /**
      * DirectWriteBehaviour controls how TransactionalStore responds
      * when called directly (not through a Transaction) for a write
-     * operation (add, remove, change, or revert).
+     * operation (add, remove, addAll, removeAll, change, or revert).
      *
      * NoAutoTransaction (the default) means that an RDF exception
      * will be thrown whenever a write is attempted without a
      * transaction.
      *
      * AutoTransaction means that a Transaction object will be
-     * created, used for the single access, and then closed.  This may
-     * cause a deadlock if another transaction is already ongoing
-     * elsewhere.
+     * created, used for the single access, and then committed.  This
+     * will fail if the calling thread already has a transaction in
+     * progress, and the access may fail with RDFTransactionConflict
+     * if another thread's transaction commits a conflicting change
+     * meanwhile.
      */
     enum DirectWriteBehaviour {
         NoAutoTransaction,
@@ -104,6 +143,30 @@ public:
      * use it for all routine accesses to the underlying store.
      */
     TransactionalStore(Store *store, DirectWriteBehaviour dwb = NoAutoTransaction);
+
+    /**
+     * Create a TransactionalStore operating on the given store, using
+     * the given ChangeJournal as a write-ahead log.  Any changes in
+     * the journal are first replayed into the store, so that a store
+     * restored from its last save (or its journal's base snapshot)
+     * recovers every transaction committed since.  Replay is
+     * idempotent, so it does no harm if the store already reflects
+     * some or all of the journal.
+     *
+     * Thereafter every transaction's changes are appended to the
+     * journal as it commits, and Transaction::commit() does not
+     * return until they have been synced to disc.  Transactions
+     * committing on different threads share syncs where they can (see
+     * ChangeJournal::sync()).  If the changes cannot be appended, the
+     * transaction is rolled back and commit() throws RDFException; if
+     * they are appended but cannot be synced, the transaction remains
+     * committed but commit() throws all the same.
+     *
+     * The journal is not owned by the TransactionalStore, and must
+     * outlive it.
+     */
+    TransactionalStore(Store *store, ChangeJournal *log,
+                       DirectWriteBehaviour dwb = NoAutoTransaction);
     
     /**
      * Delete the TransactionalStore.  This does _not_ delete the
@@ -117,16 +180,153 @@ public:
      * carry out its operations.  Once the transaction is complete,
      * you must call commit on the Transaction object to finish the
      * transaction, and then you must delete the object.
+     *
+     * Transactions on different threads may proceed at the same
+     * time, but each thread may have only one transaction in
+     * progress: this throws RDFTransactionError if the calling thread
+     * already has one.
      */
     Transaction *startTransaction();
 
+    /**
+     * Start a read-only transaction, through which to read a
+     * consistent view of the store: every read through it sees the
+     * store as it was when the transaction began, whatever other
+     * transactions commit meanwhile.  Delete the returned object when
+     * finished with it; there is nothing to commit.
+     *
+     * The Transaction is const, so its Store interface offers only
+     * read functions.
+     *
+     * Read-only transactions are cheap to start and take no part in
+     * conflict detection.  Any number of them may be in progress at
+     * once, on any threads, alongside other transactions.  Each
+     * commit that takes place while a read-only transaction is in
+     * progress must record its changes for that transaction to
+     * exclude, though, so don't keep one open for longer than you
+     * need it.
+     */
+    const Transaction *startReadOnlyTransaction() const;
+
+    /**
+     * Subscribe to the changes, made by subsequently committed
+     * transactions, that match the given triple pattern.  Any Nothing
+     * node in the pattern is a wildcard.  The returned object emits
+     * ChangeSubscription::changesCommitted with the matching changes
+     * from each transaction that has any.
+     *
+     * The subscription is owned by the given parent if one is
+     * supplied, or otherwise by the caller, and is ended by deleting
+     * it.
+     */
+    ChangeSubscription *subscribe(Triple pattern, QObject *parent = 0);
+
+    /**
+     * Set whether transactions committing on different threads at
+     * the same time should be committed together as a group.  With
+     * group commit, a transaction that comes to commit while another
+     * commit is being applied waits for it to finish, and is then
+     * validated and applied to the store in a single change together
+     * with every other transaction that has arrived meanwhile.  This
+     * costs a little latency for each commit, but raises the total
+     * rate of commits when many threads commit at once, as the store
+     * (and the write-ahead log, if any) is updated once per group
+     * rather than once per transaction.
+     *
+     * Each transaction in a group still succeeds or fails on its own:
+     * one that conflicts with an earlier member of its group fails
+     * with RDFTransactionConflict just as if that member had committed
+     * first, and the others are unaffected.  Each obtains only its
+     * own changes from Transaction::getCommittedChanges(), and is
+     * notified separately.  The default is false.
+     */
+    void setGroupCommit(bool group);
+
+    /**
+     * Return true if group commit is enabled (see setGroupCommit).
+     */
+    bool getGroupCommit() const;
+
+    /**
+     * Write the whole underlying store as the new base snapshot of
+     * the write-ahead log and empty the log (see
+     * ChangeJournal::compact()).  Commits wait until this is done,
+     * and so do SPARQL queries and saves through a transaction, which
+     * would otherwise apply that transaction's uncommitted changes to
+     * the store while it was being written.  Call this rather than
+     * compacting the journal directly.  Throws RDFException if there
+     * is no write-ahead log or the underlying store is not a
+     * BasicStore.
+     */
+    void compact();
+
+    /**
+     * Set whether the store gathers statistics about transactions and
+     * its internal locks, for getStatistics().  The default is false,
+     * in which case gathering them costs next to nothing.  This does
+     * not affect the underlying store, which may gather statistics
+     * of its own (see BasicStore::setStatisticsEnabled).
+     */
+    void setStatisticsEnabled(bool enabled);
+
+    /**
+     * Return true if the store is gathering statistics.
+     */
+    bool getStatisticsEnabled() const;
+
+    /**
+     * Return a snapshot of the statistics gathered so far.  These are:
+     *
+     *  - for each Store operation carried out directly on the
+     *    TransactionalStore (by name, such as "match"), and for each
+     *    carried out through a Transaction (prefixed "transaction ",
+     *    as in "transaction add"): a count, and a duration histogram
+     *    under the same name.  "transaction addAll", "transaction
+     *    removeAll", "transaction change" and "transaction revert"
+     *    also have a size histogram;
+     *
+     *  - counts and durations for "start", "startReadOnly", "commit",
+     *    "rollback" and "compact", the size of each commit under "commit", and
+     *    a count of commits that failed with RDFTransactionConflict
+     *    under "conflict";
+     *
+     *  - duration histograms of whole transactions, from start to
+     *    commit or rollback, as "transaction" and "read-only
+     *    transaction";
+     *
+     *  - the number of transactions in each group, with group commit
+     *    (see setGroupCommit), as the size histogram "commit group";
+     *
+     *  - a count and size histogram of "context switch", for each
+     *    time a transaction's changes are applied to the underlying
+     *    store and reverted again so as to run a SPARQL query or
+     *    save() through the transaction;
+     *
+     *  - wait and hold duration histograms for "transaction mutex",
+     *    which serialises commits and the starting and ending of
+     *    transactions, and for "store read" and "store write", the
+     *    lock that keeps readers of the underlying store out while
+     *    changes are applied to it.
+     */
+    Statistics getStatistics() const;
+
+    /**
+     * Discard the statistics gathered so far.
+     */
+    void resetStatistics();
+
     // Store interface
     bool add(Triple t);
     bool remove(Triple t);
+    int addAll(Triples ts);
+    int removeAll(Triples ts);
     void change(ChangeSet changes);
     void revert(ChangeSet changes);
     bool contains(Triple t) const;
     Triples match(Triple t) const;
+    void match(Triple t, TripleVisitor visitor) const;
+    int count(Triple t) const;
+    int size() const;
     ResultSet query(QString sparql) const;
     Node complete(Triple t) const;
     Triple matchOnce(Triple t) const;
@@ -147,6 +347,22 @@ signals:
      * emitted, so that in a multi-threaded context it is possible
      * that other users of the store may have carried out further
      * transactions before this signal can be acted on.
+     *
+     * For a transaction committed with Transaction::commitAsync(),
+     * this is emitted from a separate notifier thread, so that
+     * receivers in other threads will receive it through a queued
+     * connection unless they ask otherwise.
+     *
+     * Signals are emitted in commit order, whichever threads the
+     * transactions were committed from: a commit waits for the
+     * signals for earlier commits to be emitted before emitting its
+     * own.  (A transaction committed from within a receiver called
+     * directly for an earlier commit can't wait for that one, so its
+     * signal may be emitted from another thread after its commit()
+     * has returned.)  An exception thrown by a receiver called
+     * directly does not hold up the signals for later commits: it is
+     * passed on from commit() once they have been emitted, and the
+     * transaction remains committed.
      */
     void transactionCommitted(const ChangeSet &cs);
 
@@ -163,16 +379,24 @@ private:
     class D;
     D *m_d;
 
+    friend class ChangeSubscription;
+    void unsubscribe(ChangeSubscription *);
+
     class TSTransaction : public Transaction
     {
     public:
         // Store interface
         bool add(Triple t);
         bool remove(Triple t);
+        int addAll(Triples ts);
+        int removeAll(Triples ts);
         void change(ChangeSet changes);
         void revert(ChangeSet changes);
         bool contains(Triple t) const;
         Triples match(Triple t) const;
+        void match(Triple t, TripleVisitor visitor) const;
+        int count(Triple t) const;
+        int size() const;
         ResultSet query(QString sparql) const;
         Node complete(Triple t) const;
         Triple matchOnce(Triple t) const;
@@ -188,11 +412,14 @@ private:
 
         // Transaction interface
         void commit();
+        QFuture<bool> commitAsync();
         void rollback();
+        int savepoint();
+        void rollbackTo(int savepoint);
         ChangeSet getCommittedChanges() const;
         ChangeSet getChanges() const;
 
-        TSTransaction(TransactionalStore::D *td);
+        TSTransaction(TransactionalStore::D *td, bool readOnly = false);
         virtual ~TSTransaction();
 
     private:
@@ -34,8 +34,17 @@
 #ifndef DATAQUAY_TRIPLE_H
 #define DATAQUAY_TRIPLE_H
 
+namespace Dataquay {
+class Triple;
+}
+
+// Declared early for the same reason as qHash(Node) in Node.h
+extern unsigned int qHash(const Dataquay::Triple &);
+
 #include "Node.h"
 
+#include <QHash>
+
 namespace Dataquay
 {
 
@@ -122,8 +131,7 @@ public:
         if (this == &other) return true;
         if (size() != other.size()) return false;
         if (size() < 2) return QList<Triple>::operator==(other);
-        // Triple has operator< but not qHash, hence use QMap rather than QSet
-        QMap<Triple, int> a, b;
+        QHash<Triple, int> a, b;
         foreach (Triple t, *this) ++a[t];
         foreach (Triple t, other) ++b[t];
         return a == b;
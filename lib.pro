@@ -24,10 +24,16 @@ INCLUDEPATH += dataquay
 !debug:DEFINES += NDEBUG
 
 HEADERS += dataquay/BasicStore.h \
+           dataquay/ChangeJournal.h \
+           dataquay/ChangeSubscription.h \
            dataquay/Connection.h \
+           dataquay/ConnectionPool.h \
+           dataquay/LiveMatch.h \
            dataquay/Node.h \
            dataquay/PropertyObject.h \
            dataquay/RDFException.h \
+           dataquay/SnapshotStore.h \
+           dataquay/Statistics.h \
            dataquay/Store.h \
            dataquay/Transaction.h \
            dataquay/TransactionalStore.h \
@@ -41,17 +47,29 @@ HEADERS += dataquay/BasicStore.h \
            dataquay/objectmapper/ObjectMapperForwarder.h \
            dataquay/objectmapper/ObjectStorer.h \
            dataquay/objectmapper/TypeMapping.h \
-           src/Debug.h
+           src/Debug.h \
+           src/NTriplesParser.h \
+           src/Snapshot.h \
+           src/StatisticsCollector.h
            
-SOURCES += src/Connection.cpp \
+SOURCES += src/ChangeJournal.cpp \
+           src/ChangeSubscription.cpp \
+           src/Connection.cpp \
+           src/ConnectionPool.cpp \
+           src/LiveMatch.cpp \
            src/Node.cpp \
+           src/NTriplesParser.cpp \
            src/PropertyObject.cpp \
            src/RDFException.cpp \
+           src/Snapshot.cpp \
+           src/SnapshotStore.cpp \
+           src/Statistics.cpp \
            src/Store.cpp \
            src/Transaction.cpp \
            src/TransactionalStore.cpp \
            src/Triple.cpp \
            src/Uri.cpp \
+           src/backend/BasicStoreNative.cpp \
            src/backend/BasicStoreRedland.cpp \
            src/backend/BasicStoreSord.cpp \
            src/backend/define-check.cpp \
@@ -0,0 +1,430 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#include "ChangeJournal.h"
+#include "BasicStore.h"
+#include "RDFException.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+#include "Debug.h"
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Dataquay
+{
+
+// The journal is a header (magic and version) followed by one record
+// per ChangeSet: a 32-bit payload length, a 16-bit CRC of the
+// payload, and then the payload, which is the number of changes
+// followed by each change type and triple in QDataStream form
+
+static const char journalMagic[] = "DQJOURNL";
+static const quint32 journalVersion = 1;
+static const qint64 journalHeaderSize = 12;
+static const qint64 recordHeaderSize = 6;
+
+// Every stream uses this version, rather than the default for the Qt
+// we were built with, so that a journal written with one version of
+// Qt can be read with another
+static const QDataStream::Version journalStreamVersion = QDataStream::Qt_5_0;
+
+static quint16
+checksum(const char *data, qint64 len)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    return qChecksum(QByteArrayView(data, len));
+#else
+    return qChecksum(data, uint(len));
+#endif
+}
+
+static bool
+syncToDisc(int fd)
+{
+#ifdef Q_OS_WIN
+    return _commit(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+class ChangeJournal::D
+{
+public:
+    D(QString filename) :
+        m_filename(filename),
+        m_journalFilename(filename + ".journal"),
+        m_file(m_journalFilename),
+        m_entries(0),
+        m_sequence(0),
+        m_synced(0),
+        m_syncing(false),
+        m_groupSync(true) {
+        open(0);
+    }
+
+    ~D() {
+        m_file.close();
+    }
+
+    BasicStore *load() {
+        QMutexLocker locker(&m_mutex);
+        BasicStore *store = 0;
+        if (QFile::exists(m_filename)) {
+            store = BasicStore::loadSnapshot(m_filename);
+        } else {
+            store = new BasicStore;
+        }
+        try {
+            waitForSync();
+            m_file.close();
+            open(store);
+        } catch (...) {
+            delete store;
+            throw;
+        }
+        return store;
+    }
+
+    void replay(Store *store) {
+        QMutexLocker locker(&m_mutex);
+        waitForSync();
+        m_file.close();
+        open(store);
+    }
+
+    quint64 append(const ChangeSet &changes) {
+
+        QByteArray payload;
+        {
+            QDataStream ds(&payload, QIODevice::WriteOnly);
+            ds.setVersion(journalStreamVersion);
+            ds << qint32(changes.size());
+            foreach (const Change &c, changes) ds << c.first << c.second;
+        }
+
+        QByteArray record;
+        {
+            QDataStream ds(&record, QIODevice::WriteOnly);
+            ds.setVersion(journalStreamVersion);
+            ds << quint32(payload.size())
+               << checksum(payload.constData(), payload.size());
+        }
+        record.append(payload);
+
+        QMutexLocker locker(&m_mutex);
+        qint64 before = m_file.pos();
+        if (m_file.write(record) != record.size() || !m_file.flush()) {
+            // Don't leave a partial record for later ones to follow
+            m_file.resize(before);
+            m_file.seek(before);
+            throw RDFException("Failed to append to change journal",
+                               m_journalFilename);
+        }
+        ++m_entries;
+        return ++m_sequence;
+    }
+
+    void sync(quint64 entry) {
+
+        QMutexLocker locker(&m_mutex);
+
+        if (!m_groupSync) {
+            if (!syncToDisc(m_file.handle())) {
+                throw RDFException("Failed to sync change journal",
+                                   m_journalFilename);
+            }
+            m_synced = m_sequence;
+            return;
+        }
+
+        // Group sync.  Whichever thread finds no sync under way syncs
+        // every entry appended so far, without holding the mutex so
+        // that others can go on appending meanwhile.  Threads whose
+        // entries are not yet synced wait for it, and then either
+        // find themselves covered by it or start the next one
+
+        while (m_synced < entry) {
+            if (m_syncing) {
+                m_syncDone.wait(&m_mutex);
+                continue;
+            }
+            m_syncing = true;
+            quint64 target = m_sequence;
+            int fd = m_file.handle();
+            locker.unlock();
+            bool ok = syncToDisc(fd);
+            locker.relock();
+            m_syncing = false;
+            if (ok) m_synced = target;
+            m_syncDone.wakeAll();
+            if (!ok) {
+                throw RDFException("Failed to sync change journal",
+                                   m_journalFilename);
+            }
+        }
+    }
+
+    void setGroupSync(bool group) {
+        QMutexLocker locker(&m_mutex);
+        m_groupSync = group;
+    }
+
+    void compact(const BasicStore *store) {
+        QMutexLocker locker(&m_mutex);
+        DQ_DEBUG << "ChangeJournal::compact: " << m_entries
+                 << " change set(s) in journal" << endl;
+        // The journal may be emptied only once the snapshot that
+        // replaces it is safely on disc: saveSnapshot returns only
+        // after syncing the new snapshot file and the rename that
+        // puts it in place, and throws (leaving the journal alone)
+        // if it can't.  If we fail between writing the snapshot and
+        // emptying the journal, the journal is replayed over a
+        // snapshot that already includes it.  That's harmless, as
+        // replay is idempotent (see replay())
+        store->saveSnapshot(m_filename);
+        waitForSync();
+        m_file.close();
+        if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            throw RDFException("Failed to open change journal",
+                               m_journalFilename);
+        }
+        writeHeader();
+        m_entries = 0;
+        // Nothing left in the journal needs syncing
+        m_synced = m_sequence;
+    }
+
+    int getEntryCount() const {
+        QMutexLocker locker(&m_mutex);
+        return m_entries;
+    }
+
+    qint64 getJournalSize() const {
+        QMutexLocker locker(&m_mutex);
+        return m_file.size();
+    }
+
+private:
+    QString m_filename;
+    QString m_journalFilename;
+    QFile m_file;
+    int m_entries;
+    quint64 m_sequence; // entries appended since construction
+    quint64 m_synced;   // entries known to be on disc
+    bool m_syncing;
+    bool m_groupSync;
+    mutable QMutex m_mutex;
+    QWaitCondition m_syncDone;
+
+    void waitForSync() {
+        // Called with m_mutex held, before closing m_file
+        while (m_syncing) m_syncDone.wait(&m_mutex);
+    }
+
+    void open(Store *store) {
+
+        // Called with m_mutex held.  Read the journal, replaying it
+        // into the store if there is one, then leave it open for
+        // appending.  A truncated or corrupt record, and anything
+        // following it, is cut off
+
+        m_entries = 0;
+        qint64 good = 0;
+
+        if (m_file.open(QIODevice::ReadOnly)) {
+            QByteArray data = m_file.readAll();
+            m_file.close();
+            if (data.size() >= journalHeaderSize) {
+                if (!data.startsWith(journalMagic)) {
+                    throw RDFException("File is not a change journal",
+                                       m_journalFilename);
+                }
+                QDataStream ds(data.mid(8, 4));
+                ds.setVersion(journalStreamVersion);
+                quint32 version;
+                ds >> version;
+                if (version != journalVersion) {
+                    throw RDFException
+                        (QString("Unsupported change journal version %1")
+                         .arg(version), m_journalFilename);
+                }
+                good = scan(data, store);
+            }
+        }
+
+        if (!m_file.open(QIODevice::ReadWrite)) {
+            throw RDFException("Failed to open change journal",
+                               m_journalFilename);
+        }
+        if (good == 0) {
+            m_file.resize(0);
+            writeHeader();
+        } else if (good < m_file.size()) {
+            DQ_DEBUG << "ChangeJournal: Discarding " << m_file.size() - good
+                     << " byte(s) of incomplete record at end of journal"
+                     << endl;
+            m_file.resize(good);
+        }
+        m_file.seek(m_file.size());
+    }
+
+    qint64 scan(const QByteArray &data, Store *store) {
+
+        // Return the offset just past the last complete record
+
+        qint64 pos = journalHeaderSize;
+
+        while (data.size() - pos >= recordHeaderSize) {
+
+            quint32 length;
+            quint16 sum;
+            {
+                QDataStream ds(data.mid(pos, recordHeaderSize));
+                ds.setVersion(journalStreamVersion);
+                ds >> length >> sum;
+            }
+            if (data.size() - pos - recordHeaderSize < qint64(length)) break;
+
+            const char *payload = data.constData() + pos + recordHeaderSize;
+            if (checksum(payload, length) != sum) break;
+
+            if (store) {
+                QDataStream ds(QByteArray::fromRawData(payload, length));
+                ds.setVersion(journalStreamVersion);
+                qint32 n;
+                ds >> n;
+                for (qint32 i = 0; i < n && ds.status() == QDataStream::Ok; ++i) {
+                    Change c;
+                    ds >> c.first >> c.second;
+                    replay(store, c);
+                }
+            }
+
+            pos += recordHeaderSize + length;
+            ++m_entries;
+        }
+
+        return pos;
+    }
+
+    void replay(Store *store, const Change &c) {
+        // Make each change without regard to whether it succeeds, so
+        // that replaying changes already present in the snapshot
+        // leaves every triple as it was after the last change to it
+        if (c.first == AddTriple) store->add(c.second);
+        else store->remove(c.second);
+    }
+
+    void writeHeader() {
+        QDataStream ds(&m_file);
+        ds.setVersion(journalStreamVersion);
+        ds.writeRawData(journalMagic, 8);
+        ds << journalVersion;
+        if (!m_file.flush()) {
+            throw RDFException("Failed to write change journal header",
+                               m_journalFilename);
+        }
+    }
+};
+
+ChangeJournal::ChangeJournal(QString filename) :
+    m_d(new D(filename))
+{
+}
+
+ChangeJournal::~ChangeJournal()
+{
+    delete m_d;
+}
+
+BasicStore *
+ChangeJournal::load()
+{
+    return m_d->load();
+}
+
+void
+ChangeJournal::replay(Store *store)
+{
+    m_d->replay(store);
+}
+
+quint64
+ChangeJournal::append(const ChangeSet &changes)
+{
+    return m_d->append(changes);
+}
+
+void
+ChangeJournal::sync(quint64 entry)
+{
+    m_d->sync(entry);
+}
+
+void
+ChangeJournal::setGroupSync(bool group)
+{
+    m_d->setGroupSync(group);
+}
+
+void
+ChangeJournal::compact(const BasicStore *store)
+{
+    m_d->compact(store);
+}
+
+int
+ChangeJournal::getEntryCount() const
+{
+    return m_d->getEntryCount();
+}
+
+qint64
+ChangeJournal::getJournalSize() const
+{
+    return m_d->getJournalSize();
+}
+
+}
+
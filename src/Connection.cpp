@@ -35,6 +35,7 @@
 
 #include "TransactionalStore.h"
 #include "Transaction.h"
+#include "RDFException.h"
 
 namespace Dataquay
 {
@@ -47,10 +48,15 @@ public:
 
     bool add(Triple t);
     bool remove(Triple t);
+    int addAll(Triples ts);
+    int removeAll(Triples ts);
     void change(ChangeSet changes);
     void revert(ChangeSet changes);
     bool contains(Triple t) const;
     Triples match(Triple t) const;
+    void match(Triple t, TripleVisitor visitor) const;
+    int count(Triple t) const;
+    int size() const;
     ResultSet query(QString sparql) const;
     Node complete(Triple t) const;
     Triple matchOnce(Triple t) const;
@@ -101,6 +107,20 @@ Connection::D::remove(Triple t)
     return m_tx->remove(t);
 }
 
+int
+Connection::D::addAll(Triples ts)
+{
+    start();
+    return m_tx->addAll(ts);
+}
+
+int
+Connection::D::removeAll(Triples ts)
+{
+    start();
+    return m_tx->removeAll(ts);
+}
+
 void
 Connection::D::change(ChangeSet cs)
 {
@@ -126,7 +146,16 @@ void
 Connection::D::commit()
 {
     if (m_tx) {
-        m_tx->commit();
+        try {
+            m_tx->commit();
+        } catch (const RDFException &) {
+            // The transaction has been rolled back (for example
+            // because of a conflict), so the next operation should
+            // start a new one
+            delete m_tx;
+            m_tx = NoTransaction;
+            throw;
+        }
         delete m_tx;
         m_tx = NoTransaction;
     }
@@ -137,7 +166,13 @@ Connection::D::commitAndObtain()
 {
     ChangeSet cs;
     if (m_tx) {
-        m_tx->commit();
+        try {
+            m_tx->commit();
+        } catch (const RDFException &) {
+            delete m_tx;
+            m_tx = NoTransaction;
+            throw;
+        }
         cs = m_tx->getCommittedChanges();
         delete m_tx;
         m_tx = NoTransaction;
@@ -149,7 +184,16 @@ void
 Connection::D::rollback()
 {
     if (m_tx) {
-	m_tx->rollback();
+        try {
+            m_tx->rollback();
+        } catch (const RDFException &) {
+            // The transaction may already have been abandoned (for
+            // example after a failed operation), but either way it's
+            // finished with, so the next operation should start anew
+            delete m_tx;
+            m_tx = NoTransaction;
+            throw;
+        }
 	delete m_tx;
 	m_tx = NoTransaction;
     }
@@ -174,6 +218,24 @@ Connection::D::match(Triple t) const
     return getStore()->match(t);
 }
 
+void
+Connection::D::match(Triple t, TripleVisitor visitor) const
+{
+    getStore()->match(t, visitor);
+}
+
+int
+Connection::D::count(Triple t) const
+{
+    return getStore()->count(t);
+}
+
+int
+Connection::D::size() const
+{
+    return getStore()->size();
+}
+
 ResultSet
 Connection::D::query(QString sparql) const
 {
@@ -271,6 +333,18 @@ Connection::remove(Triple t)
     return m_d->remove(t);
 }
 
+int
+Connection::addAll(Triples ts)
+{
+    return m_d->addAll(ts);
+}
+
+int
+Connection::removeAll(Triples ts)
+{
+    return m_d->removeAll(ts);
+}
+
 void 
 Connection::change(ChangeSet changes)
 {
@@ -295,6 +369,24 @@ Connection::match(Triple t) const
     return m_d->match(t);
 }
 
+void
+Connection::match(Triple t, TripleVisitor visitor) const
+{
+    m_d->match(t, visitor);
+}
+
+int
+Connection::count(Triple t) const
+{
+    return m_d->count(t);
+}
+
+int
+Connection::size() const
+{
+    return m_d->size();
+}
+
 ResultSet 
 Connection::query(QString sparql) const
 {
@@ -0,0 +1,261 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#include "ConnectionPool.h"
+
+#include "Connection.h"
+#include "TransactionalStore.h"
+#include "RDFException.h"
+#include "Debug.h"
+#include "StatisticsCollector.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QThread>
+#include <QHash>
+#include <QSet>
+
+namespace Dataquay
+{
+
+class ConnectionPool::D
+{
+public:
+    D(TransactionalStore *ts, int maxConnections) :
+        m_ts(ts),
+        m_max(maxConnections) {
+    }
+
+    ~D() {
+        QMutexLocker locker(&m_mutex);
+        if (!m_active.empty()) {
+            DQ_DEBUG << "ConnectionPool::~ConnectionPool: " << m_active.size()
+                     << " connection(s) still in use" << endl;
+        }
+        foreach (Connection *c, m_active) {
+            // Connection commits on deletion, which we don't want
+            rollback(c);
+            delete c;
+        }
+        foreach (Connection *c, m_idle) {
+            delete c;
+        }
+    }
+
+    Connection *acquire() {
+        StatisticsCollector::Operation op(m_stats, "acquire");
+        QMutexLocker locker(&m_mutex);
+        while (m_idle.empty() && m_max > 0 &&
+               m_active.size() + m_releasing.size() >= m_max) {
+            m_available.wait(&m_mutex);
+        }
+        Connection *c = 0;
+        if (!m_idle.empty()) {
+            c = m_idle.takeLast();
+        } else {
+            StatisticsCollector::Operation cop(m_stats, "create");
+            c = new Connection(m_ts);
+        }
+        m_active.insert(c);
+        if (m_stats.isEnabled()) m_stats.addSize("active", m_active.size());
+        return c;
+    }
+
+    void release(Connection *c) {
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!m_active.remove(c)) {
+                throw RDFException("Connection is not in use from this pool");
+            }
+            m_releasing.insert(c);
+            QThread *thread = m_threadConnections.key(c);
+            if (thread) m_threadConnections.remove(thread);
+        }
+        StatisticsCollector::Operation op(m_stats, "release");
+        // Nobody else can acquire the connection until it goes back
+        // on the idle list, so this need not (and, as it may wait for
+        // the store, should not) happen with the pool locked
+        rollback(c);
+        QMutexLocker locker(&m_mutex);
+        m_releasing.remove(c);
+        m_idle.push_back(c);
+        m_available.wakeOne();
+    }
+
+    Connection *getThreadConnection() {
+        QThread *thread = QThread::currentThread();
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_threadConnections.contains(thread)) {
+                return m_threadConnections[thread];
+            }
+        }
+        Connection *c = acquire();
+        QMutexLocker locker(&m_mutex);
+        m_threadConnections[thread] = c;
+        return c;
+    }
+
+    void releaseThreadConnection() {
+        Connection *c = 0;
+        {
+            QMutexLocker locker(&m_mutex);
+            c = m_threadConnections.take(QThread::currentThread());
+        }
+        if (c) release(c);
+    }
+
+    int getMaxConnections() const {
+        return m_max;
+    }
+
+    int getActiveConnections() const {
+        QMutexLocker locker(&m_mutex);
+        return m_active.size();
+    }
+
+    int getIdleConnections() const {
+        QMutexLocker locker(&m_mutex);
+        return m_idle.size();
+    }
+
+    StatisticsCollector &getStatisticsCollector() const {
+        return m_stats;
+    }
+
+private:
+    TransactionalStore *m_ts;
+    int m_max;
+
+    static void rollback(Connection *c) {
+        // Must not throw: we may be called from ~PooledConnection
+        // during unwinding, and the connection has to go back on the
+        // idle list regardless. A transaction already abandoned after
+        // a failed operation refuses a second rollback, but it has
+        // been rolled back all the same
+        try {
+            c->rollback();
+        } catch (const RDFException &e) {
+            DQ_DEBUG << "ConnectionPool: ignoring failure on rollback: "
+                     << e.what() << endl;
+        }
+    }
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_available;
+    QSet<Connection *> m_active;
+    QSet<Connection *> m_releasing;
+    QList<Connection *> m_idle;
+    QHash<QThread *, Connection *> m_threadConnections;
+    mutable StatisticsCollector m_stats;
+};
+
+ConnectionPool::ConnectionPool(TransactionalStore *ts, int maxConnections) :
+    m_d(new D(ts, maxConnections))
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    delete m_d;
+}
+
+Connection *
+ConnectionPool::acquire()
+{
+    return m_d->acquire();
+}
+
+void
+ConnectionPool::release(Connection *c)
+{
+    m_d->release(c);
+}
+
+Connection *
+ConnectionPool::getThreadConnection()
+{
+    return m_d->getThreadConnection();
+}
+
+void
+ConnectionPool::releaseThreadConnection()
+{
+    m_d->releaseThreadConnection();
+}
+
+int
+ConnectionPool::getMaxConnections() const
+{
+    return m_d->getMaxConnections();
+}
+
+int
+ConnectionPool::getActiveConnections() const
+{
+    return m_d->getActiveConnections();
+}
+
+int
+ConnectionPool::getIdleConnections() const
+{
+    return m_d->getIdleConnections();
+}
+
+void
+ConnectionPool::setStatisticsEnabled(bool enabled)
+{
+    m_d->getStatisticsCollector().setEnabled(enabled);
+}
+
+bool
+ConnectionPool::getStatisticsEnabled() const
+{
+    return m_d->getStatisticsCollector().isEnabled();
+}
+
+Statistics
+ConnectionPool::getStatistics() const
+{
+    return m_d->getStatisticsCollector().getStatistics();
+}
+
+void
+ConnectionPool::resetStatistics()
+{
+    m_d->getStatisticsCollector().reset();
+}
+
+}
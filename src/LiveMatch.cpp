@@ -0,0 +1,175 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#include "LiveMatch.h"
+
+#include "TransactionalStore.h"
+#include "ChangeSubscription.h"
+#include "Debug.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+
+namespace Dataquay
+{
+
+class LiveMatch::D
+{
+public:
+    D(LiveMatch *lm, Triple pattern) :
+        m_lm(lm),
+        m_pattern(pattern),
+        m_subscription(0) {
+    }
+
+    void start(TransactionalStore *ts) {
+        // Called only once the LiveMatch has its D, as a commit on
+        // another thread may be delivered to it as soon as we have
+        // subscribed.  Subscribe before matching, so that no commit
+        // can fall between the two unseen.  Applying a change twice
+        // does no harm, as changes are only ever applied where they
+        // would make a difference
+        m_subscription = ts->subscribe(m_pattern);
+        QObject::connect(m_subscription,
+                         SIGNAL(changesCommitted(const ChangeSet &)),
+                         m_lm, SLOT(changesCommitted(const ChangeSet &)),
+                         Qt::DirectConnection);
+
+        QMutexLocker locker(&m_mutex);
+        ts->match(m_pattern, [this](const Triple &t) {
+                m_matches.insert(t);
+                return true;
+            });
+        DQ_DEBUG << "LiveMatch: " << m_matches.size() << " initial match(es)" << endl;
+    }
+
+    ~D() {
+        delete m_subscription;
+    }
+
+    Triple getPattern() const {
+        return m_pattern;
+    }
+
+    Triples getMatches() const {
+        QMutexLocker locker(&m_mutex);
+        Triples ts;
+        foreach (const Triple &t, m_matches) ts.push_back(t);
+        return ts;
+    }
+
+    int getMatchCount() const {
+        QMutexLocker locker(&m_mutex);
+        return m_matches.size();
+    }
+
+    bool contains(Triple t) const {
+        QMutexLocker locker(&m_mutex);
+        return m_matches.contains(t);
+    }
+
+    void apply(const ChangeSet &cs, Triples &added, Triples &removed) {
+        QMutexLocker locker(&m_mutex);
+        foreach (const Change &c, cs) {
+            const Triple &t = c.second;
+            if (c.first == AddTriple) {
+                if (m_matches.contains(t)) continue;
+                m_matches.insert(t);
+                if (!removed.removeOne(t)) added.push_back(t);
+            } else {
+                if (!m_matches.remove(t)) continue;
+                if (!added.removeOne(t)) removed.push_back(t);
+            }
+        }
+    }
+
+private:
+    LiveMatch *m_lm;
+    Triple m_pattern;
+    ChangeSubscription *m_subscription;
+    mutable QMutex m_mutex;
+    QSet<Triple> m_matches;
+};
+
+LiveMatch::LiveMatch(TransactionalStore *ts, Triple pattern, QObject *parent) :
+    QObject(parent)
+{
+    // For queued connections to the signals
+    qRegisterMetaType<Triples>("Triples");
+    qRegisterMetaType<Triples>("Dataquay::Triples");
+    m_d = new D(this, pattern);
+    m_d->start(ts);
+}
+
+LiveMatch::~LiveMatch()
+{
+    delete m_d;
+}
+
+Triple
+LiveMatch::getPattern() const
+{
+    return m_d->getPattern();
+}
+
+Triples
+LiveMatch::getMatches() const
+{
+    return m_d->getMatches();
+}
+
+int
+LiveMatch::getMatchCount() const
+{
+    return m_d->getMatchCount();
+}
+
+bool
+LiveMatch::contains(Triple t) const
+{
+    return m_d->contains(t);
+}
+
+void
+LiveMatch::changesCommitted(const ChangeSet &cs)
+{
+    Triples added, removed;
+    m_d->apply(cs, added, removed);
+    if (!removed.empty()) triplesRemoved(removed);
+    if (!added.empty()) triplesAdded(added);
+}
+
+}
+
@@ -0,0 +1,313 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#include "NTriplesParser.h"
+#include "RDFException.h"
+#include "Debug.h"
+
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#include <cctype>
+
+namespace Dataquay
+{
+
+/**
+ * Parser state for a single line.  Throws RDFException on any
+ * syntax error, with a message that the caller qualifies with the
+ * line number.
+ */
+class LineParser
+{
+public:
+    LineParser(const char *begin, const char *end, const QString &blankPrefix) :
+        m_p(begin), m_end(end), m_blankPrefix(blankPrefix) { }
+
+    // Return false for a line with no statement on it (blank or
+    // comment only)
+    bool parse(Triple &t) {
+        skipSpace();
+        if (atEnd() || *m_p == '#') return false;
+        t.a = (*m_p == '_') ? blank() : iri();
+        skipSpace();
+        t.b = iri();
+        skipSpace();
+        if (atEnd()) fail("missing object");
+        if (*m_p == '"') t.c = literal();
+        else if (*m_p == '_') t.c = blank();
+        else t.c = iri();
+        skipSpace();
+        if (atEnd() || *m_p != '.') fail("expected '.' at end of statement");
+        ++m_p;
+        skipSpace();
+        if (!atEnd() && *m_p != '#') fail("unexpected text after statement");
+        return true;
+    }
+
+private:
+    const char *m_p;
+    const char *m_end;
+    const QString &m_blankPrefix;
+
+    bool atEnd() const { return m_p >= m_end; }
+
+    void skipSpace() {
+        while (!atEnd() && (*m_p == ' ' || *m_p == '\t')) ++m_p;
+    }
+
+    void fail(QString why) const {
+        throw RDFException(why);
+    }
+
+    static void appendUtf8(QByteArray &b, uint c) {
+        if (c < 0x80) {
+            b.append(char(c));
+        } else if (c < 0x800) {
+            b.append(char(0xc0 | (c >> 6)));
+            b.append(char(0x80 | (c & 0x3f)));
+        } else if (c < 0x10000) {
+            b.append(char(0xe0 | (c >> 12)));
+            b.append(char(0x80 | ((c >> 6) & 0x3f)));
+            b.append(char(0x80 | (c & 0x3f)));
+        } else {
+            b.append(char(0xf0 | (c >> 18)));
+            b.append(char(0x80 | ((c >> 12) & 0x3f)));
+            b.append(char(0x80 | ((c >> 6) & 0x3f)));
+            b.append(char(0x80 | (c & 0x3f)));
+        }
+    }
+
+    void escape(QByteArray &b) {
+        // called with m_p just past a backslash
+        if (atEnd()) fail("incomplete escape");
+        char c = *m_p++;
+        switch (c) {
+        case 't': b.append('\t'); return;
+        case 'b': b.append('\b'); return;
+        case 'n': b.append('\n'); return;
+        case 'r': b.append('\r'); return;
+        case 'f': b.append('\f'); return;
+        case '"': b.append('"'); return;
+        case '\'': b.append('\''); return;
+        case '\\': b.append('\\'); return;
+        case 'u': case 'U': {
+            int n = (c == 'u' ? 4 : 8);
+            if (m_end - m_p < n) fail("incomplete escape");
+            bool ok = false;
+            uint code = QByteArray(m_p, n).toUInt(&ok, 16);
+            if (!ok || code > 0x10ffff) fail("bad escape");
+            m_p += n;
+            appendUtf8(b, code);
+            return;
+        }
+        default:
+            fail(QString("unknown escape \\%1").arg(c));
+        }
+    }
+
+    // Read up to the given terminator, decoding escapes
+    QString text(char terminator) {
+        const char *start = m_p;
+        while (!atEnd() && *m_p != terminator && *m_p != '\\') ++m_p;
+        if (!atEnd() && *m_p == terminator) {
+            // the usual case, with nothing to unescape
+            QString s = QString::fromUtf8(start, int(m_p - start));
+            ++m_p;
+            return s;
+        }
+        QByteArray b(start, int(m_p - start));
+        while (!atEnd() && *m_p != terminator) {
+            if (*m_p == '\\') {
+                ++m_p;
+                escape(b);
+            } else {
+                b.append(*m_p++);
+            }
+        }
+        if (atEnd()) fail(QString("missing closing %1").arg(terminator));
+        ++m_p;
+        return QString::fromUtf8(b.constData(), b.size());
+    }
+
+    Node iri() {
+        if (atEnd() || *m_p != '<') fail("expected '<'");
+        ++m_p;
+        return Node(Uri(text('>')));
+    }
+
+    Node blank() {
+        if (m_end - m_p < 3 || m_p[0] != '_' || m_p[1] != ':') {
+            fail("expected blank node");
+        }
+        m_p += 2;
+        const char *start = m_p;
+        while (!atEnd() && *m_p != ' ' && *m_p != '\t') ++m_p;
+        // a full stop may end the label only as the end of the statement
+        while (m_p > start && m_p[-1] == '.') --m_p;
+        if (m_p == start) fail("empty blank node label");
+        Node n;
+        n.type = Node::Blank;
+        n.value = m_blankPrefix + QString::fromUtf8(start, int(m_p - start));
+        return n;
+    }
+
+    Node literal() {
+        ++m_p; // the opening quote
+        Node n(text('"'));
+        if (!atEnd() && *m_p == '@') {
+            ++m_p;
+            while (!atEnd() && (isalnum((unsigned char)*m_p) || *m_p == '-')) {
+                ++m_p;
+            }
+        } else if (m_end - m_p >= 2 && m_p[0] == '^' && m_p[1] == '^') {
+            m_p += 2;
+            n.datatype = Uri(iri().value);
+        }
+        return n;
+    }
+};
+
+class NTriplesParser::Chunk : public QRunnable
+{
+public:
+    Chunk(const char *begin, const char *end, QString blankPrefix) :
+        m_begin(begin), m_end(end), m_blankPrefix(blankPrefix),
+        m_lines(0), m_errorLine(0) {
+        setAutoDelete(false);
+    }
+
+    void run() {
+        const char *p = m_begin;
+        while (p < m_end) {
+            const char *eol = p;
+            while (eol < m_end && *eol != '\n') ++eol;
+            const char *e = eol;
+            if (e > p && e[-1] == '\r') --e;
+            ++m_lines;
+            try {
+                Triple t;
+                if (LineParser(p, e, m_blankPrefix).parse(t)) {
+                    m_triples.push_back(t);
+                }
+            } catch (const RDFException &ex) {
+                m_errorLine = m_lines;
+                m_error = ex.what();
+                return;
+            }
+            p = eol + 1;
+        }
+    }
+
+    const Triples &triples() const { return m_triples; }
+    int lines() const { return m_lines; }
+    int errorLine() const { return m_errorLine; }
+    QString error() const { return m_error; }
+
+private:
+    const char *m_begin;
+    const char *m_end;
+    QString m_blankPrefix;
+    Triples m_triples;
+    int m_lines;
+    int m_errorLine; // 0 if no error
+    QString m_error;
+};
+
+Triples
+NTriplesParser::parse(const QByteArray &data, int threads, QString blankPrefix)
+{
+    if (threads <= 0) threads = QThread::idealThreadCount();
+    if (threads <= 0) threads = 1;
+
+    // Several chunks per thread, so that threads finishing early can
+    // take up the slack, but not so small as to be dominated by
+    // per-chunk overhead
+    const char *begin = data.constData();
+    const char *end = begin + data.size();
+    qint64 target = qMax(qint64(65536), qint64(data.size()) / (threads * 4));
+
+    QList<Chunk *> chunks;
+    for (const char *p = begin; p < end; ) {
+        const char *q = p + qMin(target, qint64(end - p));
+        while (q < end && q[-1] != '\n') ++q;
+        chunks.push_back(new Chunk(p, q, blankPrefix));
+        p = q;
+    }
+
+    DQ_DEBUG << "NTriplesParser::parse: " << data.size() << " bytes in "
+             << chunks.size() << " chunk(s) on up to " << threads
+             << " thread(s)" << endl;
+
+    if (threads == 1 || chunks.size() == 1) {
+        foreach (Chunk *c, chunks) c->run();
+    } else {
+        QThreadPool pool;
+        pool.setMaxThreadCount(threads);
+        foreach (Chunk *c, chunks) pool.start(c);
+        pool.waitForDone();
+    }
+
+    Triples result;
+    int line = 0;
+    foreach (Chunk *c, chunks) {
+        if (c->errorLine() > 0) {
+            QString message = QString("Failed to parse N-Triples at line %1: %2")
+                .arg(line + c->errorLine()).arg(c->error());
+            foreach (Chunk *d, chunks) delete d;
+            throw RDFException(message);
+        }
+        line += c->lines();
+        result += c->triples();
+    }
+    foreach (Chunk *c, chunks) delete c;
+    return result;
+}
+
+void
+NTriplesParser::removeBlankPrefix(Triples &ts, QString blankPrefix)
+{
+    int n = blankPrefix.length();
+    if (n == 0) return;
+    for (int i = 0; i < ts.size(); ++i) {
+        // Predicates are never blank
+        Triple &t = ts[i];
+        if (t.a.type == Node::Blank) t.a.value = t.a.value.mid(n);
+        if (t.c.type == Node::Blank) t.c.value = t.c.value.mid(n);
+    }
+}
+
+}
+
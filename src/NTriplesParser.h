@@ -0,0 +1,82 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef DATAQUAY_INTERNAL_NTRIPLES_PARSER_H
+#define DATAQUAY_INTERNAL_NTRIPLES_PARSER_H
+
+#include "Triple.h"
+
+#include <QByteArray>
+#include <QString>
+
+namespace Dataquay
+{
+
+/**
+ * NTriplesParser parses N-Triples documents without the help of an
+ * RDF library.  N-Triples has one statement per line, so a document
+ * can be split into chunks at line boundaries and the chunks parsed
+ * at the same time on separate threads, which is what parse() does.
+ *
+ * Language tags on literals are discarded, as Node has no place to
+ * keep them.
+ */
+class NTriplesParser
+{
+public:
+    /**
+     * Parse the given UTF-8 N-Triples document, using up to the given
+     * number of threads (or one per processor core if threads is 0).
+     * The string blankPrefix is prepended to every blank node
+     * identifier.  Return the triples in document order.  Throw
+     * RDFException, naming the line, if the document cannot be
+     * parsed.
+     */
+    static Triples parse(const QByteArray &data, int threads = 0,
+                         QString blankPrefix = "");
+
+    /**
+     * Remove the given prefix, as passed to parse(), from the
+     * identifier of every blank node in the given triples, so that
+     * they have the identifiers they had in the document.
+     */
+    static void removeBlankPrefix(Triples &ts, QString blankPrefix);
+
+private:
+    class Chunk;
+};
+
+}
+
+#endif
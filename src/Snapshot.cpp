@@ -0,0 +1,541 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#include "Snapshot.h"
+#include "RDFException.h"
+
+#include <QDataStream>
+#include <QFileInfo>
+#include <QtEndian>
+
+#include "Debug.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <io.h>
+#else
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Dataquay
+{
+
+static const char snapshotMagic[] = "DQSNAPSH";
+static const int sectionCount = 7;
+static const quint64 headerSize = 16 + sectionCount * 24;
+
+static quint64
+align8(quint64 n)
+{
+    return (n + 7) & ~quint64(7);
+}
+
+static void
+writeString(QDataStream &out, QString s)
+{
+    QByteArray b = s.toUtf8();
+    out << quint32(b.size());
+    out.writeRawData(b.constData(), b.size());
+}
+
+static bool
+syncToDisc(int fd)
+{
+#ifdef Q_OS_WIN
+    return _commit(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+static bool
+replaceFile(QString from, QString to)
+{
+    // Atomically, so that there is never a moment with no file at
+    // the target name
+#ifdef Q_OS_WIN
+    return MoveFileExW((LPCWSTR)from.utf16(), (LPCWSTR)to.utf16(),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return rename(QFile::encodeName(from).constData(),
+                  QFile::encodeName(to).constData()) == 0;
+#endif
+}
+
+static bool
+syncDirectory(QString filename)
+{
+    // Make the rename of a file within the directory durable
+    // (MoveFileEx has done this already with MOVEFILE_WRITE_THROUGH)
+#ifdef Q_OS_WIN
+    Q_UNUSED(filename);
+    return true;
+#else
+    QString dir = QFileInfo(filename).absolutePath();
+    int fd = open(QFile::encodeName(dir).constData(), O_RDONLY);
+    if (fd < 0) return false;
+    // Some filesystems can't sync a directory, and have nothing to
+    // sync when they can't
+    bool ok = (fsync(fd) == 0 || errno == EINVAL);
+    close(fd);
+    return ok;
+#endif
+}
+
+static int
+compareBytes(const uchar *a, quint64 alen, const uchar *b, quint64 blen)
+{
+    int c = memcmp(a, b, size_t(qMin(alen, blen)));
+    if (c != 0) return c;
+    if (alen < blen) return -1;
+    if (alen > blen) return 1;
+    return 0;
+}
+
+Node
+Snapshot::canonical(Node n)
+{
+    if (n.type != Node::Literal) n.datatype = Uri();
+    return n;
+}
+
+QByteArray
+Snapshot::encodeTerm(const Node &n)
+{
+    QByteArray b;
+    QDataStream ts(&b, QIODevice::WriteOnly);
+    ts.setByteOrder(QDataStream::LittleEndian);
+    QByteArray v = n.value.toUtf8();
+    ts << quint8(n.type) << quint32(v.size());
+    ts.writeRawData(v.constData(), v.size());
+    if (n.type == Node::Literal && n.datatype != Uri()) {
+        QByteArray d = n.datatype.toString().toUtf8();
+        ts.writeRawData(d.constData(), d.size());
+    }
+    return b;
+}
+
+SnapshotWriter::SnapshotWriter(Uri baseUri, Snapshot::PrefixMap prefixes) :
+    m_baseUri(baseUri),
+    m_prefixes(prefixes)
+{
+}
+
+quint32
+SnapshotWriter::id(const Node &n)
+{
+    Node cn = Snapshot::canonical(n);
+    QHash<Node, quint32>::const_iterator i = m_ids.find(cn);
+    if (i != m_ids.end()) return i.value();
+    quint32 id = m_terms.size();
+    m_terms.push_back(cn);
+    m_ids.insert(cn, id);
+    return id;
+}
+
+void
+SnapshotWriter::add(const Triple &t)
+{
+    IdTriple it;
+    it.a = id(t.a);
+    it.b = id(t.b);
+    it.c = id(t.c);
+    m_triples.push_back(it);
+}
+
+void
+SnapshotWriter::write(QString filename) const
+{
+    DQ_DEBUG << "SnapshotWriter::write(" << filename << "): "
+             << m_terms.size() << " terms, " << m_triples.size()
+             << " triples" << endl;
+
+    QByteArray meta;
+    {
+        QDataStream ms(&meta, QIODevice::WriteOnly);
+        ms.setByteOrder(QDataStream::LittleEndian);
+        writeString(ms, m_baseUri.toString());
+        ms << quint32(m_prefixes.size());
+        for (Snapshot::PrefixMap::const_iterator i = m_prefixes.begin();
+             i != m_prefixes.end(); ++i) {
+            writeString(ms, i.key());
+            writeString(ms, i.value().toString());
+        }
+    }
+
+    QByteArray termData;
+    QVector<quint64> termOffsets;
+    for (int i = 0; i < m_terms.size(); ++i) {
+        termOffsets.push_back(termData.size());
+        termData.append(Snapshot::encodeTerm(m_terms[i]));
+    }
+    termOffsets.push_back(termData.size());
+
+    // Term IDs ordered by their data, for SnapshotReader::findTerm
+    QVector<quint32> termIndex(m_terms.size());
+    for (int i = 0; i < termIndex.size(); ++i) termIndex[i] = i;
+    const uchar *td = (const uchar *)termData.constData();
+    std::sort(termIndex.begin(), termIndex.end(),
+              [&](quint32 a, quint32 b) {
+                  return compareBytes
+                      (td + termOffsets[a], termOffsets[a+1] - termOffsets[a],
+                       td + termOffsets[b], termOffsets[b+1] - termOffsets[b])
+                      < 0;
+              });
+
+    QVector<IdTriple> spo(m_triples), pos, osp;
+    std::sort(spo.begin(), spo.end());
+    foreach (const IdTriple &t, spo) {
+        IdTriple p = { t.b, t.c, t.a };
+        IdTriple o = { t.c, t.a, t.b };
+        pos.push_back(p);
+        osp.push_back(o);
+    }
+    std::sort(pos.begin(), pos.end());
+    std::sort(osp.begin(), osp.end());
+
+    quint32 ids[sectionCount] = {
+        Snapshot::MetaSection, Snapshot::TermOffsetSection,
+        Snapshot::TermDataSection, Snapshot::SPOSection,
+        Snapshot::POSSection, Snapshot::OSPSection,
+        Snapshot::TermIndexSection
+    };
+    quint64 tableSize = quint64(spo.size()) * 12;
+    quint64 sizes[sectionCount] = {
+        quint64(meta.size()), quint64(termOffsets.size()) * 8,
+        quint64(termData.size()), tableSize, tableSize, tableSize,
+        quint64(termIndex.size()) * 4
+    };
+    quint64 offsets[sectionCount];
+    quint64 end = headerSize;
+    for (int i = 0; i < sectionCount; ++i) {
+        offsets[i] = align8(end);
+        end = offsets[i] + sizes[i];
+    }
+
+    QString tmpFilename = QString("%1.part").arg(filename);
+
+    QFile tf(tmpFilename);
+    if (!tf.open(QFile::WriteOnly | QFile::Truncate)) {
+        throw RDFException("Failed to open partial file for writing", tmpFilename);
+    }
+
+    QDataStream out(&tf);
+    out.setByteOrder(QDataStream::LittleEndian);
+
+    out.writeRawData(snapshotMagic, 8);
+    out << Snapshot::version << quint32(sectionCount);
+    for (int i = 0; i < sectionCount; ++i) {
+        out << ids[i] << quint32(0) << offsets[i] << sizes[i];
+    }
+
+    quint64 written = headerSize;
+    for (int i = 0; i < sectionCount; ++i) {
+        while (written < offsets[i]) {
+            out << quint8(0);
+            ++written;
+        }
+        switch (ids[i]) {
+        case Snapshot::MetaSection:
+            out.writeRawData(meta.constData(), meta.size());
+            break;
+        case Snapshot::TermOffsetSection:
+            foreach (quint64 o, termOffsets) out << o;
+            break;
+        case Snapshot::TermDataSection:
+            out.writeRawData(termData.constData(), termData.size());
+            break;
+        case Snapshot::SPOSection:
+            foreach (const IdTriple &t, spo) out << t.a << t.b << t.c;
+            break;
+        case Snapshot::POSSection:
+            foreach (const IdTriple &t, pos) out << t.a << t.b << t.c;
+            break;
+        case Snapshot::OSPSection:
+            foreach (const IdTriple &t, osp) out << t.a << t.b << t.c;
+            break;
+        case Snapshot::TermIndexSection:
+            foreach (quint32 id, termIndex) out << id;
+            break;
+        }
+        written += sizes[i];
+    }
+
+    // The snapshot must be on disc before it replaces the old one,
+    // and the replacement must be on disc before we return, as the
+    // caller may then discard data that only the old one held (see
+    // ChangeJournal::compact)
+    bool ok = (out.status() == QDataStream::Ok &&
+               tf.flush() && syncToDisc(tf.handle()));
+    tf.close();
+    if (!ok || tf.error() != QFile::NoError) {
+        QFile::remove(tmpFilename);
+        throw RDFException("Failed to write snapshot file", tmpFilename);
+    }
+
+    if (!replaceFile(tmpFilename, filename)) {
+        QFile::remove(tmpFilename);
+        throw RDFException("Failed to rename temporary file to snapshot file",
+                           filename);
+    }
+    if (!syncDirectory(filename)) {
+        throw RDFException("Failed to sync directory of snapshot file",
+                           filename);
+    }
+}
+
+SnapshotReader::SnapshotReader(QString filename) :
+    m_filename(filename),
+    m_file(filename),
+    m_data(0),
+    m_size(0),
+    m_termCount(0),
+    m_tripleCount(0),
+    m_termOffsets(0),
+    m_termData(0),
+    m_termDataSize(0),
+    m_spo(0),
+    m_pos(0),
+    m_osp(0),
+    m_termIndex(0)
+{
+    if (!m_file.open(QFile::ReadOnly)) {
+        throw RDFException("Failed to open snapshot file for reading", filename);
+    }
+
+    m_size = m_file.size();
+    if (m_size > 0) m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        DQ_DEBUG << "SnapshotReader: Failed to map " << filename
+                 << ", reading it instead" << endl;
+        m_buffer = m_file.readAll();
+        m_data = (const uchar *)m_buffer.constData();
+        m_size = m_buffer.size();
+    }
+
+    if (m_size < 16 || memcmp(m_data, snapshotMagic, 8)) {
+        invalid("not a snapshot file");
+    }
+    quint32 v = qFromLittleEndian<quint32>(m_data + 8);
+    if (v == 0 || v > Snapshot::version) {
+        invalid(QString("unsupported version %1").arg(v));
+    }
+    quint32 n = qFromLittleEndian<quint32>(m_data + 12);
+    if (n > (m_size - 16) / 24) {
+        invalid("section table is truncated");
+    }
+    for (quint32 i = 0; i < n; ++i) {
+        const uchar *entry = m_data + 16 + i * 24;
+        quint64 offset = qFromLittleEndian<quint64>(entry + 8);
+        quint64 size = qFromLittleEndian<quint64>(entry + 16);
+        if (offset > m_size || size > m_size - offset) {
+            invalid("section extends beyond end of file");
+        }
+    }
+
+    quint64 size = 0;
+    const uchar *meta = section(Snapshot::MetaSection, size);
+    if (!meta) invalid("no metadata section");
+    const uchar *metaEnd = meta + size;
+
+    struct StringReader {
+        const uchar *&p;
+        const uchar *end;
+        bool read(QString &s) {
+            if (end - p < 4) return false;
+            quint32 len = qFromLittleEndian<quint32>(p);
+            p += 4;
+            if (quint64(end - p) < len) return false;
+            s = QString::fromUtf8((const char *)p, len);
+            p += len;
+            return true;
+        }
+    } sr = { meta, metaEnd };
+
+    QString s;
+    if (!sr.read(s)) invalid("bad base URI");
+    if (s != "") m_baseUri = Uri(s);
+    if (metaEnd - meta < 4) invalid("bad prefix table");
+    quint32 prefixes = qFromLittleEndian<quint32>(meta);
+    meta += 4;
+    for (quint32 i = 0; i < prefixes; ++i) {
+        QString prefix, uri;
+        if (!sr.read(prefix) || !sr.read(uri)) invalid("bad prefix table");
+        m_prefixes[prefix] = Uri(uri);
+    }
+
+    m_termOffsets = section(Snapshot::TermOffsetSection, size);
+    if (!m_termOffsets || size < 8 || size % 8 != 0) {
+        invalid("bad term offset table");
+    }
+    m_termCount = quint32(size / 8 - 1);
+
+    m_termData = section(Snapshot::TermDataSection, m_termDataSize);
+    if (!m_termData) invalid("no term data");
+
+    m_spo = section(Snapshot::SPOSection, size);
+    if (!m_spo || size % 12 != 0) invalid("bad triple table");
+    m_tripleCount = size / 12;
+
+    // The remaining sections are optional, but must be the right
+    // size if present
+    m_pos = section(Snapshot::POSSection, size);
+    if (m_pos && size != m_tripleCount * 12) invalid("bad POS index");
+    m_osp = section(Snapshot::OSPSection, size);
+    if (m_osp && size != m_tripleCount * 12) invalid("bad OSP index");
+    m_termIndex = section(Snapshot::TermIndexSection, size);
+    if (m_termIndex && size != quint64(m_termCount) * 4) invalid("bad term index");
+
+    DQ_DEBUG << "SnapshotReader: " << filename << ": " << m_termCount
+             << " terms, " << m_tripleCount << " triples" << endl;
+}
+
+SnapshotReader::~SnapshotReader()
+{
+    // QFile unmaps on close
+}
+
+const uchar *
+SnapshotReader::section(quint32 id, quint64 &size) const
+{
+    quint32 n = qFromLittleEndian<quint32>(m_data + 12);
+    for (quint32 i = 0; i < n; ++i) {
+        const uchar *entry = m_data + 16 + i * 24;
+        if (qFromLittleEndian<quint32>(entry) == id) {
+            size = qFromLittleEndian<quint64>(entry + 16);
+            return m_data + qFromLittleEndian<quint64>(entry + 8);
+        }
+    }
+    size = 0;
+    return 0;
+}
+
+void
+SnapshotReader::invalid(QString why) const
+{
+    throw RDFException(QString("Invalid snapshot file (%1)").arg(why),
+                       m_filename);
+}
+
+const uchar *
+SnapshotReader::termData(quint32 id, quint64 &size) const
+{
+    if (id >= m_termCount) invalid("term ID out of range");
+    quint64 start = qFromLittleEndian<quint64>(m_termOffsets + id * 8);
+    quint64 end = qFromLittleEndian<quint64>(m_termOffsets + (id + 1) * 8);
+    if (start > end || end > m_termDataSize || end - start < 5) {
+        invalid("bad term offset");
+    }
+    size = end - start;
+    return m_termData + start;
+}
+
+Node
+SnapshotReader::getTerm(quint32 id) const
+{
+    quint64 size = 0;
+    const uchar *p = termData(id, size);
+    quint32 len = qFromLittleEndian<quint32>(p + 1);
+    if (len > size - 5) invalid("bad term length");
+    Node n;
+    switch (p[0]) {
+    case Node::URI: n.type = Node::URI; break;
+    case Node::Literal: n.type = Node::Literal; break;
+    case Node::Blank: n.type = Node::Blank; break;
+    default: invalid("bad term type");
+    }
+    n.value = QString::fromUtf8((const char *)p + 5, len);
+    quint64 dlen = size - 5 - len;
+    if (dlen > 0) {
+        n.datatype = Uri(QString::fromUtf8((const char *)p + 5 + len, int(dlen)));
+    }
+    return n;
+}
+
+void
+SnapshotReader::getTripleIds(quint64 index,
+                             quint32 &s, quint32 &p, quint32 &o) const
+{
+    if (index >= m_tripleCount) invalid("triple index out of range");
+    const uchar *t = m_spo + index * 12;
+    s = qFromLittleEndian<quint32>(t);
+    p = qFromLittleEndian<quint32>(t + 4);
+    o = qFromLittleEndian<quint32>(t + 8);
+    if (s >= m_termCount || p >= m_termCount || o >= m_termCount) {
+        invalid("term ID out of range");
+    }
+}
+
+const uchar *
+SnapshotReader::getIndex(Snapshot::SectionId id) const
+{
+    switch (id) {
+    case Snapshot::SPOSection: return m_spo;
+    case Snapshot::POSSection: return m_pos;
+    case Snapshot::OSPSection: return m_osp;
+    default: return 0;
+    }
+}
+
+bool
+SnapshotReader::findTerm(const Node &n, quint32 &id) const
+{
+    if (!m_termIndex) invalid("no term index");
+    QByteArray b = Snapshot::encodeTerm(Snapshot::canonical(n));
+    const uchar *key = (const uchar *)b.constData();
+    quint32 lo = 0, hi = m_termCount;
+    while (lo < hi) {
+        quint32 mid = lo + (hi - lo) / 2;
+        quint32 candidate = qFromLittleEndian<quint32>(m_termIndex + mid * 4);
+        quint64 size = 0;
+        const uchar *data = termData(candidate, size);
+        int c = compareBytes(data, size, key, b.size());
+        if (c == 0) {
+            id = candidate;
+            return true;
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return false;
+}
+
+}
+
@@ -0,0 +1,247 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef DATAQUAY_INTERNAL_SNAPSHOT_H
+#define DATAQUAY_INTERNAL_SNAPSHOT_H
+
+#include "Triple.h"
+#include "Uri.h"
+
+#include <QHash>
+#include <QVector>
+#include <QByteArray>
+#include <QString>
+#include <QFile>
+
+namespace Dataquay
+{
+
+/**
+ * The binary snapshot format written by BasicStore::saveSnapshot and
+ * read by BasicStore::loadSnapshot.
+ *
+ * A snapshot holds the store's triples as a term dictionary and a
+ * table of term ID triples, so that loading one involves no RDF
+ * parsing at all.  All values are little-endian.  The file starts
+ * with a header:
+ *
+ *  - the 8 bytes "DQSNAPSH"
+ *  - quint32 format version
+ *  - quint32 number of sections
+ *  - for each section, quint32 section ID, quint32 reserved (0),
+ *    quint64 offset from the start of the file, and quint64 size
+ *    in bytes
+ *
+ * and each section starts on an 8-byte boundary.  The sections are:
+ *
+ *  - MetaSection: the base URI, then a quint32 count followed by that
+ *    many prefix and URI pairs.  Each string is a quint32 byte count
+ *    followed by UTF-8 data.
+ *
+ *  - TermOffsetSection: one quint64 per term, plus one more at the
+ *    end, giving the offset of each term's data within
+ *    TermDataSection.  Term IDs are indices into this table.
+ *
+ *  - TermDataSection: for each term, a quint8 Node::Type, a quint32
+ *    byte count and the UTF-8 value, then the UTF-8 datatype URI (if
+ *    any) running to the start of the next term.
+ *
+ *  - SPOSection: three quint32 term IDs per triple, sorted by
+ *    subject, then predicate, then object.
+ *
+ *  - POSSection and OSPSection: the same triples again, as predicate,
+ *    object, subject and as object, subject, predicate, each sorted
+ *    in that order.
+ *
+ *  - TermIndexSection: one quint32 term ID per term, ordered by the
+ *    bytes of the terms' data, for looking up the ID of a term.
+ *
+ * Readers should ignore sections they do not recognise.  Only the
+ * first four are needed to load a snapshot into a BasicStore; the
+ * rest allow a SnapshotStore to answer queries directly from the
+ * file.
+ */
+class Snapshot
+{
+public:
+    enum SectionId {
+        MetaSection = 1,
+        TermOffsetSection = 2,
+        TermDataSection = 3,
+        SPOSection = 4,
+        POSSection = 5,
+        OSPSection = 6,
+        TermIndexSection = 7
+    };
+
+    static const quint32 version = 1;
+
+    typedef QHash<QString, Uri> PrefixMap;
+
+    /**
+     * Return the node in the canonical form in which it is held in
+     * the dictionary, i.e. with no datatype unless it is a literal.
+     */
+    static Node canonical(Node n);
+
+    /**
+     * Return the term data for the given node, as held in
+     * TermDataSection.
+     */
+    static QByteArray encodeTerm(const Node &n);
+};
+
+/**
+ * SnapshotWriter collects triples and writes them out as a snapshot
+ * file.  Not thread safe.
+ */
+class SnapshotWriter
+{
+public:
+    SnapshotWriter(Uri baseUri, Snapshot::PrefixMap prefixes);
+
+    /**
+     * Add a triple to the snapshot.  The triple must be complete, and
+     * should not already have been added.
+     */
+    void add(const Triple &t);
+
+    /**
+     * Write the snapshot to the given file, replacing it if it
+     * exists.  May throw RDFException.
+     */
+    void write(QString filename) const;
+
+private:
+    struct IdTriple {
+        quint32 a, b, c;
+        bool operator<(const IdTriple &t) const {
+            if (a != t.a) return a < t.a;
+            if (b != t.b) return b < t.b;
+            return c < t.c;
+        }
+    };
+
+    Uri m_baseUri;
+    Snapshot::PrefixMap m_prefixes;
+    QHash<Node, quint32> m_ids;
+    QVector<Node> m_terms;
+    QVector<IdTriple> m_triples;
+
+    quint32 id(const Node &n);
+};
+
+/**
+ * SnapshotReader provides access to the contents of a snapshot file,
+ * which it maps into memory if possible and reads otherwise.  Terms
+ * and triples are decoded only as they are asked for.  All functions
+ * are const and safe to call from multiple threads at once.
+ */
+class SnapshotReader
+{
+public:
+    /**
+     * Open the given snapshot file.  Throw RDFException if it cannot
+     * be read or is not a valid snapshot.
+     */
+    SnapshotReader(QString filename);
+    ~SnapshotReader();
+
+    Uri getBaseUri() const { return m_baseUri; }
+    Snapshot::PrefixMap getPrefixes() const { return m_prefixes; }
+
+    quint32 getTermCount() const { return m_termCount; }
+
+    /**
+     * Return the term with the given ID.  Throw RDFException if the
+     * ID is out of range or the term data is invalid.
+     */
+    Node getTerm(quint32 id) const;
+
+    quint64 getTripleCount() const { return m_tripleCount; }
+
+    /**
+     * Retrieve the term IDs of the triple at the given index in
+     * subject-predicate-object order.  Throw RDFException if the
+     * index is out of range.
+     */
+    void getTripleIds(quint64 index, quint32 &s, quint32 &p, quint32 &o) const;
+
+    /**
+     * Return true if the snapshot has the POS and OSP indexes and the
+     * term index, as well as the SPO table.
+     */
+    bool hasIndexes() const { return m_pos && m_osp && m_termIndex; }
+
+    /**
+     * Return the table of getTripleCount() triples for the given
+     * index section (SPOSection, POSSection or OSPSection), as three
+     * little-endian quint32 term IDs each, in the section's order.
+     * Return 0 if the snapshot lacks that index.
+     */
+    const uchar *getIndex(Snapshot::SectionId id) const;
+
+    /**
+     * Look up the ID of the given node.  Return false if the node is
+     * not among the snapshot's terms.  Requires hasIndexes().
+     */
+    bool findTerm(const Node &n, quint32 &id) const;
+
+private:
+    QString m_filename;
+    QFile m_file;
+    QByteArray m_buffer; // if the file could not be mapped
+    const uchar *m_data;
+    quint64 m_size;
+
+    Uri m_baseUri;
+    Snapshot::PrefixMap m_prefixes;
+    quint32 m_termCount;
+    quint64 m_tripleCount;
+    const uchar *m_termOffsets;
+    const uchar *m_termData;
+    quint64 m_termDataSize;
+    const uchar *m_spo;
+    const uchar *m_pos;
+    const uchar *m_osp;
+    const uchar *m_termIndex;
+
+    const uchar *section(quint32 id, quint64 &size) const;
+    const uchar *termData(quint32 id, quint64 &size) const;
+    void invalid(QString why) const;
+};
+
+}
+
+#endif
@@ -0,0 +1,492 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#include "SnapshotStore.h"
+#include "BasicStore.h"
+#include "RDFException.h"
+#include "Snapshot.h"
+#include "Debug.h"
+
+#include <QHash>
+#include <QCryptographicHash>
+#include <QtEndian>
+
+#include <cstdlib>
+#include <time.h>
+
+namespace Dataquay
+{
+
+class SnapshotStore::D
+{
+public:
+    D(QString filename) :
+        m_filename(filename),
+        m_reader(filename),
+        m_baseUri(m_reader.getBaseUri()),
+        m_prefixes(m_reader.getPrefixes()) {
+        if (!m_reader.hasIndexes()) {
+            throw RDFException("Snapshot file lacks the indexes needed by SnapshotStore", filename);
+        }
+        DQ_DEBUG << "SnapshotStore: opened " << filename << " with "
+                 << m_reader.getTripleCount() << " triple(s)" << endl;
+    }
+
+    Uri getBaseUri() const {
+        return m_baseUri;
+    }
+
+    void readOnly(QString operation) const {
+        throw RDFUnsupportedError
+            (QString("SnapshotStore is read-only: %1 not supported")
+             .arg(operation), m_filename);
+    }
+
+    bool contains(Triple t) const {
+        DQ_DEBUG << "SnapshotStore::contains: " << t << endl;
+        if (t.a.type == Node::Nothing ||
+            t.b.type == Node::Nothing ||
+            t.c.type == Node::Nothing) {
+            throw RDFException("Failed to test for triple (statement is incomplete)");
+        }
+        Pattern pat;
+        if (!resolve(t, pat)) return false;
+        quint64 lo, hi;
+        range(pat, lo, hi);
+        return lo < hi;
+    }
+
+    Triples match(Triple t, bool single = false) const {
+        Triples results;
+        match(t, [&](const Triple &r) {
+                results.push_back(r);
+                return !single;
+            });
+        return results;
+    }
+
+    void match(Triple t, const TripleVisitor &visitor) const {
+        DQ_DEBUG << "SnapshotStore::match: " << t << endl;
+        Pattern pat;
+        if (!resolve(t, pat)) return;
+        quint64 lo, hi;
+        range(pat, lo, hi);
+        // Results commonly share terms (all with the same predicate,
+        // say), so decode each distinct term only once per match
+        QHash<quint32, Node> terms;
+        for (quint64 i = lo; i < hi; ++i) {
+            quint32 ids[3];
+            tripleAt(pat.index, i, ids);
+            Node n[3];
+            for (int j = 0; j < 3; ++j) {
+                QHash<quint32, Node>::const_iterator ti = terms.find(ids[j]);
+                if (ti != terms.end()) {
+                    n[j] = ti.value();
+                } else {
+                    n[j] = m_reader.getTerm(ids[j]);
+                    terms.insert(ids[j], n[j]);
+                }
+            }
+            if (!visitor(Triple(n[0], n[1], n[2]))) break;
+        }
+    }
+
+    int count(Triple t) const {
+        DQ_DEBUG << "SnapshotStore::count: " << t << endl;
+        Pattern pat;
+        if (!resolve(t, pat)) return 0;
+        quint64 lo, hi;
+        range(pat, lo, hi);
+        return int(hi - lo);
+    }
+
+    int size() const {
+        return int(m_reader.getTripleCount());
+    }
+
+    Node complete(Triple t) const {
+        int count = 0, match = 0;
+        if (t.a == Node()) { ++count; match = 0; }
+        if (t.b == Node()) { ++count; match = 1; }
+        if (t.c == Node()) { ++count; match = 2; }
+        if (count != 1) {
+            throw RDFException("Cannot complete triple unless it has only a single wildcard node", t);
+        }
+        DQ_DEBUG << "SnapshotStore::complete: " << t << endl;
+        Triples result = this->match(t, true);
+        if (result.empty()) return Node();
+        else switch (match) {
+            case 0: return result[0].a;
+            case 1: return result[0].b;
+            case 2: return result[0].c;
+            default: return Node();
+            }
+    }
+
+    Triple matchOnce(Triple t) const {
+        DQ_DEBUG << "SnapshotStore::matchOnce: " << t << endl;
+        Triples result = match(t, true);
+        if (result.empty()) return Triple();
+        else return result[0];
+    }
+
+    Uri getUniqueUri(QString prefix) const {
+        DQ_DEBUG << "SnapshotStore::getUniqueUri: prefix " << prefix << endl;
+        while (true) {
+            QString s =
+                QString::fromLocal8Bit
+                (QCryptographicHash::hash
+                 (QString("%1").arg(rand() + time(0)).toLocal8Bit(),
+                  QCryptographicHash::Sha1).toHex())
+                .left(12);
+            // This may be used as the whole of a name in some
+            // contexts, so it must not start with a digit
+            if (s[0].isDigit()) {
+                s = "x" + s.right(s.length()-1);
+            }
+            Uri uri = expand(prefix + s);
+            quint32 id;
+            if (!m_reader.findTerm(Node(uri), id)) return uri;
+        }
+    }
+
+    Uri expand(QString shrt) const {
+
+        if (shrt == "a") {
+            return Uri::rdfTypeUri();
+        }
+
+        int index = shrt.indexOf(':');
+        if (index == 0) {
+            // starts with colon
+            return Uri(m_baseUri.toString() + shrt.right(shrt.length() - 1));
+        } else if (index > 0) {
+            // colon appears in middle somewhere
+            if (index + 2 < shrt.length() &&
+                shrt[index+1] == '/' &&
+                shrt[index+2] == '/') {
+                // we have found "://", this is a scheme, therefore
+                // the uri is already expanded
+                return Uri(shrt);
+            }
+        } else {
+            // no colon present, no possibility of expansion
+            return Uri(shrt);
+        }
+
+        // fall through only for colon in middle and no "://" found,
+        // i.e. a plausible prefix appears
+
+        QString prefix = shrt.left(index);
+        Snapshot::PrefixMap::const_iterator pi = m_prefixes.find(prefix);
+        if (pi != m_prefixes.end()) {
+            return Uri(pi.value().toString() +
+                       shrt.right(shrt.length() - (index + 1)));
+        } else {
+            return Uri(shrt);
+        }
+    }
+
+    void save(QString filename) const {
+        // Writing Turtle is the business of the RDF library behind
+        // BasicStore, so go by way of one
+        DQ_DEBUG << "SnapshotStore::save(" << filename << ")" << endl;
+        BasicStore store;
+        if (m_baseUri != Uri()) store.setBaseUri(m_baseUri);
+        for (Snapshot::PrefixMap::const_iterator i = m_prefixes.begin();
+             i != m_prefixes.end(); ++i) {
+            if (i.key() != "") store.addPrefix(i.key(), i.value());
+        }
+        store.addAll(match(Triple()));
+        store.save(filename);
+    }
+
+private:
+    QString m_filename;
+    SnapshotReader m_reader;
+    Uri m_baseUri;
+    Snapshot::PrefixMap m_prefixes;
+
+    // A wildcard pattern resolved to a range of one of the snapshot's
+    // indexes: the first n IDs of key are the pattern's bound nodes,
+    // in the index's own order
+    struct Pattern {
+        Snapshot::SectionId index;
+        quint32 key[3];
+        int n;
+    };
+
+    bool resolve(Triple t, Pattern &pat) const {
+
+        // Return false if any bound node is not in the snapshot, in
+        // which case nothing can match
+
+        quint32 s = 0, p = 0, o = 0;
+        bool hs = (t.a.type != Node::Nothing);
+        bool hp = (t.b.type != Node::Nothing);
+        bool ho = (t.c.type != Node::Nothing);
+        if (hs && !m_reader.findTerm(t.a, s)) return false;
+        if (hp && !m_reader.findTerm(t.b, p)) return false;
+        if (ho && !m_reader.findTerm(t.c, o)) return false;
+
+        if (hs && (hp || !ho)) {
+            pat.index = Snapshot::SPOSection;
+            pat.key[0] = s; pat.key[1] = p; pat.key[2] = o;
+            pat.n = (hp ? (ho ? 3 : 2) : 1);
+        } else if (hs) {
+            pat.index = Snapshot::OSPSection;
+            pat.key[0] = o; pat.key[1] = s; pat.key[2] = 0;
+            pat.n = 2;
+        } else if (hp) {
+            pat.index = Snapshot::POSSection;
+            pat.key[0] = p; pat.key[1] = o; pat.key[2] = 0;
+            pat.n = (ho ? 2 : 1);
+        } else if (ho) {
+            pat.index = Snapshot::OSPSection;
+            pat.key[0] = o; pat.key[1] = 0; pat.key[2] = 0;
+            pat.n = 1;
+        } else {
+            pat.index = Snapshot::SPOSection;
+            pat.key[0] = 0; pat.key[1] = 0; pat.key[2] = 0;
+            pat.n = 0;
+        }
+        return true;
+    }
+
+    int compareAt(const Pattern &pat, const uchar *index, quint64 i) const {
+        const uchar *entry = index + i * 12;
+        for (int j = 0; j < pat.n; ++j) {
+            quint32 v = qFromLittleEndian<quint32>(entry + j * 4);
+            if (v != pat.key[j]) return (v < pat.key[j] ? -1 : 1);
+        }
+        return 0;
+    }
+
+    void range(const Pattern &pat, quint64 &lo, quint64 &hi) const {
+
+        // Find the range of entries in the pattern's index that match
+        // it, by binary search for each end
+
+        const uchar *index = m_reader.getIndex(pat.index);
+        quint64 n = m_reader.getTripleCount();
+
+        quint64 a = 0, b = n;
+        while (a < b) {
+            quint64 mid = a + (b - a) / 2;
+            if (compareAt(pat, index, mid) < 0) a = mid + 1;
+            else b = mid;
+        }
+        lo = a;
+
+        b = n;
+        while (a < b) {
+            quint64 mid = a + (b - a) / 2;
+            if (compareAt(pat, index, mid) <= 0) a = mid + 1;
+            else b = mid;
+        }
+        hi = a;
+    }
+
+    void tripleAt(Snapshot::SectionId id, quint64 i, quint32 *spo) const {
+        // Retrieve entry i of the given index in SPO order
+        const uchar *entry = m_reader.getIndex(id) + i * 12;
+        quint32 a = qFromLittleEndian<quint32>(entry);
+        quint32 b = qFromLittleEndian<quint32>(entry + 4);
+        quint32 c = qFromLittleEndian<quint32>(entry + 8);
+        switch (id) {
+        case Snapshot::POSSection: spo[0] = c; spo[1] = a; spo[2] = b; break;
+        case Snapshot::OSPSection: spo[0] = b; spo[1] = c; spo[2] = a; break;
+        default: spo[0] = a; spo[1] = b; spo[2] = c; break;
+        }
+    }
+};
+
+SnapshotStore::SnapshotStore(QString filename) :
+    m_d(new D(filename))
+{
+}
+
+SnapshotStore::~SnapshotStore()
+{
+    delete m_d;
+}
+
+Uri
+SnapshotStore::getBaseUri() const
+{
+    return m_d->getBaseUri();
+}
+
+bool
+SnapshotStore::add(Triple)
+{
+    m_d->readOnly("add");
+    return false;
+}
+
+bool
+SnapshotStore::remove(Triple)
+{
+    m_d->readOnly("remove");
+    return false;
+}
+
+int
+SnapshotStore::addAll(Triples)
+{
+    m_d->readOnly("addAll");
+    return 0;
+}
+
+int
+SnapshotStore::removeAll(Triples)
+{
+    m_d->readOnly("removeAll");
+    return 0;
+}
+
+void
+SnapshotStore::change(ChangeSet)
+{
+    m_d->readOnly("change");
+}
+
+void
+SnapshotStore::revert(ChangeSet)
+{
+    m_d->readOnly("revert");
+}
+
+bool
+SnapshotStore::contains(Triple t) const
+{
+    return m_d->contains(t);
+}
+
+Triples
+SnapshotStore::match(Triple t) const
+{
+    return m_d->match(t);
+}
+
+void
+SnapshotStore::match(Triple t, TripleVisitor visitor) const
+{
+    m_d->match(t, visitor);
+}
+
+int
+SnapshotStore::count(Triple t) const
+{
+    return m_d->count(t);
+}
+
+int
+SnapshotStore::size() const
+{
+    return m_d->size();
+}
+
+ResultSet
+SnapshotStore::query(QString sparql) const
+{
+    throw RDFUnsupportedError
+        ("SPARQL queries are not supported by SnapshotStore", sparql);
+}
+
+Node
+SnapshotStore::complete(Triple t) const
+{
+    return m_d->complete(t);
+}
+
+Triple
+SnapshotStore::matchOnce(Triple t) const
+{
+    return m_d->matchOnce(t);
+}
+
+Node
+SnapshotStore::queryOnce(QString sparql, QString) const
+{
+    throw RDFUnsupportedError
+        ("SPARQL queries are not supported by SnapshotStore", sparql);
+}
+
+Uri
+SnapshotStore::getUniqueUri(QString prefix) const
+{
+    return m_d->getUniqueUri(prefix);
+}
+
+Node
+SnapshotStore::addBlankNode()
+{
+    m_d->readOnly("addBlankNode");
+    return Node();
+}
+
+Uri
+SnapshotStore::expand(QString uri) const
+{
+    return m_d->expand(uri);
+}
+
+void
+SnapshotStore::save(QString filename) const
+{
+    m_d->save(filename);
+}
+
+void
+SnapshotStore::import(QUrl, ImportDuplicatesMode, QString)
+{
+    m_d->readOnly("import");
+}
+
+void
+SnapshotStore::importString(QString, Uri, ImportDuplicatesMode, QString)
+{
+    m_d->readOnly("importString");
+}
+
+SnapshotStore::Features
+SnapshotStore::getSupportedFeatures() const
+{
+    // Neither ModifyFeature nor QueryFeature
+    return Features();
+}
+
+}
+
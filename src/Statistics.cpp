@@ -0,0 +1,239 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#include "Statistics.h"
+#include "StatisticsCollector.h"
+
+#include <QMutexLocker>
+#include <QTextStream>
+
+#include <limits>
+
+namespace Dataquay
+{
+
+Statistics::Histogram::Histogram() :
+    m_count(0),
+    m_total(0),
+    m_max(0),
+    m_buckets(getBucketCount(), 0)
+{
+}
+
+void
+Statistics::Histogram::add(quint64 value)
+{
+    int bucket = 0;
+    for (quint64 v = value; v; v >>= 1) ++bucket;
+    ++m_buckets[bucket];
+    ++m_count;
+    m_total += value;
+    if (value > m_max) m_max = value;
+}
+
+Statistics::Histogram &
+Statistics::Histogram::operator+=(const Histogram &h)
+{
+    for (int i = 0; i < getBucketCount(); ++i) m_buckets[i] += h.m_buckets[i];
+    m_count += h.m_count;
+    m_total += h.m_total;
+    if (h.m_max > m_max) m_max = h.m_max;
+    return *this;
+}
+
+double
+Statistics::Histogram::getMean() const
+{
+    if (m_count == 0) return 0.0;
+    return double(m_total) / double(m_count);
+}
+
+quint64
+Statistics::Histogram::getPercentile(double fraction) const
+{
+    if (m_count == 0) return 0;
+    quint64 rank = quint64(fraction * double(m_count));
+    if (rank >= m_count) rank = m_count - 1;
+    quint64 seen = 0;
+    for (int i = 0; i < getBucketCount(); ++i) {
+        seen += m_buckets[i];
+        if (seen > rank) return qMin(getBucketLimit(i), m_max);
+    }
+    return m_max;
+}
+
+quint64
+Statistics::Histogram::getBucketLimit(int i)
+{
+    if (i + 1 >= getBucketCount()) return std::numeric_limits<quint64>::max();
+    return quint64(1) << i;
+}
+
+Statistics::Statistics()
+{
+}
+
+QStringList
+Statistics::getOperations() const
+{
+    return m_operations.keys();
+}
+
+quint64
+Statistics::getOperationCount(QString operation) const
+{
+    return m_operations.value(operation, 0);
+}
+
+QStringList
+Statistics::getTimings() const
+{
+    return m_timings.keys();
+}
+
+Statistics::Histogram
+Statistics::getTiming(QString name) const
+{
+    return m_timings.value(name);
+}
+
+QStringList
+Statistics::getSizes() const
+{
+    return m_sizes.keys();
+}
+
+Statistics::Histogram
+Statistics::getSize(QString name) const
+{
+    return m_sizes.value(name);
+}
+
+QString
+Statistics::toString() const
+{
+    QString s;
+    QTextStream out(&s);
+    foreach (QString op, m_operations.keys()) {
+        out << op << ": " << m_operations[op] << "\n";
+    }
+    foreach (QString name, m_timings.keys()) {
+        const Histogram &h = m_timings[name];
+        out << name << ": " << h.getCount() << " in " << h.getTotal() / 1000
+            << "us, mean " << h.getMean() / 1000.0
+            << "us, p50 " << h.getPercentile(0.5) / 1000
+            << "us, p99 " << h.getPercentile(0.99) / 1000
+            << "us, max " << h.getMax() / 1000 << "us\n";
+    }
+    foreach (QString name, m_sizes.keys()) {
+        const Histogram &h = m_sizes[name];
+        out << name << ": " << h.getCount() << " of mean size "
+            << h.getMean() << ", max " << h.getMax() << "\n";
+    }
+    out.flush();
+    return s;
+}
+
+void
+StatisticsCollector::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    m_operations.clear();
+    m_timings.clear();
+    m_sizes.clear();
+    m_lockWaits.clear();
+    m_lockHolds.clear();
+}
+
+Statistics
+StatisticsCollector::getStatistics() const
+{
+    // The same name may appear under more than one address, if it was
+    // given in more than one translation unit
+    QMutexLocker locker(&m_mutex);
+    Statistics s;
+    for (QHash<const char *, quint64>::const_iterator i =
+             m_operations.begin(); i != m_operations.end(); ++i) {
+        s.m_operations[QString::fromLatin1(i.key())] += i.value();
+    }
+    for (QHash<const char *, Statistics::Histogram>::const_iterator i =
+             m_timings.begin(); i != m_timings.end(); ++i) {
+        s.m_timings[QString::fromLatin1(i.key())] += i.value();
+    }
+    for (QHash<const char *, Statistics::Histogram>::const_iterator i =
+             m_sizes.begin(); i != m_sizes.end(); ++i) {
+        s.m_sizes[QString::fromLatin1(i.key())] += i.value();
+    }
+    for (QHash<const char *, Statistics::Histogram>::const_iterator i =
+             m_lockWaits.begin(); i != m_lockWaits.end(); ++i) {
+        s.m_timings[QString::fromLatin1(i.key()) + " wait"] += i.value();
+    }
+    for (QHash<const char *, Statistics::Histogram>::const_iterator i =
+             m_lockHolds.begin(); i != m_lockHolds.end(); ++i) {
+        s.m_timings[QString::fromLatin1(i.key()) + " hold"] += i.value();
+    }
+    return s;
+}
+
+void
+StatisticsCollector::countOperation(const char *operation)
+{
+    QMutexLocker locker(&m_mutex);
+    ++m_operations[operation];
+}
+
+void
+StatisticsCollector::addTiming(const char *name, qint64 ns)
+{
+    QMutexLocker locker(&m_mutex);
+    m_timings[name].add(quint64(qMax(qint64(0), ns)));
+}
+
+void
+StatisticsCollector::addSize(const char *name, quint64 size)
+{
+    QMutexLocker locker(&m_mutex);
+    m_sizes[name].add(size);
+}
+
+void
+StatisticsCollector::addLockTimes(const char *lock, qint64 waitNs, qint64 holdNs)
+{
+    QMutexLocker locker(&m_mutex);
+    m_lockWaits[lock].add(quint64(qMax(qint64(0), waitNs)));
+    m_lockHolds[lock].add(quint64(qMax(qint64(0), holdNs)));
+}
+
+}
+
@@ -0,0 +1,222 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef DATAQUAY_INTERNAL_STATISTICS_COLLECTOR_H
+#define DATAQUAY_INTERNAL_STATISTICS_COLLECTOR_H
+
+#include "Statistics.h"
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QReadWriteLock>
+
+namespace Dataquay
+{
+
+/**
+ * Gathers the statistics of a single store, for
+ * BasicStore::getStatistics and TransactionalStore::getStatistics.
+ *
+ * Collection is off until enabled.  While it is off, each of the
+ * classes below costs one atomic load and a test, and the record
+ * functions must not be called.  While it is on, each record takes
+ * the collector's own mutex briefly.
+ *
+ * Names are string literals, and are keyed by address until a
+ * snapshot is taken.
+ */
+class StatisticsCollector
+{
+public:
+    StatisticsCollector() : m_enabled(0) { }
+
+    void setEnabled(bool enabled) { m_enabled.storeRelease(enabled ? 1 : 0); }
+    bool isEnabled() const { return m_enabled.loadAcquire() != 0; }
+
+    void reset();
+    Statistics getStatistics() const;
+
+    void countOperation(const char *operation);
+    void addTiming(const char *name, qint64 ns);
+    void addSize(const char *name, quint64 size);
+    void addLockTimes(const char *lock, qint64 waitNs, qint64 holdNs);
+
+    /**
+     * Counts an operation and records how long it takes, from
+     * construction to destruction, and optionally its size (such as
+     * the number of triples it was given) under the same name.
+     */
+    class Operation
+    {
+    public:
+        Operation(StatisticsCollector &s, const char *operation) :
+            m_s(s.isEnabled() ? &s : 0), m_operation(operation) {
+            if (m_s) {
+                m_s->countOperation(m_operation);
+                m_timer.start();
+            }
+        }
+        Operation(StatisticsCollector &s, const char *operation,
+                  quint64 size) :
+            m_s(s.isEnabled() ? &s : 0), m_operation(operation) {
+            if (m_s) {
+                m_s->countOperation(m_operation);
+                m_s->addSize(m_operation, size);
+                m_timer.start();
+            }
+        }
+        ~Operation() {
+            if (m_s) m_s->addTiming(m_operation, m_timer.nsecsElapsed());
+        }
+    private:
+        StatisticsCollector *m_s;
+        const char *m_operation;
+        QElapsedTimer m_timer;
+        Operation(const Operation &);
+        Operation &operator=(const Operation &);
+    };
+
+    /**
+     * Base for the timed lockers: records how long the lock took to
+     * obtain and how long it was then held.
+     */
+    class LockTimer
+    {
+    protected:
+        LockTimer(StatisticsCollector &s, const char *lock) :
+            m_s(s.isEnabled() ? &s : 0), m_lock(lock), m_wait(0) {
+            if (m_s) m_timer.start();
+        }
+        void locked() {
+            if (m_s) m_wait = m_timer.nsecsElapsed();
+        }
+        qint64 held() const {
+            return m_s ? m_timer.nsecsElapsed() - m_wait : 0;
+        }
+        void unlocked(qint64 hold) {
+            // after the lock is released, so as not to count our own
+            // bookkeeping as time held
+            if (m_s) m_s->addLockTimes(m_lock, m_wait, hold);
+        }
+    private:
+        StatisticsCollector *m_s;
+        const char *m_lock;
+        QElapsedTimer m_timer;
+        qint64 m_wait;
+    };
+
+    /**
+     * As QReadLocker, timing the lock under the given name.
+     */
+    class ReadLocker : public LockTimer
+    {
+    public:
+        ReadLocker(QReadWriteLock *lock, StatisticsCollector &s,
+                   const char *name) :
+            LockTimer(s, name), m_rwlock(lock) {
+            m_rwlock->lockForRead();
+            locked();
+        }
+        ~ReadLocker() {
+            qint64 hold = held();
+            m_rwlock->unlock();
+            unlocked(hold);
+        }
+    private:
+        QReadWriteLock *m_rwlock;
+        ReadLocker(const ReadLocker &);
+        ReadLocker &operator=(const ReadLocker &);
+    };
+
+    /**
+     * As QWriteLocker, timing the lock under the given name.
+     */
+    class WriteLocker : public LockTimer
+    {
+    public:
+        WriteLocker(QReadWriteLock *lock, StatisticsCollector &s,
+                    const char *name) :
+            LockTimer(s, name), m_rwlock(lock) {
+            m_rwlock->lockForWrite();
+            locked();
+        }
+        ~WriteLocker() {
+            qint64 hold = held();
+            m_rwlock->unlock();
+            unlocked(hold);
+        }
+    private:
+        QReadWriteLock *m_rwlock;
+        WriteLocker(const WriteLocker &);
+        WriteLocker &operator=(const WriteLocker &);
+    };
+
+    /**
+     * As QMutexLocker, timing the mutex under the given name.
+     */
+    class MutexLocker : public LockTimer
+    {
+    public:
+        MutexLocker(QMutex *mutex, StatisticsCollector &s,
+                    const char *name) :
+            LockTimer(s, name), m_mutex(mutex) {
+            m_mutex->lock();
+            locked();
+        }
+        ~MutexLocker() {
+            qint64 hold = held();
+            m_mutex->unlock();
+            unlocked(hold);
+        }
+    private:
+        QMutex *m_mutex;
+        MutexLocker(const MutexLocker &);
+        MutexLocker &operator=(const MutexLocker &);
+    };
+
+private:
+    QAtomicInt m_enabled;
+    mutable QMutex m_mutex;
+    QHash<const char *, quint64> m_operations;
+    QHash<const char *, Statistics::Histogram> m_timings;
+    QHash<const char *, Statistics::Histogram> m_sizes;
+    QHash<const char *, Statistics::Histogram> m_lockWaits;
+    QHash<const char *, Statistics::Histogram> m_lockHolds;
+};
+
+}
+
+#endif
@@ -33,13 +33,28 @@
 
 #include "TransactionalStore.h"
 #include "BasicStore.h"
+#include "ChangeJournal.h"
+#include "ChangeSubscription.h"
 #include "RDFException.h"
 #include "Debug.h"
+#include "StatisticsCollector.h"
 
 #include <QMutex>
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+#include <QRecursiveMutex>
+#endif
 #include <QMutexLocker>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QMultiMap>
+#include <QThread>
+#include <QMultiHash>
+#include <QQueue>
+#include <QWaitCondition>
+#include <QFutureInterface>
 
 #include <iostream>
+#include <exception> // exception_ptr
 #include <memory> // unique_ptr
 
 using std::unique_ptr;
@@ -50,158 +65,873 @@ namespace Dataquay
 class TransactionalStore::D
 {
     /**
-     * Current store context.
+     * A set of triples indexed by each of their nodes, so that the
+     * triples matching a pattern can be found without looking at all
+     * of them.
+     */
+    class TripleSet
+    {
+    public:
+        bool contains(const Triple &t) const {
+            return m_triples.contains(t);
+        }
+
+        bool insert(const Triple &t) {
+            if (m_triples.contains(t)) return false;
+            m_triples.insert(t);
+            for (int i = 0; i < 3; ++i) m_index[i].insert(node(t, i), t);
+            return true;
+        }
+
+        bool remove(const Triple &t) {
+            if (!m_triples.remove(t)) return false;
+            for (int i = 0; i < 3; ++i) m_index[i].remove(node(t, i), t);
+            return true;
+        }
+
+        int size() const {
+            return m_triples.size();
+        }
+
+        QList<Triple> triples() const {
+            return m_triples.values();
+        }
+
+        void clear() {
+            m_triples.clear();
+            for (int i = 0; i < 3; ++i) m_index[i].clear();
+        }
+
+        // Call visitor for each triple matching the given pattern, as
+        // Store::match; return false if the visitor stopped early
+        bool match(const Triple &pattern, TripleVisitor visitor) const {
+            int best = -1;
+            int bestCount = 0;
+            for (int i = 0; i < 3; ++i) {
+                const Node &n = node(pattern, i);
+                if (n.type == Node::Nothing) continue;
+                int count = m_index[i].count(n);
+                if (best < 0 || count < bestCount) {
+                    best = i;
+                    bestCount = count;
+                }
+            }
+            if (best < 0) {
+                foreach (const Triple &t, m_triples.values()) {
+                    if (!visitor(t)) return false;
+                }
+                return true;
+            }
+            // Copy the candidates, as the visitor may change this set
+            QList<Triple> candidates = m_index[best].values(node(pattern, best));
+            foreach (const Triple &t, candidates) {
+                if (matches(pattern, t) && !visitor(t)) return false;
+            }
+            return true;
+        }
+
+        int count(const Triple &pattern) const {
+            int n = 0;
+            match(pattern, [&](const Triple &) { ++n; return true; });
+            return n;
+        }
+
+        bool mentions(const Node &n) const {
+            for (int i = 0; i < 3; ++i) {
+                if (m_index[i].contains(n)) return true;
+            }
+            return false;
+        }
+
+        static bool matches(const Triple &pattern, const Triple &t) {
+            for (int i = 0; i < 3; ++i) {
+                const Node &n = node(pattern, i);
+                if (n.type != Node::Nothing && n != node(t, i)) return false;
+            }
+            return true;
+        }
+
+    private:
+        QSet<Triple> m_triples;
+        QMultiHash<Node, Triple> m_index[3];
+
+        static const Node &node(const Triple &t, int i) {
+            return i == 0 ? t.a : i == 1 ? t.b : t.c;
+        }
+    };
+
+    /**
+     * The triple patterns that a transaction has read from, or
+     * written to, the store, so that the changes committed by other
+     * transactions since it began can be checked against them.
+     */
+    class PatternSet
+    {
+    public:
+        PatternSet() : m_all(false) { }
+
+        void insert(const Triple &pattern) {
+            if (m_all) return;
+            int wild = 0;
+            if (pattern.a.type == Node::Nothing) ++wild;
+            if (pattern.b.type == Node::Nothing) ++wild;
+            if (pattern.c.type == Node::Nothing) ++wild;
+            if (wild == 3) {
+                m_all = true;
+                m_exact.clear();
+                m_wild.clear();
+            } else if (wild > 0) {
+                m_wild.insert(pattern);
+            } else {
+                m_exact.insert(pattern);
+            }
+        }
+
+        bool matches(const Triple &t) const {
+            if (m_all || m_exact.contains(t)) return true;
+            foreach (const Triple &pattern, m_wild) {
+                if (TripleSet::matches(pattern, t)) return true;
+            }
+            return false;
+        }
+
+        void clear() {
+            m_all = false;
+            m_exact.clear();
+            m_wild.clear();
+        }
+
+    private:
+        bool m_all;
+        QSet<Triple> m_exact;
+        QSet<Triple> m_wild;
+    };
+
+    /**
+     * A triple changed by a committed transaction, with the store
+     * version that commit produced.
+     */
+    struct Committed
+    {
+        quint64 version;
+        QList<Triple> triples;
+    };
+
+    /**
+     * Delivers the results of commitAsync on a thread of its own.
+     * For each commit, in commit order, it waits for the write-ahead
+     * log to be synced (if there is one), completes the commit's
+     * future, and then notifies listeners in turn (see
+     * notifyInTurn).
+     */
+    class Notifier : public QThread
+    {
+    public:
+        struct Job
+        {
+            quint64 entry; // in the log, or 0 if already complete
+            quint64 ticket; // for notifyInTurn
+            ChangeSet changes;
+            QFutureInterface<bool> result;
+        };
+
+        Notifier(D *d) : m_d(d), m_exiting(false) { }
+
+        ~Notifier() {
+            // Finish any jobs already queued before exiting
+            {
+                QMutexLocker locker(&m_mutex);
+                m_exiting = true;
+                m_queued.wakeAll();
+            }
+            wait();
+        }
+
+        void enqueue(const Job &job) {
+            QMutexLocker locker(&m_mutex);
+            m_queue.enqueue(job);
+            m_queued.wakeAll();
+        }
+
+    protected:
+        void run() {
+            QMutexLocker locker(&m_mutex);
+            while (true) {
+                if (m_queue.empty()) {
+                    if (m_exiting) break;
+                    m_queued.wait(&m_mutex);
+                    continue;
+                }
+                Job job = m_queue.dequeue();
+                locker.unlock();
+                m_d->deliver(job);
+                locker.relock();
+            }
+        }
+
+    private:
+        D *m_d;
+        QMutex m_mutex;
+        QWaitCondition m_queued;
+        QQueue<Job> m_queue;
+        bool m_exiting;
+    };
+
+public:
+    /**
+     * The state of a single transaction: its changes, not yet in the
+     * store, and the patterns it has read.  Owned by its
+     * TSTransaction.
      *
-     * TxContext: changes pending for the transaction are present in the
-     * store (committing the transaction would be a no-op;
-     * non-transactional queries would return incorrect results).
+     * Any number of threads may work in one transaction at once.  The
+     * transactional operations below each take mutex, after taking
+     * m_storeLock for reading, while they use the overlay and change
+     * list.  Anything holding m_storeLock for writing excludes them
+     * all, and so may read those without it.
      *
-     * NonTxContext: changes pending for the transaction are absent from
-     * the store (store is ready for non-transactional queries;
-     * committing the transaction would require reapplying changes).
+     * A read-only transaction uses the same overlay to keep its view
+     * of the store as it was when it began: each commit since then
+     * puts the triples it added into removed, and those it removed
+     * into added (see pin()).
+     */
+    struct Pending
+    {
+        Pending() : finished(false) { }
+
+        // Triples added that are not in the store, and triples
+        // removed that are
+        TripleSet added;
+        TripleSet removed;
+        PatternSet reads;
+        ChangeSet changes; // in the order they were made
+        QList<int> savepoints; // each an index into changes
+        QElapsedTimer timer; // started only if statistics are enabled
+        QMutex mutex; // not recursive: a match visitor may not call back
+        quint64 version; // of the store when the transaction began
+        QThread *thread; // that started the transaction
+        bool readOnly;
+        bool finished; // set, with mutex held, once committing or rolled back
+    };
+
+    /**
+     * Holds a transaction's mutex, having checked that the
+     * transaction is still in train: another thread sharing it may
+     * have committed it or rolled it back meanwhile, and any change
+     * made after that would be lost.
+     */
+    class PendingLocker
+    {
+    public:
+        PendingLocker(Pending *p) : m_locker(&p->mutex) {
+            if (p->finished) {
+                throw RDFTransactionError("Transaction used after being committed or rolled back");
+            }
+        }
+    private:
+        QMutexLocker m_locker;
+    };
+
+    /**
+     * A transaction on its way to being committed, perhaps as one of
+     * a group (see commitGrouped).
      */
-    enum Context { TxContext, NonTxContext };
+    struct Commit
+    {
+        Commit(Pending *p_, QFutureInterface<bool> *async_) :
+            p(p_), async(async_), entry(0), ticket(0),
+            outcome(Waiting), done(false) { }
+
+        Pending *p;
+        ChangeSet cs; // taken from p as it is committed
+        QFutureInterface<bool> *async;
+        ChangeSet net;
+        quint64 entry; // in the log, if any
+        quint64 ticket; // for notifyInTurn, if committed
+        enum { Waiting, Succeeded, Conflicted, Failed } outcome;
+        QString error;
+        bool done; // protected by m_groupMutex
+    };
 
-public:
-    D(TransactionalStore *ts, Store *store, DirectWriteBehaviour dwb) :
+    D(TransactionalStore *ts, Store *store, ChangeJournal *log,
+      DirectWriteBehaviour dwb) :
         m_ts(ts),
         m_store(store),
+        m_basicStore(dynamic_cast<BasicStore *>(store)),
+        m_log(log),
         m_dwb(dwb),
-        m_currentTx(NoTransaction),
-        m_context(NonTxContext) {
+        m_storeLock(QReadWriteLock::Recursive),
+        m_version(0),
+        m_notifier(0),
+        m_notifyIssued(0),
+        m_notifyDelivered(0),
+        m_notifyThread(0),
+#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
+        m_subscriptionMutex(QMutex::Recursive),
+#endif
+        m_groupCommit(false),
+        m_groupLeader(false) {
+        // Needed for queued delivery of transactionCommitted from the
+        // notifier thread
+        qRegisterMetaType<ChangeSet>("ChangeSet");
+        qRegisterMetaType<ChangeSet>("Dataquay::ChangeSet");
+        if (m_log) {
+            DQ_DEBUG << "TransactionalStore: Recovering from write-ahead log ("
+                     << m_log->getEntryCount() << " entries)" << endl;
+            m_log->replay(m_store);
+        }
     }
     
     ~D() {
-        if (m_currentTx != NoTransaction) {
+        delete m_notifier;
+        if (!m_active.empty()) {
             std::cerr << "WARNING: TransactionalStore deleted with transaction ongoing" << std::endl;
         }
     }
 
     Transaction *startTransaction() {
-        QMutexLocker locker(&m_mutex);
+        return new TSTransaction(this);
+    }
+
+    const Transaction *startReadOnlyTransaction() {
+        return new TSTransaction(this, true);
+    }
+
+    Pending *beginTransaction() {
+        StatisticsCollector::Operation op(m_stats, "start");
+        StatisticsCollector::MutexLocker locker(&m_mutex, m_stats,
+                                                "transaction mutex");
         DQ_DEBUG << "TransactionalStore::startTransaction" << endl;
-        if (m_currentTx != NoTransaction) {
+        QThread *thread = QThread::currentThread();
+        if (m_threads.contains(thread)) {
             throw RDFTransactionError("ERROR: Attempt to start transaction when another transaction from the same thread is already in train");
         }
-        Transaction *tx = new TSTransaction(this);
-        m_currentTx = tx;
-        return tx;
+        Pending *p = new Pending;
+        p->version = m_version;
+        p->thread = thread;
+        p->readOnly = false;
+        if (m_stats.isEnabled()) p->timer.start();
+        m_threads.insert(thread);
+        m_active.insert(p->version, p);
+        return p;
     }
 
-    void commitTransaction(Transaction *tx) {
-        ChangeSet cs;
-        {
-            QMutexLocker locker(&m_mutex);
-            DQ_DEBUG << "TransactionalStore::commitTransaction" << endl;
-            if (tx != m_currentTx) {
-                throw RDFInternalError("Transaction integrity error");
-            }
-            enterTransactionContext();
-            cs = m_currentTx->getChanges();
-            // The store is now in transaction context, which means
-            // its changes have been committed; resetting m_currentTx
-            // now ensures they will remain committed.  Reset
-            // m_context as well for symmetry with the initial state
-            // in the constructor, though it shouldn't be necessary
-            m_currentTx = NoTransaction;
-            m_context = NonTxContext;
+    Pending *beginReadOnlyTransaction() {
+        // Needs nothing more than a place in m_readers, so that
+        // subsequent commits can keep its view where it is
+        StatisticsCollector::Operation op(m_stats, "startReadOnly");
+        StatisticsCollector::MutexLocker locker(&m_mutex, m_stats,
+                                                "transaction mutex");
+        DQ_DEBUG << "TransactionalStore::startReadOnlyTransaction" << endl;
+        Pending *p = new Pending;
+        p->version = m_version;
+        p->thread = 0;
+        p->readOnly = true;
+        if (m_stats.isEnabled()) p->timer.start();
+        m_readers.insert(p);
+        return p;
+    }
+
+    // If async is given, commitTransaction returns once the changes
+    // have been applied, and leaves the notifier to sync the log,
+    // complete async and notify listeners
+
+    void commitTransaction(Pending *p, bool &committed,
+                           QFutureInterface<bool> *async = 0) {
+        DQ_DEBUG << "TransactionalStore::commitTransaction" << endl;
+        StatisticsCollector::Operation op(m_stats, "commit");
+        Commit c(p, async);
+        if (getGroupCommit()) {
+            commitGrouped(c);
+        } else {
+            QList<Commit *> single;
+            single.push_back(&c);
+            applyCommits(single);
+        }
+        switch (c.outcome) {
+        case Commit::Conflicted:
+            if (m_stats.isEnabled()) m_stats.countOperation("conflict");
+            throw RDFTransactionConflict("Transaction conflicts with another transaction committed since it began");
+        case Commit::Failed:
+            throw RDFTransactionError(c.error);
+        default:
+            break;
+        }
+        committed = true;
+        const ChangeSet &cs = c.cs;
+        if (m_stats.isEnabled()) m_stats.addSize("commit", cs.size());
+        if (async) return;
+        if (c.entry) {
+            // Wait for the log to reach the disc only after releasing
+            // the mutex, so that other transactions may proceed and
+            // commit meanwhile and share the same sync.  The changes
+            // are in the store even if the sync fails, so listeners
+            // must hear of them either way, as they would from
+            // deliver()
+            try {
+                m_log->sync(c.entry);
+            } catch (const RDFException &) {
+                notifyInTurn(c.ticket, cs);
+                throw;
+            }
         }
         DQ_DEBUG << "TransactionalStore::commitTransaction: committed " << cs.size() << " change(s)" << endl;
+        notifyInTurn(c.ticket, cs);
+        DQ_DEBUG << "TransactionalStore::commitTransaction complete" << endl;
+    }
+
+    void notifyInTurn(quint64 ticket, const ChangeSet &cs) {
+        // Listeners must hear of commits in the order they were
+        // made, whichever threads they were made on, and however
+        // long each took to sync: a LiveMatch told of an add after
+        // the remove that followed it would be wrong for good.  So
+        // each commit waits for those with earlier tickets to be
+        // notified before notifying of its own
+        QMutexLocker locker(&m_notifyMutex);
+        if (m_notifyThread == QThread::currentThread()) {
+            // Committed by a listener called from this thread, which
+            // must finish hearing of the earlier commit first.  We
+            // can't wait for that, so leave it to whichever thread
+            // notifies of the ticket before it
+            m_handedOff[ticket] = cs;
+            return;
+        }
+        while (m_notifyDelivered + 1 != ticket) {
+            m_notifyTurn.wait(&m_notifyMutex);
+        }
+        ChangeSet next = cs;
+        std::exception_ptr failure;
+        while (true) {
+            m_notifyThread = QThread::currentThread();
+            locker.unlock();
+            try {
+                notify(next);
+            } catch (...) {
+                // A listener threw.  The commit is still made, and
+                // later ones must not wait for this one for ever, so
+                // carry on as if it had returned and pass the first
+                // exception on to our caller once we're done
+                if (!failure) failure = std::current_exception();
+            }
+            locker.relock();
+            m_notifyThread = 0;
+            ++m_notifyDelivered;
+            if (!m_handedOff.contains(m_notifyDelivered + 1)) break;
+            next = m_handedOff.take(m_notifyDelivered + 1);
+        }
+        m_notifyTurn.wakeAll();
+        locker.unlock();
+        if (failure) std::rethrow_exception(failure);
+    }
+
+    void setGroupCommit(bool group) {
+        QMutexLocker locker(&m_groupMutex);
+        m_groupCommit = group;
+    }
+
+    bool getGroupCommit() const {
+        QMutexLocker locker(&m_groupMutex);
+        return m_groupCommit;
+    }
+
+    void compact() {
+        StatisticsCollector::Operation op(m_stats, "compact");
+        if (!m_log) {
+            throw RDFException("TransactionalStore has no write-ahead log to compact");
+        }
+        if (!m_basicStore) {
+            throw RDFException("Cannot compact write-ahead log: underlying store is not a BasicStore");
+        }
+        // The snapshot must hold exactly what the log does.  Holding
+        // m_mutex keeps commits from appending to the log or
+        // changing the store meanwhile, and m_storeLock keeps out
+        // Applied, which puts uncommitted changes into the store
+        StatisticsCollector::MutexLocker locker(&m_mutex, m_stats,
+                                                "transaction mutex");
+        StatisticsCollector::ReadLocker slocker(&m_storeLock, m_stats,
+                                                "store read");
+        m_log->compact(m_basicStore);
+    }
+
+    void deliver(Notifier::Job &job) {
+        // Called on the notifier thread
+        if (job.entry) {
+            bool synced = true;
+            try {
+                m_log->sync(job.entry);
+            } catch (const RDFException &e) {
+                std::cerr << "WARNING: TransactionalStore: Failed to sync write-ahead log: " << e.what() << std::endl;
+                synced = false;
+            }
+            job.result.reportResult(synced);
+            job.result.reportFinished();
+        }
+        DQ_DEBUG << "TransactionalStore: notifying of " << job.changes.size() << " change(s)" << endl;
+        try {
+            notifyInTurn(job.ticket, job.changes);
+        } catch (const std::exception &e) {
+            // Nobody to pass it on to from this thread
+            std::cerr << "WARNING: TransactionalStore: Exception thrown by listener to asynchronous commit: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "WARNING: TransactionalStore: Exception thrown by listener to asynchronous commit" << std::endl;
+        }
+    }
+
+    void notify(const ChangeSet &cs) {
+        if (!cs.empty()) notifySubscriptions(cs);
         m_ts->transactionCommitted(cs);
         m_ts->transactionCommitted();
-        DQ_DEBUG << "TransactionalStore::commitTransaction complete" << endl;
     }
 
-    void rollbackTransaction(Transaction *tx) {
-        QMutexLocker locker(&m_mutex);
+    void subscribe(ChangeSubscription *s) {
+        QMutexLocker locker(&m_subscriptionMutex);
+        int i = subscriptionIndex(s->getPattern());
+        if (i < 0) m_wildSubscriptions.push_back(s);
+        else m_subscriptionIndex[i].insert(node(s->getPattern(), i), s);
+        m_subscriptions.insert(s);
+    }
+
+    void unsubscribe(ChangeSubscription *s) {
+        QMutexLocker locker(&m_subscriptionMutex);
+        int i = subscriptionIndex(s->getPattern());
+        if (i < 0) m_wildSubscriptions.removeAll(s);
+        else m_subscriptionIndex[i].remove(node(s->getPattern(), i), s);
+        m_subscriptions.remove(s);
+    }
+
+    QList<ChangeSubscription *> getSubscriptions() const {
+        QMutexLocker locker(&m_subscriptionMutex);
+        return m_subscriptions.values();
+    }
+
+    void rollbackTransaction(Pending *p) {
+        StatisticsCollector::Operation op(m_stats, "rollback");
+        StatisticsCollector::MutexLocker locker(&m_mutex, m_stats,
+                                                "transaction mutex");
         DQ_DEBUG << "TransactionalStore::rollbackTransaction" << endl;
-        if (tx != m_currentTx) {
-            throw RDFInternalError("Transaction integrity error");
-        }
-        leaveTransactionContext();
-        // The store is now in non-transaction context, which means
-        // the transaction's changes are uncommitted
-        m_currentTx = NoTransaction;
+        // The transaction's changes were never made to the store, so
+        // there is nothing to undo
+        endTransaction(p);
         DQ_DEBUG << "TransactionalStore::rollbackTransaction complete" << endl;
     }
 
-    class Operation
+    /**
+     * Held by the containing TransactionalStore while it carries out
+     * a non-transactional read access.  The store holds only
+     * committed changes, so the read can go straight to it; the lock
+     * only keeps out the brief periods in which a transaction's
+     * changes are applied to the store (see Applied and
+     * applyCommits).
+     */
+    class NonTransactionalAccess
     {
     public:
-        Operation(const D *d, const Transaction *tx) :
-            m_d(d), m_tx(tx) {
-            m_d->startOperation(m_tx);
-        }
-        ~Operation() {
-            m_d->endOperation(m_tx);
+        NonTransactionalAccess(D *d, const char *operation) :
+            m_op(d->m_stats, operation),
+            m_locker(&d->m_storeLock, d->m_stats, "store read") {
         }
     private:
-        const D *m_d;
-        const Transaction *m_tx;
+        StatisticsCollector::Operation m_op;
+        StatisticsCollector::ReadLocker m_locker;
     };
 
-    class NonTransactionalAccess
-    {
-    public:
-        NonTransactionalAccess(D *d) :
-            m_d(d) {
-            m_d->startNonTransactionalAccess();
+    // The transactional operations below work on a transaction's view
+    // of the store: the store itself, which holds only committed
+    // changes, overlaid with the transaction's own pending changes.
+    // Each takes the store lock for reading only, so transactions
+    // (and non-transactional readers) proceed in parallel, and a
+    // transaction's reads may see the commits of others as they
+    // happen -- but see conflicts().  Each also takes the
+    // transaction's own mutex, so that threads sharing a transaction
+    // see one another's changes whole and record them in order
+
+    bool add(Pending *p, Triple t) {
+        StatisticsCollector::Operation op(m_stats, "transaction add");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        checkComplete(t, "add");
+        bool stored = m_store->contains(t);
+        PendingLocker plocker(p);
+        if (!doAdd(p, t, stored)) return false;
+        p->changes.push_back(Change(AddTriple, t));
+        return true;
+    }
+
+    bool remove(Pending *p, Triple t) {
+        StatisticsCollector::Operation op(m_stats, "transaction remove");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        // If some nodes are null, we need to remove all matching
+        // triples -- we need to do that here instead of relying on
+        // the underlying store (which does the same thing) because we
+        // can't push the incomplete statement onto the change set
+        Triples tt;
+        if (t.a.type == Node::Nothing || 
+            t.b.type == Node::Nothing ||
+            t.c.type == Node::Nothing) {
+            doMatch(p, t, [&](const Triple &m) { tt.push_back(m); return true; });
+        } else {
+            tt.push_back(t);
         }
-        ~NonTransactionalAccess() {
-            m_d->endNonTransactionalAccess();
+        bool found = false;
+        foreach (const Triple &r, tt) {
+            if (doRemove(p, r)) {
+                p->changes.push_back(Change(RemoveTriple, r));
+                found = true;
+            }
         }
-    private:
-        D *m_d;
-    };
+        return found;
+    }
+
+    int addAll(Pending *p, Triples ts) {
+        StatisticsCollector::Operation op(m_stats, "transaction addAll",
+                                          ts.size());
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        foreach (Triple t, ts) checkComplete(t, "add");
+        // Look the triples up in the store before taking the
+        // transaction's own lock, so that threads adding to the same
+        // transaction do most of their work in parallel
+        QList<bool> stored = storeContains(ts);
+        PendingLocker plocker(p);
+        int n = 0;
+        for (int i = 0; i < ts.size(); ++i) {
+            if (doAdd(p, ts[i], stored[i])) {
+                p->changes.push_back(Change(AddTriple, ts[i]));
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    int removeAll(Pending *p, Triples ts) {
+        StatisticsCollector::Operation op(m_stats, "transaction removeAll",
+                                          ts.size());
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        foreach (Triple t, ts) checkComplete(t, "remove");
+        QList<bool> stored = storeContains(ts);
+        PendingLocker plocker(p);
+        int n = 0;
+        for (int i = 0; i < ts.size(); ++i) {
+            if (doRemove(p, ts[i], stored[i])) {
+                p->changes.push_back(Change(RemoveTriple, ts[i]));
+                ++n;
+            }
+        }
+        return n;
+    }
 
-    bool add(Transaction *tx, Triple t) {
-        Operation op(this, tx);
-        return m_store->add(t);
+    void change(Pending *p, ChangeSet cs) {
+        StatisticsCollector::Operation op(m_stats, "transaction change",
+                                          cs.size());
+        // Atomic, as Store::change
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        int i = 0;
+        try {
+            for (i = 0; i < cs.size(); ++i) {
+                Triple triple = cs[i].second;
+                if (cs[i].first == AddTriple) {
+                    if (!doAdd(p, triple)) {
+                        throw RDFException("Change add failed: triple is already in store", triple);
+                    }
+                } else {
+                    if (!doRemove(p, triple)) {
+                        throw RDFException("Change remove failed: triple is not in store", triple);
+                    }
+                }
+            }
+        } catch (const RDFException &) {
+            while (--i >= 0) {
+                if (cs[i].first == AddTriple) doRemove(p, cs[i].second);
+                else doAdd(p, cs[i].second);
+            }
+            throw;
+        }
+        p->changes += cs;
     }
 
-    bool remove(Transaction *tx, Triple t) {
-        Operation op(this, tx);
-        return m_store->remove(t);
+    void revert(Pending *p, ChangeSet cs) {
+        StatisticsCollector::Operation op(m_stats, "transaction revert",
+                                          cs.size());
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        int i = cs.size() - 1;
+        try {
+            for (i = cs.size() - 1; i >= 0; --i) {
+                Triple triple = cs[i].second;
+                if (cs[i].first == AddTriple) {
+                    if (!doRemove(p, triple)) {
+                        throw RDFException("Revert of add failed: triple is not in store", triple);
+                    }
+                } else {
+                    if (!doAdd(p, triple)) {
+                        throw RDFException("Revert of remove failed: triple is already in store", triple);
+                    }
+                }
+            }
+        } catch (const RDFException &) {
+            while (++i < cs.size()) {
+                if (cs[i].first == AddTriple) doAdd(p, cs[i].second);
+                else doRemove(p, cs[i].second);
+            }
+            throw;
+        }
+        for (i = cs.size() - 1; i >= 0; --i) {
+            p->changes.push_back
+                (Change(cs[i].first == AddTriple ? RemoveTriple : AddTriple,
+                        cs[i].second));
+        }
     }
 
-    bool contains(const Transaction *tx, Triple t) const {
-        Operation op(this, tx);
-        return m_store->contains(t);
+    int savepoint(Pending *p) {
+        PendingLocker plocker(p);
+        p->savepoints.push_back(p->changes.size());
+        return p->savepoints.size() - 1;
     }
 
-    Triples match(const Transaction *tx, Triple t) const {
-        Operation op(this, tx);
-        return m_store->match(t);
+    void rollbackTo(Pending *p, int savepoint) {
+        StatisticsCollector::Operation op(m_stats, "transaction rollbackTo");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        if (savepoint < 0 || savepoint >= p->savepoints.size()) {
+            throw RDFTransactionError
+                (QString("Unknown savepoint %1 (there are %2 savepoints)")
+                 .arg(savepoint).arg(p->savepoints.size()));
+        }
+        int mark = p->savepoints[savepoint];
+        while (p->savepoints.size() > savepoint + 1) {
+            p->savepoints.pop_back();
+        }
+        DQ_DEBUG << "TransactionalStore::rollbackTo: undoing "
+                 << p->changes.size() - mark << " change(s)" << endl;
+        // Undo the changes since the savepoint, latest first, in the
+        // overlay alone: whatever other transactions have committed
+        // to the store since, each undo returns the overlay to just
+        // as it was before the change was made
+        for (int i = p->changes.size() - 1; i >= mark; --i) {
+            const Triple &t = p->changes[i].second;
+            if (p->changes[i].first == AddTriple) {
+                if (!p->added.remove(t)) p->removed.insert(t);
+            } else {
+                if (!p->removed.remove(t)) p->added.insert(t);
+            }
+        }
+        p->changes.erase(p->changes.begin() + mark, p->changes.end());
     }
 
-    ResultSet query(const Transaction *tx, QString sparql) const {
-        Operation op(this, tx);
+    ChangeSet getChanges(Pending *p) const {
+        QMutexLocker plocker(&p->mutex);
+        return p->changes;
+    }
+
+    bool contains(Pending *p, Triple t) const {
+        StatisticsCollector::Operation op(m_stats, "transaction contains");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        bool found = false;
+        doMatch(p, t, [&](const Triple &) { found = true; return false; });
+        return found;
+    }
+
+    Triples match(Pending *p, Triple t) const {
+        StatisticsCollector::Operation op(m_stats, "transaction match");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        Triples result;
+        doMatch(p, t, [&](const Triple &m) { result.push_back(m); return true; });
+        return result;
+    }
+
+    void match(Pending *p, Triple t, TripleVisitor visitor) const {
+        StatisticsCollector::Operation op(m_stats, "transaction match");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        doMatch(p, t, visitor);
+    }
+
+    int count(Pending *p, Triple t) const {
+        StatisticsCollector::Operation op(m_stats, "transaction count");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        read(p, t);
+        return overlaid(p, t, m_store->count(t));
+    }
+
+    int size(Pending *p) const {
+        StatisticsCollector::Operation op(m_stats, "transaction size");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        read(p, Triple());
+        return overlaid(p, Triple(), m_store->size());
+    }
+
+    ResultSet query(Pending *p, QString sparql) const {
+        StatisticsCollector::Operation op(m_stats, "transaction query");
+        // We can't tell what a query reads, so assume everything
+        readAll(p);
+        Applied applied(this, p);
         return m_store->query(sparql);
     }
 
-    Node complete(const Transaction *tx, Triple t) const {
-        Operation op(this, tx);
-        return m_store->complete(t);
+    Node complete(Pending *p, Triple t) const {
+        int count = 0, match = 0;
+        if (t.a == Node()) { ++count; match = 0; }
+        if (t.b == Node()) { ++count; match = 1; }
+        if (t.c == Node()) { ++count; match = 2; }
+        if (count != 1) {
+            throw RDFException("Cannot complete triple unless it has only a single wildcard node", t);
+        }
+        Triple result = matchOnce(p, t);
+        switch (match) {
+        case 0: return result.a;
+        case 1: return result.b;
+        default: return result.c;
+        }
     }        
 
-    Triple matchOnce(const Transaction *tx, Triple t) const {
-        Operation op(this, tx);
-        return m_store->matchOnce(t);
+    Triple matchOnce(Pending *p, Triple t) const {
+        StatisticsCollector::Operation op(m_stats, "transaction matchOnce");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        Triple result;
+        doMatch(p, t, [&](const Triple &m) { result = m; return false; });
+        return result;
     }
 
-    Node queryOnce(const Transaction *tx, QString sparql,
-                    QString bindingName) const {
-        Operation op(this, tx);
+    Node queryOnce(Pending *p, QString sparql, QString bindingName) const {
+        StatisticsCollector::Operation op(m_stats, "transaction queryOnce");
+        readAll(p);
+        Applied applied(this, p);
         return m_store->queryOnce(sparql, bindingName);
     }
 
-    Uri getUniqueUri(const Transaction *tx, QString prefix) const {
-        Operation op(this, tx);
-        return m_store->getUniqueUri(prefix);
+    Uri getUniqueUri(Pending *p, QString prefix) const {
+        StatisticsCollector::Operation op(m_stats, "transaction getUniqueUri");
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        // The store knows nothing of URIs used so far only in this
+        // transaction
+        while (true) {
+            Uri uri = m_store->getUniqueUri(prefix);
+            if (!p->added.mentions(uri)) return uri;
+        }
     }
 
-    Node addBlankNode(Transaction *tx) const {
-        Operation op(this, tx);
+    Node addBlankNode(Pending *) const {
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
         return m_store->addBlankNode();
     }
 
@@ -209,8 +939,10 @@ public:
         return m_store->expand(uri);
     }
 
-    void save(const Transaction *tx, QString filename) const {
-        Operation op(this, tx);
+    void save(Pending *p, QString filename) const {
+        StatisticsCollector::Operation op(m_stats, "transaction save");
+        readAll(p);
+        Applied applied(this, p);
         m_store->save(filename);
     }
 
@@ -222,149 +954,562 @@ public:
         return m_dwb == AutoTransaction;
     }
 
-    void startNonTransactionalAccess() {
-        // This is only called from the containing TransactionalStore
-        // when it wants to carry out a non-transactional read access.
-        // Hence, it needs to take a lock and hold it until
-        // endNonTransactionalAccess is called
-        m_mutex.lock();
-        DQ_DEBUG << "TransactionalStore::startNonTransactionalAccess" << endl;
-        if (m_context == NonTxContext) DQ_DEBUG << "(note: already in non-tx context)" << endl;
-        leaveTransactionContext();
-        // return with mutex held
-    }
-
-    void endNonTransactionalAccess() {
-        // We can remain in NonTxContext, since every transactional
-        // access checks this via enterTransactionContext before doing
-        // any work; this way is quicker if we may have multiple
-        // non-transactional reads happening together.
-        DQ_DEBUG << "TransactionalStore::endNonTransactionalAccess" << endl;
-        m_mutex.unlock();
-    }
-
     Store *getStore() { return m_store; }
     const Store *getStore() const { return m_store; }
+
+    StatisticsCollector &getStatisticsCollector() const { return m_stats; }
     
 private:
-    // Most things are mutable here because the TransactionalStore
-    // manipulates the Store extensively when entering and leaving
-    // transaction context, which can happen on any supposedly
-    // read-only access
     TransactionalStore *m_ts;
     mutable Store *m_store;
+    const BasicStore *m_basicStore; // m_store, if it is one
+    ChangeJournal *m_log;
     DirectWriteBehaviour m_dwb;
+
+    // m_mutex serialises commits, and protects m_version, m_active,
+    // m_threads, m_readers and m_history
     mutable QMutex m_mutex;
-    const Transaction *m_currentTx;
-    mutable Context m_context;
 
-    void startOperation(const Transaction *tx) const {
-        // This will succeed immediately if the mutex is already held
-        // by this thread from a startTransaction call (because it is
-        // a recursive mutex).  If another thread is performing a
-        // transaction, then we have to block until the whole
-        // transaction is complete
-        m_mutex.lock();
-        if (tx != m_currentTx) {
-            throw RDFInternalError("Transaction integrity error");
+    // m_storeLock is held for writing while changes are applied to
+    // the store, and for reading by everything else that uses it
+    mutable QReadWriteLock m_storeLock;
+
+    // Incremented by each commit that changes the store
+    quint64 m_version;
+
+    // Transactions in train, by the version at which they began
+    QMultiMap<quint64, Pending *> m_active;
+
+    // Threads that have a transaction in train
+    QSet<QThread *> m_threads;
+
+    // Read-only transactions in train
+    QSet<Pending *> m_readers;
+
+    // Created on the first call to commitAsync
+    Notifier *m_notifier;
+
+    // Tickets for notifyInTurn.  m_notifyIssued is protected by
+    // m_mutex, and the rest by m_notifyMutex
+    quint64 m_notifyIssued;
+    QMutex m_notifyMutex;
+    QWaitCondition m_notifyTurn;
+    quint64 m_notifyDelivered;
+    QThread *m_notifyThread; // notifying at the moment, if any
+    QMap<quint64, ChangeSet> m_handedOff;
+
+    mutable StatisticsCollector m_stats;
+
+    // Subscriptions, each indexed under the node of its pattern that
+    // is likely to be most selective (see subscriptionIndex), apart
+    // from those whose patterns are all wildcards.  Recursive, so
+    // that a receiver called directly may unsubscribe
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    mutable QRecursiveMutex m_subscriptionMutex;
+#else
+    mutable QMutex m_subscriptionMutex;
+#endif
+    QMultiHash<Node, ChangeSubscription *> m_subscriptionIndex[3];
+    QList<ChangeSubscription *> m_wildSubscriptions;
+    QSet<ChangeSubscription *> m_subscriptions;
+
+    // Transactions waiting to be committed as a group, and whether a
+    // thread is committing a group at the moment
+    mutable QMutex m_groupMutex;
+    QWaitCondition m_groupDone;
+    bool m_groupCommit;
+    bool m_groupLeader;
+    QList<Commit *> m_groupQueue;
+
+    // Triples changed by each commit since the oldest transaction in
+    // train began, in commit order
+    QList<Committed> m_history;
+
+    /**
+     * Applies a transaction's changes to the store for the lifetime
+     * of the object, for operations such as SPARQL queries that can't
+     * work through its overlay, holding off all other readers
+     * meanwhile.
+     */
+    class Applied
+    {
+    public:
+        Applied(const D *d, Pending *p) :
+            m_d(d),
+            m_locker(&d->m_storeLock, d->m_stats, "store write") {
+            {
+                PendingLocker plocker(p);
+                m_net = d->netChanges(p);
+            }
+            if (m_d->m_stats.isEnabled()) {
+                m_d->m_stats.countOperation("context switch");
+                m_d->m_stats.addSize("context switch", m_net.size());
+            }
+            try {
+                if (!m_net.empty()) m_d->m_store->change(m_net);
+            } catch (const RDFException &e) {
+                // Most likely the transaction's changes were
+                // overtaken by another transaction's commit
+                throw RDFTransactionConflict(QString("Failed to apply transaction to store.  Original error is: %1").arg(e.what()));
+            }
+        }
+        ~Applied() {
+            try {
+                if (!m_net.empty()) m_d->m_store->revert(m_net);
+            } catch (const RDFException &e) {
+                std::cerr << "WARNING: TransactionalStore: Failed to revert transaction from store: " << e.what() << std::endl;
+            }
+        }
+    private:
+        const D *m_d;
+        StatisticsCollector::WriteLocker m_locker;
+        ChangeSet m_net;
+    };
+
+    void commitGrouped(Commit &c) {
+        // Whichever thread finds no group under way commits every
+        // transaction queued by the time it starts, including its
+        // own, while the others wait.  So each group gathers the
+        // transactions that arrive while the one before it is
+        // being applied
+        QMutexLocker locker(&m_groupMutex);
+        m_groupQueue.push_back(&c);
+        while (!c.done) {
+            if (m_groupLeader) {
+                m_groupDone.wait(&m_groupMutex);
+                continue;
+            }
+            m_groupLeader = true;
+            QList<Commit *> group = m_groupQueue;
+            m_groupQueue.clear();
+            locker.unlock();
+            if (m_stats.isEnabled()) {
+                m_stats.addSize("commit group", group.size());
+            }
+            DQ_DEBUG << "TransactionalStore::commitGrouped: committing "
+                     << group.size() << " transaction(s) together" << endl;
+            applyCommits(group);
+            locker.relock();
+            foreach (Commit *gc, group) gc->done = true;
+            m_groupLeader = false;
+            m_groupDone.wakeAll();
         }
-        enterTransactionContext();
     }
 
-    void endOperation(const Transaction *tx) const {
-        if (tx != m_currentTx) {
-            throw RDFInternalError("Transaction integrity error");
-        }            
-        m_mutex.unlock();
+    void applyCommits(const QList<Commit *> &commits) {
+        // Validate and apply the given transactions, in order, with a
+        // single change to the store, recording the outcome of each.
+        // Each is validated against those before it in the list as
+        // well as against earlier commits, so those that pass change
+        // disjoint sets of triples and can be applied together
+        StatisticsCollector::MutexLocker locker(&m_mutex, m_stats,
+                                                "transaction mutex");
+        QList<Commit *> accepted;
+        QList<Triple> written;
+        ChangeSet combined;
+        foreach (Commit *c, commits) {
+            // Threads sharing the transaction may still be working in
+            // it.  Once it is marked finished they can change it no
+            // further, so what we validate and apply is all there is
+            {
+                QMutexLocker plocker(&c->p->mutex);
+                c->p->finished = true;
+                c->cs = c->p->changes;
+            }
+            if (!c->cs.empty() &&
+                (conflicts(c->p) || conflicts(c->p, written))) {
+                c->outcome = Commit::Conflicted;
+                continue;
+            }
+            // The store takes only the net effect of the transaction
+            c->net = netChanges(c->p);
+            foreach (const Change &ch, c->net) written.push_back(ch.second);
+            combined += c->net;
+            accepted.push_back(c);
+        }
+
+        StatisticsCollector::WriteLocker wlocker(&m_storeLock, m_stats,
+                                                 "store write");
+        if (!combined.empty()) {
+            try {
+                m_store->change(combined);
+            } catch (const RDFException &) {
+                // Apply them one at a time, to find out which failed
+                foreach (Commit *c, accepted) {
+                    if (c->net.empty()) continue;
+                    try {
+                        m_store->change(c->net);
+                    } catch (const RDFException &e) {
+                        c->outcome = Commit::Failed;
+                        c->error = QString("Failed to commit transaction.  Has the store been modified non-transactionally while a transaction was in progress?  Original error is: %1").arg(e.what());
+                    }
+                }
+            }
+        }
+
+        ChangeSet applied;
+        foreach (Commit *c, accepted) {
+            if (c->outcome == Commit::Failed) continue;
+            if (m_log && !c->cs.empty()) {
+                // Log while still holding the mutex, so that the log
+                // order is the commit order
+                try {
+                    c->entry = m_log->append(c->cs);
+                } catch (const RDFException &e) {
+                    m_store->revert(c->net);
+                    c->outcome = Commit::Failed;
+                    c->error = QString("Failed to write transaction to log: %1").arg(e.what());
+                    continue;
+                }
+            }
+            c->outcome = Commit::Succeeded;
+            c->ticket = ++m_notifyIssued;
+            applied += c->net;
+        }
+
+        foreach (Commit *c, commits) endTransaction(c->p);
+
+        if (!applied.empty()) {
+            ++m_version;
+            foreach (Pending *r, m_readers) pin(r, applied);
+            if (!m_active.empty()) {
+                // Others still in train must be validated against
+                // these commits when they come to commit themselves
+                Committed record;
+                record.version = m_version;
+                foreach (const Change &ch, applied) {
+                    record.triples.push_back(ch.second);
+                }
+                m_history.push_back(record);
+            }
+        }
+
+        foreach (Commit *c, commits) {
+            if (c->outcome != Commit::Succeeded || !c->async) continue;
+            if (!c->entry) {
+                c->async->reportResult(true);
+                c->async->reportFinished();
+            }
+            // Queue while still holding the mutex, so that
+            // notifications are delivered in commit order
+            if (!m_notifier) {
+                m_notifier = new Notifier(this);
+                m_notifier->start();
+            }
+            Notifier::Job job;
+            job.entry = c->entry;
+            job.ticket = c->ticket;
+            job.changes = c->cs;
+            job.result = *c->async;
+            m_notifier->enqueue(job);
+        }
     }
 
-    void enterTransactionContext() const {
-        // This is always called from within this class, with the
-        // mutex held already
-        if (m_context == TxContext) {
-            return;
+    void endTransaction(Pending *p) {
+        // Called with m_mutex held
+        QMutexLocker plocker(&p->mutex);
+        p->finished = true;
+        if (p->timer.isValid() && m_stats.isEnabled()) {
+            m_stats.addTiming(p->readOnly ? "read-only transaction" :
+                              "transaction", p->timer.nsecsElapsed());
         }
-        if (m_currentTx == NoTransaction) {
+        if (p->readOnly) {
+            m_readers.remove(p);
+            p->added.clear();
+            p->removed.clear();
             return;
         }
-        ChangeSet cs = m_currentTx->getChanges();
-        if (!cs.empty()) {
-            DQ_DEBUG << "TransactionalStore::enterTransactionContext: replaying" << endl;
-            try {
-                m_store->change(cs);
-            } catch (const RDFException &e) {
-                throw RDFTransactionError(QString("Failed to enter transaction context.  Has the store been modified non-transactionally while a transaction was in progress?  Original error is: %1").arg(e.what()));
+        m_active.remove(p->version, p);
+        m_threads.remove(p->thread);
+        p->added.clear();
+        p->removed.clear();
+        p->reads.clear();
+        // Forget any commits that no remaining transaction began
+        // before
+        if (m_active.empty()) {
+            m_history.clear();
+        } else {
+            quint64 oldest = m_active.firstKey();
+            while (!m_history.empty() && m_history.first().version <= oldest) {
+                m_history.removeFirst();
             }
         }
-        m_context = TxContext;
     }
 
-    void leaveTransactionContext() const {
-        // This is always called from within this class, with the
-        // mutex held already
-        if (m_context == NonTxContext) {
-            return;
+    static bool conflicts(const Pending *p, const QList<Triple> &written) {
+        foreach (const Triple &t, written) {
+            if (p->reads.matches(t)) return true;
         }
-        if (m_currentTx == NoTransaction) {
-            m_context = NonTxContext;
-            return;
+        return false;
+    }
+
+    bool conflicts(const Pending *p) const {
+        // Called with m_mutex held.  The transaction conflicts if any
+        // commit since it began changed a triple that it read or
+        // wrote, as it might then have acted on out-of-date
+        // information
+        for (int i = m_history.size() - 1; i >= 0; --i) {
+            const Committed &c = m_history[i];
+            if (c.version <= p->version) break;
+            foreach (const Triple &t, c.triples) {
+                if (p->reads.matches(t)) {
+                    DQ_DEBUG << "TransactionalStore: Transaction conflicts on " << t << endl;
+                    return true;
+                }
+            }
         }
-        // N.B. This is the reason for Transaction::getChanges()
-        // returning the change set prior to rollback, rather than
-        // e.g. an empty change set, if called after a rollback
-        ChangeSet cs = m_currentTx->getChanges();
-        if (!cs.empty()) {
-            try {
-                m_store->revert(cs);
-            } catch (const RDFException &e) {
-                throw RDFTransactionError(QString("Failed to leave transaction context.  Has the store been modified non-transactionally while a transaction was in progress?  Original error is: %1").arg(e.what()));
+        return false;
+    }
+
+    static const Node &node(const Triple &t, int i) {
+        return i == 0 ? t.a : i == 1 ? t.b : t.c;
+    }
+
+    static int subscriptionIndex(const Triple &pattern) {
+        // Subject if given, then object, then predicate: there are
+        // usually few predicates, each in many triples
+        if (pattern.a.type != Node::Nothing) return 0;
+        if (pattern.c.type != Node::Nothing) return 2;
+        if (pattern.b.type != Node::Nothing) return 1;
+        return -1;
+    }
+
+    void notifySubscriptions(const ChangeSet &cs) {
+        QMutexLocker locker(&m_subscriptionMutex);
+        if (m_subscriptions.empty()) return;
+        // Each subscription is indexed under one node only, so it
+        // is found at most once per change
+        QHash<ChangeSubscription *, ChangeSet> routed;
+        QList<ChangeSubscription *> order;
+        foreach (const Change &c, cs) {
+            for (int i = 0; i < 3; ++i) {
+                const Node &n = node(c.second, i);
+                QMultiHash<Node, ChangeSubscription *>::const_iterator j =
+                    m_subscriptionIndex[i].find(n);
+                while (j != m_subscriptionIndex[i].end() && j.key() == n) {
+                    ChangeSubscription *s = j.value();
+                    if (TripleSet::matches(s->getPattern(), c.second)) {
+                        if (!routed.contains(s)) order.push_back(s);
+                        routed[s].push_back(c);
+                    }
+                    ++j;
+                }
+            }
+            foreach (ChangeSubscription *s, m_wildSubscriptions) {
+                if (!routed.contains(s)) order.push_back(s);
+                routed[s].push_back(c);
             }
         }
-        m_context = NonTxContext;
-    }        
+        foreach (ChangeSubscription *s, order) {
+            // A receiver may have deleted a subscription meanwhile
+            if (m_subscriptions.contains(s)) {
+                s->changesCommitted(routed[s]);
+            }
+        }
+    }
+
+    static void pin(Pending *r, const ChangeSet &net) {
+        // Called with m_storeLock held for writing.  Keeps the
+        // read-only transaction r seeing the store as it was before
+        // the given changes were committed
+        foreach (const Change &c, net) {
+            if (c.first == AddTriple) {
+                if (!r->added.remove(c.second)) r->removed.insert(c.second);
+            } else {
+                if (!r->removed.remove(c.second)) r->added.insert(c.second);
+            }
+        }
+    }
+
+    static void read(Pending *p, const Triple &pattern) {
+        // Read-only transactions can't conflict with anything, so
+        // need no record of what they read
+        if (!p->readOnly) p->reads.insert(pattern);
+    }
+
+    void readAll(Pending *p) const {
+        StatisticsCollector::ReadLocker locker(&m_storeLock, m_stats,
+                                               "store read");
+        PendingLocker plocker(p);
+        read(p, Triple());
+    }
+
+    static ChangeSet netChanges(const Pending *p) {
+        ChangeSet cs;
+        foreach (const Triple &t, p->removed.triples()) {
+            cs.push_back(Change(RemoveTriple, t));
+        }
+        foreach (const Triple &t, p->added.triples()) {
+            cs.push_back(Change(AddTriple, t));
+        }
+        return cs;
+    }
+
+    QList<bool> storeContains(const Triples &ts) const {
+        // Called with m_storeLock held.  A BasicStore can look up the
+        // whole list under one lock of its own
+        if (m_basicStore) return m_basicStore->containsAll(ts);
+        QList<bool> found;
+        foreach (const Triple &t, ts) found.push_back(m_store->contains(t));
+        return found;
+    }
+
+    static void checkComplete(const Triple &t, QString op) {
+        // As the store would check, had we passed the triple to it
+        if ((t.a.type == Node::URI || t.a.type == Node::Blank) &&
+            t.b.type == Node::URI &&
+            t.c.type != Node::Nothing) {
+            return;
+        }
+        throw RDFException(QString("Failed to %1 triple (statement is incomplete)").arg(op), t);
+    }
+
+    // doAdd, doRemove and doMatch are called with m_storeLock held
+    // for reading and the transaction's mutex held.  The forms of
+    // doAdd and doRemove that are told whether the store contains the
+    // triple (which can be found without the mutex) take it as
+    // already checked for completeness
+
+    bool doAdd(Pending *p, const Triple &t) {
+        checkComplete(t, "add");
+        return doAdd(p, t, m_store->contains(t));
+    }
+
+    bool doRemove(Pending *p, const Triple &t) {
+        checkComplete(t, "remove");
+        return doRemove(p, t, m_store->contains(t));
+    }
+
+    bool doAdd(Pending *p, const Triple &t, bool stored) {
+        read(p, t);
+        if (p->removed.remove(t)) return true;
+        if (p->added.contains(t) || stored) return false;
+        p->added.insert(t);
+        return true;
+    }
+
+    bool doRemove(Pending *p, const Triple &t, bool stored) {
+        read(p, t);
+        if (p->added.remove(t)) return true;
+        if (p->removed.contains(t) || !stored) return false;
+        p->removed.insert(t);
+        return true;
+    }
+
+    // A transaction's added triples were not in the store, and its
+    // removed ones were, when it made those changes -- but another
+    // transaction may since have committed the same change, in which
+    // case this one is bound to conflict when it commits.  Until
+    // then, its reads must still make sense, so doMatch and overlaid
+    // take no account of an overlay triple that the store already
+    // agrees with
+
+    void doMatch(Pending *p, const Triple &t, TripleVisitor visitor) const {
+        read(p, t);
+        bool more = true;
+        m_store->match(t, [&](const Triple &m) {
+                if (p->removed.contains(m)) return true;
+                if (p->added.contains(m)) return true; // visited below
+                more = visitor(m);
+                return more;
+            });
+        if (more) p->added.match(t, visitor);
+    }
+
+    int overlaid(Pending *p, const Triple &t, int stored) const {
+        // Return the number of triples matching t in the
+        // transaction's view, given the number in the store
+        p->removed.match(t, [&](const Triple &r) {
+                if (m_store->contains(r)) --stored;
+                return true;
+            });
+        p->added.match(t, [&](const Triple &a) {
+                if (!m_store->contains(a)) ++stored;
+                return true;
+            });
+        return stored;
+    }
 };
 
 class TransactionalStore::TSTransaction::D
 {
 public:
-    D(TransactionalStore::TSTransaction *tx, TransactionalStore::D *td) :
-        m_tx(tx), m_td(td), m_committed(false), m_abandoned(false) {
+    D(TransactionalStore::D *td, bool readOnly) :
+        m_td(td),
+        m_pending(readOnly ?
+                  td->beginReadOnlyTransaction() : td->beginTransaction()),
+        m_committing(false), m_committed(false), m_abandoned(false) {
     }
     ~D() {
-        if (!m_committed && !m_abandoned && !m_tx->getChanges().empty()) {
-            // we need to either commit or rollback, or else the next
-            // transaction will stall
-            m_td->rollbackTransaction(m_tx);
-            // Not good form to throw an exception from the dtor
-            std::cerr << "WARNING: Transaction deleted without having been committed or rolled back" << std::endl;
+        if (!m_committed && !m_abandoned) {
+            // we need to either commit or rollback, or else the store
+            // will go on keeping track of this transaction
+            m_td->rollbackTransaction(m_pending);
+            if (!m_pending->changes.empty()) {
+                // Not good form to throw an exception from the dtor
+                std::cerr << "WARNING: Transaction deleted without having been committed or rolled back" << std::endl;
+            }
         }
+        delete m_pending;
     }
 
     void abandon() const {
-        if (m_abandoned || m_committed) return;
+        {
+            // Another thread may be abandoning it too
+            QMutexLocker locker(&m_mutex);
+            if (m_abandoned || m_committing || m_committed) return;
+            m_abandoned = true;
+        }
         DQ_DEBUG << "TransactionalStore::TSTransaction::abandon: Auto-rollback triggered by exception" << endl;
-        m_td->rollbackTransaction(m_tx);
-        m_abandoned = true;
+        m_td->rollbackTransaction(m_pending);
     }
     
     void check() const {
+        QMutexLocker locker(&m_mutex);
+        checkState();
+    }
+
+    void checkState() const {
+        // Called with m_mutex held
         if (m_abandoned) {
             throw RDFTransactionError("Transaction used after being rolled back");
         }
+        if (m_committing) {
+            throw RDFTransactionError("Transaction used while being committed");
+        }
         if (m_committed) {
             throw RDFTransactionError("Transaction used afted being committed");
         }
     }
 
-    bool add(Triple t) {
+    // Checking that the transaction is still usable and marking it
+    // as being committed is one step, so that of two threads sharing
+    // a transaction only one may commit it
+
+    void beginCommit() {
+        QMutexLocker locker(&m_mutex);
+        checkState();
+        m_committing = true;
+    }
+
+    void endCommit(bool committed) {
+        QMutexLocker locker(&m_mutex);
+        m_committing = false;
+        if (committed) m_committed = true;
+        else m_abandoned = true;
+    }
+
+    void checkWritable() const {
         check();
+        if (m_pending->readOnly) {
+            throw RDFTransactionError("Attempt to write in a read-only transaction");
+        }
+    }
+
+    bool add(Triple t) {
+        checkWritable();
         try {
-            if (m_td->add(m_tx, t)) {
-                m_changes.push_back(Change(AddTriple, t));
-                return true;
-            } else {
-                return false;
-            }
+            return m_td->add(m_pending, t);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -372,42 +1517,65 @@ public:
     }
 
     bool remove(Triple t) {
-        check();
+        checkWritable();
         try {
-            // If some nodes are null, we need to remove all matching
-            // triples -- we need to do that here instead of relying
-            // on the underlying store (which does the same thing)
-            // because we can't push the incomplete statement onto the
-            // change set
-            Triples tt;
-            bool wild = false;
-            if (t.a.type == Node::Nothing || 
-                t.b.type == Node::Nothing ||
-                t.c.type == Node::Nothing) {
-                tt = m_td->match(m_tx, t);
-                wild = true;
-            } else {
-                tt.push_back(t);
-            }
-            bool found = false;
-            for (int i = 0; i < tt.size(); ++i) {
-                if (m_td->remove(m_tx, tt[i])) {
-                    m_changes.push_back(Change(RemoveTriple, tt[i]));
-                    found = true;
-                } else if (wild) {
-                    throw RDFInternalError("Failed to remove matched statement in remove() with wildcards");
-                }
-            }
-            return found;
+            return m_td->remove(m_pending, t);
+        } catch (const RDFException &) {
+            abandon();
+            throw;
+        }
+    }
+
+    int addAll(Triples ts) {
+        checkWritable();
+        try {
+            return m_td->addAll(m_pending, ts);
         } catch (const RDFException &) {
             abandon();
             throw;
         }
     }
 
+    int removeAll(Triples ts) {
+        checkWritable();
+        try {
+            return m_td->removeAll(m_pending, ts);
+        } catch (const RDFException &) {
+            abandon();
+            throw;
+        }
+    }
+
+    static bool isComplete(const ChangeSet &cs) {
+        foreach (const Change &c, cs) {
+            if (c.second.a.type == Node::Nothing ||
+                c.second.b.type == Node::Nothing ||
+                c.second.c.type == Node::Nothing) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     void change(ChangeSet cs) {
-        // this is all atomic anyway (as it's part of the
-        // transaction), so unlike BasicStore we don't need a lock
+        checkWritable();
+        if (isComplete(cs)) {
+            // Hand the whole set to the store in one operation.  The
+            // store applies it atomically, so if it refuses (because
+            // of a duplicate add, say) nothing has changed and the
+            // transaction can carry on
+            try {
+                m_td->change(m_pending, cs);
+            } catch (const RDFTransactionError &) {
+                abandon();
+                throw;
+            } catch (const RDFInternalError &) {
+                abandon();
+                throw;
+            }
+            return;
+        }
+        // Wildcard removes must be expanded one at a time, see remove()
         for (int i = 0; i < cs.size(); ++i) {
             ChangeType type = cs[i].first;
             Triple triple = cs[i].second;
@@ -427,8 +1595,20 @@ public:
     }
 
     void revert(ChangeSet cs) {
-        // this is all atomic anyway (as it's part of the
-        // transaction), so unlike BasicStore we don't need a lock
+        checkWritable();
+        if (isComplete(cs)) {
+            // As for change()
+            try {
+                m_td->revert(m_pending, cs);
+            } catch (const RDFTransactionError &) {
+                abandon();
+                throw;
+            } catch (const RDFInternalError &) {
+                abandon();
+                throw;
+            }
+            return;
+        }
         for (int i = cs.size()-1; i >= 0; --i) {
             ChangeType type = cs[i].first;
             Triple triple = cs[i].second;
@@ -450,7 +1630,7 @@ public:
     bool contains(Triple t) const {
         check();
         try {
-            return m_td->contains(m_tx, t);
+            return m_td->contains(m_pending, t);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -460,7 +1640,37 @@ public:
     Triples match(Triple t) const {
         check();
         try {
-            return m_td->match(m_tx, t);
+            return m_td->match(m_pending, t);
+        } catch (const RDFException &) {
+            abandon();
+            throw;
+        }
+    }
+
+    void match(Triple t, TripleVisitor visitor) const {
+        check();
+        try {
+            m_td->match(m_pending, t, visitor);
+        } catch (const RDFException &) {
+            abandon();
+            throw;
+        }
+    }
+
+    int count(Triple t) const {
+        check();
+        try {
+            return m_td->count(m_pending, t);
+        } catch (const RDFException &) {
+            abandon();
+            throw;
+        }
+    }
+
+    int size() const {
+        check();
+        try {
+            return m_td->size(m_pending);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -470,7 +1680,7 @@ public:
     ResultSet query(QString sparql) const {
         check();
         try {
-            return m_td->query(m_tx, sparql);
+            return m_td->query(m_pending, sparql);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -480,7 +1690,7 @@ public:
     Node complete(Triple t) const {
         check();
         try {
-            return m_td->complete(m_tx, t);
+            return m_td->complete(m_pending, t);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -490,7 +1700,7 @@ public:
     Triple matchOnce(Triple t) const {
         check();
         try {
-            return m_td->matchOnce(m_tx, t);
+            return m_td->matchOnce(m_pending, t);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -500,7 +1710,7 @@ public:
     Node queryOnce(QString sparql, QString bindingName) const {
         check();
         try {
-            return m_td->queryOnce(m_tx, sparql, bindingName);
+            return m_td->queryOnce(m_pending, sparql, bindingName);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -510,7 +1720,7 @@ public:
     Uri getUniqueUri(QString prefix) const {
         check();
         try {
-            return m_td->getUniqueUri(m_tx, prefix);
+            return m_td->getUniqueUri(m_pending, prefix);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -518,9 +1728,9 @@ public:
     }
 
     Node addBlankNode() {
-        check();
+        checkWritable();
         try {
-            return m_td->addBlankNode(m_tx);
+            return m_td->addBlankNode(m_pending);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -534,7 +1744,7 @@ public:
     void save(QString filename) const {
         check();
         try {
-            return m_td->save(m_tx, filename);
+            return m_td->save(m_pending, filename);
         } catch (const RDFException &) {
             abandon();
             throw;
@@ -542,18 +1752,14 @@ public:
     }
 
     void import(QUrl url, ImportDuplicatesMode idm, QString format) {
-        check();
+        checkWritable();
         BasicStore *bs = 0;
         try {
             bs = BasicStore::load(url, format);
             Triples ts = bs->match(Triple());
-            foreach (Triple t, ts) {
-                bool added = m_td->add(m_tx, t);
-                if (added) {
-                    m_changes.push_back(Change(AddTriple, t));
-                } else if (idm == ImportFailOnDuplicates) {
-                    throw RDFDuplicateImportException("Duplicate statement encountered on import in ImportFailOnDuplicates mode");
-                }
+            int added = m_td->addAll(m_pending, ts);
+            if (added < ts.size() && idm == ImportFailOnDuplicates) {
+                throw RDFDuplicateImportException("Duplicate statement encountered on import in ImportFailOnDuplicates mode");
             }
             delete bs;
             bs = 0;
@@ -566,18 +1772,14 @@ public:
 
     void importString(QString encodedRdf, Uri baseUri,
                       ImportDuplicatesMode idm, QString format) {
-        check();
+        checkWritable();
         BasicStore *bs = 0;
         try {
             bs = BasicStore::loadString(encodedRdf, baseUri, format);
             Triples ts = bs->match(Triple());
-            foreach (Triple t, ts) {
-                bool added = m_td->add(m_tx, t);
-                if (added) {
-                    m_changes.push_back(Change(AddTriple, t));
-                } else if (idm == ImportFailOnDuplicates) {
-                    throw RDFDuplicateImportException("Duplicate statement encountered on import in ImportFailOnDuplicates mode");
-                }
+            int added = m_td->addAll(m_pending, ts);
+            if (added < ts.size() && idm == ImportFailOnDuplicates) {
+                throw RDFDuplicateImportException("Duplicate statement encountered on import in ImportFailOnDuplicates mode");
             }
             delete bs;
             bs = 0;
@@ -593,43 +1795,106 @@ public:
     }
 
     void commit() {
-        check();
+        beginCommit();
         DQ_DEBUG << "TransactionalStore::TSTransaction::commit: Committing" << endl;
-        m_td->commitTransaction(m_tx);
-        m_committed = true;
+        if (m_pending->readOnly) {
+            // Nothing to commit, and nobody to tell about it
+            m_td->rollbackTransaction(m_pending);
+            endCommit(true);
+            return;
+        }
+        // This sets committed as soon as the changes are committed to
+        // the store, which they may be even if syncing the
+        // write-ahead log then fails
+        bool committed = false;
+        try {
+            m_td->commitTransaction(m_pending, committed);
+        } catch (const RDFException &) {
+            endCommit(committed);
+            throw;
+        }
+        endCommit(true);
+    }
+
+    QFuture<bool> commitAsync() {
+        QFutureInterface<bool> result;
+        result.reportStarted();
+        if (m_pending->readOnly) {
+            commit();
+            result.reportResult(true);
+            result.reportFinished();
+            return result.future();
+        }
+        beginCommit();
+        DQ_DEBUG << "TransactionalStore::TSTransaction::commitAsync: Committing" << endl;
+        bool committed = false;
+        try {
+            m_td->commitTransaction(m_pending, committed, &result);
+        } catch (const RDFException &) {
+            endCommit(committed);
+            throw;
+        }
+        endCommit(true);
+        return result.future();
+    }
+
+    int savepoint() {
+        checkWritable();
+        return m_td->savepoint(m_pending);
+    }
+
+    void rollbackTo(int savepoint) {
+        checkWritable();
+        m_td->rollbackTo(m_pending, savepoint);
     }
 
     void rollback() {
-        check();
+        {
+            QMutexLocker locker(&m_mutex);
+            checkState();
+            m_abandoned = true;
+        }
         DQ_DEBUG << "TransactionalStore::TSTransaction::rollback: Abandoning" << endl;
-        m_td->rollbackTransaction(m_tx);
-        m_abandoned = true;
+        m_td->rollbackTransaction(m_pending);
     }
 
     ChangeSet getCommittedChanges() const {
-        if (m_committed) return m_changes;
-        else return ChangeSet();
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!m_committed) return ChangeSet();
+        }
+        return m_td->getChanges(m_pending);
     }
 
     ChangeSet getChanges() const {
-        return m_changes;
+        return m_td->getChanges(m_pending);
     }
         
 private:
-    TransactionalStore::TSTransaction *m_tx;
     TransactionalStore::D *m_td;
-    ChangeSet m_changes;
+    TransactionalStore::D::Pending *m_pending;
+    mutable QMutex m_mutex; // for m_committing, m_committed and m_abandoned
+    mutable bool m_committing;
     mutable bool m_committed;
     mutable bool m_abandoned;
 };
 
 TransactionalStore::TransactionalStore(Store *store, DirectWriteBehaviour dwb) :
-    m_d(new D(this, store, dwb))
+    m_d(new D(this, store, 0, dwb))
+{
+}
+
+TransactionalStore::TransactionalStore(Store *store, ChangeJournal *log,
+                                       DirectWriteBehaviour dwb) :
+    m_d(new D(this, store, log, dwb))
 {
 }
 
 TransactionalStore::~TransactionalStore()
 {
+    foreach (ChangeSubscription *s, m_d->getSubscriptions()) {
+        s->m_ts = 0;
+    }
     delete m_d;
 }
 
@@ -639,10 +1904,72 @@ TransactionalStore::startTransaction()
     return m_d->startTransaction();
 }
 
+const Transaction *
+TransactionalStore::startReadOnlyTransaction() const
+{
+    return m_d->startReadOnlyTransaction();
+}
+
+ChangeSubscription *
+TransactionalStore::subscribe(Triple pattern, QObject *parent)
+{
+    ChangeSubscription *s = new ChangeSubscription(this, pattern, parent);
+    m_d->subscribe(s);
+    return s;
+}
+
+void
+TransactionalStore::setGroupCommit(bool group)
+{
+    m_d->setGroupCommit(group);
+}
+
+bool
+TransactionalStore::getGroupCommit() const
+{
+    return m_d->getGroupCommit();
+}
+
+void
+TransactionalStore::compact()
+{
+    m_d->compact();
+}
+
+void
+TransactionalStore::setStatisticsEnabled(bool enabled)
+{
+    m_d->getStatisticsCollector().setEnabled(enabled);
+}
+
+bool
+TransactionalStore::getStatisticsEnabled() const
+{
+    return m_d->getStatisticsCollector().isEnabled();
+}
+
+Statistics
+TransactionalStore::getStatistics() const
+{
+    return m_d->getStatisticsCollector().getStatistics();
+}
+
+void
+TransactionalStore::resetStatistics()
+{
+    m_d->getStatisticsCollector().reset();
+}
+
+void
+TransactionalStore::unsubscribe(ChangeSubscription *s)
+{
+    m_d->unsubscribe(s);
+}
+
 void
 TransactionalStore::save(QString filename) const
 {
-    D::NonTransactionalAccess ntxa(m_d);
+    D::NonTransactionalAccess ntxa(m_d, "save");
     m_d->getStore()->save(filename);
 }
 
@@ -653,7 +1980,8 @@ TransactionalStore::import(QUrl url, ImportDuplicatesMode idm, QString format)
         throw RDFException("TransactionalStore::import() called without Transaction");
     }
     unique_ptr<Transaction> tx(startTransaction());
-    return tx->import(url, idm, format);
+    tx->import(url, idm, format);
+    tx->commit();
 }
 
 void
@@ -664,7 +1992,8 @@ TransactionalStore::importString(QString encodedRdf, Uri baseUri,
         throw RDFException("TransactionalStore::import() called without Transaction");
     }
     unique_ptr<Transaction> tx(startTransaction());
-    return tx->importString(encodedRdf, baseUri, idm, format);
+    tx->importString(encodedRdf, baseUri, idm, format);
+    tx->commit();
 }
 
 TransactionalStore::Features
@@ -681,7 +2010,9 @@ TransactionalStore::add(Triple t)
     }
     // unique_ptr here is very useful to ensure destruction on exceptions
     unique_ptr<Transaction> tx(startTransaction());
-    return tx->add(t);
+    bool added = tx->add(t);
+    tx->commit();
+    return added;
 }
 
 bool
@@ -691,7 +2022,33 @@ TransactionalStore::remove(Triple t)
         throw RDFException("TransactionalStore::remove() called without Transaction");
     }
     unique_ptr<Transaction> tx(startTransaction());
-    return tx->remove(t);
+    bool removed = tx->remove(t);
+    tx->commit();
+    return removed;
+}
+
+int
+TransactionalStore::addAll(Triples ts)
+{
+    if (!m_d->hasWrap()) {
+        throw RDFException("TransactionalStore::addAll() called without Transaction");
+    }
+    unique_ptr<Transaction> tx(startTransaction());
+    int n = tx->addAll(ts);
+    tx->commit();
+    return n;
+}
+
+int
+TransactionalStore::removeAll(Triples ts)
+{
+    if (!m_d->hasWrap()) {
+        throw RDFException("TransactionalStore::removeAll() called without Transaction");
+    }
+    unique_ptr<Transaction> tx(startTransaction());
+    int n = tx->removeAll(ts);
+    tx->commit();
+    return n;
 }
 
 void
@@ -702,6 +2059,7 @@ TransactionalStore::change(ChangeSet cs)
     }
     unique_ptr<Transaction> tx(startTransaction());
     tx->change(cs);
+    tx->commit();
 }
 
 void
@@ -712,54 +2070,76 @@ TransactionalStore::revert(ChangeSet cs)
     }
     unique_ptr<Transaction> tx(startTransaction());
     tx->revert(cs);
+    tx->commit();
 }
 
 bool
 TransactionalStore::contains(Triple t) const
 {
-    D::NonTransactionalAccess ntxa(m_d);
+    D::NonTransactionalAccess ntxa(m_d, "contains");
     return m_d->getStore()->contains(t);
 }
     
 Triples
 TransactionalStore::match(Triple t) const
 {
-    D::NonTransactionalAccess ntxa(m_d);
+    D::NonTransactionalAccess ntxa(m_d, "match");
     return m_d->getStore()->match(t);
 }
 
+void
+TransactionalStore::match(Triple t, TripleVisitor visitor) const
+{
+    D::NonTransactionalAccess ntxa(m_d, "match");
+    m_d->getStore()->match(t, visitor);
+}
+
+int
+TransactionalStore::count(Triple t) const
+{
+    D::NonTransactionalAccess ntxa(m_d, "count");
+    return m_d->getStore()->count(t);
+}
+
+int
+TransactionalStore::size() const
+{
+    D::NonTransactionalAccess ntxa(m_d, "size");
+    return m_d->getStore()->size();
+}
+
 ResultSet
 TransactionalStore::query(QString s) const
 {
-    D::NonTransactionalAccess ntxa(m_d);
+    D::NonTransactionalAccess ntxa(m_d, "query");
     return m_d->getStore()->query(s);
 }
 
 Node
 TransactionalStore::complete(Triple t) const
 {
-    D::NonTransactionalAccess ntxa(m_d);
+    D::NonTransactionalAccess ntxa(m_d, "complete");
     return m_d->getStore()->complete(t);
 }
 
 Triple
 TransactionalStore::matchOnce(Triple t) const
 {
-    D::NonTransactionalAccess ntxa(m_d);
+    D::NonTransactionalAccess ntxa(m_d, "matchOnce");
     return m_d->getStore()->matchOnce(t);
 }
 
 Node
 TransactionalStore::queryOnce(QString s, QString b) const
 {
-    D::NonTransactionalAccess ntxa(m_d);
+    D::NonTransactionalAccess ntxa(m_d, "queryOnce");
     return m_d->getStore()->queryOnce(s, b);
 }
 
 Uri
 TransactionalStore::getUniqueUri(QString prefix) const
 {
-    D::NonTransactionalAccess ntxa(m_d);
+    D::NonTransactionalAccess ntxa(m_d, "getUniqueUri");
     return m_d->getStore()->getUniqueUri(prefix);
 }
 
@@ -770,7 +2150,9 @@ TransactionalStore::addBlankNode()
         throw RDFException("TransactionalStore::addBlankNode() called without Transaction");
     }
     unique_ptr<Transaction> tx(startTransaction());
-    return tx->addBlankNode();
+    Node node = tx->addBlankNode();
+    tx->commit();
+    return node;
 }
 
 Uri
@@ -779,8 +2161,9 @@ TransactionalStore::expand(QString uri) const
     return m_d->expand(uri);
 }
 
-TransactionalStore::TSTransaction::TSTransaction(TransactionalStore::D *td) :
-    m_d(new D(this, td))
+TransactionalStore::TSTransaction::TSTransaction(TransactionalStore::D *td,
+                                               bool readOnly) :
+    m_d(new D(td, readOnly))
 {
 }
 
@@ -801,6 +2184,18 @@ TransactionalStore::TSTransaction::remove(Triple t)
     return m_d->remove(t);
 }
 
+int
+TransactionalStore::TSTransaction::addAll(Triples ts)
+{
+    return m_d->addAll(ts);
+}
+
+int
+TransactionalStore::TSTransaction::removeAll(Triples ts)
+{
+    return m_d->removeAll(ts);
+}
+
 void
 TransactionalStore::TSTransaction::change(ChangeSet cs)
 {
@@ -825,6 +2220,24 @@ TransactionalStore::TSTransaction::match(Triple t) const
     return m_d->match(t);
 }
 
+void
+TransactionalStore::TSTransaction::match(Triple t, TripleVisitor visitor) const
+{
+    m_d->match(t, visitor);
+}
+
+int
+TransactionalStore::TSTransaction::count(Triple t) const
+{
+    return m_d->count(t);
+}
+
+int
+TransactionalStore::TSTransaction::size() const
+{
+    return m_d->size();
+}
+
 ResultSet
 TransactionalStore::TSTransaction::query(QString sparql) const
 {
@@ -899,12 +2312,30 @@ TransactionalStore::TSTransaction::commit()
     m_d->commit();
 }
 
+QFuture<bool>
+TransactionalStore::TSTransaction::commitAsync()
+{
+    return m_d->commitAsync();
+}
+
 void
 TransactionalStore::TSTransaction::rollback()
 {
     m_d->rollback();
 }
 
+int
+TransactionalStore::TSTransaction::savepoint()
+{
+    return m_d->savepoint();
+}
+
+void
+TransactionalStore::TSTransaction::rollbackTo(int savepoint)
+{
+    m_d->rollbackTo(savepoint);
+}
+
 ChangeSet
 TransactionalStore::TSTransaction::getCommittedChanges() const
 {
@@ -80,3 +80,11 @@ operator<<(QTextStream &out, const Triple &t)
 
 }
 
+unsigned int
+qHash(const Dataquay::Triple &t)
+{
+    unsigned int h = qHash(t.a);
+    h = h * 31 + qHash(t.b);
+    return h * 31 + qHash(t.c);
+}
+
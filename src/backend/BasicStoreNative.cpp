@@ -0,0 +1,1570 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifdef USE_NATIVE
+
+#include "BasicStore.h"
+#include "RDFException.h"
+
+#include <serd/serd.h>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
+#include <QVector>
+#include <QFile>
+#include <QCryptographicHash>
+#include <QReadWriteLock>
+
+#include "../Debug.h"
+#include "../StatisticsCollector.h"
+#include "../Snapshot.h"
+#include "../NTriplesParser.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <time.h>
+
+namespace Dataquay
+{
+
+/*
+ * The native backend keeps no external RDF library model.  Every
+ * distinct node is entered once into a term dictionary and given a
+ * 32-bit ID, and each triple is held as three IDs in each of three
+ * sorted indexes (SPO, POS and OSP), so that any wildcard pattern is
+ * a range scan over whichever index has the pattern's bound nodes
+ * first.  IDs are converted back to Nodes only as triples are
+ * returned.  Serd is used for import and export.
+ *
+ * Terms are never removed from the dictionary (except by clear()),
+ * so a store that sees a great many distinct nodes come and go will
+ * grow accordingly.
+ */
+class BasicStore::D
+{
+public:
+    D() : m_uriCacheSize(1024), m_importThreads(0) {
+        m_prefixes["rdf"] = Uri("http://www.w3.org/1999/02/22-rdf-syntax-ns#");
+        m_prefixes["xsd"] = Uri("http://www.w3.org/2001/XMLSchema#");
+        clear();
+    }
+
+    ~D() {
+    }
+
+    QString getNewString() const {
+        QString s =
+            QString::fromLocal8Bit
+            (QCryptographicHash::hash
+             (QString("%1").arg(rand() + time(0)).toLocal8Bit(),
+              QCryptographicHash::Sha1).toHex())
+            .left(12);
+        // This may be used as the whole of a name in some contexts,
+        // so it must not start with a digit
+        if (s[0].isDigit()) {
+            s = "x" + s.right(s.length()-1);
+        }
+        return s;
+    }
+    
+    void collision() const {
+        // If we get a collision when generating a "random" string,
+        // seed the random number generator (it probably means the
+        // generator hasn't been seeded at all).  But only once.
+        static QMutex m;
+        static bool seeded = false;
+        static QMutexLocker l(&m);
+        if (!seeded) return;
+        srand((unsigned int)time(0));
+        seeded = true;
+    }
+
+    void setBaseUri(Uri baseUri) {
+        QMutexLocker plocker(&m_prefixLock);
+        m_baseUri = baseUri;
+        m_prefixes[""] = m_baseUri;
+    }
+    
+    Uri getBaseUri() const {
+        return m_baseUri;
+    }
+
+    void clear() {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::clear" << endl;
+        m_spo.clear();
+        m_pos.clear();
+        m_osp.clear();
+        m_ids.clear();
+        m_terms.clear();
+        m_terms.push_back(Node()); // ID 0 is the wildcard, never a term
+    }
+
+    void addPrefix(QString prefix, Uri uri) {
+        QMutexLocker plocker(&m_prefixLock);
+        m_prefixes[prefix] = uri;
+    }
+
+    // Nodes are never converted here except at the API boundary, so
+    // there is nothing for a URI cache to hold.  The size is kept
+    // only so that it reads back as set, and nothing is ever counted.
+
+    void setUriCacheSize(int uris) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        m_uriCacheSize = uris;
+    }
+
+    int getUriCacheSize() const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        return m_uriCacheSize;
+    }
+
+    quint64 getUriCacheHits() const {
+        return 0;
+    }
+
+    quint64 getUriCacheMisses() const {
+        return 0;
+    }
+
+    void setImportThreads(int threads) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        m_importThreads = threads;
+    }
+
+    int getImportThreads() const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        return m_importThreads;
+    }
+
+    StatisticsCollector &getStatisticsCollector() const {
+        return m_stats;
+    }
+
+    bool add(Triple t) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::add: " << t << endl;
+        return doAdd(t);
+    }
+
+    bool remove(Triple t) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::remove: " << t << endl;
+        if (t.a.type == Node::Nothing || 
+            t.b.type == Node::Nothing ||
+            t.c.type == Node::Nothing) {
+            Order order;
+            Key prefix;
+            if (!resolve(t, order, prefix)) return false;
+            QVector<Key> keys;
+            scan(order, prefix, [&](const Key &k) {
+                    keys.push_back(k);
+                    return true;
+                });
+            if (keys.empty()) return false;
+            DQ_DEBUG << "BasicStore::remove: Removing " << keys.size() << " triple(s)" << endl;
+            foreach (const Key &k, keys) {
+                if (!erase(k)) {
+                    throw RDFInternalError("Failed to remove matched statement in remove() with wildcards");
+                }
+            }
+            return true;
+        } else {
+            return doRemove(t);
+        }
+    }
+
+    int addAll(Triples ts) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::addAll: " << ts.size() << " triple(s)" << endl;
+        // Check everything before adding anything, so that an
+        // incomplete triple leaves the store (and dictionary) unchanged
+        for (int i = 0; i < ts.size(); ++i) {
+            if (!checkComplete(ts[i])) {
+                throw RDFException("Failed to add triple (statement is incomplete)", ts[i]);
+            }
+        }
+        int added = 0;
+        for (int i = 0; i < ts.size(); ++i) {
+            if (insert(intern(ts[i]))) ++added;
+        }
+        DQ_DEBUG << "BasicStore::addAll: added " << added << endl;
+        return added;
+    }
+
+    int removeAll(Triples ts) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::removeAll: " << ts.size() << " triple(s)" << endl;
+        for (int i = 0; i < ts.size(); ++i) {
+            if (!checkComplete(ts[i])) {
+                throw RDFException("Failed to remove triple (statement is incomplete)", ts[i]);
+            }
+        }
+        int removed = 0;
+        for (int i = 0; i < ts.size(); ++i) {
+            Key k;
+            if (lookup(ts[i], k) && erase(k)) ++removed;
+        }
+        DQ_DEBUG << "BasicStore::removeAll: removed " << removed << endl;
+        return removed;
+    }
+
+    void change(ChangeSet cs) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::change: " << cs.size() << " changes" << endl;
+        int i = 0;
+        try {
+            for (i = 0; i < cs.size(); ++i) {
+                ChangeType type = cs[i].first;
+                Triple triple = cs[i].second;
+                switch (type) {
+                case AddTriple:
+                    if (!doAdd(triple)) {
+                        throw RDFException("Change add failed: triple is already in store", triple);
+                    }
+                    break;
+                case RemoveTriple:
+                    if (!doRemove(cs[i].second)) {
+                        throw RDFException("Change remove failed: triple is not in store", triple);
+                    }
+                    break;
+                }
+            }
+        } catch (const RDFException &) {
+            // Undo the changes that succeeded, so the store is left
+            // as it was before the call
+            while (--i >= 0) restoreChange(cs[i], true);
+            throw;
+        }
+    }
+
+    void revert(ChangeSet cs) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::revert: " << cs.size() << " changes" << endl;
+        int i = cs.size()-1;
+        try {
+            for (i = cs.size()-1; i >= 0; --i) {
+                ChangeType type = cs[i].first;
+                Triple triple = cs[i].second;
+                switch (type) {
+                case AddTriple:
+                    if (!doRemove(triple)) {
+                        throw RDFException("Revert of add failed: triple is not in store", triple);
+                    }
+                    break;
+                case RemoveTriple:
+                    if (!doAdd(triple)) {
+                        throw RDFException("Revert of remove failed: triple is already in store", triple);
+                    }
+                    break;
+                }
+            }
+        } catch (const RDFException &) {
+            // Reapply the changes we had already reverted
+            while (++i < cs.size()) restoreChange(cs[i], false);
+            throw;
+        }
+    }
+
+    bool contains(Triple t) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::contains: " << t << endl;
+        if (!checkComplete(t)) {
+            throw RDFException("Failed to test for triple (statement is incomplete)");
+        }
+        Key k;
+        if (!lookup(t, k)) return false;
+        return m_spo.find(k) != m_spo.end();
+    }
+
+    QList<bool> containsAll(Triples ts) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::containsAll: " << ts.size() << " triple(s)" << endl;
+        QList<bool> found;
+        for (int i = 0; i < ts.size(); ++i) {
+            if (!checkComplete(ts[i])) {
+                throw RDFException("Failed to test for triple (statement is incomplete)", ts[i]);
+            }
+            Key k;
+            found.push_back(lookup(ts[i], k) && m_spo.find(k) != m_spo.end());
+        }
+        return found;
+    }
+    
+    Triples match(Triple t) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::match: " << t << endl;
+        Triples result = doMatch(t);
+#ifndef NDEBUG
+        DQ_DEBUG << "BasicStore::match result (size " << result.size() << "):" << endl;
+        for (int i = 0; i < result.size(); ++i) {
+            DQ_DEBUG << i << ". " << result[i] << endl;
+        }
+#endif
+        return result;
+    }
+
+    void match(Triple t, TripleVisitor visitor) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::match (visitor): " << t << endl;
+        doMatch(t, visitor);
+    }
+
+    int count(Triple t) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::count: " << t << endl;
+        Order order;
+        Key prefix;
+        if (!resolve(t, order, prefix)) return 0;
+        if (!prefix.a) return int(m_spo.size());
+        int n = 0;
+        scan(order, prefix, [&](const Key &) {
+                ++n;
+                return true;
+            });
+        return n;
+    }
+
+    int size() const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        return int(m_spo.size());
+    }
+
+    Node complete(Triple t) const {
+        int count = 0, match = 0;
+        if (t.a == Node()) { ++count; match = 0; }
+        if (t.b == Node()) { ++count; match = 1; }
+        if (t.c == Node()) { ++count; match = 2; }
+        if (count != 1) {
+            throw RDFException("Cannot complete triple unless it has only a single wildcard node", t);
+        }
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::complete: " << t << endl;
+        Triples result = doMatch(t, true);
+        if (result.empty()) return Node();
+        else switch (match) {
+            case 0: return result[0].a;
+            case 1: return result[0].b;
+            case 2: return result[0].c;
+            default: return Node();
+            }
+    }
+
+    Triple matchOnce(Triple t) const {
+        if (t.c != Node() && t.b != Node() && t.a != Node()) {
+            // triple is complete: short-circuit to a single lookup
+            if (contains(t)) return t;
+            else return Triple();
+        }
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::matchOnce: " << t << endl;
+        Triples result = doMatch(t, true);
+#ifndef NDEBUG
+        DQ_DEBUG << "BasicStore::matchOnce result:" << endl;
+        for (int i = 0; i < result.size(); ++i) {
+            DQ_DEBUG << i << ". " << result[i] << endl;
+        }
+#endif
+        if (result.empty()) return Triple();
+        else return result[0];
+    }
+
+    ResultSet query(QString sparql) const {
+        throw RDFUnsupportedError
+            ("SPARQL queries are not supported with native backend",
+             sparql);
+    }
+
+    Node queryOnce(QString sparql, QString /* bindingName */) const {
+        throw RDFUnsupportedError
+            ("SPARQL queries are not supported with native backend",
+             sparql);
+    }
+
+    Uri getUniqueUri(QString prefix) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::getUniqueUri: prefix " << prefix << endl;
+        bool good = false;
+        Uri uri;
+        while (!good) {
+            QString s = getNewString();
+            uri = expand(prefix + s);
+            // Stricter than necessary, as the dictionary may still
+            // hold terms no longer used in any triple
+            if (!m_ids.contains(Node(uri))) good = true;
+            else collision();
+        }
+        return uri;
+    }
+
+    Uri expand(QString shrt) const {
+
+        if (shrt == "a") {
+            return Uri::rdfTypeUri();
+        }
+
+        int index = shrt.indexOf(':');
+        if (index == 0) {
+            // starts with colon
+            return Uri(m_baseUri.toString() + shrt.right(shrt.length() - 1));
+        } else if (index > 0) {
+            // colon appears in middle somewhere
+            if (index + 2 < shrt.length() &&
+                shrt[index+1] == '/' &&
+                shrt[index+2] == '/') {
+                // we have found "://", this is a scheme, therefore
+                // the uri is already expanded
+                return Uri(shrt);
+            }
+        } else {
+            // no colon present, no possibility of expansion
+            return Uri(shrt);
+        }
+
+        // fall through only for colon in middle and no "://" found,
+        // i.e. a plausible prefix appears
+
+        QString prefix = shrt.left(index);
+        QString expanded;
+
+        m_prefixLock.lock();
+        PrefixMap::const_iterator pi = m_prefixes.find(prefix);
+        if (pi != m_prefixes.end()) {
+            expanded = pi.value().toString() +
+                shrt.right(shrt.length() - (index + 1));
+        } else {
+            expanded = shrt;
+        }
+        m_prefixLock.unlock();
+
+        return Uri(expanded);
+    }
+
+    Node addBlankNode() {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        Node n;
+        n.type = Node::Blank;
+        do {
+            n.value = getNewString();
+        } while (m_ids.contains(n));
+        return n;
+    }
+
+    static size_t saveSink(const void *buf, size_t len, void *stream) {
+        QIODevice *dev = (QIODevice *)stream;
+        qint64 r = dev->write((const char *)buf, len);
+        if (r < 0) throw RDFException("Write failed");
+        else return r;
+    }
+
+    void save(QString filename) const {
+
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker plocker(&m_prefixLock);
+
+        DQ_DEBUG << "BasicStore::save(" << filename << ")" << endl;
+
+        QByteArray bb = m_baseUri.toString().toUtf8();
+        SerdURI bu;
+
+        if (serd_uri_parse((uint8_t *)bb.data(), &bu) != SERD_SUCCESS) {
+            throw RDFInternalError("Failed to parse base URI", m_baseUri);
+        }
+
+        SerdNode bn = serd_node_from_string(SERD_URI, (uint8_t *)bb.data());
+        SerdEnv *env = serd_env_new(&bn);
+
+        for (PrefixMap::const_iterator i = m_prefixes.begin();
+             i != m_prefixes.end(); ++i) {
+            addToSerdNamespace(env, i.key(), i.value().toString());
+        }
+
+        QFile f(filename);
+        if (!f.exists()) {
+            if (!f.open(QFile::WriteOnly)) {
+                serd_env_free(env);
+                throw RDFException("Failed to open file for writing", filename);
+            }
+            f.close();
+        }
+
+        QString tmpFilename = QString("%1.part").arg(filename);
+
+        QFile tf(tmpFilename);
+        if (!tf.open(QFile::WriteOnly)) {
+            serd_env_free(env);
+            throw RDFException("Failed to open partial file for writing", tmpFilename);
+        }
+        
+        SerdEnv *wenv = serd_env_new(&bn);
+
+        SerdWriter *writer = serd_writer_new
+            (SERD_TURTLE,
+             SerdStyle(SERD_STYLE_ABBREVIATED | SERD_STYLE_RESOLVED | SERD_STYLE_CURIED),
+             wenv, &bu, saveSink, &tf);
+
+        serd_env_foreach(env,
+                         (SerdPrefixSink)serd_writer_set_prefix,
+                         writer);
+
+        // The SPO index is ordered by subject, so the writer can
+        // group each subject's statements together
+        try {
+            for (Index::const_iterator i = m_spo.begin(); i != m_spo.end(); ++i) {
+                writeStatement(writer, *i);
+            }
+        } catch (...) {
+            serd_writer_free(writer);
+            serd_env_free(env);
+            serd_env_free(wenv);
+            throw;
+        }
+
+        serd_writer_finish(writer);
+        serd_writer_free(writer);
+
+        serd_env_free(env);
+        serd_env_free(wenv);
+        
+        tf.close();
+
+        // New file is now completed; the following is scruffy, but
+        // that shouldn't really matter now
+
+        if (!QFile::remove(filename)) {
+            // Not necessarily fatal
+            DQ_DEBUG << "BasicStore::save: Failed to remove former save file "
+                  << filename << endl;
+        }
+        if (!QFile::rename(tmpFilename, filename)) {
+            throw RDFException("Failed to rename temporary file to save file",
+                               filename);
+        }
+    }
+
+    void addPrefixOnImport(QString pfx, Uri uri) {
+
+        DQ_DEBUG << "namespace: " << pfx << " -> " << uri << endl;
+
+        // don't call addPrefix; it tries to lock the mutex,
+        // and anyway we want to add the prefix only if it
+        // isn't already there (to avoid surprisingly changing
+        // a prefix in unusual cases, or changing the base URI)
+        if (m_prefixes.find(pfx) == m_prefixes.end()) {
+            m_prefixes[pfx] = uri;
+        }
+    }
+
+    static SerdStatus addPrefixSink(void *handle,
+                                    const SerdNode *name,
+                                    const SerdNode *uri) {
+
+        D *d = (D *)handle;
+
+        try {
+
+            QString qpfx(QString::fromUtf8((const char *)name->buf,
+                                           (int)name->n_bytes));
+            Uri quri(QString::fromUtf8((const char *)uri->buf,
+                                       (int)uri->n_bytes));
+
+            d->addPrefixOnImport(qpfx, quri);
+
+        } catch (const RDFIncompleteURI &) {
+        }
+
+        return SERD_SUCCESS;
+    }
+
+    // N-Triples has one statement per line, so it can be parsed in
+    // parallel by NTriplesParser instead of by the RDF library.  The
+    // parse needs no lock at all; the results are then merged in a
+    // single pass under the write lock
+
+    bool importNTriplesFile(QUrl url, ImportDuplicatesMode idm) {
+        // Return false if the URL is not a local file, leaving it to
+        // the RDF library to retrieve
+        QString filename = url.toLocalFile();
+        if (filename == "") return false;
+        QFile f(filename);
+        if (!f.open(QFile::ReadOnly)) {
+            throw RDFException("Failed to open file for import", url.toString());
+        }
+        importNTriples(f.readAll(), idm);
+        return true;
+    }
+
+    void importNTriples(QByteArray data, ImportDuplicatesMode idm) {
+
+        int threads = 0;
+        {
+            StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                                   "backend read");
+            threads = m_importThreads;
+        }
+
+        // If we have data in the store already, then we must add a
+        // prefix for the new blank nodes we're importing to
+        // disambiguate them.  We can't know whether the store will
+        // be empty once we have the write lock, so parse with a
+        // prefix and remove it then if it turns out to be unneeded
+        QString prefix = getNewString();
+        Triples ts = NTriplesParser::parse(data, threads, prefix);
+
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::importNTriples: " << ts.size()
+                 << " triple(s)" << endl;
+        if (m_spo.empty()) {
+            NTriplesParser::removeBlankPrefix(ts, prefix);
+        }
+        importTriples(ts, idm);
+    }
+
+    static void checkImportFormat(QString format) {
+        // Serd reads only Turtle, of which N-Triples is a subset
+        if (format == "" || format == "turtle" || format == "ntriples") {
+            return;
+        }
+        throw RDFUnsupportedError
+            ("Import format not supported with native backend (only turtle and ntriples are)",
+             format);
+    }
+
+    void import(QUrl url, ImportDuplicatesMode idm, QString format) {
+
+        DQ_DEBUG << "BasicStoreNative::import: " << url << endl;
+
+        checkImportFormat(format);
+
+        if (format == "ntriples" && importNTriplesFile(url, idm)) return;
+
+        StatisticsCollector::WriteLocker wlocker(&m_backendLock, m_stats,
+                                                 "backend write");
+        QMutexLocker plocker(&m_prefixLock);
+
+        QString base = m_baseUri.toString();
+        if (base == "") {
+            // No base URI in store: use file URL as base
+            base = url.toString();
+        }
+
+        QString fileUri = url.toString();
+
+        // serd_uri_to_path doesn't like the brief file:blah
+        // convention, it insists that file: is followed by //
+        // (the opposite of Redland)
+
+        if (fileUri.startsWith("file:") && !fileUri.startsWith("file://")) {
+            // however, it's happy with scheme-less paths
+            fileUri = fileUri.right(fileUri.length()-5);
+        }
+
+        Reader reader(base);
+
+        // if we have data in the store already, then we must add a
+        // prefix for the new blank nodes we're importing to
+        // disambiguate them
+        if (!m_spo.empty()) reader.addBlankPrefix(getNewString());
+
+        SerdStatus rv = reader.readFile(fileUri.toUtf8());
+
+        if (rv != SERD_SUCCESS) {
+            throw RDFException
+                (QString("Failed to import model from URL: %1")
+                 .arg(serdStatusToString(rv)),
+                 url.toString());
+        }
+        if (reader.failed()) {
+            throw RDFException
+                (QString("Failed to import model from URL: %1")
+                 .arg(reader.error()),
+                 url.toString());
+        }
+
+        importTriples(reader.triples(), idm);
+
+        serd_env_foreach(reader.env(), addPrefixSink, this);
+    }
+
+    void importString(QString encodedRdf, Uri baseUri,
+                      ImportDuplicatesMode idm, QString format) {
+
+        DQ_DEBUG << "BasicStoreNative::importString" << endl;
+
+        checkImportFormat(format);
+
+        if (format == "ntriples") {
+            importNTriples(encodedRdf.toUtf8(), idm);
+            return;
+        }
+
+        StatisticsCollector::WriteLocker wlocker(&m_backendLock, m_stats,
+                                                 "backend write");
+        QMutexLocker plocker(&m_prefixLock);
+
+        Reader reader(baseUri.toString());
+
+        if (!m_spo.empty()) reader.addBlankPrefix(getNewString());
+
+        SerdStatus rv = reader.readString(encodedRdf.toUtf8());
+
+        if (rv != SERD_SUCCESS) {
+            throw RDFException
+                (QString("Failed to import model from string: %1")
+                 .arg(serdStatusToString(rv)));
+        }
+        if (reader.failed()) {
+            throw RDFException
+                (QString("Failed to import model from string: %1")
+                 .arg(reader.error()));
+        }
+
+        importTriples(reader.triples(), idm);
+
+        serd_env_foreach(reader.env(), addPrefixSink, this);
+    }
+
+    void saveSnapshot(QString filename) const {
+
+        Uri baseUri;
+        PrefixMap prefixes;
+        {
+            QMutexLocker plocker(&m_prefixLock);
+            baseUri = m_baseUri;
+            prefixes = m_prefixes;
+        }
+
+        // The writer takes its own copy of everything, so the file
+        // can be written after the store is unlocked
+        SnapshotWriter writer(baseUri, prefixes);
+        {
+            StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                                   "backend read");
+            DQ_DEBUG << "BasicStore::saveSnapshot(" << filename << ")" << endl;
+            doMatch(Triple(), [&](const Triple &t) {
+                    writer.add(t);
+                    return true;
+                });
+        }
+        writer.write(filename);
+    }
+
+    void loadSnapshot(const SnapshotReader &reader) {
+
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::loadSnapshot: " << reader.getTripleCount()
+                 << " triple(s)" << endl;
+
+        {
+            QMutexLocker plocker(&m_prefixLock);
+            m_baseUri = reader.getBaseUri();
+            m_prefixes = reader.getPrefixes();
+        }
+
+        // The snapshot is already dictionary-encoded, so its terms
+        // and ID triples go straight into the dictionary and indexes
+        QVector<quint32> ids(reader.getTermCount());
+        for (int i = 0; i < ids.size(); ++i) {
+            ids[i] = intern(reader.getTerm(i));
+        }
+        for (quint64 i = 0; i < reader.getTripleCount(); ++i) {
+            quint32 s, p, o;
+            reader.getTripleIds(i, s, p, o);
+            Key k(ids[s], ids[p], ids[o]);
+            if (!checkComplete(Triple(m_terms.at(k.a), m_terms.at(k.b),
+                                      m_terms.at(k.c)))) {
+                throw RDFException("Failed to load triple from snapshot (statement is incomplete)");
+            }
+            insert(k);
+        }
+    }
+
+private:
+    // A triple of term IDs.  The same type serves for all three
+    // indexes, with a, b and c taken in the index's own order
+    struct Key {
+        Key(quint32 _a = 0, quint32 _b = 0, quint32 _c = 0) :
+            a(_a), b(_b), c(_c) { }
+        quint32 a;
+        quint32 b;
+        quint32 c;
+        bool operator<(const Key &k) const {
+            if (a != k.a) return a < k.a;
+            if (b != k.b) return b < k.b;
+            return c < k.c;
+        }
+    };
+
+    typedef std::set<Key> Index;
+
+    enum Order { SPO, POS, OSP };
+
+    Index m_spo;
+    Index m_pos;
+    Index m_osp;
+    QHash<Node, quint32> m_ids;
+    QVector<Node> m_terms; // indexed by ID
+    int m_uriCacheSize;
+    int m_importThreads; // protected by m_backendLock
+    mutable QReadWriteLock m_backendLock; // protects indexes and dictionary
+    mutable StatisticsCollector m_stats;
+
+    typedef QHash<QString, Uri> PrefixMap;
+    Uri m_baseUri;
+    PrefixMap m_prefixes;
+    mutable QMutex m_prefixLock; // also protects m_baseUri
+
+    /**
+     * Parses Turtle with Serd into a list of Triples, keeping track
+     * of the prefixes and base URI declared in the document as it
+     * goes.  Errors found while converting nodes are recorded rather
+     * than thrown, as they must not pass back through Serd.
+     */
+    class Reader
+    {
+    public:
+        Reader(QString base) : m_failed(false) {
+            m_base = base.toUtf8();
+            SerdNode bn = serd_node_from_string
+                (SERD_URI, (const uint8_t *)m_base.data());
+            m_env = serd_env_new(&bn);
+            m_reader = serd_reader_new(SERD_TURTLE, this, 0,
+                                       baseSink, prefixSink,
+                                       statementSink, 0);
+        }
+        ~Reader() {
+            serd_reader_free(m_reader);
+            serd_env_free(m_env);
+        }
+
+        void addBlankPrefix(QString prefix) {
+            serd_reader_add_blank_prefix
+                (m_reader, (const uint8_t *)prefix.toUtf8().data());
+        }
+
+        SerdStatus readFile(QByteArray file) {
+            return serd_reader_read_file
+                (m_reader, (const uint8_t *)file.data());
+        }
+
+        SerdStatus readString(QByteArray rdf) {
+            return serd_reader_read_string
+                (m_reader, (const uint8_t *)rdf.data());
+        }
+
+        bool failed() const { return m_failed; }
+        QString error() const { return m_error; }
+        const Triples &triples() const { return m_triples; }
+        SerdEnv *env() const { return m_env; }
+
+    private:
+        QByteArray m_base;
+        SerdEnv *m_env;
+        SerdReader *m_reader;
+        Triples m_triples;
+        bool m_failed;
+        QString m_error;
+
+        static SerdStatus baseSink(void *handle, const SerdNode *uri) {
+            Reader *r = (Reader *)handle;
+            return serd_env_set_base_uri(r->m_env, uri);
+        }
+
+        static SerdStatus prefixSink(void *handle,
+                                     const SerdNode *name,
+                                     const SerdNode *uri) {
+            Reader *r = (Reader *)handle;
+            return serd_env_set_prefix(r->m_env, name, uri);
+        }
+
+        static SerdStatus statementSink(void *handle,
+                                        SerdStatementFlags,
+                                        const SerdNode *,
+                                        const SerdNode *subject,
+                                        const SerdNode *predicate,
+                                        const SerdNode *object,
+                                        const SerdNode *datatype,
+                                        const SerdNode *) {
+            Reader *r = (Reader *)handle;
+            try {
+                r->m_triples.push_back
+                    (Triple(r->toNode(subject, 0),
+                            r->toNode(predicate, 0),
+                            r->toNode(object, datatype)));
+            } catch (const RDFException &e) {
+                if (!r->m_failed) {
+                    r->m_failed = true;
+                    r->m_error = e.what();
+                }
+                return SERD_ERR_BAD_ARG;
+            }
+            return SERD_SUCCESS;
+        }
+
+        QString expand(const SerdNode *sn) const {
+            // Resolves relative URIs and abbreviated (prefixed) names
+            SerdNode en = serd_env_expand_node(m_env, sn);
+            if (!en.buf) {
+                throw RDFException("Failed to expand URI",
+                                   QString::fromUtf8((const char *)sn->buf,
+                                                     (int)sn->n_bytes));
+            }
+            QString s = QString::fromUtf8((const char *)en.buf,
+                                          (int)en.n_bytes);
+            serd_node_free(&en);
+            return s;
+        }
+
+        Node toNode(const SerdNode *sn, const SerdNode *datatype) const {
+            Node v;
+            if (!sn) return v;
+            switch (sn->type) {
+            case SERD_URI:
+            case SERD_CURIE:
+                v.type = Node::URI;
+                v.value = expand(sn);
+                break;
+            case SERD_BLANK:
+                v.type = Node::Blank;
+                v.value = QString::fromUtf8((const char *)sn->buf,
+                                            (int)sn->n_bytes);
+                break;
+            case SERD_LITERAL:
+                v.type = Node::Literal;
+                v.value = QString::fromUtf8((const char *)sn->buf,
+                                            (int)sn->n_bytes);
+                if (datatype && datatype->buf) {
+                    v.datatype = Uri(expand(datatype));
+                }
+                break;
+            default:
+                break;
+            }
+            return v;
+        }
+    };
+
+    void importTriples(const Triples &ts, ImportDuplicatesMode idm) {
+
+        // Called with m_backendLock held for writing.  Nothing is
+        // added unless the whole document can be
+
+        for (int i = 0; i < ts.size(); ++i) {
+            if (!checkComplete(ts[i])) {
+                throw RDFException("Failed to import triple (statement is incomplete)", ts[i]);
+            }
+        }
+
+        if (idm == ImportFailOnDuplicates) {
+            for (int i = 0; i < ts.size(); ++i) {
+                Key k;
+                if (lookup(ts[i], k) && m_spo.find(k) != m_spo.end()) {
+                    throw RDFDuplicateImportException("Duplicate statement encountered on import in ImportFailOnDuplicates mode", ts[i]);
+                }
+            }
+        }
+
+        // The indexes cannot hold duplicate triples, so in
+        // ImportPermitDuplicates mode they are merged as well
+        for (int i = 0; i < ts.size(); ++i) {
+            insert(intern(ts[i]));
+        }
+    }
+
+    // Dictionary.  Nodes are held in a canonical form, as the
+    // datatype is significant only for literals
+
+    static Node canonical(Node n) {
+        if (n.type != Node::Literal) n.datatype = Uri();
+        return n;
+    }
+
+    quint32 lookup(const Node &n) const {
+        // Return 0 if the node has never been entered
+        QHash<Node, quint32>::const_iterator i = m_ids.find(canonical(n));
+        if (i == m_ids.end()) return 0;
+        return i.value();
+    }
+
+    bool lookup(const Triple &t, Key &k) const {
+        // Return false if any node has never been entered, in which
+        // case no triple containing it can be in the store
+        k = Key(lookup(t.a), lookup(t.b), lookup(t.c));
+        return k.a && k.b && k.c;
+    }
+
+    quint32 intern(const Node &n) { // called with m_backendLock held for writing
+        Node cn = canonical(n);
+        QHash<Node, quint32>::const_iterator i = m_ids.find(cn);
+        if (i != m_ids.end()) return i.value();
+        quint32 id = m_terms.size();
+        m_terms.push_back(cn);
+        m_ids.insert(cn, id);
+        return id;
+    }
+
+    Key intern(const Triple &t) {
+        return Key(intern(t.a), intern(t.b), intern(t.c));
+    }
+
+    // Indexes.  Keys passed to and from these functions are always
+    // in SPO order
+
+    bool insert(const Key &k) {
+        if (!m_spo.insert(k).second) return false;
+        m_pos.insert(Key(k.b, k.c, k.a));
+        m_osp.insert(Key(k.c, k.a, k.b));
+        return true;
+    }
+
+    bool erase(const Key &k) {
+        if (!m_spo.erase(k)) return false;
+        m_pos.erase(Key(k.b, k.c, k.a));
+        m_osp.erase(Key(k.c, k.a, k.b));
+        return true;
+    }
+
+    static Key toSPO(const Key &k, Order order) {
+        switch (order) {
+        case POS: return Key(k.c, k.a, k.b);
+        case OSP: return Key(k.b, k.c, k.a);
+        case SPO: default: return k;
+        }
+    }
+
+    bool resolve(Triple t, Order &order, Key &prefix) const {
+
+        // Find the index and key prefix for a wildcard pattern, such
+        // that the bound nodes come first in the key and the wildcards
+        // (0) last.  Return false if any bound node has never been
+        // entered, in which case nothing can match
+
+        quint32 s = 0, p = 0, o = 0;
+        if (t.a.type != Node::Nothing && !(s = lookup(t.a))) return false;
+        if (t.b.type != Node::Nothing && !(p = lookup(t.b))) return false;
+        if (t.c.type != Node::Nothing && !(o = lookup(t.c))) return false;
+
+        if (s && (p || !o)) {
+            order = SPO; prefix = Key(s, p, o);
+        } else if (s) {
+            order = OSP; prefix = Key(o, s, 0);
+        } else if (p) {
+            order = POS; prefix = Key(p, o, 0);
+        } else {
+            order = OSP; prefix = Key(o, 0, 0);
+        }
+        return true;
+    }
+
+    void scan(Order order, Key prefix,
+              const std::function<bool(const Key &)> &f) const {
+
+        // Call f with the SPO key of each triple matching the prefix,
+        // stopping if it returns false.  An all-wildcard prefix
+        // matches everything
+
+        const Index &index =
+            (order == SPO ? m_spo : order == POS ? m_pos : m_osp);
+
+        // Wildcards are 0, which sorts before any real ID, so this
+        // finds the first match if there is one
+        Index::const_iterator i = index.lower_bound(prefix);
+
+        for (; i != index.end(); ++i) {
+            if (prefix.a && i->a != prefix.a) break;
+            if (prefix.b && i->b != prefix.b) break;
+            if (prefix.c && i->c != prefix.c) break;
+            if (!f(toSPO(*i, order))) break;
+        }
+    }
+
+    // doAdd, doRemove and restoreChange are called with m_backendLock
+    // held for writing
+
+    void restoreChange(Change c, bool undo) {
+        // Used only when backing out of a failed change or revert, to
+        // undo (or redo) a change that has already succeeded once
+        if ((c.first == AddTriple) != undo) doAdd(c.second);
+        else doRemove(c.second);
+    }
+    
+    bool doAdd(Triple t) {
+        if (!checkComplete(t)) {
+            throw RDFException("Failed to add triple (statement is incomplete)");
+        }
+        return insert(intern(t));
+    }
+
+    bool doRemove(Triple t) {
+        if (!checkComplete(t)) {
+            throw RDFException("Failed to remove triple (statement is incomplete)");
+        }
+        Key k;
+        if (!lookup(t, k)) return false;
+        return erase(k);
+    }
+
+    bool checkComplete(const Triple &t) const {
+        if (t.a.type == Node::Nothing ||
+            t.b.type == Node::Nothing ||
+            t.c.type == Node::Nothing) {
+            std::cerr << "BasicStore::checkComplete: WARNING: RDF statement contains one or more NULL nodes" << std::endl;
+            return false;
+        }
+        if ((t.a.type == Node::URI || t.a.type == Node::Blank) &&
+            t.b.type == Node::URI) {
+            return true;
+        } else {
+            std::cerr << "BasicStore::checkComplete: WARNING: RDF statement is incomplete: [" << t.a.value.toStdString() << "," << t.b.value.toStdString() << "," << t.c.value.toStdString() << "]" << std::endl;
+            return false;
+        }
+    }
+
+    static SerdNode toSerdNode(const Node &n, QByteArray &b) {
+        // b must outlive the returned node
+        b = n.value.toUtf8();
+        SerdType type = SERD_LITERAL;
+        if (n.type == Node::URI) type = SERD_URI;
+        else if (n.type == Node::Blank) type = SERD_BLANK;
+        return serd_node_from_string(type, (const uint8_t *)b.data());
+    }
+
+    void writeStatement(SerdWriter *writer, const Key &k) const {
+        const Node &object = m_terms.at(k.c);
+        QByteArray sb, pb, ob, db;
+        SerdNode sn = toSerdNode(m_terms.at(k.a), sb);
+        SerdNode pn = toSerdNode(m_terms.at(k.b), pb);
+        SerdNode on = toSerdNode(object, ob);
+        SerdNode dn = SERD_NODE_NULL;
+        if (object.type == Node::Literal && object.datatype != Uri()) {
+            db = object.datatype.toString().toUtf8();
+            dn = serd_node_from_string(SERD_URI, (const uint8_t *)db.data());
+        }
+        SerdStatus rv = serd_writer_write_statement
+            (writer, 0, 0, &sn, &pn, &on, dn.buf ? &dn : 0, 0);
+        if (rv != SERD_SUCCESS) {
+            throw RDFException
+                (QString("Failed to write statement: %1")
+                 .arg(serdStatusToString(rv)),
+                 Triple(m_terms.at(k.a), m_terms.at(k.b), object));
+        }
+    }
+
+    void addToSerdNamespace(SerdEnv *env, QString key, QString value) const {
+
+        QByteArray b = key.toUtf8();
+        QByteArray v = value.toUtf8();
+
+        SerdNode name = serd_node_from_string(SERD_URI, (uint8_t *)b.data());
+        SerdNode uri = serd_node_from_string(SERD_URI, (uint8_t *)v.data());
+            
+        serd_env_set_prefix(env, &name, &uri); // copies name, uri
+    }
+
+    Triples doMatch(Triple t, bool single = false) const {
+        // Any of a, b, and c in t that have Nothing as their node type
+        // will contribute all matching nodes to the returned triples
+        Triples results;
+        doMatch(t, [&](const Triple &r) {
+                results.push_back(r);
+                return !single;
+            });
+        return results;
+    }
+
+    void doMatch(Triple t, const TripleVisitor &visitor) const {
+        // Called with m_backendLock held (possibly shared with other
+        // readers).  IDs become Nodes only here, one triple at a time
+        Order order;
+        Key prefix;
+        if (!resolve(t, order, prefix)) return;
+        scan(order, prefix, [&](const Key &k) {
+                return visitor(Triple(m_terms.at(k.a),
+                                      m_terms.at(k.b),
+                                      m_terms.at(k.c)));
+            });
+    }
+
+    static QString serdStatusToString(SerdStatus s)
+    {
+        switch (s) {
+        case SERD_SUCCESS: return "Success";
+        case SERD_FAILURE: return "Non-fatal failure";
+        case SERD_ERR_UNKNOWN: return "Unknown error";
+        case SERD_ERR_BAD_SYNTAX: return "Invalid syntax";
+        case SERD_ERR_NOT_FOUND: return "Not found";
+        case SERD_ERR_BAD_ARG: return "Bad argument";
+        case SERD_ERR_ID_CLASH: return "Blank node ID clash";
+        case SERD_ERR_BAD_CURIE: return "Bad abbreviated URI";
+        case SERD_ERR_INTERNAL: return "Internal error in Serd";
+        default: return "General Serd error";
+        }
+    }
+};
+
+BasicStore::BasicStore() :
+    m_d(new D())
+{
+}
+
+BasicStore::~BasicStore()
+{
+    delete m_d;
+}
+
+void
+BasicStore::setBaseUri(Uri uri)
+{
+    m_d->setBaseUri(uri);
+}
+
+Uri
+BasicStore::getBaseUri() const
+{
+    return m_d->getBaseUri();
+}
+
+void
+BasicStore::clear()
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "clear");
+    m_d->clear();
+}
+
+bool
+BasicStore::add(Triple t)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "add");
+    return m_d->add(t);
+}
+
+bool
+BasicStore::remove(Triple t)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "remove");
+    return m_d->remove(t);
+}
+
+int
+BasicStore::addAll(Triples ts)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "addAll",
+                                     ts.size());
+    return m_d->addAll(ts);
+}
+
+int
+BasicStore::removeAll(Triples ts)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "removeAll",
+                                     ts.size());
+    return m_d->removeAll(ts);
+}
+
+void
+BasicStore::change(ChangeSet t)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "change",
+                                     t.size());
+    m_d->change(t);
+}
+
+void
+BasicStore::revert(ChangeSet t)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "revert",
+                                     t.size());
+    m_d->revert(t);
+}
+
+bool
+BasicStore::contains(Triple t) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "contains");
+    return m_d->contains(t);
+}
+
+QList<bool>
+BasicStore::containsAll(Triples ts) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(),
+                                      "containsAll", ts.size());
+    return m_d->containsAll(ts);
+}
+
+Triples
+BasicStore::match(Triple t) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "match");
+    return m_d->match(t);
+}
+
+void
+BasicStore::match(Triple t, TripleVisitor visitor) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "match");
+    m_d->match(t, visitor);
+}
+
+int
+BasicStore::count(Triple t) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "count");
+    return m_d->count(t);
+}
+
+int
+BasicStore::size() const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "size");
+    return m_d->size();
+}
+
+void
+BasicStore::addPrefix(QString prefix, Uri uri)
+{
+    m_d->addPrefix(prefix, uri);
+}
+
+void
+BasicStore::setUriCacheSize(int uris)
+{
+    m_d->setUriCacheSize(uris);
+}
+
+int
+BasicStore::getUriCacheSize() const
+{
+    return m_d->getUriCacheSize();
+}
+
+quint64
+BasicStore::getUriCacheHits() const
+{
+    return m_d->getUriCacheHits();
+}
+
+quint64
+BasicStore::getUriCacheMisses() const
+{
+    return m_d->getUriCacheMisses();
+}
+
+void
+BasicStore::setImportThreads(int threads)
+{
+    m_d->setImportThreads(threads);
+}
+
+int
+BasicStore::getImportThreads() const
+{
+    return m_d->getImportThreads();
+}
+
+void
+BasicStore::setStatisticsEnabled(bool enabled)
+{
+    m_d->getStatisticsCollector().setEnabled(enabled);
+}
+
+bool
+BasicStore::getStatisticsEnabled() const
+{
+    return m_d->getStatisticsCollector().isEnabled();
+}
+
+Statistics
+BasicStore::getStatistics() const
+{
+    return m_d->getStatisticsCollector().getStatistics();
+}
+
+void
+BasicStore::resetStatistics()
+{
+    m_d->getStatisticsCollector().reset();
+}
+
+ResultSet
+BasicStore::query(QString sparql) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "query");
+    return m_d->query(sparql);
+}
+
+Node
+BasicStore::complete(Triple t) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "complete");
+    return m_d->complete(t);
+}
+
+Triple
+BasicStore::matchOnce(Triple t) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "matchOnce");
+    return m_d->matchOnce(t);
+}
+
+Node
+BasicStore::queryOnce(QString sparql, QString bindingName) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "queryOnce");
+    return m_d->queryOnce(sparql, bindingName);
+}
+
+Uri
+BasicStore::getUniqueUri(QString prefix) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "getUniqueUri");
+    return m_d->getUniqueUri(prefix);
+}
+
+Uri
+BasicStore::expand(QString uri) const
+{
+    return m_d->expand(uri);
+}
+
+Node
+BasicStore::addBlankNode()
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "addBlankNode");
+    return m_d->addBlankNode();
+}
+
+void
+BasicStore::save(QString filename) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "save");
+    m_d->save(filename);
+}
+
+void
+BasicStore::saveSnapshot(QString filename) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "saveSnapshot");
+    m_d->saveSnapshot(filename);
+}
+
+void
+BasicStore::import(QUrl url, ImportDuplicatesMode idm, QString format)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "import");
+    m_d->import(url, idm, format);
+}
+
+void
+BasicStore::importString(QString encodedRdf, Uri baseUri,
+                         ImportDuplicatesMode idm, QString format)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "importString");
+    m_d->importString(encodedRdf, baseUri, idm, format);
+}
+
+BasicStore *
+BasicStore::load(QUrl url, QString format)
+{
+    BasicStore *s = new BasicStore();
+    QString su = url.toString();
+    Uri baseUri(su.replace(" ", "%20"));
+    s->setBaseUri(baseUri);
+    // store is empty, ImportIgnoreDuplicates is faster
+    s->import(url, ImportIgnoreDuplicates, format);
+    return s;
+}
+
+BasicStore *
+BasicStore::loadString(QString encodedRdf, Uri baseUri, QString format)
+{
+    BasicStore *s = new BasicStore();
+    s->setBaseUri(baseUri);
+    // store is empty, ImportIgnoreDuplicates is faster
+    s->importString(encodedRdf, baseUri, ImportIgnoreDuplicates, format);
+    return s;
+}
+
+BasicStore *
+BasicStore::loadSnapshot(QString filename)
+{
+    SnapshotReader reader(filename);
+    BasicStore *s = new BasicStore();
+    try {
+        s->m_d->loadSnapshot(reader);
+    } catch (...) {
+        delete s;
+        throw;
+    }
+    return s;
+}
+
+BasicStore::Features
+BasicStore::getSupportedFeatures() const
+{
+    Features fs;
+    fs << ModifyFeature;
+    return fs;
+}
+
+}
+
+#endif
+
@@ -42,11 +42,16 @@
 #include <QMutex>
 #include <QMutexLocker>
 #include <QHash>
+#include <QCache>
+#include <QVector>
 #include <QFile>
 #include <QCryptographicHash>
 #include <QReadWriteLock>
 
 #include "../Debug.h"
+#include "../StatisticsCollector.h"
+#include "../Snapshot.h"
+#include "../NTriplesParser.h"
 
 #include <cstdlib>
 #include <iostream>
@@ -57,16 +62,21 @@ namespace Dataquay
 class BasicStore::D
 {
 public:
-    D() : m_storage(0), m_model(0), m_counter(0) {
+    D() : m_storage(0), m_model(0),
+          m_uriCache(1024), m_uriCacheHits(0), m_uriCacheMisses(0),
+          m_counter(0), m_importThreads(0) {
         m_prefixes["rdf"] = Uri("http://www.w3.org/1999/02/22-rdf-syntax-ns#");
         m_prefixes["xsd"] = Uri("http://www.w3.org/2001/XMLSchema#");
         clear();
     }
 
     ~D() {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
         if (m_model) librdf_free_model(m_model);
         if (m_storage) librdf_free_storage(m_storage);
+        m_uriCache.clear(); // frees nodes, so needs the world lock
     }
     
     QString getNewString() const {
@@ -107,7 +117,9 @@ public:
     }
 
     void clear() {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::clear" << endl;
         if (m_model) librdf_free_model(m_model);
         if (m_storage) librdf_free_storage(m_storage);
@@ -126,14 +138,55 @@ public:
         m_prefixes[prefix] = uri;
     }
 
+    void setUriCacheSize(int uris) {
+        QMutexLocker worldLocker(m_w.getLock());
+        m_uriCache.setMaxCost(uris);
+    }
+
+    int getUriCacheSize() const {
+        QMutexLocker worldLocker(m_w.getLock());
+        return m_uriCache.maxCost();
+    }
+
+    quint64 getUriCacheHits() const {
+        QMutexLocker worldLocker(m_w.getLock());
+        return m_uriCacheHits;
+    }
+
+    quint64 getUriCacheMisses() const {
+        QMutexLocker worldLocker(m_w.getLock());
+        return m_uriCacheMisses;
+    }
+
+    void setImportThreads(int threads) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        m_importThreads = threads;
+    }
+
+    int getImportThreads() const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        return m_importThreads;
+    }
+
+    StatisticsCollector &getStatisticsCollector() const {
+        return m_stats;
+    }
+
     bool add(Triple t) {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::add: " << t << endl;
-        return doAdd(t);
+        NodeCache nc(this);
+        return doAdd(t, nc);
     }
 
     bool remove(Triple t) {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::remove: " << t << endl;
         if (t.a.type == Node::Nothing || 
             t.b.type == Node::Nothing ||
@@ -141,62 +194,164 @@ public:
             Triples tt = doMatch(t);
             if (tt.empty()) return false;
             DQ_DEBUG << "BasicStore::remove: Removing " << tt.size() << " triple(s)" << endl;
+            NodeCache nc(this);
             for (int i = 0; i < tt.size(); ++i) {
-                if (!doRemove(tt[i])) {
+                if (!doRemove(tt[i], nc)) {
                     DQ_DEBUG << "Failed to remove matched triple in remove() with wildcards; triple was: " << tt[i] << endl;
                     throw RDFInternalError("Failed to remove matched statement in remove() with wildcards");
                 }
             }
             return true;
         } else {
-            return doRemove(t);
+            NodeCache nc(this);
+            return doRemove(t, nc);
+        }
+    }
+
+    int addAll(Triples ts) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
+        DQ_DEBUG << "BasicStore::addAll: " << ts.size() << " triple(s)" << endl;
+        NodeCache nc(this);
+        QVector<librdf_statement *> statements;
+        int added = 0;
+        try {
+            // Convert everything before adding anything, so that an
+            // incomplete triple leaves the store unchanged
+            foreach (Triple t, ts) {
+                librdf_statement *statement = nc.toStatement(t);
+                statements.push_back(statement);
+                if (!checkComplete(statement)) {
+                    throw RDFException("Failed to add triple (statement is incomplete)", t);
+                }
+            }
+            foreach (librdf_statement *statement, statements) {
+                if (librdf_model_contains_statement(m_model, statement)) {
+                    continue;
+                }
+                if (librdf_model_add_statement(m_model, statement)) {
+                    throw RDFInternalError("Failed to add statement to model");
+                }
+                ++added;
+            }
+        } catch (...) {
+            foreach (librdf_statement *statement, statements) {
+                librdf_free_statement(statement);
+            }
+            throw;
+        }
+        foreach (librdf_statement *statement, statements) {
+            librdf_free_statement(statement);
+        }
+        DQ_DEBUG << "BasicStore::addAll: added " << added << endl;
+        return added;
+    }
+
+    int removeAll(Triples ts) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
+        DQ_DEBUG << "BasicStore::removeAll: " << ts.size() << " triple(s)" << endl;
+        NodeCache nc(this);
+        QVector<librdf_statement *> statements;
+        int removed = 0;
+        try {
+            foreach (Triple t, ts) {
+                librdf_statement *statement = nc.toStatement(t);
+                statements.push_back(statement);
+                if (!checkComplete(statement)) {
+                    throw RDFException("Failed to remove triple (statement is incomplete)", t);
+                }
+            }
+            foreach (librdf_statement *statement, statements) {
+                // See doRemove for why we test this separately
+                if (!librdf_model_contains_statement(m_model, statement)) {
+                    continue;
+                }
+                librdf_model_remove_statement(m_model, statement);
+                ++removed;
+            }
+        } catch (...) {
+            foreach (librdf_statement *statement, statements) {
+                librdf_free_statement(statement);
+            }
+            throw;
+        }
+        foreach (librdf_statement *statement, statements) {
+            librdf_free_statement(statement);
         }
+        DQ_DEBUG << "BasicStore::removeAll: removed " << removed << endl;
+        return removed;
     }
 
     void change(ChangeSet cs) {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::change: " << cs.size() << " changes" << endl;
-        for (int i = 0; i < cs.size(); ++i) {
-            ChangeType type = cs[i].first;
-            Triple triple = cs[i].second;
-            switch (type) {
-            case AddTriple:
-                if (!doAdd(triple)) {
-                    throw RDFException("Change add failed: triple is already in store", triple);
-                }
-                break;
-            case RemoveTriple:
-                if (!doRemove(cs[i].second)) {
-                    throw RDFException("Change remove failed: triple is not in store", triple);
+        NodeCache nc(this);
+        int i = 0;
+        try {
+            for (i = 0; i < cs.size(); ++i) {
+                ChangeType type = cs[i].first;
+                Triple triple = cs[i].second;
+                switch (type) {
+                case AddTriple:
+                    if (!doAdd(triple, nc)) {
+                        throw RDFException("Change add failed: triple is already in store", triple);
+                    }
+                    break;
+                case RemoveTriple:
+                    if (!doRemove(cs[i].second, nc)) {
+                        throw RDFException("Change remove failed: triple is not in store", triple);
+                    }
+                    break;
                 }
-                break;
             }
+        } catch (const RDFException &) {
+            // Undo the changes that succeeded, so the store is left
+            // as it was before the call
+            while (--i >= 0) restoreChange(cs[i], true, nc);
+            throw;
         }
     }
 
     void revert(ChangeSet cs) {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::revert: " << cs.size() << " changes" << endl;
-        for (int i = cs.size()-1; i >= 0; --i) {
-            ChangeType type = cs[i].first;
-            Triple triple = cs[i].second;
-            switch (type) {
-            case AddTriple:
-                if (!doRemove(triple)) {
-                    throw RDFException("Revert of add failed: triple is not in store", triple);
-                }
-                break;
-            case RemoveTriple:
-                if (!doAdd(triple)) {
-                    throw RDFException("Revert of remove failed: triple is already in store", triple);
+        NodeCache nc(this);
+        int i = cs.size()-1;
+        try {
+            for (i = cs.size()-1; i >= 0; --i) {
+                ChangeType type = cs[i].first;
+                Triple triple = cs[i].second;
+                switch (type) {
+                case AddTriple:
+                    if (!doRemove(triple, nc)) {
+                        throw RDFException("Revert of add failed: triple is not in store", triple);
+                    }
+                    break;
+                case RemoveTriple:
+                    if (!doAdd(triple, nc)) {
+                        throw RDFException("Revert of remove failed: triple is already in store", triple);
+                    }
+                    break;
                 }
-                break;
             }
+        } catch (const RDFException &) {
+            // Reapply the changes we had already reverted
+            while (++i < cs.size()) restoreChange(cs[i], false, nc);
+            throw;
         }
     }
 
     bool contains(Triple t) const {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::contains: " << t << endl;
         librdf_statement *statement = tripleToStatement(t);
         if (!checkComplete(statement)) {
@@ -211,9 +366,30 @@ public:
             return true;
         }
     }
+
+    QList<bool> containsAll(Triples ts) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
+        DQ_DEBUG << "BasicStore::containsAll: " << ts.size() << " triple(s)" << endl;
+        NodeCache nc(this);
+        QList<bool> found;
+        foreach (Triple t, ts) {
+            librdf_statement *statement = nc.toStatement(t);
+            if (!checkComplete(statement)) {
+                librdf_free_statement(statement);
+                throw RDFException("Failed to test for triple (statement is incomplete)", t);
+            }
+            found.push_back(librdf_model_contains_statement(m_model, statement) != 0);
+            librdf_free_statement(statement);
+        }
+        return found;
+    }
     
     Triples match(Triple t) const {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::match: " << t << endl;
         Triples result = doMatch(t);
 #ifndef NDEBUG
@@ -225,6 +401,90 @@ public:
         return result;
     }
 
+    void match(Triple t, TripleVisitor visitor) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::match (visitor): " << t << endl;
+        // The world lock is shared by every Redland store, so the
+        // visitor must run without it: otherwise a visitor that used
+        // any other store would deadlock, and every other store would
+        // wait for the visitor.  Read the matches a batch at a time
+        // under the lock, and visit each batch after releasing it.
+        // Nothing touches the stream while the lock is released, and
+        // our backend lock keeps writers out of this store meanwhile
+        static const int batchSize = 1024;
+        QMutexLocker worldLocker(m_w.getLock());
+        bool locked = true;
+        librdf_statement *templ = tripleToStatement(t);
+        librdf_stream *stream = librdf_model_find_statements(m_model, templ);
+        if (!stream) {
+            librdf_free_statement(templ);
+            throw RDFInternalError("Failed to match RDF triples");
+        }
+        try {
+            bool more = true;
+            while (more && !librdf_stream_end(stream)) {
+                Triples batch;
+                while (!librdf_stream_end(stream) && batch.size() < batchSize) {
+                    librdf_statement *current = librdf_stream_get_object(stream);
+                    if (current) batch.push_back(statementToTriple(current));
+                    librdf_stream_next(stream);
+                }
+                worldLocker.unlock();
+                locked = false;
+                foreach (const Triple &r, batch) {
+                    if (!visitor(r)) {
+                        more = false;
+                        break;
+                    }
+                }
+                worldLocker.relock();
+                locked = true;
+            }
+        } catch (...) {
+            if (!locked) worldLocker.relock();
+            librdf_free_stream(stream);
+            librdf_free_statement(templ);
+            throw;
+        }
+        librdf_free_stream(stream);
+        librdf_free_statement(templ);
+    }
+
+    int count(Triple t) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
+        DQ_DEBUG << "BasicStore::count: " << t << endl;
+        if (t.a.type == Node::Nothing &&
+            t.b.type == Node::Nothing &&
+            t.c.type == Node::Nothing) {
+            int n = librdf_model_size(m_model);
+            if (n >= 0) return n;
+            // else the storage can't tell us, so count the hard way
+        }
+        // Step through the stream without converting anything back
+        // to Triples
+        librdf_statement *templ = tripleToStatement(t);
+        librdf_stream *stream = librdf_model_find_statements(m_model, templ);
+        if (!stream) {
+            librdf_free_statement(templ);
+            throw RDFInternalError("Failed to match RDF triples");
+        }
+        int n = 0;
+        while (!librdf_stream_end(stream)) {
+            ++n;
+            librdf_stream_next(stream);
+        }
+        librdf_free_stream(stream);
+        librdf_free_statement(templ);
+        return n;
+    }
+
+    int size() const {
+        return count(Triple());
+    }
+
     Node complete(Triple t) const {
         int count = 0, match = 0;
         if (t.a == Node()) { ++count; match = 0; }
@@ -233,7 +493,9 @@ public:
         if (count != 1) {
             throw RDFException("Cannot complete triple unless it has only a single wildcard node", t);
         }
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::complete: " << t << endl;
         Triples result = doMatch(t, true);
         if (result.empty()) return Node();
@@ -251,7 +513,9 @@ public:
             if (contains(t)) return t;
             else return Triple();
         }
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::matchOnce: " << t << endl;
         Triples result = doMatch(t, true);
 #ifndef NDEBUG
@@ -265,14 +529,18 @@ public:
     }
 
     ResultSet query(QString sparql) const {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::query: " << sparql << endl;
         ResultSet rs = runQuery(sparql);
         return rs;
     }
 
     Node queryOnce(QString sparql, QString bindingName) const {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::queryOnce: " << bindingName << " from " << sparql << endl;
         ResultSet rs = runQuery(sparql);
         if (rs.empty()) return Node();
@@ -286,7 +554,9 @@ public:
     }
 
     Uri getUniqueUri(QString prefix) const {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
         DQ_DEBUG << "BasicStore::getUniqueUri: prefix " << prefix << endl;
         bool good = false;
         Uri uri;
@@ -344,7 +614,9 @@ public:
     }
 
     Node addBlankNode() {
-        QMutexLocker locker(&m_librdfLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
         librdf_node *node = librdf_new_node_from_blank_identifier(m_w.getWorld(), 0);
         if (!node) throw RDFInternalError("Failed to create new blank node");
         Node n = lrdfNodeToNode(node);
@@ -354,7 +626,9 @@ public:
 
     void save(QString filename) const {
 
-        QMutexLocker wlocker(&m_librdfLock);
+        StatisticsCollector::ReadLocker wlocker(&m_backendLock, m_stats,
+                                                "backend read");
+        QMutexLocker worldLocker(m_w.getLock());
         QMutexLocker plocker(&m_prefixLock);
 
         DQ_DEBUG << "BasicStore::save(" << filename << ")" << endl;
@@ -407,9 +681,63 @@ public:
         }
     }
 
+    // N-Triples has one statement per line, so it can be parsed in
+    // parallel by NTriplesParser instead of by the RDF library.  The
+    // parse needs no lock at all; the results are then merged in a
+    // single pass under the write lock
+
+    bool importNTriplesFile(QUrl url, ImportDuplicatesMode idm) {
+        // Return false if the URL is not a local file, leaving it to
+        // the RDF library to retrieve
+        QString filename = url.toLocalFile();
+        if (filename == "") return false;
+        QFile f(filename);
+        if (!f.open(QFile::ReadOnly)) {
+            throw RDFException("Failed to open file for import", url.toString());
+        }
+        importNTriples(f.readAll(), idm);
+        return true;
+    }
+
+    void importNTriples(QByteArray data, ImportDuplicatesMode idm) {
+
+        int threads = 0;
+        {
+            StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                                   "backend read");
+            threads = m_importThreads;
+        }
+
+        // If we have data in the store already, then we must add a
+        // prefix for the new blank nodes we're importing to
+        // disambiguate them.  We can't know whether the store will
+        // be empty once we have the write lock, so parse with a
+        // prefix and remove it then if it turns out to be unneeded
+        QString prefix = getNewString();
+        Triples ts = NTriplesParser::parse(data, threads, prefix);
+
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::importNTriples: " << ts.size()
+                 << " triple(s)" << endl;
+        bool empty = false;
+        {
+            QMutexLocker worldLocker(m_w.getLock());
+            empty = (librdf_model_size(m_model) == 0);
+        }
+        if (empty) {
+            NTriplesParser::removeBlankPrefix(ts, prefix);
+        }
+        importTriples(ts, idm);
+    }
+
     void import(QUrl url, ImportDuplicatesMode idm, QString format) {
 
-        QMutexLocker wlocker(&m_librdfLock);
+        if (format == "ntriples" && importNTriplesFile(url, idm)) return;
+
+        StatisticsCollector::WriteLocker wlocker(&m_backendLock, m_stats,
+                                                 "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
         QMutexLocker plocker(&m_prefixLock);
 
         QString base = m_baseUri.toString();
@@ -502,7 +830,14 @@ public:
     void importString(QString encodedRdf, Uri baseUri,
                       ImportDuplicatesMode idm, QString format) {
 
-        QMutexLocker wlocker(&m_librdfLock);
+        if (format == "ntriples") {
+            importNTriples(encodedRdf.toUtf8(), idm);
+            return;
+        }
+
+        StatisticsCollector::WriteLocker wlocker(&m_backendLock, m_stats,
+                                                 "backend write");
+        QMutexLocker worldLocker(m_w.getLock());
         QMutexLocker plocker(&m_prefixLock);
 
         QString base = baseUri.toString();
@@ -575,6 +910,62 @@ public:
         librdf_free_parser(parser);
     }
 
+    void saveSnapshot(QString filename) const {
+
+        Uri baseUri;
+        PrefixMap prefixes;
+        {
+            QMutexLocker plocker(&m_prefixLock);
+            baseUri = m_baseUri;
+            prefixes = m_prefixes;
+        }
+
+        // The writer takes its own copy of everything, so the file
+        // can be written after the store is unlocked
+        SnapshotWriter writer(baseUri, prefixes);
+        {
+            StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                                   "backend read");
+            QMutexLocker worldLocker(m_w.getLock());
+            DQ_DEBUG << "BasicStore::saveSnapshot(" << filename << ")" << endl;
+            doMatch(Triple(), [&](const Triple &t) {
+                    writer.add(t);
+                    return true;
+                });
+        }
+        writer.write(filename);
+    }
+
+    void loadSnapshot(const SnapshotReader &reader) {
+
+        DQ_DEBUG << "BasicStore::loadSnapshot: " << reader.getTripleCount()
+                 << " triple(s)" << endl;
+
+        {
+            QMutexLocker plocker(&m_prefixLock);
+            m_baseUri = reader.getBaseUri();
+            m_prefixes = reader.getPrefixes();
+        }
+
+        // Decode each term only once, and add the triples in batches
+        // so as not to hold them all in memory at once as Triples
+        QVector<Node> terms(reader.getTermCount());
+        for (int i = 0; i < terms.size(); ++i) {
+            terms[i] = reader.getTerm(i);
+        }
+        Triples batch;
+        for (quint64 i = 0; i < reader.getTripleCount(); ++i) {
+            quint32 s, p, o;
+            reader.getTripleIds(i, s, p, o);
+            batch.push_back(Triple(terms[s], terms[p], terms[o]));
+            if (batch.size() == 65536) {
+                addAll(batch);
+                batch.clear();
+            }
+        }
+        if (!batch.empty()) addAll(batch);
+    }
+
 private:
     class World
     {
@@ -597,6 +988,21 @@ private:
         }
         
         librdf_world *getWorld() const { return m_world; }
+
+        // librdf shares URIs and nodes between all models in a world
+        // without locking them, so any librdf call at all needs this
+        // lock.  Readers of a store share its backend lock, but they
+        // still take turns here, with readers of every other store:
+        // with Redland, reads are not concurrent at all.  A world per
+        // store would free stores from waiting for one another, but
+        // Redland doesn't promise that separate worlds may be used
+        // from separate threads at once (the parsers and libraries
+        // beneath it keep state of their own), so we don't risk it.
+        // Nothing that might call back into a store (see the visitor
+        // form of match) may be called with it held
+        QMutex *getLock() const {
+            return &m_mutex;
+        }
         
     private:
         static QMutex m_mutex;
@@ -607,7 +1013,27 @@ private:
     World m_w;
     librdf_storage *m_storage;
     librdf_model *m_model;
-    static QMutex m_librdfLock; // assume the worst
+    mutable QReadWriteLock m_backendLock; // protects m_model
+    mutable StatisticsCollector m_stats;
+
+    // A reference to the librdf node for a recently used URI,
+    // released when the cache evicts it
+    class CachedUri
+    {
+    public:
+        CachedUri(librdf_node *node) : m_node(node) { }
+        ~CachedUri() { librdf_free_node(m_node); }
+        librdf_node *node() const { return m_node; }
+    private:
+        librdf_node *m_node;
+    };
+
+    // The URI cache and its counters are protected by the world lock
+    // rather than m_backendLock, as they are used wherever nodes are
+    // converted, including by readers sharing m_backendLock
+    mutable QCache<Uri, CachedUri> m_uriCache;
+    mutable quint64 m_uriCacheHits;
+    mutable quint64 m_uriCacheMisses;
 
     typedef QHash<QString, Uri> PrefixMap;
     Uri m_baseUri;
@@ -615,6 +1041,7 @@ private:
     mutable QMutex m_prefixLock; // also protects m_baseUri
 
     mutable int m_counter;
+    int m_importThreads; // protected by m_backendLock
 
     void importFromTemporaryModel(librdf_model *im, ImportDuplicatesMode idm) {
         
@@ -669,6 +1096,49 @@ private:
         if (all) librdf_free_statement(all);
     }
 
+    void importTriples(const Triples &ts, ImportDuplicatesMode idm) {
+
+        // Called with m_backendLock held for writing.  Nothing is
+        // added unless the whole document can be
+
+        QMutexLocker worldLocker(m_w.getLock());
+        NodeCache nc(this);
+        QVector<librdf_statement *> statements;
+        try {
+            foreach (Triple t, ts) {
+                librdf_statement *statement = nc.toStatement(t);
+                statements.push_back(statement);
+                if (!checkComplete(statement)) {
+                    throw RDFException("Failed to import triple (statement is incomplete)", t);
+                }
+            }
+            if (idm == ImportFailOnDuplicates) {
+                for (int i = 0; i < statements.size(); ++i) {
+                    if (librdf_model_contains_statement(m_model, statements[i])) {
+                        throw RDFDuplicateImportException("Duplicate statement encountered on import in ImportFailOnDuplicates mode", ts[i]);
+                    }
+                }
+            }
+            foreach (librdf_statement *statement, statements) {
+                if (idm != ImportPermitDuplicates &&
+                    librdf_model_contains_statement(m_model, statement)) {
+                    continue;
+                }
+                if (librdf_model_add_statement(m_model, statement)) {
+                    throw RDFInternalError("Failed to add statement to model");
+                }
+            }
+        } catch (...) {
+            foreach (librdf_statement *statement, statements) {
+                librdf_free_statement(statement);
+            }
+            throw;
+        }
+        foreach (librdf_statement *statement, statements) {
+            librdf_free_statement(statement);
+        }
+    }
+
     void importNamespacesFromParser(librdf_parser *parser) {
         
         int namespaces = librdf_parser_get_namespaces_seen_count(parser);
@@ -694,8 +1164,63 @@ private:
         }
     }
     
-    bool doAdd(Triple t) {
-        librdf_statement *statement = tripleToStatement(t);
+    /**
+     * Converts Dataquay nodes to librdf nodes, converting each
+     * distinct node only once however many statements it appears in.
+     * The cache keeps one reference to each node and hands out new
+     * references (cheap copies) for use in statements.  Use only with
+     * the world lock held for the whole lifetime of the cache.
+     */
+    class NodeCache
+    {
+    public:
+        NodeCache(const D *d) : m_d(d) { }
+        ~NodeCache() {
+            foreach (librdf_node *node, m_nodes) {
+                librdf_free_node(node);
+            }
+        }
+
+        librdf_node *get(Node v) {
+            if (v.type == Node::Nothing) return 0;
+            librdf_node *node = 0;
+            QHash<Node, librdf_node *>::const_iterator i = m_nodes.find(v);
+            if (i != m_nodes.end()) {
+                node = i.value();
+            } else {
+                node = m_d->nodeToLrdfNode(v);
+                m_nodes.insert(v, node);
+            }
+            return librdf_new_node_from_node(node);
+        }
+
+        librdf_statement *toStatement(Triple t) {
+            librdf_node *na = get(t.a);
+            librdf_node *nb = get(t.b);
+            librdf_node *nc = get(t.c);
+            librdf_statement *statement =
+                librdf_new_statement_from_nodes(m_d->m_w.getWorld(), na, nb, nc);
+            if (!statement) throw RDFException("Failed to construct statement");
+            return statement;
+        }
+
+    private:
+        const D *m_d;
+        QHash<Node, librdf_node *> m_nodes;
+    };
+
+    // doAdd, doRemove and restoreChange are called with both
+    // m_backendLock and the world lock held
+
+    void restoreChange(Change c, bool undo, NodeCache &nc) {
+        // Used only when backing out of a failed change or revert, to
+        // undo (or redo) a change that has already succeeded once
+        if ((c.first == AddTriple) != undo) doAdd(c.second, nc);
+        else doRemove(c.second, nc);
+    }
+
+    bool doAdd(Triple t, NodeCache &nc) {
+        librdf_statement *statement = nc.toStatement(t);
         if (!checkComplete(statement)) {
             librdf_free_statement(statement);
             throw RDFException("Failed to add triple (statement is incomplete)");
@@ -712,8 +1237,8 @@ private:
         return true;
     }
 
-    bool doRemove(Triple t) {
-        librdf_statement *statement = tripleToStatement(t);
+    bool doRemove(Triple t, NodeCache &nc) {
+        librdf_statement *statement = nc.toStatement(t);
         if (!checkComplete(statement)) {
             librdf_free_statement(statement);
             throw RDFException("Failed to remove triple (statement is incomplete)");
@@ -738,13 +1263,30 @@ private:
         return luri;
     }
 
+    librdf_node *uriToLrdfNode(Uri uri) const { // called with world lock held
+        // Returns a new reference, which the caller must free as
+        // usual; the cache keeps a reference of its own
+        CachedUri *cached = m_uriCache.object(uri);
+        if (cached) {
+            ++m_uriCacheHits;
+            return librdf_new_node_from_node(cached->node());
+        }
+        ++m_uriCacheMisses;
+        librdf_uri *luri = uriToLrdfUri(uri);
+        librdf_node *node = librdf_new_node_from_uri(m_w.getWorld(), luri);
+        librdf_free_uri(luri); // the node has its own copy
+        if (!node) throw RDFException("Failed to construct node from URI");
+        m_uriCache.insert(uri, new CachedUri(librdf_new_node_from_node(node)));
+        return node;
+    }
+
     Uri lrdfUriToUri(librdf_uri *u) const {
         const char *s = (const char *)librdf_uri_as_string(u);
         if (s) return Uri(QString::fromUtf8(s));
         else return Uri();
     }
 
-    librdf_node *nodeToLrdfNode(Node v) const { // called with m_librdfLock held
+    librdf_node *nodeToLrdfNode(Node v) const { // called with world lock held
         librdf_node *node = 0;
         switch (v.type) {
         case Node::Nothing:
@@ -759,20 +1301,19 @@ private:
         }
             break;
         case Node::URI: {
-            librdf_uri *uri = uriToLrdfUri(Uri(v.value));
-            if (!uri) throw RDFException("Failed to construct URI from value ", v.value);
-            node = librdf_new_node_from_uri(m_w.getWorld(), uri);
-            if (!node) throw RDFException("Failed to construct node from URI");
+            node = uriToLrdfNode(Uri(v.value));
         }
             break;
         case Node::Literal: {
             QByteArray b = v.value.toUtf8();
             const unsigned char *literal = (const unsigned char *)b.data();
             if (v.datatype != Uri()) {
-                Uri dtu = v.datatype;
-                librdf_uri *type_uri = uriToLrdfUri(dtu);
+                // The literal takes its own copy of the type URI
+                librdf_node *type_node = uriToLrdfNode(v.datatype);
                 node = librdf_new_node_from_typed_literal
-                    (m_w.getWorld(), literal, 0, type_uri);
+                    (m_w.getWorld(), literal, 0,
+                     librdf_node_get_uri(type_node));
+                librdf_free_node(type_node);
                 if (!node) throw RDFException
                                ("Failed to construct node from literal of type ",
                                 v.datatype);
@@ -865,21 +1406,33 @@ private:
         // Any of a, b, and c in t that have Nothing as their node type
         // will contribute all matching nodes to the returned triples
         Triples results;
+        doMatch(t, [&](const Triple &r) {
+                results.push_back(r);
+                return !single;
+            });
+        return results;
+    }
+
+    void doMatch(Triple t, const TripleVisitor &visitor) const {
         librdf_statement *templ = tripleToStatement(t);
         librdf_stream *stream = librdf_model_find_statements(m_model, templ);
         if (!stream) {
             librdf_free_statement(templ);
             throw RDFInternalError("Failed to match RDF triples");
         }
-        while (!librdf_stream_end(stream)) {
-            librdf_statement *current = librdf_stream_get_object(stream);
-            if (current) results.push_back(statementToTriple(current));
-            if (single) break;
-            librdf_stream_next(stream);
+        try {
+            while (!librdf_stream_end(stream)) {
+                librdf_statement *current = librdf_stream_get_object(stream);
+                if (current && !visitor(statementToTriple(current))) break;
+                librdf_stream_next(stream);
+            }
+        } catch (...) {
+            librdf_free_stream(stream);
+            librdf_free_statement(templ);
+            throw;
         }
         librdf_free_stream(stream);
         librdf_free_statement(templ);
-        return results;
     }
 
     ResultSet runQuery(QString rawQuery) const {
@@ -943,9 +1496,6 @@ private:
     }
 };
 
-QMutex
-BasicStore::D::m_librdfLock;
-
 QMutex
 BasicStore::D::World::m_mutex;
 
@@ -980,78 +1530,197 @@ BasicStore::getBaseUri() const
 void
 BasicStore::clear()
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "clear");
     m_d->clear();
 }
 
 bool
 BasicStore::add(Triple t)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "add");
     return m_d->add(t);
 }
 
 bool
 BasicStore::remove(Triple t)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "remove");
     return m_d->remove(t);
 }
 
+int
+BasicStore::addAll(Triples ts)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "addAll",
+                                     ts.size());
+    return m_d->addAll(ts);
+}
+
+int
+BasicStore::removeAll(Triples ts)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "removeAll",
+                                     ts.size());
+    return m_d->removeAll(ts);
+}
+
 void
 BasicStore::change(ChangeSet t)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "change",
+                                     t.size());
     m_d->change(t);
 }
 
 void
 BasicStore::revert(ChangeSet t)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "revert",
+                                     t.size());
     m_d->revert(t);
 }
 
 bool
 BasicStore::contains(Triple t) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "contains");
     return m_d->contains(t);
 }
 
+QList<bool>
+BasicStore::containsAll(Triples ts) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(),
+                                      "containsAll", ts.size());
+    return m_d->containsAll(ts);
+}
+
 Triples
 BasicStore::match(Triple t) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "match");
     return m_d->match(t);
 }
 
+void
+BasicStore::match(Triple t, TripleVisitor visitor) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "match");
+    m_d->match(t, visitor);
+}
+
+int
+BasicStore::count(Triple t) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "count");
+    return m_d->count(t);
+}
+
+int
+BasicStore::size() const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "size");
+    return m_d->size();
+}
+
 void
 BasicStore::addPrefix(QString prefix, Uri uri)
 {
     m_d->addPrefix(prefix, uri);
 }
 
+void
+BasicStore::setUriCacheSize(int uris)
+{
+    m_d->setUriCacheSize(uris);
+}
+
+int
+BasicStore::getUriCacheSize() const
+{
+    return m_d->getUriCacheSize();
+}
+
+quint64
+BasicStore::getUriCacheHits() const
+{
+    return m_d->getUriCacheHits();
+}
+
+quint64
+BasicStore::getUriCacheMisses() const
+{
+    return m_d->getUriCacheMisses();
+}
+
+void
+BasicStore::setImportThreads(int threads)
+{
+    m_d->setImportThreads(threads);
+}
+
+int
+BasicStore::getImportThreads() const
+{
+    return m_d->getImportThreads();
+}
+
+void
+BasicStore::setStatisticsEnabled(bool enabled)
+{
+    m_d->getStatisticsCollector().setEnabled(enabled);
+}
+
+bool
+BasicStore::getStatisticsEnabled() const
+{
+    return m_d->getStatisticsCollector().isEnabled();
+}
+
+Statistics
+BasicStore::getStatistics() const
+{
+    return m_d->getStatisticsCollector().getStatistics();
+}
+
+void
+BasicStore::resetStatistics()
+{
+    m_d->getStatisticsCollector().reset();
+}
+
 ResultSet
 BasicStore::query(QString sparql) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "query");
     return m_d->query(sparql);
 }
 
 Node
 BasicStore::complete(Triple t) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "complete");
     return m_d->complete(t);
 }
 
 Triple
 BasicStore::matchOnce(Triple t) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "matchOnce");
     return m_d->matchOnce(t);
 }
 
 Node
 BasicStore::queryOnce(QString sparql, QString bindingName) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "queryOnce");
     return m_d->queryOnce(sparql, bindingName);
 }
 
 Uri
 BasicStore::getUniqueUri(QString prefix) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "getUniqueUri");
     return m_d->getUniqueUri(prefix);
 }
 
@@ -1064,18 +1733,28 @@ BasicStore::expand(QString uri) const
 Node
 BasicStore::addBlankNode()
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "addBlankNode");
     return m_d->addBlankNode();
 }
 
 void
 BasicStore::save(QString filename) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "save");
     m_d->save(filename);
 }
 
+void
+BasicStore::saveSnapshot(QString filename) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "saveSnapshot");
+    m_d->saveSnapshot(filename);
+}
+
 void
 BasicStore::import(QUrl url, ImportDuplicatesMode idm, QString format)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "import");
     m_d->import(url, idm, format);
 }
 
@@ -1083,6 +1762,7 @@ void
 BasicStore::importString(QString encodedRdf, Uri baseUri,
                          ImportDuplicatesMode idm, QString format)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "importString");
     m_d->importString(encodedRdf, baseUri, idm, format);
 }
 
@@ -1106,6 +1786,20 @@ BasicStore::loadString(QString encodedRdf, Uri baseUri, QString format)
     return s;
 }
 
+BasicStore *
+BasicStore::loadSnapshot(QString filename)
+{
+    SnapshotReader reader(filename);
+    BasicStore *s = new BasicStore();
+    try {
+        s->m_d->loadSnapshot(reader);
+    } catch (...) {
+        delete s;
+        throw;
+    }
+    return s;
+}
+
 BasicStore::Features
 BasicStore::getSupportedFeatures() const
 {
@@ -42,11 +42,16 @@
 #include <QMutex>
 #include <QMutexLocker>
 #include <QHash>
+#include <QCache>
+#include <QVector>
 #include <QFile>
 #include <QCryptographicHash>
 #include <QReadWriteLock>
 
 #include "../Debug.h"
+#include "../StatisticsCollector.h"
+#include "../Snapshot.h"
+#include "../NTriplesParser.h"
 
 #include <cstdlib>
 #include <iostream>
@@ -58,15 +63,19 @@ namespace Dataquay
 class BasicStore::D
 {
 public:
-    D() : m_model(0) {
+    D() : m_model(0), m_uriCache(1024), m_uriCacheHits(0), m_uriCacheMisses(0),
+          m_importThreads(0) {
         m_prefixes["rdf"] = Uri("http://www.w3.org/1999/02/22-rdf-syntax-ns#");
         m_prefixes["xsd"] = Uri("http://www.w3.org/2001/XMLSchema#");
         clear();
     }
 
     ~D() {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        QMutexLocker wlocker(m_w.getLock());
         if (m_model) sord_free(m_model);
+        m_uriCache.clear(); // frees nodes, so needs the world lock
     }
 
     QString getNewString() const {
@@ -107,9 +116,13 @@ public:
     }
 
     void clear() {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
         DQ_DEBUG << "BasicStore::clear" << endl;
-        if (m_model) sord_free(m_model);
+        if (m_model) {
+            QMutexLocker wlocker(m_w.getLock());
+            sord_free(m_model);
+        }
         // Sord can only perform wildcard matches if at least one of
         // the non-wildcard nodes in the matched triple is the primary
         // term for one of its indices
@@ -122,14 +135,54 @@ public:
         m_prefixes[prefix] = uri;
     }
 
+    void setUriCacheSize(int uris) {
+        QMutexLocker wlocker(m_w.getLock());
+        m_uriCache.setMaxCost(uris);
+    }
+
+    int getUriCacheSize() const {
+        QMutexLocker wlocker(m_w.getLock());
+        return m_uriCache.maxCost();
+    }
+
+    quint64 getUriCacheHits() const {
+        QMutexLocker wlocker(m_w.getLock());
+        return m_uriCacheHits;
+    }
+
+    quint64 getUriCacheMisses() const {
+        QMutexLocker wlocker(m_w.getLock());
+        return m_uriCacheMisses;
+    }
+
+    void setImportThreads(int threads) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        m_importThreads = threads;
+    }
+
+    int getImportThreads() const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        return m_importThreads;
+    }
+
+    StatisticsCollector &getStatisticsCollector() const {
+        return m_stats;
+    }
+
     bool add(Triple t) {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
         DQ_DEBUG << "BasicStore::add: " << t << endl;
-        return doAdd(t);
+        QMutexLocker wlocker(m_w.getLock());
+        NodeCache nc(this);
+        return doAdd(t, nc);
     }
 
     bool remove(Triple t) {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
         DQ_DEBUG << "BasicStore::remove: " << t << endl;
         if (t.a.type == Node::Nothing || 
             t.b.type == Node::Nothing ||
@@ -137,77 +190,176 @@ public:
             Triples tt = doMatch(t);
             if (tt.empty()) return false;
             DQ_DEBUG << "BasicStore::remove: Removing " << tt.size() << " triple(s)" << endl;
+            QMutexLocker wlocker(m_w.getLock());
+            NodeCache nc(this);
             for (int i = 0; i < tt.size(); ++i) {
-                if (!doRemove(tt[i])) {
+                if (!doRemove(tt[i], nc)) {
                     DQ_DEBUG << "Failed to remove matched triple in remove() with wildcards; triple was: " << tt[i] << endl;
                     throw RDFInternalError("Failed to remove matched statement in remove() with wildcards");
                 }
             }
             return true;
         } else {
-            return doRemove(t);
+            QMutexLocker wlocker(m_w.getLock());
+            NodeCache nc(this);
+            return doRemove(t, nc);
         }
     }
 
+    int addAll(Triples ts) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::addAll: " << ts.size() << " triple(s)" << endl;
+        QMutexLocker wlocker(m_w.getLock());
+        NodeCache nc(this);
+        QVector<const SordNode *> quads(ts.size() * 4);
+        // Convert everything before adding anything, so that an
+        // incomplete triple leaves the store unchanged
+        for (int i = 0; i < ts.size(); ++i) {
+            const SordNode **q = quads.data() + i * 4;
+            nc.toStatement(ts[i], q);
+            if (!checkComplete(q)) {
+                throw RDFException("Failed to add triple (statement is incomplete)", ts[i]);
+            }
+        }
+        int added = 0;
+        for (int i = 0; i < ts.size(); ++i) {
+            const SordNode **q = quads.data() + i * 4;
+            if (!sord_contains(m_model, q)) {
+                sord_add(m_model, q);
+                ++added;
+            }
+        }
+        DQ_DEBUG << "BasicStore::addAll: added " << added << endl;
+        return added;
+    }
+
+    int removeAll(Triples ts) {
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::removeAll: " << ts.size() << " triple(s)" << endl;
+        QMutexLocker wlocker(m_w.getLock());
+        NodeCache nc(this);
+        QVector<const SordNode *> quads(ts.size() * 4);
+        for (int i = 0; i < ts.size(); ++i) {
+            const SordNode **q = quads.data() + i * 4;
+            nc.toStatement(ts[i], q);
+            if (!checkComplete(q)) {
+                throw RDFException("Failed to remove triple (statement is incomplete)", ts[i]);
+            }
+        }
+        int removed = 0;
+        for (int i = 0; i < ts.size(); ++i) {
+            const SordNode **q = quads.data() + i * 4;
+            if (sord_contains(m_model, q)) {
+                sord_remove(m_model, q);
+                ++removed;
+            }
+        }
+        DQ_DEBUG << "BasicStore::removeAll: removed " << removed << endl;
+        return removed;
+    }
+
     void change(ChangeSet cs) {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
         DQ_DEBUG << "BasicStore::change: " << cs.size() << " changes" << endl;
-        for (int i = 0; i < cs.size(); ++i) {
-            ChangeType type = cs[i].first;
-            Triple triple = cs[i].second;
-            switch (type) {
-            case AddTriple:
-                if (!doAdd(triple)) {
-                    throw RDFException("Change add failed: triple is already in store", triple);
-                }
-                break;
-            case RemoveTriple:
-                if (!doRemove(cs[i].second)) {
-                    throw RDFException("Change remove failed: triple is not in store", triple);
+        QMutexLocker wlocker(m_w.getLock());
+        NodeCache nc(this);
+        int i = 0;
+        try {
+            for (i = 0; i < cs.size(); ++i) {
+                ChangeType type = cs[i].first;
+                Triple triple = cs[i].second;
+                switch (type) {
+                case AddTriple:
+                    if (!doAdd(triple, nc)) {
+                        throw RDFException("Change add failed: triple is already in store", triple);
+                    }
+                    break;
+                case RemoveTriple:
+                    if (!doRemove(cs[i].second, nc)) {
+                        throw RDFException("Change remove failed: triple is not in store", triple);
+                    }
+                    break;
                 }
-                break;
             }
+        } catch (const RDFException &) {
+            // Undo the changes that succeeded, so the store is left
+            // as it was before the call
+            while (--i >= 0) restoreChange(cs[i], true, nc);
+            throw;
         }
     }
 
     void revert(ChangeSet cs) {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
         DQ_DEBUG << "BasicStore::revert: " << cs.size() << " changes" << endl;
-        for (int i = cs.size()-1; i >= 0; --i) {
-            ChangeType type = cs[i].first;
-            Triple triple = cs[i].second;
-            switch (type) {
-            case AddTriple:
-                if (!doRemove(triple)) {
-                    throw RDFException("Revert of add failed: triple is not in store", triple);
-                }
-                break;
-            case RemoveTriple:
-                if (!doAdd(triple)) {
-                    throw RDFException("Revert of remove failed: triple is already in store", triple);
+        QMutexLocker wlocker(m_w.getLock());
+        NodeCache nc(this);
+        int i = cs.size()-1;
+        try {
+            for (i = cs.size()-1; i >= 0; --i) {
+                ChangeType type = cs[i].first;
+                Triple triple = cs[i].second;
+                switch (type) {
+                case AddTriple:
+                    if (!doRemove(triple, nc)) {
+                        throw RDFException("Revert of add failed: triple is not in store", triple);
+                    }
+                    break;
+                case RemoveTriple:
+                    if (!doAdd(triple, nc)) {
+                        throw RDFException("Revert of remove failed: triple is already in store", triple);
+                    }
+                    break;
                 }
-                break;
             }
+        } catch (const RDFException &) {
+            // Reapply the changes we had already reverted
+            while (++i < cs.size()) restoreChange(cs[i], false, nc);
+            throw;
         }
     }
 
     bool contains(Triple t) const {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
         DQ_DEBUG << "BasicStore::contains: " << t << endl;
+        QMutexLocker wlocker(m_w.getLock());
         SordQuad statement;
         tripleToStatement(t, statement);
         if (!checkComplete(statement)) {
+            freeStatement(statement);
             throw RDFException("Failed to test for triple (statement is incomplete)");
         }
-        if (!sord_contains(m_model, statement)) {
-            return false;
-        }
+        bool found = sord_contains(m_model, statement);
         freeStatement(statement);
-        return true;
+        return found;
+    }
+
+    QList<bool> containsAll(Triples ts) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::containsAll: " << ts.size() << " triple(s)" << endl;
+        QMutexLocker wlocker(m_w.getLock());
+        NodeCache nc(this);
+        QList<bool> found;
+        for (int i = 0; i < ts.size(); ++i) {
+            SordQuad statement;
+            nc.toStatement(ts[i], statement);
+            if (!checkComplete(statement)) {
+                throw RDFException("Failed to test for triple (statement is incomplete)", ts[i]);
+            }
+            found.push_back(sord_contains(m_model, statement));
+        }
+        return found;
     }
     
     Triples match(Triple t) const {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
         DQ_DEBUG << "BasicStore::match: " << t << endl;
         Triples result = doMatch(t);
 #ifndef NDEBUG
@@ -219,6 +371,49 @@ public:
         return result;
     }
 
+    void match(Triple t, TripleVisitor visitor) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::match (visitor): " << t << endl;
+        doMatch(t, visitor);
+    }
+
+    int count(Triple t) const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        DQ_DEBUG << "BasicStore::count: " << t << endl;
+        if (t.a.type == Node::Nothing &&
+            t.b.type == Node::Nothing &&
+            t.c.type == Node::Nothing) {
+            return int(sord_num_quads(m_model));
+        }
+        // Walk the index without converting anything back to Triples
+        SordQuad templ;
+        SordIter *itr = 0;
+        {
+            QMutexLocker wlocker(m_w.getLock());
+            tripleToStatement(t, templ);
+            itr = sord_find(m_model, templ);
+        }
+        int n = 0;
+        while (!sord_iter_end(itr)) {
+            ++n;
+            sord_iter_next(itr);
+        }
+        {
+            QMutexLocker wlocker(m_w.getLock());
+            sord_iter_free(itr);
+            freeStatement(templ);
+        }
+        return n;
+    }
+
+    int size() const {
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
+        return int(sord_num_quads(m_model));
+    }
+
     Node complete(Triple t) const {
         int count = 0, match = 0;
         if (t.a == Node()) { ++count; match = 0; }
@@ -227,7 +422,8 @@ public:
         if (count != 1) {
             throw RDFException("Cannot complete triple unless it has only a single wildcard node", t);
         }
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
         DQ_DEBUG << "BasicStore::complete: " << t << endl;
         Triples result = doMatch(t, true);
         if (result.empty()) return Node();
@@ -245,7 +441,8 @@ public:
             if (contains(t)) return t;
             else return Triple();
         }
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
         DQ_DEBUG << "BasicStore::matchOnce: " << t << endl;
         Triples result = doMatch(t, true);
 #ifndef NDEBUG
@@ -271,7 +468,8 @@ public:
     }
 
     Uri getUniqueUri(QString prefix) const {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
         DQ_DEBUG << "BasicStore::getUniqueUri: prefix " << prefix << endl;
         bool good = false;
         Uri uri;
@@ -329,12 +527,16 @@ public:
     }
 
     Node addBlankNode() {
-        QMutexLocker locker(&m_backendLock);
+        StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                               "backend read");
         QString blankId = getNewString();
+        QMutexLocker wlocker(m_w.getLock());
         //!!! todo: how to check whether the blank node is already in use
         SordNode *node = sord_new_blank(m_w.getWorld(), (uint8_t *)blankId.toUtf8().data());
         if (!node) throw RDFInternalError("Failed to create new blank node");
-        return sordNodeToNode(node);
+        Node n = sordNodeToNode(node);
+        sord_node_free(m_w.getWorld(), node);
+        return n;
     }
 
     static size_t saveSink(const void *buf, size_t len, void *stream) {
@@ -346,7 +548,11 @@ public:
 
     void save(QString filename) const {
 
-        QMutexLocker wlocker(&m_backendLock);
+        // Exclusive although we only read the model: sord_write
+        // iterates without the world lock, and Sord keeps a per-model
+        // count of live iterators that concurrent readers would race on
+        StatisticsCollector::WriteLocker wlocker(&m_backendLock, m_stats,
+                                                 "backend write");
         QMutexLocker plocker(&m_prefixLock);
 
         DQ_DEBUG << "BasicStore::save(" << filename << ")" << endl;
@@ -452,11 +658,59 @@ public:
         return SERD_SUCCESS;
     }
 
-    void import(QUrl url, ImportDuplicatesMode idm, QString /* format */) {
+    // N-Triples has one statement per line, so it can be parsed in
+    // parallel by NTriplesParser instead of by the RDF library.  The
+    // parse needs no lock at all; the results are then merged in a
+    // single pass under the write lock
+
+    bool importNTriplesFile(QUrl url, ImportDuplicatesMode idm) {
+        // Return false if the URL is not a local file, leaving it to
+        // the RDF library to retrieve
+        QString filename = url.toLocalFile();
+        if (filename == "") return false;
+        QFile f(filename);
+        if (!f.open(QFile::ReadOnly)) {
+            throw RDFException("Failed to open file for import", url.toString());
+        }
+        importNTriples(f.readAll(), idm);
+        return true;
+    }
+
+    void importNTriples(QByteArray data, ImportDuplicatesMode idm) {
+
+        int threads = 0;
+        {
+            StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                                   "backend read");
+            threads = m_importThreads;
+        }
+
+        // If we have data in the store already, then we must add a
+        // prefix for the new blank nodes we're importing to
+        // disambiguate them.  We can't know whether the store will
+        // be empty once we have the write lock, so parse with a
+        // prefix and remove it then if it turns out to be unneeded
+        QString prefix = getNewString();
+        Triples ts = NTriplesParser::parse(data, threads, prefix);
+
+        StatisticsCollector::WriteLocker locker(&m_backendLock, m_stats,
+                                                "backend write");
+        DQ_DEBUG << "BasicStore::importNTriples: " << ts.size()
+                 << " triple(s)" << endl;
+        if (sord_num_quads(m_model) == 0) {
+            NTriplesParser::removeBlankPrefix(ts, prefix);
+        }
+        importTriples(ts, idm);
+    }
+
+    void import(QUrl url, ImportDuplicatesMode idm, QString format) {
 
         DQ_DEBUG << "BasicStoreSord::import: " << url << endl;
 
-        QMutexLocker wlocker(&m_backendLock);
+        if (format == "ntriples" && importNTriplesFile(url, idm)) return;
+
+        StatisticsCollector::WriteLocker wlocker(&m_backendLock, m_stats,
+                                                 "backend write");
         QMutexLocker plocker(&m_prefixLock);
 
         //!!! todo: format?
@@ -493,12 +747,17 @@ public:
             // No special handling for duplicates, do whatever the
             // underlying engine does
 
-            SerdReader *reader = sord_new_reader(m_model, env, SERD_TURTLE, NULL);
-
             // if we have data in the store already, then we must add
             // a prefix for the new blank nodes we're importing to
             // disambiguate them
-            if (!doMatch(Triple(), true).empty()) {
+            bool needPrefix = (sord_num_quads(m_model) > 0);
+
+            // the reader creates nodes in the world as it goes
+            QMutexLocker wlocker(m_w.getLock());
+
+            SerdReader *reader = sord_new_reader(m_model, env, SERD_TURTLE, NULL);
+
+            if (needPrefix) {
                 serd_reader_add_blank_prefix
                     (reader, (uint8_t *)(getNewString().toUtf8().data()));
             }
@@ -522,14 +781,20 @@ public:
             // ImportFailOnDuplicates and ImportIgnoreDuplicates:
             // import into a separate model and transfer across
 
+            // if we have data in the store already, then we must add
+            // a prefix for the new blank nodes we're importing to
+            // disambiguate them
+            bool needPrefix = (sord_num_quads(m_model) > 0);
+
+            // the reader creates nodes in the world as it goes,
+            // and the transfer adds references to them
+            QMutexLocker wlocker(m_w.getLock());
+
             SordModel *im = sord_new(m_w.getWorld(), 0, false); // no index
             
             SerdReader *reader = sord_new_reader(im, env, SERD_TURTLE, NULL);
 
-            // if we have data in the store already, then we must add
-            // a prefix for the new blank nodes we're importing to
-            // disambiguate them
-            if (!doMatch(Triple(), true).empty()) {
+            if (needPrefix) {
                 serd_reader_add_blank_prefix
                     (reader, (uint8_t *)(getNewString().toUtf8().data()));
             }
@@ -565,11 +830,17 @@ public:
     }
 
     void importString(QString encodedRdf, Uri baseUri,
-                      ImportDuplicatesMode idm, QString /* format */) {
+                      ImportDuplicatesMode idm, QString format) {
 
         DQ_DEBUG << "BasicStoreSord::importString" << endl;
 
-        QMutexLocker wlocker(&m_backendLock);
+        if (format == "ntriples") {
+            importNTriples(encodedRdf.toUtf8(), idm);
+            return;
+        }
+
+        StatisticsCollector::WriteLocker wlocker(&m_backendLock, m_stats,
+                                                 "backend write");
         QMutexLocker plocker(&m_prefixLock);
 
         //!!! todo: format?
@@ -592,12 +863,17 @@ public:
             // No special handling for duplicates, do whatever the
             // underlying engine does
 
-            SerdReader *reader = sord_new_reader(m_model, env, SERD_TURTLE, NULL);
-
             // if we have data in the store already, then we must add
             // a prefix for the new blank nodes we're importing to
             // disambiguate them
-            if (!doMatch(Triple(), true).empty()) {
+            bool needPrefix = (sord_num_quads(m_model) > 0);
+
+            // the reader creates nodes in the world as it goes
+            QMutexLocker wlocker(m_w.getLock());
+
+            SerdReader *reader = sord_new_reader(m_model, env, SERD_TURTLE, NULL);
+
+            if (needPrefix) {
                 serd_reader_add_blank_prefix
                     (reader, (uint8_t *)(getNewString().toUtf8().data()));
             }
@@ -620,14 +896,20 @@ public:
             // ImportFailOnDuplicates and ImportIgnoreDuplicates:
             // import into a separate model and transfer across
 
+            // if we have data in the store already, then we must add
+            // a prefix for the new blank nodes we're importing to
+            // disambiguate them
+            bool needPrefix = (sord_num_quads(m_model) > 0);
+
+            // the reader creates nodes in the world as it goes,
+            // and the transfer adds references to them
+            QMutexLocker wlocker(m_w.getLock());
+
             SordModel *im = sord_new(m_w.getWorld(), 0, false); // no index
             
             SerdReader *reader = sord_new_reader(im, env, SERD_TURTLE, NULL);
 
-            // if we have data in the store already, then we must add
-            // a prefix for the new blank nodes we're importing to
-            // disambiguate them
-            if (!doMatch(Triple(), true).empty()) {
+            if (needPrefix) {
                 serd_reader_add_blank_prefix
                     (reader, (uint8_t *)(getNewString().toUtf8().data()));
             }
@@ -661,40 +943,122 @@ public:
         serd_env_free(env);
     }
 
+    void saveSnapshot(QString filename) const {
+
+        Uri baseUri;
+        PrefixMap prefixes;
+        {
+            QMutexLocker plocker(&m_prefixLock);
+            baseUri = m_baseUri;
+            prefixes = m_prefixes;
+        }
+
+        // The writer takes its own copy of everything, so the file
+        // can be written after the store is unlocked
+        SnapshotWriter writer(baseUri, prefixes);
+        {
+            StatisticsCollector::ReadLocker locker(&m_backendLock, m_stats,
+                                                   "backend read");
+            DQ_DEBUG << "BasicStore::saveSnapshot(" << filename << ")" << endl;
+            doMatch(Triple(), [&](const Triple &t) {
+                    writer.add(t);
+                    return true;
+                });
+        }
+        writer.write(filename);
+    }
+
+    void loadSnapshot(const SnapshotReader &reader) {
+
+        DQ_DEBUG << "BasicStore::loadSnapshot: " << reader.getTripleCount()
+                 << " triple(s)" << endl;
+
+        {
+            QMutexLocker plocker(&m_prefixLock);
+            m_baseUri = reader.getBaseUri();
+            m_prefixes = reader.getPrefixes();
+        }
+
+        // Decode each term only once, and add the triples in batches
+        // so as not to hold them all in memory at once as Triples
+        QVector<Node> terms(reader.getTermCount());
+        for (int i = 0; i < terms.size(); ++i) {
+            terms[i] = reader.getTerm(i);
+        }
+        Triples batch;
+        for (quint64 i = 0; i < reader.getTripleCount(); ++i) {
+            quint32 s, p, o;
+            reader.getTripleIds(i, s, p, o);
+            batch.push_back(Triple(terms[s], terms[p], terms[o]));
+            if (batch.size() == 65536) {
+                addAll(batch);
+                batch.clear();
+            }
+        }
+        if (!batch.empty()) addAll(batch);
+    }
+
 private:
     class World
     {
     public:
-        World() {
-            QMutexLocker locker(&m_mutex);
-            if (!m_world) {
-                m_world = sord_world_new();
-            }
-            ++m_refcount;
+        World() : m_world(sord_world_new()) {
+            if (!m_world) throw RDFInternalError("Failed to create RDF world");
         }
         ~World() {
-            QMutexLocker locker(&m_mutex);
-            DQ_DEBUG << "~World: About to lower refcount from " << m_refcount << endl;
-            if (--m_refcount == 0) {
-                DQ_DEBUG << "Freeing world" << endl;
-                sord_world_free(m_world);
-                m_world = 0;
-            }
+            sord_world_free(m_world);
         }
         
         SordWorld *getWorld() const {
             return m_world;
         }
+
+        // Sord does no locking of its own.  Creating or freeing
+        // nodes, and adding or removing statements (which changes
+        // the reference counts of the nodes), must be done with this
+        // lock held.  Reading a model, including iterating through
+        // it, need not be.  Nodes never pass from one store to
+        // another, so each store has a world of its own, and work in
+        // one store never waits for this lock in another.
+        QMutex *getLock() const {
+            return &m_mutex;
+        }
         
     private:
-        static QMutex m_mutex;
-        static SordWorld *m_world;
-        static int m_refcount;
+        SordWorld *m_world;
+        mutable QMutex m_mutex;
+
+        World(const World &);
+        World &operator=(const World &);
     };
 
     World m_w;
     SordModel *m_model;
-    static QMutex m_backendLock; // assume the worst
+    mutable QReadWriteLock m_backendLock; // protects m_model
+    mutable StatisticsCollector m_stats;
+
+    // A reference to the Sord node for a recently used URI, released
+    // when the cache evicts it
+    class CachedUri
+    {
+    public:
+        CachedUri(SordWorld *world, SordNode *node) :
+            m_world(world), m_node(node) { }
+        ~CachedUri() { sord_node_free(m_world, m_node); }
+        SordNode *node() const { return m_node; }
+    private:
+        SordWorld *m_world;
+        SordNode *m_node;
+    };
+
+    // The URI cache and its counters are protected by the world lock
+    // rather than m_backendLock, as they are used wherever nodes are
+    // converted, including by readers sharing m_backendLock
+    mutable QCache<Uri, CachedUri> m_uriCache;
+    mutable quint64 m_uriCacheHits;
+    mutable quint64 m_uriCacheMisses;
+
+    int m_importThreads; // protected by m_backendLock
 
     typedef QHash<QString, Uri> PrefixMap;
     Uri m_baseUri;
@@ -736,10 +1100,92 @@ private:
         sord_iter_free(itr);
         freeStatement(templ);
     }
+
+    void importTriples(const Triples &ts, ImportDuplicatesMode idm) {
+
+        // Called with m_backendLock held for writing.  Nothing is
+        // added unless the whole document can be.  Sord never stores
+        // a duplicate statement, so ImportPermitDuplicates has the
+        // same effect as ImportIgnoreDuplicates
+
+        QMutexLocker wlocker(m_w.getLock());
+        NodeCache nc(this);
+        QVector<const SordNode *> quads(ts.size() * 4);
+        for (int i = 0; i < ts.size(); ++i) {
+            const SordNode **q = quads.data() + i * 4;
+            nc.toStatement(ts[i], q);
+            if (!checkComplete(q)) {
+                throw RDFException("Failed to import triple (statement is incomplete)", ts[i]);
+            }
+        }
+
+        if (idm == ImportFailOnDuplicates) {
+            for (int i = 0; i < ts.size(); ++i) {
+                if (sord_contains(m_model, quads.data() + i * 4)) {
+                    throw RDFDuplicateImportException("Duplicate statement encountered on import in ImportFailOnDuplicates mode", ts[i]);
+                }
+            }
+        }
+
+        for (int i = 0; i < ts.size(); ++i) {
+            const SordNode **q = quads.data() + i * 4;
+            if (!sord_contains(m_model, q)) {
+                sord_add(m_model, q);
+            }
+        }
+    }
+    
+    /**
+     * Converts Dataquay nodes to Sord nodes, converting each distinct
+     * node only once however many statements it appears in.  The
+     * cache owns the nodes it returns, so statements made with it
+     * must not be passed to freeStatement.  Use only with the world
+     * lock held for the whole lifetime of the cache.
+     */
+    class NodeCache
+    {
+    public:
+        NodeCache(const D *d) : m_d(d) { }
+        ~NodeCache() {
+            foreach (SordNode *node, m_nodes) {
+                sord_node_free(m_d->m_w.getWorld(), node);
+            }
+        }
+
+        const SordNode *get(Node v) {
+            if (v.type == Node::Nothing) return 0;
+            QHash<Node, SordNode *>::const_iterator i = m_nodes.find(v);
+            if (i != m_nodes.end()) return i.value();
+            SordNode *node = m_d->nodeToSordNode(v);
+            m_nodes.insert(v, node);
+            return node;
+        }
+
+        void toStatement(Triple t, SordQuad q) {
+            q[0] = get(t.a);
+            q[1] = get(t.b);
+            q[2] = get(t.c);
+            q[3] = 0;
+        }
+
+    private:
+        const D *m_d;
+        QHash<Node, SordNode *> m_nodes;
+    };
+
+    // doAdd, doRemove and restoreChange are called with both
+    // m_backendLock and the world lock held
+
+    void restoreChange(Change c, bool undo, NodeCache &nc) {
+        // Used only when backing out of a failed change or revert, to
+        // undo (or redo) a change that has already succeeded once
+        if ((c.first == AddTriple) != undo) doAdd(c.second, nc);
+        else doRemove(c.second, nc);
+    }
     
-    bool doAdd(Triple t) {
+    bool doAdd(Triple t, NodeCache &nc) {
         SordQuad statement;
-        tripleToStatement(t, statement);
+        nc.toStatement(t, statement);
         if (!checkComplete(statement)) {
             throw RDFException("Failed to add triple (statement is incomplete)");
         }
@@ -747,13 +1193,12 @@ private:
             return false;
         }
         sord_add(m_model, statement);
-        freeStatement(statement);
         return true;
     }
 
-    bool doRemove(Triple t) {
+    bool doRemove(Triple t, NodeCache &nc) {
         SordQuad statement;
-        tripleToStatement(t, statement);
+        nc.toStatement(t, statement);
         if (!checkComplete(statement)) {
             throw RDFException("Failed to remove triple (statement is incomplete)");
         }
@@ -761,15 +1206,23 @@ private:
             return false;
         }
         sord_remove(m_model, statement);
-        freeStatement(statement);
         return true;
     }
 
-    SordNode *uriToSordNode(Uri uri) const {
+    SordNode *uriToSordNode(Uri uri) const { // called with world lock held
+        // Returns a new reference, which the caller must free as
+        // usual; the cache keeps a reference of its own
+        CachedUri *cached = m_uriCache.object(uri);
+        if (cached) {
+            ++m_uriCacheHits;
+            return sord_node_copy(cached->node());
+        }
+        ++m_uriCacheMisses;
         SordNode *node = sord_new_uri
             (m_w.getWorld(), 
              (const unsigned char *)uri.toString().toUtf8().data());
         if (!node) throw RDFInternalError("Failed to convert URI to internal representation", uri);
+        m_uriCache.insert(uri, new CachedUri(m_w.getWorld(), sord_node_copy(node)));
         return node;
     }
 
@@ -783,7 +1236,7 @@ private:
         else return Uri();
     }
 
-    SordNode *nodeToSordNode(Node v) const { // called with m_backendLock held
+    SordNode *nodeToSordNode(Node v) const { // called with world lock held
         SordNode *node = 0;
         switch (v.type) {
         case Node::Nothing:
@@ -904,19 +1357,44 @@ private:
         // Any of a, b, and c in t that have Nothing as their node type
         // will contribute all matching nodes to the returned triples
         Triples results;
+        doMatch(t, [&](const Triple &r) {
+                results.push_back(r);
+                return !single;
+            });
+        return results;
+    }
+
+    void doMatch(Triple t, const TripleVisitor &visitor) const {
+        // Called with m_backendLock held (possibly shared with other
+        // readers) but not the world lock, which we need only while
+        // making and freeing the template and iterator: Sord counts
+        // live iterators in the model, so creating and freeing them
+        // is not safe between concurrent readers
         SordQuad templ;
-        tripleToStatement(t, templ);
-        SordIter *itr = sord_find(m_model, templ);
-        while (!sord_iter_end(itr)) {
-            SordQuad q;
-            sord_iter_get(itr, q);
-            results.push_back(statementToTriple(q));
-            if (single) break;
-            sord_iter_next(itr);
+        SordIter *itr = 0;
+        {
+            QMutexLocker wlocker(m_w.getLock());
+            tripleToStatement(t, templ);
+            itr = sord_find(m_model, templ);
+        }
+        try {
+            while (!sord_iter_end(itr)) {
+                SordQuad q;
+                sord_iter_get(itr, q);
+                if (!visitor(statementToTriple(q))) break;
+                sord_iter_next(itr);
+            }
+        } catch (...) {
+            QMutexLocker wlocker(m_w.getLock());
+            sord_iter_free(itr);
+            freeStatement(templ);
+            throw;
+        }
+        {
+            QMutexLocker wlocker(m_w.getLock());
+            sord_iter_free(itr);
+            freeStatement(templ);
         }
-        sord_iter_free(itr);
-        freeStatement(templ);
-        return results;
     }
 
     QString serdStatusToString(SerdStatus s)
@@ -936,18 +1414,6 @@ private:
     }
 };
 
-QMutex
-BasicStore::D::m_backendLock;
-
-QMutex
-BasicStore::D::World::m_mutex;
-
-SordWorld *
-BasicStore::D::World::m_world = 0;
-
-int
-BasicStore::D::World::m_refcount = 0;
-
 BasicStore::BasicStore() :
     m_d(new D())
 {
@@ -973,78 +1439,197 @@ BasicStore::getBaseUri() const
 void
 BasicStore::clear()
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "clear");
     m_d->clear();
 }
 
 bool
 BasicStore::add(Triple t)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "add");
     return m_d->add(t);
 }
 
 bool
 BasicStore::remove(Triple t)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "remove");
     return m_d->remove(t);
 }
 
+int
+BasicStore::addAll(Triples ts)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "addAll",
+                                     ts.size());
+    return m_d->addAll(ts);
+}
+
+int
+BasicStore::removeAll(Triples ts)
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "removeAll",
+                                     ts.size());
+    return m_d->removeAll(ts);
+}
+
 void
 BasicStore::change(ChangeSet t)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "change",
+                                     t.size());
     m_d->change(t);
 }
 
 void
 BasicStore::revert(ChangeSet t)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "revert",
+                                     t.size());
     m_d->revert(t);
 }
 
 bool
 BasicStore::contains(Triple t) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "contains");
     return m_d->contains(t);
 }
 
+QList<bool>
+BasicStore::containsAll(Triples ts) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(),
+                                      "containsAll", ts.size());
+    return m_d->containsAll(ts);
+}
+
 Triples
 BasicStore::match(Triple t) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "match");
     return m_d->match(t);
 }
 
+void
+BasicStore::match(Triple t, TripleVisitor visitor) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "match");
+    m_d->match(t, visitor);
+}
+
+int
+BasicStore::count(Triple t) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "count");
+    return m_d->count(t);
+}
+
+int
+BasicStore::size() const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "size");
+    return m_d->size();
+}
+
 void
 BasicStore::addPrefix(QString prefix, Uri uri)
 {
     m_d->addPrefix(prefix, uri);
 }
 
+void
+BasicStore::setUriCacheSize(int uris)
+{
+    m_d->setUriCacheSize(uris);
+}
+
+int
+BasicStore::getUriCacheSize() const
+{
+    return m_d->getUriCacheSize();
+}
+
+quint64
+BasicStore::getUriCacheHits() const
+{
+    return m_d->getUriCacheHits();
+}
+
+quint64
+BasicStore::getUriCacheMisses() const
+{
+    return m_d->getUriCacheMisses();
+}
+
+void
+BasicStore::setImportThreads(int threads)
+{
+    m_d->setImportThreads(threads);
+}
+
+int
+BasicStore::getImportThreads() const
+{
+    return m_d->getImportThreads();
+}
+
+void
+BasicStore::setStatisticsEnabled(bool enabled)
+{
+    m_d->getStatisticsCollector().setEnabled(enabled);
+}
+
+bool
+BasicStore::getStatisticsEnabled() const
+{
+    return m_d->getStatisticsCollector().isEnabled();
+}
+
+Statistics
+BasicStore::getStatistics() const
+{
+    return m_d->getStatisticsCollector().getStatistics();
+}
+
+void
+BasicStore::resetStatistics()
+{
+    m_d->getStatisticsCollector().reset();
+}
+
 ResultSet
 BasicStore::query(QString sparql) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "query");
     return m_d->query(sparql);
 }
 
 Node
 BasicStore::complete(Triple t) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "complete");
     return m_d->complete(t);
 }
 
 Triple
 BasicStore::matchOnce(Triple t) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "matchOnce");
     return m_d->matchOnce(t);
 }
 
 Node
 BasicStore::queryOnce(QString sparql, QString bindingName) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "queryOnce");
     return m_d->queryOnce(sparql, bindingName);
 }
 
 Uri
 BasicStore::getUniqueUri(QString prefix) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "getUniqueUri");
     return m_d->getUniqueUri(prefix);
 }
 
@@ -1057,18 +1642,28 @@ BasicStore::expand(QString uri) const
 Node
 BasicStore::addBlankNode()
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "addBlankNode");
     return m_d->addBlankNode();
 }
 
 void
 BasicStore::save(QString filename) const
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "save");
     m_d->save(filename);
 }
 
+void
+BasicStore::saveSnapshot(QString filename) const
+{
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "saveSnapshot");
+    m_d->saveSnapshot(filename);
+}
+
 void
 BasicStore::import(QUrl url, ImportDuplicatesMode idm, QString format)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "import");
     m_d->import(url, idm, format);
 }
 
@@ -1076,6 +1671,7 @@ void
 BasicStore::importString(QString encodedRdf, Uri baseUri,
                          ImportDuplicatesMode idm, QString format)
 {
+    StatisticsCollector::Operation op(m_d->getStatisticsCollector(), "importString");
     m_d->importString(encodedRdf, baseUri, idm, format);
 }
 
@@ -1101,6 +1697,20 @@ BasicStore::loadString(QString encodedRdf, Uri baseUri, QString format)
     return s;
 }
 
+BasicStore *
+BasicStore::loadSnapshot(QString filename)
+{
+    SnapshotReader reader(filename);
+    BasicStore *s = new BasicStore();
+    try {
+        s->m_d->loadSnapshot(reader);
+    } catch (...) {
+        delete s;
+        throw;
+    }
+    return s;
+}
+
 BasicStore::Features
 BasicStore::getSupportedFeatures() const
 {
@@ -1,13 +1,24 @@
 
 #ifdef USE_REDLAND
 #ifdef USE_SORD
-#error Only one of USE_REDLAND and USE_SORD may be defined
+#error Only one of USE_REDLAND, USE_SORD and USE_NATIVE may be defined
+#endif
+#ifdef USE_NATIVE
+#error Only one of USE_REDLAND, USE_SORD and USE_NATIVE may be defined
+#endif
+#endif
+
+#ifdef USE_SORD
+#ifdef USE_NATIVE
+#error Only one of USE_REDLAND, USE_SORD and USE_NATIVE may be defined
 #endif
 #endif
 
 #ifndef USE_REDLAND
 #ifndef USE_SORD
-#error One of USE_REDLAND or USE_SORD must be defined
+#ifndef USE_NATIVE
+#error One of USE_REDLAND, USE_SORD or USE_NATIVE must be defined
+#endif
 #endif
 #endif
 
@@ -39,10 +39,39 @@
 #include <dataquay/RDFException.h>
 
 #include <QObject>
+#include <QThread>
 #include <QtTest>
 
 namespace Dataquay {
 
+/**
+ * Imports an N-Triples document into a store from its own thread.
+ */
+class NTriplesImporter : public QThread
+{
+public:
+    NTriplesImporter(BasicStore *store, QString nt) :
+        m_store(store), m_nt(nt), m_failed(false) { }
+
+    bool failed() const { return m_failed; }
+
+protected:
+    void run() {
+        try {
+            m_store->importString(m_nt, Uri(),
+                                  BasicStore::ImportIgnoreDuplicates,
+                                  "ntriples");
+        } catch (const RDFException &) {
+            m_failed = true;
+        }
+    }
+
+private:
+    BasicStore *m_store;
+    QString m_nt;
+    bool m_failed;
+};
+
 class TestBasicStore : public QObject
 {
     Q_OBJECT
@@ -379,6 +408,49 @@ private slots:
 		 toAlice);
     }
 
+    void counts() {
+        // Must run after adds.  As matchCounts, but without matching
+        QCOMPARE(store.size(), count);
+        QCOMPARE(store.count(Triple()), count);
+        QCOMPARE(store.count
+                 (Triple(store.expand(":fred"), Node(), Node())),
+                 fromFred);
+        QCOMPARE(store.count
+                 (Triple(Node(), store.expand("foaf:knows"), Node())),
+                 usingKnows);
+        QCOMPARE(store.count
+                 (Triple(Node(), Node(), store.expand(":alice"))),
+                 toAlice);
+    }
+
+    void matchVisitor() {
+        // Must run after adds.  Visiting every match should see the
+        // same triples as the list form of match
+        Triples visited;
+        store.match(Triple(), [&](const Triple &t) {
+                visited.push_back(t);
+                return true;
+            });
+        QCOMPARE(visited.size(), count);
+        QVERIFY(visited.matches(store.match(Triple())));
+
+        visited.clear();
+        store.match(Triple(store.expand(":fred"), Node(), Node()),
+                    [&](const Triple &t) {
+                        visited.push_back(t);
+                        return true;
+                    });
+        QCOMPARE(visited.size(), fromFred);
+
+        // returning false stops the match
+        int seen = 0;
+        store.match(Triple(), [&](const Triple &) {
+                ++seen;
+                return false;
+            });
+        QCOMPARE(seen, 1);
+    }
+
     void compareTriples() {
 
 	// check empty Triples match
@@ -529,7 +601,34 @@ private slots:
 	QCOMPARE(store.match
 		 (Triple(Node(), Node(), store.expand(":alice"))).size(),
 		 toAlice);
-    }	
+    }
+
+    void saveAndLoadSnapshot() {
+
+        store.saveSnapshot("test.dqs");
+
+        BasicStore *store2 = BasicStore::loadSnapshot("test.dqs");
+        QVERIFY(store2);
+
+        QCOMPARE(store2->getBaseUri().toString(),
+                 store.getBaseUri().toString());
+        QCOMPARE(store2->expand(":fred").toString(),
+                 store.expand(":fred").toString());
+
+        Triples tt = store.match(Triple());
+        QCOMPARE(store2->match(Triple()).size(), tt.size());
+        foreach (Triple t, tt) QVERIFY(store2->contains(t));
+
+        delete store2;
+
+        // a file that is not a snapshot is rejected
+        try {
+            delete BasicStore::loadSnapshot("test.ttl");
+            QFAIL("loadSnapshot accepted a file that is not a snapshot");
+        } catch (const RDFException &) {
+            QVERIFY(1);
+        }
+    }
 
     //!!! todo: files with explicit @base in file
 
@@ -667,6 +766,92 @@ private slots:
         delete s;
     }
 
+    void importNTriples() {
+
+        // N-Triples is parsed by Dataquay itself, in parallel
+
+        QString nt =
+            "# comment\n"
+            "<http://breakfastquay.com/rdf/dataquay/tests#nt> <http://breakfastquay.com/rdf/dataquay/tests#name> \"tab\\there \\\"quoted\\\" \\u00e9\" .\n"
+            "\n"
+            "<http://breakfastquay.com/rdf/dataquay/tests#nt> <http://breakfastquay.com/rdf/dataquay/tests#age> \"7\"^^<http://www.w3.org/2001/XMLSchema#integer> .\r\n"
+            "<http://breakfastquay.com/rdf/dataquay/tests#nt> <http://breakfastquay.com/rdf/dataquay/tests#says> \"bonjour\"@fr .\n"
+            "<http://breakfastquay.com/rdf/dataquay/tests#nt> <http://breakfastquay.com/rdf/dataquay/tests#has> _:b1.\n";
+
+        BasicStore s;
+        s.importString(nt, Uri("http://breakfastquay.com/rdf/dataquay/tests"),
+                       BasicStore::ImportFailOnDuplicates, "ntriples");
+        QCOMPARE(s.size(), 4);
+
+        Uri nts("http://breakfastquay.com/rdf/dataquay/tests#nt");
+        QVERIFY(s.contains(Triple(nts, Uri("http://breakfastquay.com/rdf/dataquay/tests#name"),
+                                  Node(QString::fromUtf8("tab\there \"quoted\" \xc3\xa9")))));
+        QVERIFY(s.contains(Triple(nts, Uri("http://breakfastquay.com/rdf/dataquay/tests#age"),
+                                  Node::fromVariant(7))));
+        QVERIFY(s.contains(Triple(nts, Uri("http://breakfastquay.com/rdf/dataquay/tests#says"),
+                                  Node("bonjour"))));
+        Node b = s.complete(Triple(nts, Uri("http://breakfastquay.com/rdf/dataquay/tests#has"), Node()));
+        QVERIFY(b.type == Node::Blank);
+
+        // Duplicates in FailOnDuplicates mode leave the store unchanged
+
+        bool caught = false;
+        try {
+            s.importString(nt, Uri(), BasicStore::ImportFailOnDuplicates, "ntriples");
+        } catch (const RDFDuplicateImportException &) {
+            caught = true;
+        }
+        QVERIFY(caught);
+        QCOMPARE(s.size(), 4);
+
+        // Enough lines to be split into several chunks, with an error
+        // far into the document, which must be reported by line
+
+        QString big;
+        for (int i = 0; i < 20000; ++i) {
+            big += QString("<http://breakfastquay.com/rdf/dataquay/tests#n%1> "
+                           "<http://breakfastquay.com/rdf/dataquay/tests#value> "
+                           "\"%1\" .\n").arg(i);
+        }
+
+        BasicStore p;
+        p.setImportThreads(4);
+        QCOMPARE(p.getImportThreads(), 4);
+        p.importString(big, Uri(), BasicStore::ImportIgnoreDuplicates, "ntriples");
+        QCOMPARE(p.size(), 20000);
+        QVERIFY(p.contains(Triple(Uri("http://breakfastquay.com/rdf/dataquay/tests#n19999"),
+                                  Uri("http://breakfastquay.com/rdf/dataquay/tests#value"),
+                                  Node("19999"))));
+
+        big += "<http://breakfastquay.com/rdf/dataquay/tests#broken> .\n";
+        BasicStore q;
+        caught = false;
+        try {
+            q.importString(big, Uri(), BasicStore::ImportIgnoreDuplicates, "ntriples");
+        } catch (const RDFException &e) {
+            caught = QString(e.what()).contains("line 20001");
+        }
+        QVERIFY(caught);
+        QCOMPARE(q.size(), 0);
+
+        // Two documents imported at once into an empty store must
+        // still keep their blank nodes apart
+
+        QString blank =
+            "<http://breakfastquay.com/rdf/dataquay/tests#nt> <http://breakfastquay.com/rdf/dataquay/tests#has> _:b1 .\n";
+        for (int round = 0; round < 20; ++round) {
+            BasicStore c;
+            NTriplesImporter i1(&c, blank), i2(&c, blank);
+            i1.start();
+            i2.start();
+            i1.wait();
+            i2.wait();
+            QVERIFY(!i1.failed());
+            QVERIFY(!i2.failed());
+            QCOMPARE(c.size(), 2);
+        }
+    }
+
     void remove() {
 	// check we can remove a triple
 	QVERIFY(store.remove
@@ -698,6 +883,201 @@ private slots:
 	QCOMPARE(triples.size(), 0);
     }
 
+    void addAllRemoveAll() {
+        // Must run after removeMatch, with the store empty
+        Triples tt;
+        for (int i = 0; i < 10; ++i) {
+            tt.push_back(Triple(store.expand(QString(":item%1").arg(i)),
+                                store.expand("rdf:value"),
+                                Node::fromVariant(i)));
+        }
+        QCOMPARE(store.addAll(tt), 10);
+        QCOMPARE(store.match(Triple()).size(), 10);
+
+        // duplicates of triples in the store, or within the list
+        // itself, are not counted
+        Triple extra(store.expand(":item10"),
+                     store.expand("rdf:value"),
+                     Node::fromVariant(10));
+        Triples more;
+        more.push_back(tt[0]);
+        more.push_back(extra);
+        more.push_back(extra);
+        QCOMPARE(store.addAll(more), 1);
+        QCOMPARE(store.match(Triple()).size(), 11);
+
+        // an incomplete triple fails the whole list, and nothing is
+        // added
+        Triple another(store.expand(":item11"),
+                       store.expand("rdf:value"),
+                       Node::fromVariant(11));
+        Triples bad;
+        bad.push_back(another);
+        bad.push_back(Triple(store.expand(":item12"), Node(), Node()));
+        try {
+            store.addAll(bad);
+            QVERIFY(0);
+        } catch (const RDFException &) {
+            QVERIFY(1);
+        }
+        QVERIFY(!store.contains(another));
+
+        // containsAll answers for each triple in turn, and fails for
+        // an incomplete one as contains does
+        Triples probe;
+        probe.push_back(tt[3]);
+        probe.push_back(another);
+        probe.push_back(extra);
+        QList<bool> found = store.containsAll(probe);
+        QCOMPARE(found.size(), 3);
+        QVERIFY(found[0]);
+        QVERIFY(!found[1]);
+        QVERIFY(found[2]);
+        QVERIFY(store.containsAll(Triples()).empty());
+        try {
+            store.containsAll(bad);
+            QVERIFY(0);
+        } catch (const RDFException &) {
+            QVERIFY(1);
+        }
+
+        more.push_back(another);
+        QCOMPARE(store.removeAll(more), 2);
+        QCOMPARE(store.removeAll(tt), 9);
+        QCOMPARE(store.match(Triple()).size(), 0);
+    }
+
+    void changeIsAtomic() {
+        Triple t0(store.expand(":item0"), store.expand("rdf:value"),
+                  Node::fromVariant(0));
+        Triple t1(store.expand(":item1"), store.expand("rdf:value"),
+                  Node::fromVariant(1));
+        QVERIFY(store.add(t0));
+
+        // the second add fails, so the first must be undone
+        ChangeSet cs;
+        cs.push_back(Change(AddTriple, t1));
+        cs.push_back(Change(AddTriple, t0));
+        try {
+            store.change(cs);
+            QVERIFY(0);
+        } catch (const RDFException &) {
+            QVERIFY(1);
+        }
+        QVERIFY(store.contains(t0));
+        QVERIFY(!store.contains(t1));
+
+        QVERIFY(store.remove(t0));
+    }
+
+    void unsupportedImportFormat() {
+#ifndef USE_NATIVE
+#if (QT_VERSION >= 0x050000)
+        QSKIP("Import formats depend on the RDF library used by current store backend");
+#else
+        QSKIP("Import formats depend on the RDF library used by current store backend", SkipSingle);
+#endif
+#endif
+        BasicStore s;
+        try {
+            s.importString("<?xml version=\"1.0\"?>",
+                           Uri("http://breakfastquay.com/rdf/dataquay/tests"),
+                           BasicStore::ImportIgnoreDuplicates, "rdfxml");
+            QVERIFY2(0, "import succeeded with unsupported format, should have failed");
+        } catch (const RDFUnsupportedError &) {
+            QVERIFY(1);
+        }
+        s.importString("<http://breakfastquay.com/rdf/dataquay/tests#a> <http://breakfastquay.com/rdf/dataquay/tests#b> \"c\" .",
+                       Uri("http://breakfastquay.com/rdf/dataquay/tests"),
+                       BasicStore::ImportIgnoreDuplicates, "turtle");
+        QCOMPARE(s.size(), 1);
+    }
+
+    void uriCache() {
+#ifdef USE_NATIVE
+#if (QT_VERSION >= 0x050000)
+        QSKIP("URI cache not used by current store backend");
+#else
+        QSKIP("URI cache not used by current store backend", SkipSingle);
+#endif
+#endif
+        BasicStore s;
+        Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+        quint64 hits = s.getUriCacheHits();
+
+        // the predicate is converted once and then found in the
+        // cache; each subject is converted once
+        for (int i = 0; i < 10; ++i) {
+            QVERIFY(s.add(Triple(Uri(base + QString("u%1").arg(i)),
+                                 pred, Node::fromVariant(i))));
+        }
+        QVERIFY(s.getUriCacheHits() >= hits + 9);
+        QVERIFY(s.getUriCacheMisses() >= 11);
+
+        // with the cache disabled, nothing is found in it
+        s.setUriCacheSize(0);
+        QCOMPARE(s.getUriCacheSize(), 0);
+        hits = s.getUriCacheHits();
+        quint64 misses = s.getUriCacheMisses();
+        QVERIFY(s.contains(Triple(Uri(base + "u0"), pred,
+                                  Node::fromVariant(0))));
+        QCOMPARE(s.getUriCacheHits(), hits);
+        QVERIFY(s.getUriCacheMisses() > misses);
+    }
+
+    void statistics() {
+        BasicStore s;
+        Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+        QVERIFY(!s.getStatisticsEnabled());
+
+        // nothing is gathered until enabled
+        QVERIFY(s.add(Triple(Uri(base + "s0"), pred, Node::fromVariant(0))));
+        QVERIFY(s.getStatistics().getOperations().empty());
+
+        s.setStatisticsEnabled(true);
+        QVERIFY(s.getStatisticsEnabled());
+        Triples tt;
+        for (int i = 1; i <= 10; ++i) {
+            tt.push_back(Triple(Uri(base + QString("s%1").arg(i)),
+                                pred, Node::fromVariant(i)));
+        }
+        QCOMPARE(s.addAll(tt), 10);
+        for (int i = 0; i < 5; ++i) QVERIFY(s.contains(tt[i]));
+        QCOMPARE(s.match(Triple(Node(), pred, Node())).size(), 11);
+
+        Statistics st = s.getStatistics();
+        QCOMPARE(st.getOperationCount("addAll"), quint64(1));
+        QCOMPARE(st.getOperationCount("contains"), quint64(5));
+        QCOMPARE(st.getOperationCount("match"), quint64(1));
+        QCOMPARE(st.getOperationCount("add"), quint64(0));
+        QCOMPARE(st.getTiming("contains").getCount(), quint64(5));
+        QCOMPARE(st.getSize("addAll").getTotal(), quint64(10));
+        QCOMPARE(st.getTiming("backend read hold").getCount(), quint64(6));
+        QVERIFY(st.getTiming("backend write wait").getCount() >= 1);
+        QVERIFY(!st.toString().isEmpty());
+
+        // Histogram buckets are by power of two
+        Statistics::Histogram h;
+        h.add(0);
+        h.add(1);
+        h.add(5);
+        h.add(6);
+        h.add(1000);
+        QCOMPARE(h.getCount(), quint64(5));
+        QCOMPARE(h.getMax(), quint64(1000));
+        QCOMPARE(h.getBucket(0), quint64(1));
+        QCOMPARE(h.getBucket(1), quint64(1));
+        QCOMPARE(h.getBucket(3), quint64(2));
+        QCOMPARE(h.getPercentile(0.5), quint64(8));
+        QCOMPARE(h.getPercentile(1.0), quint64(1000));
+
+        s.resetStatistics();
+        QVERIFY(s.getStatistics().getOperations().empty());
+        s.setStatisticsEnabled(false);
+        QVERIFY(s.contains(tt[0]));
+        QVERIFY(s.getStatistics().getOperations().empty());
+    }
+
 private:
     BasicStore store;
     QString base;
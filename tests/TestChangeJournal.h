@@ -0,0 +1,203 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef _TEST_CHANGE_JOURNAL_H_
+#define _TEST_CHANGE_JOURNAL_H_
+
+#include <dataquay/Node.h>
+#include <dataquay/BasicStore.h>
+#include <dataquay/ChangeJournal.h>
+#include <dataquay/RDFException.h>
+
+#include <QObject>
+#include <QFile>
+#include <QtTest>
+
+namespace Dataquay {
+
+class TestChangeJournal : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init() {
+        QFile::remove("journal-test.dqs");
+        QFile::remove("journal-test.dqs.journal");
+    }
+
+    void appendAndLoad() {
+        ChangeJournal journal("journal-test.dqs");
+        QCOMPARE(journal.getEntryCount(), 0);
+
+        BasicStore *store = journal.load();
+        QCOMPARE(store->size(), 0);
+        applyAndAppend(store, journal, additions(0, 10));
+        applyAndAppend(store, journal, removals(0, 3));
+        QCOMPARE(journal.getEntryCount(), 2);
+
+        ChangeJournal reopened("journal-test.dqs");
+        QCOMPARE(reopened.getEntryCount(), 2);
+        BasicStore *loaded = reopened.load();
+        QCOMPARE(loaded->size(), 7);
+        verifySame(store, loaded);
+
+        delete loaded;
+        delete store;
+    }
+
+    void compact() {
+        ChangeJournal journal("journal-test.dqs");
+        BasicStore *store = journal.load();
+        applyAndAppend(store, journal, additions(0, 10));
+        qint64 before = journal.getJournalSize();
+
+        journal.compact(store);
+        QCOMPARE(journal.getEntryCount(), 0);
+        QVERIFY(journal.getJournalSize() < before);
+
+        applyAndAppend(store, journal, removals(5, 10));
+        applyAndAppend(store, journal, additions(20, 25));
+        QCOMPARE(journal.getEntryCount(), 2);
+
+        ChangeJournal reopened("journal-test.dqs");
+        BasicStore *loaded = reopened.load();
+        QCOMPARE(loaded->size(), 10);
+        verifySame(store, loaded);
+
+        delete loaded;
+        delete store;
+    }
+
+    void replayOverSnapshot() {
+        // As if compaction had been interrupted after the snapshot
+        // was written but before the journal was emptied: replaying
+        // the journal must leave the snapshot's contents unchanged
+        ChangeJournal journal("journal-test.dqs");
+        BasicStore *store = journal.load();
+        applyAndAppend(store, journal, additions(0, 10));
+        applyAndAppend(store, journal, removals(2, 6));
+        applyAndAppend(store, journal, additions(4, 5));
+        store->saveSnapshot("journal-test.dqs");
+
+        ChangeJournal reopened("journal-test.dqs");
+        QCOMPARE(reopened.getEntryCount(), 3);
+        BasicStore *loaded = reopened.load();
+        QCOMPARE(loaded->size(), 7);
+        verifySame(store, loaded);
+
+        delete loaded;
+        delete store;
+    }
+
+    void truncatedRecord() {
+        BasicStore *store = 0;
+        {
+            ChangeJournal journal("journal-test.dqs");
+            store = journal.load();
+            applyAndAppend(store, journal, additions(0, 10));
+            journal.append(additions(10, 20));
+        }
+
+        // Chop the end off the last record, as if the process had
+        // died while appending it
+        QFile f("journal-test.dqs.journal");
+        QVERIFY(f.open(QFile::ReadWrite));
+        QVERIFY(f.resize(f.size() - 5));
+        f.close();
+
+        ChangeJournal journal("journal-test.dqs");
+        QCOMPARE(journal.getEntryCount(), 1);
+        BasicStore *loaded = journal.load();
+        QCOMPARE(loaded->size(), 10);
+        verifySame(store, loaded);
+
+        // and the journal remains usable afterwards
+        applyAndAppend(store, journal, additions(30, 32));
+        ChangeJournal reopened("journal-test.dqs");
+        QCOMPARE(reopened.getEntryCount(), 2);
+        delete loaded;
+        loaded = reopened.load();
+        verifySame(store, loaded);
+
+        delete loaded;
+        delete store;
+    }
+
+    void notAJournal() {
+        QFile f("journal-test.dqs.journal");
+        QVERIFY(f.open(QFile::WriteOnly));
+        f.write("@prefix : <#> .\n:a :b :c .\n");
+        f.close();
+        bool caught = false;
+        try {
+            ChangeJournal journal("journal-test.dqs");
+        } catch (const RDFException &) {
+            caught = true;
+        }
+        QVERIFY(caught);
+    }
+
+private:
+    Triple triple(int i) const {
+        return Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#j%1").arg(i)),
+                      Uri("http://breakfastquay.com/rdf/dataquay/tests#value"),
+                      Node::fromVariant(i));
+    }
+
+    ChangeSet additions(int from, int to) const {
+        ChangeSet cs;
+        for (int i = from; i < to; ++i) cs.push_back(Change(AddTriple, triple(i)));
+        return cs;
+    }
+
+    ChangeSet removals(int from, int to) const {
+        ChangeSet cs;
+        for (int i = from; i < to; ++i) cs.push_back(Change(RemoveTriple, triple(i)));
+        return cs;
+    }
+
+    void applyAndAppend(BasicStore *store, ChangeJournal &journal, ChangeSet cs) {
+        store->change(cs);
+        journal.append(cs);
+    }
+
+    void verifySame(BasicStore *a, BasicStore *b) {
+        QCOMPARE(a->size(), b->size());
+        foreach (Triple t, a->match(Triple())) QVERIFY(b->contains(t));
+    }
+};
+
+}
+
+#endif
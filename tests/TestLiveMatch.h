@@ -0,0 +1,294 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+  
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef _TEST_LIVE_MATCH_H_
+#define _TEST_LIVE_MATCH_H_
+
+#include <dataquay/Node.h>
+#include <dataquay/BasicStore.h>
+#include <dataquay/TransactionalStore.h>
+#include <dataquay/LiveMatch.h>
+#include <dataquay/RDFException.h>
+
+#include <QObject>
+#include <QThread>
+#include <QtTest>
+
+namespace Dataquay {
+
+/**
+ * Records the triples reported by a LiveMatch.
+ */
+class LiveMatchListener : public QObject
+{
+    Q_OBJECT
+
+public:
+    QList<Triples> added;
+    QList<Triples> removed;
+
+public slots:
+    void triplesAdded(const Triples &ts) { added.push_back(ts); }
+    void triplesRemoved(const Triples &ts) { removed.push_back(ts); }
+};
+
+/**
+ * Adds the given triple to the store if it is absent and removes it
+ * if present, a number of times over, from its own thread, retrying
+ * each time until it commits without conflict.
+ */
+class TripleToggler : public QThread
+{
+public:
+    TripleToggler(TransactionalStore *ts, Triple t, int toggles) :
+        m_ts(ts), m_triple(t), m_toggles(toggles), m_failed(false) { }
+
+    bool failed() const { return m_failed; }
+
+protected:
+    void run() {
+        for (int i = 0; i < m_toggles; ) {
+            Transaction *t = m_ts->startTransaction();
+            try {
+                if (t->contains(m_triple)) t->remove(m_triple);
+                else t->add(m_triple);
+                t->commit();
+                ++i;
+            } catch (const RDFTransactionConflict &) {
+            } catch (const RDFException &) {
+                m_failed = true;
+                delete t;
+                return;
+            }
+            delete t;
+        }
+    }
+
+private:
+    TransactionalStore *m_ts;
+    Triple m_triple;
+    int m_toggles;
+    bool m_failed;
+};
+
+class TestLiveMatch : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase() {
+        store.setBaseUri(Uri("http://breakfastquay.com/rdf/dataquay/tests#"));
+        ts = new TransactionalStore(&store);
+    }
+
+    void cleanupTestCase() {
+        delete ts;
+    }
+
+    void init() {
+        store.clear();
+    }
+
+    void initialMatches() {
+        addTracks(0, 5);
+        LiveMatch lm(ts, tracks());
+        QCOMPARE(lm.getMatchCount(), 5);
+        QVERIFY(lm.getMatches().matches(store.match(tracks())));
+        QVERIFY(lm.contains(track(0)));
+        QVERIFY(!lm.contains(title(0)));
+    }
+
+    void incremental() {
+        addTracks(0, 5);
+        LiveMatch lm(ts, tracks());
+        LiveMatchListener l;
+        listen(lm, l);
+
+        Transaction *t = ts->startTransaction();
+        QVERIFY(t->add(track(5)));
+        QVERIFY(t->remove(track(0)));
+        QVERIFY(t->remove(title(1)));
+        t->commit();
+        delete t;
+
+        QCOMPARE(l.added.size(), 1);
+        QCOMPARE(l.added[0].size(), 1);
+        QVERIFY(l.added[0][0] == track(5));
+        QCOMPARE(l.removed.size(), 1);
+        QCOMPARE(l.removed[0].size(), 1);
+        QVERIFY(l.removed[0][0] == track(0));
+
+        QCOMPARE(lm.getMatchCount(), 5);
+        QVERIFY(lm.getMatches().matches(store.match(tracks())));
+        QVERIFY(lm.contains(track(5)));
+        QVERIFY(!lm.contains(track(0)));
+
+        // Commits that touch nothing matching say nothing
+        t = ts->startTransaction();
+        QVERIFY(t->add(title(7)));
+        t->commit();
+        delete t;
+        QCOMPARE(l.added.size(), 1);
+        QCOMPARE(l.removed.size(), 1);
+    }
+
+    void netOfCommit() {
+        LiveMatch lm(ts, tracks());
+        LiveMatchListener l;
+        listen(lm, l);
+
+        // A triple added and removed again within one transaction was
+        // never really there
+        Transaction *t = ts->startTransaction();
+        QVERIFY(t->add(track(7)));
+        QVERIFY(t->remove(track(7)));
+        t->commit();
+        delete t;
+        QVERIFY(l.added.empty());
+        QVERIFY(l.removed.empty());
+
+        // and nor was one added in a transaction rolled back
+        t = ts->startTransaction();
+        QVERIFY(t->add(track(8)));
+        t->rollback();
+        delete t;
+        QVERIFY(l.added.empty());
+        QCOMPARE(lm.getMatchCount(), 0);
+    }
+
+    void asyncCommit() {
+        LiveMatch lm(ts, tracks());
+        Transaction *t = ts->startTransaction();
+        QVERIFY(t->add(track(9)));
+        t->commitAsync().waitForFinished();
+        delete t;
+
+        // a synchronous commit waits for notification of earlier
+        // asynchronous ones
+        t = ts->startTransaction();
+        t->commit();
+        delete t;
+        QVERIFY(lm.contains(track(9)));
+        QCOMPARE(lm.getMatchCount(), 1);
+    }
+
+    void concurrentCommits() {
+        // Commits of the same triple from several threads at once
+        // must be notified in the order they were made, or the match
+        // goes wrong for good
+        LiveMatch lm(ts, tracks());
+        for (int round = 0; round < 10; ++round) {
+            QList<TripleToggler *> togglers;
+            for (int i = 0; i < 8; ++i) {
+                togglers.push_back(new TripleToggler(ts, track(i % 2), 25));
+            }
+            foreach (TripleToggler *t, togglers) t->start();
+            foreach (TripleToggler *t, togglers) t->wait();
+            foreach (TripleToggler *t, togglers) {
+                QVERIFY(!t->failed());
+                delete t;
+            }
+            QCOMPARE(lm.contains(track(0)), store.contains(track(0)));
+            QCOMPARE(lm.contains(track(1)), store.contains(track(1)));
+            QCOMPARE(lm.getMatchCount(), store.count(tracks()));
+        }
+    }
+
+    void constructDuringCommits() {
+        // A LiveMatch may be notified of a commit on another thread
+        // while it is still being constructed
+        QList<TripleToggler *> togglers;
+        for (int i = 0; i < 4; ++i) {
+            togglers.push_back(new TripleToggler(ts, track(i % 2), 200));
+        }
+        foreach (TripleToggler *t, togglers) t->start();
+        QList<LiveMatch *> lms;
+        while (lms.size() < 200) {
+            lms.push_back(new LiveMatch(ts, tracks()));
+        }
+        foreach (TripleToggler *t, togglers) t->wait();
+        foreach (TripleToggler *t, togglers) {
+            QVERIFY(!t->failed());
+            delete t;
+        }
+        foreach (LiveMatch *lm, lms) {
+            QCOMPARE(lm->contains(track(0)), store.contains(track(0)));
+            QCOMPARE(lm->contains(track(1)), store.contains(track(1)));
+            QCOMPARE(lm->getMatchCount(), store.count(tracks()));
+            delete lm;
+        }
+    }
+
+private:
+    BasicStore store;
+    TransactionalStore *ts;
+
+    Triple tracks() {
+        return Triple(Node(), store.expand("rdf:type"), store.expand(":Track"));
+    }
+
+    Triple track(int i) {
+        return Triple(store.expand(QString(":track%1").arg(i)),
+                      store.expand("rdf:type"), store.expand(":Track"));
+    }
+
+    Triple title(int i) {
+        return Triple(store.expand(QString(":track%1").arg(i)),
+                      store.expand(":title"),
+                      Node(QString("Track %1").arg(i)));
+    }
+
+    void addTracks(int from, int to) {
+        Transaction *t = ts->startTransaction();
+        for (int i = from; i < to; ++i) {
+            t->add(track(i));
+            t->add(title(i));
+        }
+        t->commit();
+        delete t;
+    }
+
+    void listen(LiveMatch &lm, LiveMatchListener &l) {
+        connect(&lm, SIGNAL(triplesAdded(const Triples &)),
+                &l, SLOT(triplesAdded(const Triples &)),
+                Qt::DirectConnection);
+        connect(&lm, SIGNAL(triplesRemoved(const Triples &)),
+                &l, SLOT(triplesRemoved(const Triples &)),
+                Qt::DirectConnection);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,1097 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+#ifndef _TEST_PERFORMANCE_H_
+#define _TEST_PERFORMANCE_H_
+
+#include <dataquay/Node.h>
+#include <dataquay/BasicStore.h>
+#include <dataquay/ChangeJournal.h>
+#include <dataquay/TransactionalStore.h>
+#include <dataquay/ChangeSubscription.h>
+#include <dataquay/Connection.h>
+#include <dataquay/RDFException.h>
+
+#include <QObject>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QtTest>
+
+#include <algorithm>
+
+namespace Dataquay {
+
+/**
+ * Runs a fixed read/write workload against a single store in its own
+ * thread.  Any failure is recorded rather than thrown, as exceptions
+ * must not escape QThread::run.
+ *
+ * If populate is false, the worker only reads, and expects the
+ * triples it would have added to be in the store already (see
+ * populate()).
+ */
+class StoreWorker : public QThread
+{
+public:
+    StoreWorker(Store *s, QString tag, int triples, int passes,
+                bool populate = true) :
+        m_store(s), m_tag(tag), m_triples(triples), m_passes(passes),
+        m_populate(populate), m_failed(false) { }
+
+    bool failed() const { return m_failed; }
+    int operations() const {
+        return (m_populate ? m_triples : 0) + m_passes * m_triples * 2;
+    }
+
+    void populate() {
+        for (int i = 0; i < m_triples; ++i) {
+            if (!m_store->add(Triple(subject(i), predicate(),
+                                     Node::fromVariant(i)))) {
+                m_failed = true;
+            }
+        }
+    }
+
+protected:
+    void run() {
+        try {
+            Uri pred(predicate());
+            if (m_populate) populate();
+            for (int p = 0; p < m_passes; ++p) {
+                for (int i = 0; i < m_triples; ++i) {
+                    if (!m_store->contains
+                        (Triple(subject(i), pred, Node::fromVariant(i)))) {
+                        m_failed = true;
+                    }
+                    if (m_store->match(Triple(subject(i), Node(), Node()))
+                        .size() != 1) {
+                        m_failed = true;
+                    }
+                }
+            }
+        } catch (const RDFException &) {
+            m_failed = true;
+        }
+    }
+
+private:
+    Store *m_store;
+    QString m_tag;
+    int m_triples;
+    int m_passes;
+    bool m_populate;
+    bool m_failed;
+
+    Uri predicate() const {
+        return Uri("http://breakfastquay.com/rdf/dataquay/tests#value");
+    }
+
+    Uri subject(int i) const {
+        return Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#%1_%2")
+                   .arg(m_tag).arg(i));
+    }
+};
+
+/**
+ * Commits a run of single-triple transactions to a TransactionalStore
+ * from its own thread.
+ */
+class CommitWorker : public QThread
+{
+public:
+    CommitWorker(TransactionalStore *ts, QString tag, int commits) :
+        m_ts(ts), m_tag(tag), m_commits(commits), m_failed(false) { }
+
+    bool failed() const { return m_failed; }
+
+protected:
+    void run() {
+        try {
+            Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+            for (int i = 0; i < m_commits; ++i) {
+                Transaction *tx = m_ts->startTransaction();
+                tx->add(Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#%1_%2")
+                                   .arg(m_tag).arg(i)),
+                               pred, Node::fromVariant(i)));
+                tx->commit();
+                delete tx;
+            }
+        } catch (const RDFException &) {
+            m_failed = true;
+        }
+    }
+
+private:
+    TransactionalStore *m_ts;
+    QString m_tag;
+    int m_commits;
+    bool m_failed;
+};
+
+/**
+ * Commits a run of single-triple transactions through a Connection of
+ * its own to a TransactionalStore, from its own thread, checking that
+ * each commit obtains its own change and no other.
+ */
+class ConnectionWorker : public QThread
+{
+public:
+    ConnectionWorker(TransactionalStore *ts, QString tag, int commits) :
+        m_ts(ts), m_tag(tag), m_commits(commits), m_failed(false) { }
+
+    bool failed() const { return m_failed; }
+
+protected:
+    void run() {
+        try {
+            Connection c(m_ts);
+            Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+            for (int i = 0; i < m_commits; ++i) {
+                Triple t(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#%1_%2")
+                             .arg(m_tag).arg(i)),
+                         pred, Node::fromVariant(i));
+                c.add(t);
+                ChangeSet cs = c.commitAndObtain();
+                if (cs.size() != 1 || cs[0] != Change(AddTriple, t)) {
+                    m_failed = true;
+                }
+            }
+        } catch (const RDFException &) {
+            m_failed = true;
+        }
+    }
+
+private:
+    TransactionalStore *m_ts;
+    QString m_tag;
+    int m_commits;
+    bool m_failed;
+};
+
+/**
+ * Reads a TransactionalStore through a run of read-only transactions
+ * from its own thread, checking that the two reads made in each
+ * transaction agree with one another.
+ */
+class ReadOnlyTransactionReader : public QThread
+{
+public:
+    ReadOnlyTransactionReader(TransactionalStore *ts, int transactions) :
+        m_ts(ts), m_transactions(transactions), m_reads(0),
+        m_failed(false) { }
+
+    int reads() const { return m_reads; }
+    bool failed() const { return m_failed; }
+
+protected:
+    void run() {
+        try {
+            Triple pattern(Node(),
+                           Uri("http://breakfastquay.com/rdf/dataquay/tests#value"),
+                           Node());
+            for (int i = 0; i < m_transactions; ++i) {
+                const Transaction *tx = m_ts->startReadOnlyTransaction();
+                int n = tx->count(pattern);
+                int m = tx->match(pattern).size();
+                delete tx;
+                m_reads += 2;
+                if (n != m) m_failed = true;
+            }
+        } catch (const RDFException &) {
+            m_failed = true;
+        }
+    }
+
+private:
+    TransactionalStore *m_ts;
+    int m_transactions;
+    int m_reads;
+    bool m_failed;
+};
+
+/**
+ * Increments counters held in a TransactionalStore from its own
+ * thread, each increment a transaction that reads a counter's value
+ * and then replaces it.  A given percentage of the increments go to
+ * a counter shared by all workers and the rest to the worker's own.
+ * Transactions that conflict with another worker's are retried.
+ */
+class ContentionWorker : public QThread
+{
+public:
+    ContentionWorker(TransactionalStore *ts, QString tag, int increments,
+                     int sharedPercent) :
+        m_ts(ts), m_tag(tag), m_increments(increments),
+        m_sharedPercent(sharedPercent), m_shared(0), m_retries(0),
+        m_failed(false) { }
+
+    QString tag() const { return m_tag; }
+    int sharedIncrements() const { return m_shared; }
+    int retries() const { return m_retries; }
+    bool failed() const { return m_failed; }
+
+    static Uri counter(QString tag) {
+        return Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#counter_%1").arg(tag));
+    }
+
+    static Uri predicate() {
+        return Uri("http://breakfastquay.com/rdf/dataquay/tests#count");
+    }
+
+    static int value(Store *s, QString tag) {
+        Triple t = s->matchOnce(Triple(counter(tag), predicate(), Node()));
+        if (t.c.type == Node::Nothing) return 0;
+        return t.c.toVariant().toInt();
+    }
+
+protected:
+    void run() {
+        try {
+            for (int i = 0; i < m_increments; ++i) {
+                // spread the shared increments evenly through the run
+                bool shared = ((i + 1) * m_sharedPercent) / 100 !=
+                    (i * m_sharedPercent) / 100;
+                Uri c = counter(shared ? "shared" : m_tag);
+                while (true) {
+                    Transaction *tx = m_ts->startTransaction();
+                    try {
+                        Triple current = tx->matchOnce
+                            (Triple(c, predicate(), Node()));
+                        int n = 0;
+                        if (current.c.type != Node::Nothing) {
+                            n = current.c.toVariant().toInt();
+                            tx->remove(current);
+                        }
+                        // give the others a chance to get in first
+                        yieldCurrentThread();
+                        tx->add(Triple(c, predicate(), Node::fromVariant(n + 1)));
+                        tx->commit();
+                    } catch (const RDFTransactionConflict &) {
+                        delete tx;
+                        ++m_retries;
+                        continue;
+                    }
+                    delete tx;
+                    break;
+                }
+                if (shared) ++m_shared;
+            }
+        } catch (const RDFException &) {
+            m_failed = true;
+        }
+    }
+
+private:
+    TransactionalStore *m_ts;
+    QString m_tag;
+    int m_increments;
+    int m_sharedPercent;
+    int m_shared;
+    int m_retries;
+    bool m_failed;
+};
+
+/**
+ * Stands in for a listener such as ObjectMapper that reloads from
+ * the store on every commit.
+ */
+class ReloadListener : public QObject
+{
+    Q_OBJECT
+
+public:
+    ReloadListener(Store *store) : m_store(store), m_reloads(0) { }
+
+    int reloads() const { return m_reloads; }
+
+public slots:
+    void reload() {
+        m_store->match(Triple());
+        ++m_reloads;
+    }
+
+private:
+    Store *m_store;
+    int m_reloads;
+};
+
+/**
+ * Counts the changes to a single subject that it is notified of,
+ * either by picking them out of every committed change set or by
+ * receiving them from a subscription.
+ */
+class SubjectListener : public QObject
+{
+    Q_OBJECT
+
+public:
+    SubjectListener(Node subject) : m_subject(subject), m_changes(0) { }
+
+    int changes() const { return m_changes; }
+
+public slots:
+    void committed(const ChangeSet &cs) {
+        foreach (const Change &c, cs) {
+            if (c.second.a == m_subject) ++m_changes;
+        }
+    }
+
+    void subscribed(const ChangeSet &cs) {
+        m_changes += cs.size();
+    }
+
+private:
+    Node m_subject;
+    int m_changes;
+};
+
+class TestPerformance : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanupTestCase() {
+        // Files written by the benchmarks below
+        QStringList files;
+        files << "perf.ttl" << "perf.dqs"
+              << "perf-journal.ttl" << "perf-journal.dqs"
+              << "perf-journal.dqs.journal"
+              << "perf-wal.dqs" << "perf-wal.dqs.journal"
+              << "perf-latency.dqs" << "perf-latency.dqs.journal";
+        foreach (QString f, files) QFile::remove(f);
+    }
+
+    void multiStoreThroughput() {
+
+        // Each thread works on its own store, so with per-store
+        // locking the aggregate rate should rise with the thread
+        // count (up to the number of cores)
+
+        int maxThreads = qMax(2, qMin(8, QThread::idealThreadCount()));
+
+        for (int n = 1; n <= maxThreads; n *= 2) {
+
+            QList<BasicStore *> stores;
+            QList<StoreWorker *> workers;
+            for (int i = 0; i < n; ++i) {
+                stores.push_back(new BasicStore);
+                workers.push_back(new StoreWorker
+                                  (stores[i], QString("s%1").arg(i), 1000, 5));
+            }
+
+            QElapsedTimer timer;
+            timer.start();
+            foreach (StoreWorker *w, workers) w->start();
+            foreach (StoreWorker *w, workers) w->wait();
+            qint64 ms = qMax(qint64(1), timer.elapsed());
+
+            int ops = 0;
+            foreach (StoreWorker *w, workers) {
+                QVERIFY(!w->failed());
+                ops += w->operations();
+            }
+
+            qDebug() << "multiStoreThroughput:" << n << "thread(s):"
+                     << ops << "ops in" << ms << "ms ="
+                     << (ops * 1000) / ms << "ops/sec";
+
+            foreach (StoreWorker *w, workers) delete w;
+            foreach (BasicStore *s, stores) delete s;
+        }
+    }
+
+    void sharedStoreReadThroughput() {
+
+        // All threads read the same store.  Readers share the store
+        // lock, so the aggregate rate should not fall as readers are
+        // added, and should rise where the backend permits
+
+        int maxThreads = qMax(2, qMin(8, QThread::idealThreadCount()));
+
+        BasicStore store;
+        StoreWorker loader(&store, "shared", 1000, 0);
+        loader.populate();
+        QVERIFY(!loader.failed());
+
+        for (int n = 1; n <= maxThreads; n *= 2) {
+
+            QList<StoreWorker *> workers;
+            for (int i = 0; i < n; ++i) {
+                workers.push_back(new StoreWorker
+                                  (&store, "shared", 1000, 5, false));
+            }
+
+            QElapsedTimer timer;
+            timer.start();
+            foreach (StoreWorker *w, workers) w->start();
+            foreach (StoreWorker *w, workers) w->wait();
+            qint64 ms = qMax(qint64(1), timer.elapsed());
+
+            int ops = 0;
+            foreach (StoreWorker *w, workers) {
+                QVERIFY(!w->failed());
+                ops += w->operations();
+            }
+
+            qDebug() << "sharedStoreReadThroughput:" << n << "thread(s):"
+                     << ops << "ops in" << ms << "ms ="
+                     << (ops * 1000) / ms << "ops/sec";
+
+            foreach (StoreWorker *w, workers) delete w;
+        }
+    }
+
+    void bulkAddThroughput() {
+
+        // Compare adding triples one at a time with adding them all
+        // in a single call
+
+        int n = 20000;
+        Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+        Triples tt;
+        for (int i = 0; i < n; ++i) {
+            tt.push_back(Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#b%1").arg(i)),
+                                pred, Node::fromVariant(i)));
+        }
+
+        BasicStore single;
+        QElapsedTimer timer;
+        timer.start();
+        foreach (Triple t, tt) QVERIFY(single.add(t));
+        qint64 ms = qMax(qint64(1), timer.elapsed());
+        qDebug() << "bulkAddThroughput: add:" << n << "triples in" << ms
+                 << "ms =" << (n * qint64(1000)) / ms << "triples/sec";
+
+        BasicStore bulk;
+        timer.restart();
+        QCOMPARE(bulk.addAll(tt), n);
+        ms = qMax(qint64(1), timer.elapsed());
+        qDebug() << "bulkAddThroughput: addAll:" << n << "triples in" << ms
+                 << "ms =" << (n * qint64(1000)) / ms << "triples/sec";
+
+        QCOMPARE(bulk.match(Triple()).size(), n);
+    }
+
+    void importAndMatch() {
+
+        // Figures for comparing the backends (build with each of
+        // USE_REDLAND, USE_SORD and USE_NATIVE in turn): import
+        // speed, match latency and approximate memory per triple
+
+        int n = 20000;
+        QString ttl = "@prefix : <http://breakfastquay.com/rdf/dataquay/tests#> .\n";
+        for (int i = 0; i < n; ++i) {
+            ttl += QString(":m%1 :value %2 ; :group :g%3 .\n")
+                .arg(i).arg(i).arg(i % 100);
+        }
+
+        qint64 before = residentKB();
+
+        BasicStore store;
+        QElapsedTimer timer;
+        timer.start();
+        store.importString(ttl, Uri("http://breakfastquay.com/rdf/dataquay/tests"),
+                           BasicStore::ImportIgnoreDuplicates);
+        qint64 ms = qMax(qint64(1), timer.elapsed());
+        QCOMPARE(store.size(), n * 2);
+        qDebug() << "importAndMatch: import:" << n * 2 << "triples in" << ms
+                 << "ms =" << (n * qint64(2000)) / ms << "triples/sec";
+
+        qint64 after = residentKB();
+        if (before > 0 && after > before) {
+            qDebug() << "importAndMatch: approx" << ((after - before) * 1024) / (n * 2)
+                     << "bytes per triple";
+        }
+
+        Uri group("http://breakfastquay.com/rdf/dataquay/tests#group");
+        timer.restart();
+        for (int i = 0; i < n; ++i) {
+            Uri s(QString("http://breakfastquay.com/rdf/dataquay/tests#m%1").arg(i));
+            QCOMPARE(store.match(Triple(s, group, Node())).size(), 1);
+        }
+        qint64 us = timer.nsecsElapsed() / 1000;
+        qDebug() << "importAndMatch: subject match:" << n << "in" << us / 1000
+                 << "ms =" << double(us) / n << "us each";
+
+        timer.restart();
+        for (int i = 0; i < 100; ++i) {
+            Uri g(QString("http://breakfastquay.com/rdf/dataquay/tests#g%1").arg(i));
+            QCOMPARE(store.match(Triple(Node(), group, g)).size(), n / 100);
+        }
+        us = timer.nsecsElapsed() / 1000;
+        qDebug() << "importAndMatch: object match:" << 100 << "in" << us / 1000
+                 << "ms =" << double(us) / 100 << "us each";
+    }
+
+    void snapshotLoad() {
+
+        // Compare reloading a store from Turtle with reloading it
+        // from a binary snapshot
+
+        int n = 20000;
+        BasicStore store;
+        store.setBaseUri(Uri("http://breakfastquay.com/rdf/dataquay/tests#"));
+        Uri pred(store.expand(":value"));
+        Triples tt;
+        for (int i = 0; i < n; ++i) {
+            tt.push_back(Triple(store.expand(QString(":s%1").arg(i)),
+                                pred, Node::fromVariant(i)));
+        }
+        QCOMPARE(store.addAll(tt), n);
+
+        store.save("perf.ttl");
+        store.saveSnapshot("perf.dqs");
+
+        QElapsedTimer timer;
+        timer.start();
+        BasicStore *fromTurtle = BasicStore::load(QUrl("file:perf.ttl"));
+        qint64 ms = qMax(qint64(1), timer.elapsed());
+        QCOMPARE(fromTurtle->size(), n);
+        qDebug() << "snapshotLoad: load:" << n << "triples in" << ms
+                 << "ms =" << (n * qint64(1000)) / ms << "triples/sec";
+        delete fromTurtle;
+
+        timer.restart();
+        BasicStore *fromSnapshot = BasicStore::loadSnapshot("perf.dqs");
+        ms = qMax(qint64(1), timer.elapsed());
+        QCOMPARE(fromSnapshot->size(), n);
+        qDebug() << "snapshotLoad: loadSnapshot:" << n << "triples in" << ms
+                 << "ms =" << (n * qint64(1000)) / ms << "triples/sec";
+        delete fromSnapshot;
+    }
+
+    void parallelNTriplesImport() {
+
+        // N-Triples import throughput against the number of parsing
+        // threads.  Parsing should scale with the thread count (up to
+        // the number of cores) until the single-threaded merge into
+        // the store dominates
+
+        int n = 200000;
+        QString nt;
+        for (int i = 0; i < n; ++i) {
+            nt += QString("<http://breakfastquay.com/rdf/dataquay/tests#p%1> "
+                          "<http://breakfastquay.com/rdf/dataquay/tests#value> "
+                          "\"%1\"^^<http://www.w3.org/2001/XMLSchema#integer> .\n")
+                .arg(i);
+        }
+
+        int maxThreads = qMax(2, QThread::idealThreadCount());
+
+        for (int threads = 1; threads <= maxThreads; threads *= 2) {
+
+            BasicStore store;
+            store.setImportThreads(threads);
+
+            QElapsedTimer timer;
+            timer.start();
+            store.importString(nt, Uri(), BasicStore::ImportIgnoreDuplicates,
+                               "ntriples");
+            qint64 ms = qMax(qint64(1), timer.elapsed());
+            QCOMPARE(store.size(), n);
+
+            qDebug() << "parallelNTriplesImport:" << threads << "thread(s):"
+                     << n << "triples in" << ms << "ms ="
+                     << (n * qint64(1000)) / ms << "triples/sec";
+        }
+    }
+
+    void journalAppend() {
+
+        // Compare saving the whole store after each single-triple
+        // change with appending each change to a journal
+
+        int n = 20000;
+        int edits = 50;
+        Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+        BasicStore store;
+        Triples tt;
+        for (int i = 0; i < n; ++i) {
+            tt.push_back(Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#j%1").arg(i)),
+                                pred, Node::fromVariant(i)));
+        }
+        QCOMPARE(store.addAll(tt), n);
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < edits; ++i) {
+            QVERIFY(store.remove(tt[i]));
+            store.save("perf-journal.ttl");
+        }
+        qint64 us = timer.nsecsElapsed() / 1000;
+        qDebug() << "journalAppend: save:" << edits << "edits in" << us / 1000
+                 << "ms =" << double(us) / edits << "us each";
+
+        QFile::remove("perf-journal.dqs");
+        QFile::remove("perf-journal.dqs.journal");
+        ChangeJournal journal("perf-journal.dqs");
+        journal.compact(&store);
+        timer.restart();
+        for (int i = 0; i < edits; ++i) {
+            ChangeSet cs;
+            cs.push_back(Change(AddTriple, tt[i]));
+            store.change(cs);
+            journal.append(cs);
+        }
+        us = timer.nsecsElapsed() / 1000;
+        qDebug() << "journalAppend: append:" << edits << "edits in" << us / 1000
+                 << "ms =" << double(us) / edits << "us each";
+
+        BasicStore *loaded = journal.load();
+        QCOMPARE(loaded->size(), n);
+        delete loaded;
+    }
+
+    void walCommitThroughput() {
+
+        // Commits through a write-ahead log, each synced to disc
+        // before commit returns, with and without group sync.  With
+        // one thread the two should be alike; with more, group sync
+        // should let several commits share each sync
+
+        int maxThreads = qMax(2, qMin(8, QThread::idealThreadCount()));
+        int commits = 50;
+
+        for (int group = 0; group < 2; ++group) {
+            for (int n = 1; n <= maxThreads; n *= 2) {
+
+                QFile::remove("perf-wal.dqs.journal");
+                ChangeJournal log("perf-wal.dqs");
+                log.setGroupSync(group);
+                BasicStore store;
+                TransactionalStore ts(&store, &log);
+
+                QList<CommitWorker *> workers;
+                for (int i = 0; i < n; ++i) {
+                    workers.push_back(new CommitWorker
+                                      (&ts, QString("w%1").arg(i), commits));
+                }
+
+                QElapsedTimer timer;
+                timer.start();
+                foreach (CommitWorker *w, workers) w->start();
+                foreach (CommitWorker *w, workers) w->wait();
+                qint64 ms = qMax(qint64(1), timer.elapsed());
+
+                foreach (CommitWorker *w, workers) QVERIFY(!w->failed());
+                QCOMPARE(store.size(), n * commits);
+                QCOMPARE(log.getEntryCount(), n * commits);
+
+                qDebug() << "walCommitThroughput:"
+                         << (group ? "group sync:" : "sync each:")
+                         << n << "thread(s):" << n * commits << "commits in"
+                         << ms << "ms =" << (n * commits * qint64(1000)) / ms
+                         << "commits/sec";
+
+                foreach (CommitWorker *w, workers) delete w;
+            }
+        }
+    }
+
+    void groupCommitThroughput() {
+
+        // Single-triple commits through a Connection per thread, with
+        // and without group commit.  With one thread the two should
+        // be alike; with many, group commit should apply several
+        // commits in each change to the store
+
+        int commits = 100;
+        int threads[] = { 1, 8, 64 };
+
+        for (int group = 0; group < 2; ++group) {
+            for (int t = 0; t < int(sizeof(threads)/sizeof(threads[0])); ++t) {
+
+                int n = threads[t];
+                BasicStore store;
+                TransactionalStore ts(&store);
+                ts.setGroupCommit(group);
+
+                QList<ConnectionWorker *> workers;
+                for (int i = 0; i < n; ++i) {
+                    workers.push_back(new ConnectionWorker
+                                      (&ts, QString("w%1").arg(i), commits));
+                }
+
+                QElapsedTimer timer;
+                timer.start();
+                foreach (ConnectionWorker *w, workers) w->start();
+                foreach (ConnectionWorker *w, workers) w->wait();
+                qint64 ms = qMax(qint64(1), timer.elapsed());
+
+                foreach (ConnectionWorker *w, workers) QVERIFY(!w->failed());
+                QCOMPARE(store.size(), n * commits);
+
+                qDebug() << "groupCommitThroughput:"
+                         << (group ? "group commit:" : "commit each:")
+                         << n << "thread(s):" << n * commits << "commits in"
+                         << ms << "ms =" << (n * commits * qint64(1000)) / ms
+                         << "commits/sec";
+
+                foreach (ConnectionWorker *w, workers) delete w;
+            }
+        }
+    }
+
+    void readOnlyTransactionThroughput() {
+
+        // Readers in read-only transactions while a writer commits.
+        // The readers neither wait for one another nor for the
+        // writer's transactions, so the aggregate read rate should
+        // rise with the number of readers
+
+        int maxThreads = qMax(2, qMin(8, QThread::idealThreadCount()));
+        int transactions = 200;
+
+        for (int n = 1; n <= maxThreads; n *= 2) {
+
+            BasicStore store;
+            TransactionalStore ts(&store);
+            CommitWorker writer(&ts, "writer", 1000);
+
+            QList<ReadOnlyTransactionReader *> readers;
+            for (int i = 0; i < n; ++i) {
+                readers.push_back(new ReadOnlyTransactionReader(&ts, transactions));
+            }
+
+            writer.start();
+            QElapsedTimer timer;
+            timer.start();
+            foreach (ReadOnlyTransactionReader *r, readers) r->start();
+            foreach (ReadOnlyTransactionReader *r, readers) r->wait();
+            qint64 ms = qMax(qint64(1), timer.elapsed());
+            writer.wait();
+
+            QVERIFY(!writer.failed());
+            int reads = 0;
+            foreach (ReadOnlyTransactionReader *r, readers) {
+                QVERIFY(!r->failed());
+                reads += r->reads();
+            }
+
+            qDebug() << "readOnlyTransactionThroughput:" << n
+                     << "reader(s) and a writer:" << reads << "reads in"
+                     << ms << "ms =" << (reads * qint64(1000)) / ms
+                     << "reads/sec";
+
+            foreach (ReadOnlyTransactionReader *r, readers) delete r;
+        }
+    }
+
+    void transactionContention() {
+
+        // Concurrent read-modify-write transactions, with a varying
+        // proportion of them working on a counter shared by all
+        // threads.  Retries should rise with the overlap, but no
+        // increment may be lost
+
+        int threads = qMax(2, qMin(8, QThread::idealThreadCount()));
+        int increments = 500;
+        int overlaps[] = { 0, 10, 50, 100 };
+
+        for (int o = 0; o < int(sizeof(overlaps)/sizeof(overlaps[0])); ++o) {
+
+            BasicStore store;
+            TransactionalStore ts(&store);
+
+            QList<ContentionWorker *> workers;
+            for (int i = 0; i < threads; ++i) {
+                workers.push_back(new ContentionWorker
+                                  (&ts, QString("w%1").arg(i),
+                                   increments, overlaps[o]));
+            }
+
+            QElapsedTimer timer;
+            timer.start();
+            foreach (ContentionWorker *w, workers) w->start();
+            foreach (ContentionWorker *w, workers) w->wait();
+            qint64 ms = qMax(qint64(1), timer.elapsed());
+
+            int shared = 0, retries = 0;
+            foreach (ContentionWorker *w, workers) {
+                QVERIFY(!w->failed());
+                QCOMPARE(ContentionWorker::value(&ts, w->tag()),
+                         increments - w->sharedIncrements());
+                shared += w->sharedIncrements();
+                retries += w->retries();
+            }
+            QCOMPARE(ContentionWorker::value(&ts, "shared"), shared);
+
+            qDebug() << "transactionContention:" << overlaps[o]
+                     << "% overlap:" << threads << "thread(s):"
+                     << threads * increments << "commits in" << ms
+                     << "ms =" << (threads * increments * qint64(1000)) / ms
+                     << "commits/sec," << retries << "retries";
+
+            foreach (ContentionWorker *w, workers) delete w;
+        }
+    }
+
+    void readsDuringLongTransaction() {
+
+        // Alternate reads on the TransactionalStore with reads in an
+        // open transaction, for increasing numbers of pending changes.
+        // The time per read should not grow with the transaction
+
+        Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+        int reads = 1000;
+
+        for (int pending = 100; pending <= 10000; pending *= 10) {
+
+            BasicStore store;
+            TransactionalStore ts(&store);
+            Triples tt;
+            for (int i = 0; i < pending; ++i) {
+                tt.push_back(Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#r%1").arg(i)),
+                                    pred, Node::fromVariant(i)));
+            }
+
+            Transaction *tx = ts.startTransaction();
+            QCOMPARE(tx->addAll(tt), pending);
+
+            QElapsedTimer timer;
+            timer.start();
+            for (int i = 0; i < reads; ++i) {
+                QVERIFY(!ts.contains(tt[i % pending]));
+                QVERIFY(tx->contains(tt[i % pending]));
+            }
+            qint64 us = timer.nsecsElapsed() / 1000;
+
+            qDebug() << "readsDuringLongTransaction:" << pending
+                     << "pending change(s):" << reads * 2 << "reads in"
+                     << us / 1000 << "ms =" << double(us) / (reads * 2)
+                     << "us each";
+
+            tx->rollback();
+            delete tx;
+        }
+    }
+
+    void addsWithOccasionalReads() {
+
+        // A transaction of 100k single adds, with a non-transactional
+        // read after every 1000 of them.  Neither the adds nor the
+        // reads should slow down as the transaction grows
+
+        Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+        int adds = 100000;
+        int every = 1000;
+
+        BasicStore store;
+        TransactionalStore ts(&store);
+        Triple pattern(Node(), pred, Node());
+
+        Transaction *tx = ts.startTransaction();
+        QElapsedTimer timer;
+        timer.start();
+        qint64 readNs = 0, firstReadNs = 0, lastReadNs = 0;
+        for (int i = 0; i < adds; ++i) {
+            tx->add(Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#r%1").arg(i)),
+                           pred, Node::fromVariant(i)));
+            if ((i + 1) % every == 0) {
+                qint64 before = timer.nsecsElapsed();
+                QCOMPARE(ts.count(pattern), 0);
+                qint64 ns = timer.nsecsElapsed() - before;
+                if (i + 1 == every) firstReadNs = ns;
+                lastReadNs = ns;
+                readNs += ns;
+            }
+        }
+        qint64 ms = qMax(qint64(1), timer.elapsed());
+        QCOMPARE(tx->count(pattern), adds);
+        tx->rollback();
+        delete tx;
+
+        qDebug() << "addsWithOccasionalReads:" << adds << "adds and"
+                 << adds / every << "reads in" << ms << "ms ="
+                 << (adds * qint64(1000)) / ms << "adds/sec; reads"
+                 << double(readNs) / (adds / every) / 1000 << "us each,"
+                 << double(firstReadNs) / 1000 << "us first,"
+                 << double(lastReadNs) / 1000 << "us last";
+    }
+
+    void subscriptionRouting() {
+
+        // Many listeners each interested in one subject, notified of
+        // commits that each touch a few of the subjects, either by
+        // scanning every change set or through subscriptions.  With
+        // subscriptions the cost of notification should follow the
+        // number of changes rather than listeners * changes
+
+        Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+        int commits = 100;
+        int perCommit = 100;
+
+        for (int listeners = 10; listeners <= 1000; listeners *= 10) {
+            for (int subscribe = 0; subscribe < 2; ++subscribe) {
+
+                BasicStore store;
+                TransactionalStore ts(&store);
+
+                QList<SubjectListener *> ll;
+                QList<ChangeSubscription *> subs;
+                for (int i = 0; i < listeners; ++i) {
+                    Node subject(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#s%1").arg(i)));
+                    SubjectListener *l = new SubjectListener(subject);
+                    if (subscribe) {
+                        ChangeSubscription *s = ts.subscribe
+                            (Triple(subject, Node(), Node()));
+                        connect(s, SIGNAL(changesCommitted(const ChangeSet &)),
+                                l, SLOT(subscribed(const ChangeSet &)),
+                                Qt::DirectConnection);
+                        subs.push_back(s);
+                    } else {
+                        connect(&ts, SIGNAL(transactionCommitted(const ChangeSet &)),
+                                l, SLOT(committed(const ChangeSet &)),
+                                Qt::DirectConnection);
+                    }
+                    ll.push_back(l);
+                }
+
+                QElapsedTimer timer;
+                timer.start();
+                for (int i = 0; i < commits; ++i) {
+                    Transaction *tx = ts.startTransaction();
+                    for (int j = 0; j < perCommit; ++j) {
+                        // spread over ten times as many subjects as
+                        // the largest number of listeners
+                        int k = (i * perCommit + j) % 10000;
+                        tx->add(Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#s%1").arg(k)), pred, Node::fromVariant(i)));
+                    }
+                    tx->commit();
+                    delete tx;
+                }
+                qint64 ms = qMax(qint64(1), timer.elapsed());
+
+                int heard = 0;
+                foreach (SubjectListener *l, ll) heard += l->changes();
+                QCOMPARE(heard, (commits * perCommit * listeners) / 10000);
+
+                qDebug() << "subscriptionRouting:" << listeners
+                         << (subscribe ? "subscriptions:" : "listeners:")
+                         << commits << "commits of" << perCommit
+                         << "changes in" << ms << "ms";
+
+                foreach (ChangeSubscription *s, subs) delete s;
+                foreach (SubjectListener *l, ll) delete l;
+            }
+        }
+    }
+
+    void commitLatency() {
+
+        // Single-triple commits through a write-ahead log, with and
+        // without a listener that reloads on every commit, using
+        // commit() and commitAsync().  The latency of commitAsync is
+        // measured to completion of its future, i.e. until the change
+        // is durable; the listener's time should show up in the
+        // latency of commit() but not of commitAsync()
+
+        Uri pred("http://breakfastquay.com/rdf/dataquay/tests#value");
+        int commits = 200;
+
+        for (int listen = 0; listen < 2; ++listen) {
+            for (int async = 0; async < 2; ++async) {
+
+                QFile::remove("perf-latency.dqs.journal");
+                ChangeJournal log("perf-latency.dqs");
+                BasicStore store;
+                TransactionalStore ts(&store, &log);
+                ReloadListener listener(&ts);
+                if (listen) {
+                    connect(&ts, SIGNAL(transactionCommitted()),
+                            &listener, SLOT(reload()),
+                            Qt::DirectConnection);
+                }
+
+                Triples tt;
+                for (int i = 0; i < 5000; ++i) {
+                    tt.push_back(Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#base%1").arg(i)), pred, Node::fromVariant(i)));
+                }
+                store.addAll(tt);
+
+                QList<qint64> latencies;
+                for (int i = 0; i < commits; ++i) {
+                    QElapsedTimer timer;
+                    timer.start();
+                    Transaction *tx = ts.startTransaction();
+                    tx->add(Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#c%1").arg(i)), pred, Node::fromVariant(i)));
+                    if (async) {
+                        QFuture<bool> f = tx->commitAsync();
+                        f.waitForFinished();
+                        QVERIFY(f.result());
+                    } else {
+                        tx->commit();
+                    }
+                    latencies.push_back(timer.nsecsElapsed() / 1000);
+                    delete tx;
+                }
+                std::sort(latencies.begin(), latencies.end());
+
+                qDebug() << "commitLatency:"
+                         << (listen ? "with listener:" : "no listener:")
+                         << (async ? "commitAsync:" : "commit:")
+                         << "p50" << latencies[commits / 2]
+                         << "us, p90" << latencies[(commits * 9) / 10]
+                         << "us, p99" << latencies[(commits * 99) / 100]
+                         << "us";
+
+                // wait for the last notifications before the listener
+                // goes away
+                Transaction *tx = ts.startTransaction();
+                tx->commit();
+                delete tx;
+                if (listen) QCOMPARE(listener.reloads(), commits + 1);
+            }
+        }
+
+        QFile::remove("perf-latency.dqs.journal");
+    }
+
+private:
+    qint64 residentKB() const {
+        // Linux only; elsewhere return 0 and skip the memory figure
+        QFile f("/proc/self/status");
+        if (!f.open(QFile::ReadOnly)) return 0;
+        foreach (QByteArray line, f.readAll().split('\n')) {
+            if (line.startsWith("VmRSS:")) {
+                return line.mid(6).trimmed().split(' ')[0].toLongLong();
+            }
+        }
+        return 0;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,183 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Dataquay
+
+    A C++/Qt library for simple RDF datastore management.
+    Copyright 2009-2012 Chris Cannam.
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Except as contained in this notice, the name of Chris Cannam
+    shall not be used in advertising or otherwise to promote the sale,
+    use or other dealings in this Software without prior written
+    authorization.
+*/
+
+
+#ifndef _TEST_SNAPSHOT_STORE_H_
+#define _TEST_SNAPSHOT_STORE_H_
+
+#include <dataquay/Node.h>
+#include <dataquay/BasicStore.h>
+#include <dataquay/SnapshotStore.h>
+#include <dataquay/RDFException.h>
+
+#include <QObject>
+#include <QtTest>
+
+namespace Dataquay {
+
+class TestSnapshotStore : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase() {
+        store.setBaseUri(Uri("http://breakfastquay.com/rdf/dataquay/tests#"));
+        store.addPrefix("foaf", Uri("http://xmlns.com/foaf/0.1/"));
+        Uri knows(store.expand("foaf:knows"));
+        Uri name(store.expand("foaf:name"));
+        Node blank = store.addBlankNode();
+        QVERIFY(store.add(Triple(store.expand(":fred"), knows, store.expand(":alice"))));
+        QVERIFY(store.add(Triple(store.expand(":fred"), knows, store.expand(":bob"))));
+        QVERIFY(store.add(Triple(store.expand(":alice"), knows, store.expand(":bob"))));
+        QVERIFY(store.add(Triple(store.expand(":fred"), name, Node("Fred"))));
+        QVERIFY(store.add(Triple(store.expand(":alice"), name, Node("Alice"))));
+        QVERIFY(store.add(Triple(store.expand(":alice"), store.expand(":age"),
+                                 Node::fromVariant(QVariant(42)))));
+        QVERIFY(store.add(Triple(blank, knows, store.expand(":fred"))));
+        QVERIFY(store.add(Triple(blank, name, Node("Someone"))));
+        store.saveSnapshot("snapshot-test.dqs");
+        snapshot = new SnapshotStore("snapshot-test.dqs");
+    }
+
+    void cleanupTestCase() {
+        delete snapshot;
+    }
+
+    void sizeAndCounts() {
+        QCOMPARE(snapshot->size(), store.size());
+        QCOMPARE(snapshot->count(Triple()), store.size());
+        QCOMPARE(snapshot->count(Triple(store.expand(":fred"), Node(), Node())), 3);
+        QCOMPARE(snapshot->count(Triple(Node(), Node(), store.expand(":bob"))), 2);
+        QCOMPARE(snapshot->count(Triple(store.expand(":nobody"), Node(), Node())), 0);
+    }
+
+    void contains() {
+        QVERIFY(snapshot->contains(Triple(store.expand(":fred"),
+                                          store.expand("foaf:knows"),
+                                          store.expand(":alice"))));
+        QVERIFY(snapshot->contains(Triple(store.expand(":alice"),
+                                          store.expand(":age"),
+                                          Node::fromVariant(QVariant(42)))));
+        QVERIFY(!snapshot->contains(Triple(store.expand(":bob"),
+                                           store.expand("foaf:knows"),
+                                           store.expand(":alice"))));
+        // same value, wrong datatype
+        QVERIFY(!snapshot->contains(Triple(store.expand(":alice"),
+                                           store.expand(":age"),
+                                           Node("42"))));
+    }
+
+    void matchEveryPattern() {
+        // Every combination of bound and wildcard nodes, for every
+        // triple, must give the same results as the original store
+        Triples all = store.match(Triple());
+        foreach (Triple t, all) {
+            for (int mask = 0; mask < 8; ++mask) {
+                Triple pattern((mask & 1) ? t.a : Node(),
+                               (mask & 2) ? t.b : Node(),
+                               (mask & 4) ? t.c : Node());
+                Triples expected = store.match(pattern);
+                QVERIFY(snapshot->match(pattern).matches(expected));
+                QCOMPARE(snapshot->count(pattern), expected.size());
+                int visited = 0;
+                snapshot->match(pattern, [&](const Triple &r) {
+                        if (expected.contains(r)) ++visited;
+                        return true;
+                    });
+                QCOMPARE(visited, expected.size());
+            }
+        }
+    }
+
+    void completeAndMatchOnce() {
+        Node n = snapshot->complete(Triple(store.expand(":fred"),
+                                           store.expand("foaf:name"),
+                                           Node()));
+        QCOMPARE(n.value, QString("Fred"));
+        Triple t = snapshot->matchOnce(Triple(Node(), store.expand("foaf:knows"),
+                                              store.expand(":alice")));
+        QCOMPARE(t.a, Node(store.expand(":fred")));
+        QCOMPARE(snapshot->matchOnce(Triple(store.expand(":bob"), Node(), Node())),
+                 Triple());
+    }
+
+    void expandAndUniqueUri() {
+        QCOMPARE(snapshot->getBaseUri().toString(), store.getBaseUri().toString());
+        QCOMPARE(snapshot->expand(":fred").toString(),
+                 store.expand(":fred").toString());
+        QCOMPARE(snapshot->expand("foaf:name").toString(),
+                 store.expand("foaf:name").toString());
+        Uri u = snapshot->getUniqueUri(":x_");
+        QVERIFY(u.toString().startsWith(store.getBaseUri().toString() + "x_"));
+        QCOMPARE(snapshot->count(Triple(u, Node(), Node())), 0);
+    }
+
+    void readOnly() {
+        QVERIFY(!snapshot->getSupportedFeatures().contains(Store::ModifyFeature));
+        try {
+            snapshot->add(Triple(store.expand(":bob"), store.expand("foaf:knows"),
+                                 store.expand(":alice")));
+            QFAIL("add succeeded on a read-only store");
+        } catch (const RDFUnsupportedError &) {
+            QVERIFY(1);
+        }
+        QCOMPARE(snapshot->size(), store.size());
+    }
+
+    void saveAsTurtle() {
+        snapshot->save("snapshot-test.ttl");
+        BasicStore *reloaded = BasicStore::load(QUrl("file:snapshot-test.ttl"));
+        QCOMPARE(reloaded->size(), store.size());
+        QVERIFY(reloaded->contains(Triple(store.expand(":alice"),
+                                          store.expand(":age"),
+                                          Node::fromVariant(QVariant(42)))));
+        delete reloaded;
+    }
+
+    void notASnapshot() {
+        try {
+            SnapshotStore s("snapshot-test.ttl");
+            QFAIL("opened a file that is not a snapshot");
+        } catch (const RDFException &) {
+            QVERIFY(1);
+        }
+    }
+
+private:
+    BasicStore store;
+    SnapshotStore *snapshot;
+};
+
+}
+
+#endif
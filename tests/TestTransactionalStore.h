@@ -39,12 +39,230 @@
 #include <dataquay/RDFException.h>
 #include <dataquay/TransactionalStore.h>
 #include <dataquay/Connection.h>
+#include <dataquay/ConnectionPool.h>
+#include <dataquay/ChangeJournal.h>
+#include <dataquay/ChangeSubscription.h>
 
 #include <QObject>
+#include <QFile>
+#include <QThread>
 #include <QtTest>
 
 namespace Dataquay {
 
+/**
+ * Starts a transaction on a thread of its own, so that a test can
+ * have more than one transaction in progress at once.
+ */
+class TransactionStarter : public QThread
+{
+public:
+    TransactionStarter(TransactionalStore *ts) : m_ts(ts), m_tx(0) { }
+
+    Transaction *startTransaction() {
+        QThread::start();
+        wait();
+        return m_tx;
+    }
+
+protected:
+    void run() {
+        try {
+            m_tx = m_ts->startTransaction();
+        } catch (const RDFException &) {
+            m_tx = 0;
+        }
+    }
+
+private:
+    TransactionalStore *m_ts;
+    Transaction *m_tx;
+};
+
+/**
+ * Records the size of each change set it is notified of, and the
+ * changes in them.
+ */
+class CommitListener : public QObject
+{
+    Q_OBJECT
+
+public:
+    QList<int> sizes;
+    ChangeSet changes;
+
+public slots:
+    void committed(const ChangeSet &cs) {
+        sizes.push_back(cs.size());
+        changes += cs;
+    }
+};
+
+/**
+ * Increments a counter in the store through a Connection of its own,
+ * from its own thread, retrying each increment until it commits
+ * without conflict.
+ */
+class CounterWorker : public QThread
+{
+public:
+    CounterWorker(TransactionalStore *ts, Triple counter, int increments) :
+        m_ts(ts), m_counter(counter), m_increments(increments),
+        m_failed(false) { }
+
+    bool failed() const { return m_failed; }
+
+protected:
+    void run() {
+        Connection c(m_ts);
+        for (int i = 0; i < m_increments; ) {
+            try {
+                Triple t = c.matchOnce(m_counter);
+                int n = t.c.toVariant().toInt();
+                if (!c.remove(t)) {
+                    // Read before our transaction began, and since
+                    // changed by another
+                    c.rollback();
+                    continue;
+                }
+                Triple next(t.a, t.b, Node::fromVariant(QVariant(n + 1)));
+                c.add(next);
+                ChangeSet cs = c.commitAndObtain();
+                if (cs.size() != 2 || cs[1] != Change(AddTriple, next)) {
+                    m_failed = true;
+                }
+                ++i;
+            } catch (const RDFTransactionConflict &) {
+                continue;
+            } catch (const RDFException &) {
+                m_failed = true;
+                return;
+            }
+        }
+    }
+
+private:
+    TransactionalStore *m_ts;
+    Triple m_counter;
+    int m_increments;
+    bool m_failed;
+};
+
+/**
+ * Works in a transaction started elsewhere, from its own thread:
+ * adds a run of triples of its own one at a time and some more in
+ * one addAll, removes half of the first run again, and adds one
+ * triple that every worker adds.
+ */
+class SharedTxWorker : public QThread
+{
+public:
+    SharedTxWorker(Transaction *tx, QString tag, int n) :
+        m_tx(tx), m_tag(tag), m_n(n), m_added(0), m_failed(false) { }
+
+    int added() const { return m_added; }
+    bool failed() const { return m_failed; }
+
+    static Triple triple(QString tag, int i) {
+        return Triple(Uri(QString("http://breakfastquay.com/rdf/dataquay/tests#%1_%2").arg(tag).arg(i)),
+                      Uri("http://breakfastquay.com/rdf/dataquay/tests#value"),
+                      Node::fromVariant(QVariant(i)));
+    }
+
+protected:
+    void run() {
+        try {
+            for (int i = 0; i < m_n; ++i) {
+                if (!m_tx->add(triple(m_tag, i))) m_failed = true;
+                if (!m_tx->contains(triple(m_tag, i))) m_failed = true;
+            }
+            Triples tt;
+            for (int i = m_n; i < m_n * 2; ++i) tt.push_back(triple(m_tag, i));
+            if (m_tx->addAll(tt) != m_n) m_failed = true;
+            for (int i = 0; i < m_n; i += 2) {
+                if (!m_tx->remove(triple(m_tag, i))) m_failed = true;
+            }
+            if (m_tx->add(triple("shared", 0))) ++m_added;
+        } catch (const RDFException &) {
+            m_failed = true;
+        }
+    }
+
+private:
+    Transaction *m_tx;
+    QString m_tag;
+    int m_n;
+    int m_added;
+    bool m_failed;
+};
+
+/**
+ * Adds triples one at a time to a transaction started elsewhere, from
+ * its own thread, until the transaction is committed under it.
+ */
+class SharedTxAdder : public QThread
+{
+public:
+    SharedTxAdder(Transaction *tx, QString tag) :
+        m_tx(tx), m_tag(tag), m_added(0), m_failed(false) { }
+
+    int added() const { return m_added; }
+    bool failed() const { return m_failed; }
+
+protected:
+    void run() {
+        try {
+            while (m_added < 1000000) {
+                if (!m_tx->add(SharedTxWorker::triple(m_tag, m_added))) {
+                    m_failed = true;
+                    return;
+                }
+                ++m_added;
+            }
+            m_failed = true;
+        } catch (const RDFTransactionError &) {
+            // committed
+        } catch (const RDFException &) {
+            m_failed = true;
+        }
+    }
+
+private:
+    Transaction *m_tx;
+    QString m_tag;
+    int m_added;
+    bool m_failed;
+};
+
+/**
+ * Adds and commits one triple through a Connection from a pool,
+ * from its own thread.
+ */
+class PoolWorker : public QThread
+{
+public:
+    PoolWorker(ConnectionPool *pool, Triple t) :
+        m_pool(pool), m_triple(t), m_failed(false) { }
+
+    bool failed() const { return m_failed; }
+
+protected:
+    void run() {
+        try {
+            PooledConnection c(m_pool);
+            if (!c->add(m_triple)) m_failed = true;
+            c->commit();
+        } catch (const RDFException &) {
+            m_failed = true;
+        }
+    }
+
+private:
+    ConnectionPool *m_pool;
+    Triple m_triple;
+    bool m_failed;
+};
+
 class TestTransactionalStore : public QObject
 {
     Q_OBJECT
@@ -203,6 +421,551 @@ private slots:
 	delete t;
     }
 
+    void concurrentTxInThreads() {
+        // Transactions begun on different threads may be in progress
+        // together, and if they don't touch the same triples, both
+        // may commit
+        TransactionStarter s1(ts), s2(ts);
+        Transaction *t1 = s1.startTransaction();
+        Transaction *t2 = s2.startTransaction();
+        QVERIFY(t1);
+        QVERIFY(t2);
+        Triple fred(store.expand(":fred"), store.expand(":age"),
+                    Node::fromVariant(QVariant(42)));
+        Triple alice(store.expand(":alice"), store.expand(":age"),
+                     Node::fromVariant(QVariant(39)));
+        QVERIFY(t1->add(fred));
+        QVERIFY(t2->add(alice));
+        QVERIFY(!t2->contains(fred));
+        QVERIFY(!t1->contains(alice));
+        t1->commit();
+        t2->commit();
+        delete t1;
+        delete t2;
+        QVERIFY(ts->contains(fred));
+        QVERIFY(ts->contains(alice));
+    }
+
+    void overlappingTx() {
+        // Two transactions make the same changes, and one commits:
+        // the other is bound to conflict, but until it commits its
+        // view must still be consistent, with nothing counted twice
+        // or not at all
+        Triple fred(store.expand(":fred"), store.expand(":age"),
+                    Node::fromVariant(QVariant(42)));
+        Triple alice(store.expand(":alice"), store.expand(":age"),
+                     Node::fromVariant(QVariant(39)));
+        Triple bob(store.expand(":bob"), store.expand(":age"),
+                   Node::fromVariant(QVariant(28)));
+        Triple ages(Node(), store.expand(":age"), Node());
+        Transaction *t = ts->startTransaction();
+        QVERIFY(t->add(alice));
+        QVERIFY(t->add(bob));
+        t->commit();
+        delete t;
+
+        TransactionStarter s1(ts), s2(ts);
+        Transaction *t1 = s1.startTransaction();
+        Transaction *t2 = s2.startTransaction();
+        QVERIFY(t1->add(fred));
+        QVERIFY(t1->remove(alice));
+        QVERIFY(t2->add(fred));
+        QVERIFY(t2->remove(alice));
+        t2->commit();
+        delete t2;
+        QCOMPARE(ts->count(ages), 2);
+
+        Triples tt = t1->match(ages);
+        QCOMPARE(tt.size(), 2);
+        QVERIFY(tt.contains(fred));
+        QVERIFY(tt.contains(bob));
+        QCOMPARE(t1->count(ages), 2);
+        QCOMPARE(t1->count(fred), 1);
+        QCOMPARE(t1->count(alice), 0);
+        QCOMPARE(t1->size(), 2);
+
+        try {
+            t1->commit();
+            QVERIFY2(0, "commit succeeded despite conflict, should have failed");
+        } catch (const RDFTransactionConflict &) {
+            QVERIFY(1);
+        }
+        delete t1;
+        QCOMPARE(ts->size(), 2);
+    }
+
+    void conflictingTx() {
+        // Two transactions each read fred's age, then set it; the
+        // second to commit has acted on out-of-date information and
+        // must fail, leaving the first one's change intact
+        TransactionStarter s1(ts), s2(ts);
+        Transaction *t1 = s1.startTransaction();
+        Transaction *t2 = s2.startTransaction();
+        Triple age(store.expand(":fred"), store.expand(":age"), Node());
+        Triple age42(age.a, age.b, Node::fromVariant(QVariant(42)));
+        Triple age43(age.a, age.b, Node::fromVariant(QVariant(43)));
+        QVERIFY(t1->match(age).empty());
+        QVERIFY(t2->match(age).empty());
+        QVERIFY(t1->add(age42));
+        QVERIFY(t2->add(age43));
+        t1->commit();
+        try {
+            t2->commit();
+            QVERIFY2(0, "commit succeeded despite conflict, should have failed");
+        } catch (const RDFTransactionConflict &) {
+            QVERIFY(1);
+        }
+        QVERIFY(t2->getCommittedChanges().empty());
+        delete t1;
+        delete t2;
+        QVERIFY(ts->contains(age42));
+        QVERIFY(!ts->contains(age43));
+
+        // and a retry sees the committed change
+        Transaction *t = ts->startTransaction();
+        QCOMPARE(t->match(age).size(), 1);
+        QVERIFY(t->remove(age42));
+        QVERIFY(t->add(age43));
+        t->commit();
+        delete t;
+        QVERIFY(ts->contains(age43));
+    }
+
+    void readOnlyTx() {
+        Transaction *t = ts->startTransaction();
+        int added = 0;
+        QVERIFY(addThings(t, added));
+        t->commit();
+        delete t;
+
+        const Transaction *r = ts->startReadOnlyTransaction();
+        QCOMPARE(r->size(), added);
+
+        // Read-only transactions may be started alongside a writing
+        // one in the same thread, and go on seeing the store as it
+        // was when they began, whatever is committed meanwhile
+        Triple name(store.expand(":fred"),
+                    Uri("http://xmlns.com/foaf/0.1/name"),
+                    Node("Fred Jenkins"));
+        Triple age(store.expand(":fred"), store.expand(":age"),
+                   Node::fromVariant(QVariant(44)));
+        t = ts->startTransaction();
+        const Transaction *rr = ts->startReadOnlyTransaction();
+        QVERIFY(t->remove(name));
+        QVERIFY(t->add(age));
+        t->commit();
+        delete t;
+        QVERIFY(!ts->contains(name));
+        QVERIFY(ts->contains(age));
+        foreach (const Transaction *view, QList<const Transaction *>() << r << rr) {
+            QVERIFY(view->contains(name));
+            QVERIFY(!view->contains(age));
+            QCOMPARE(view->size(), added);
+            QCOMPARE(view->match(Triple(store.expand(":fred"), Node(), Node())).size(), added);
+        }
+        delete rr;
+
+        // and the view is unchanged by a commit that undoes the last
+        t = ts->startTransaction();
+        QVERIFY(t->add(name));
+        QVERIFY(t->remove(age));
+        t->commit();
+        delete t;
+        QVERIFY(r->contains(name));
+        QVERIFY(!r->contains(age));
+        QCOMPARE(r->size(), added);
+
+        // It can't be written to, even if the caller insists
+        try {
+            const_cast<Transaction *>(r)->add(age);
+            QVERIFY2(0, "add succeeded in read-only transaction, should have failed");
+        } catch (const RDFTransactionError &) {
+            QVERIFY(1);
+        }
+        QVERIFY(!r->contains(age));
+        delete r;
+
+        r = ts->startReadOnlyTransaction();
+        QCOMPARE(r->size(), added);
+        delete r;
+    }
+
+    void asyncCommit() {
+        CommitListener listener;
+        connect(ts, SIGNAL(transactionCommitted(const ChangeSet &)),
+                &listener, SLOT(committed(const ChangeSet &)),
+                Qt::DirectConnection);
+
+        Transaction *t = ts->startTransaction();
+        int added = 0;
+        QVERIFY(addThings(t, added));
+        QFuture<bool> f = t->commitAsync();
+        // the changes are in the store as soon as commitAsync returns
+        QCOMPARE(ts->size(), added);
+        f.waitForFinished();
+        QVERIFY(f.result());
+        int changes = t->getCommittedChanges().size();
+        QVERIFY(changes > 0);
+        delete t;
+
+        // and listeners hear of them before those of a later commit
+        t = ts->startTransaction();
+        QVERIFY(t->add(Triple(store.expand(":alice"), store.expand(":age"),
+                              Node::fromVariant(QVariant(39)))));
+        t->commit();
+        delete t;
+        QCOMPARE(listener.sizes, QList<int>() << changes << 1);
+
+        // With a write-ahead log, the future completes once the
+        // changes have been synced
+        QFile::remove("async-test.dqs.journal");
+        {
+            ChangeJournal log("async-test.dqs");
+            BasicStore bs;
+            TransactionalStore wts(&bs, &log);
+            t = wts.startTransaction();
+            QVERIFY(addThings(t, added));
+            f = t->commitAsync();
+            delete t;
+            f.waitForFinished();
+            QVERIFY(f.result());
+            QCOMPARE(log.getEntryCount(), 1);
+        }
+        QFile::remove("async-test.dqs.journal");
+    }
+
+    void subscriptions() {
+        Node fred(store.expand(":fred"));
+        Node alice(store.expand(":alice"));
+        Node age(store.expand(":age"));
+        QList<ChangeSubscription *> subs;
+        subs << ts->subscribe(Triple(fred, Node(), Node()))
+             << ts->subscribe(Triple(Node(), age, Node()))
+             << ts->subscribe(Triple(fred, age, Node()))
+             << ts->subscribe(Triple())
+             << ts->subscribe(Triple(store.expand(":nobody"), Node(), Node()));
+        CommitListener listeners[5];
+        for (int i = 0; i < subs.size(); ++i) {
+            connect(subs[i], SIGNAL(changesCommitted(const ChangeSet &)),
+                    &listeners[i], SLOT(committed(const ChangeSet &)),
+                    Qt::DirectConnection);
+        }
+
+        Transaction *t = ts->startTransaction();
+        int added = 0;
+        QVERIFY(addThings(t, added));
+        Triple aliceAge(alice, age, Node::fromVariant(QVariant(39)));
+        QVERIFY(t->add(aliceAge));
+        t->commit();
+        ChangeSet cs = t->getCommittedChanges();
+        delete t;
+
+        // Each hears once of the changes that match its pattern only
+        QCOMPARE(listeners[3].sizes.size(), 1);
+        QVERIFY(listeners[3].changes == cs);
+        QCOMPARE(listeners[0].changes.size(), cs.size() - 1);
+        foreach (const Change &c, listeners[0].changes) QVERIFY(c.second.a == fred);
+        QCOMPARE(listeners[1].changes.size(), 4);
+        foreach (const Change &c, listeners[1].changes) QVERIFY(c.second.b == age);
+        QCOMPARE(listeners[2].changes.size(), 3);
+        QVERIFY(listeners[4].sizes.empty());
+
+        // and nothing once unsubscribed
+        delete subs[3];
+        t = ts->startTransaction();
+        QVERIFY(t->remove(aliceAge));
+        t->commit();
+        delete t;
+        QCOMPARE(listeners[3].sizes.size(), 1);
+        QCOMPARE(listeners[1].changes.size(), 5);
+        QVERIFY(listeners[1].changes.last() == Change(RemoveTriple, aliceAge));
+        QCOMPARE(listeners[0].changes.size(), cs.size() - 1);
+
+        delete subs[0];
+        delete subs[1];
+        delete subs[2];
+        delete subs[4];
+    }
+
+    void groupCommit() {
+        QVERIFY(!ts->getGroupCommit());
+        ts->setGroupCommit(true);
+        QVERIFY(ts->getGroupCommit());
+
+        // A lone commit goes through as a group of one, and conflicts
+        // are detected as before
+        conflictingTx();
+        store.clear();
+
+        // Many threads contending for one counter: those committed
+        // in the same group as an earlier increment must conflict and
+        // retry, so that no increment is lost, and each commit obtains
+        // only its own changes
+        Triple counter(store.expand(":counter"), store.expand(":value"),
+                       Node());
+        Transaction *t = ts->startTransaction();
+        QVERIFY(t->add(Triple(counter.a, counter.b,
+                              Node::fromVariant(QVariant(0)))));
+        t->commit();
+        delete t;
+
+        int increments = 50;
+        QList<CounterWorker *> workers;
+        for (int i = 0; i < 8; ++i) {
+            workers.push_back(new CounterWorker(ts, counter, increments));
+        }
+        foreach (CounterWorker *w, workers) w->start();
+        foreach (CounterWorker *w, workers) w->wait();
+        foreach (CounterWorker *w, workers) {
+            QVERIFY(!w->failed());
+            delete w;
+        }
+        QCOMPARE(ts->matchOnce(counter).c.toVariant().toInt(),
+                 8 * increments);
+        QCOMPARE(ts->size(), 1);
+
+        ts->setGroupCommit(false);
+    }
+
+    void sharedTx() {
+        // Several threads working in one transaction at once: every
+        // change should be made and recorded once, in an order that
+        // replays to the same result
+        Transaction *t = ts->startTransaction();
+        int n = 200;
+        QList<SharedTxWorker *> workers;
+        for (int i = 0; i < 8; ++i) {
+            workers.push_back(new SharedTxWorker(t, QString("w%1").arg(i), n));
+        }
+        foreach (SharedTxWorker *w, workers) w->start();
+        foreach (SharedTxWorker *w, workers) w->wait();
+        int shared = 0;
+        foreach (SharedTxWorker *w, workers) {
+            QVERIFY(!w->failed());
+            shared += w->added();
+        }
+        QCOMPARE(shared, 1);
+
+        // each worker leaves 3n/2 triples of its own
+        int expected = 8 * (n + n / 2) + 1;
+        QCOMPARE(t->size(), expected);
+        QCOMPARE(t->getChanges().size(), 8 * (n * 2 + n / 2) + 1);
+        QCOMPARE(ts->size(), 0);
+
+        BasicStore replay;
+        replay.change(t->getChanges());
+        QCOMPARE(replay.size(), expected);
+
+        t->commit();
+        delete t;
+        QCOMPARE(ts->size(), expected);
+        QVERIFY(ts->contains(SharedTxWorker::triple("w3", 1)));
+        QVERIFY(!ts->contains(SharedTxWorker::triple("w3", 2)));
+        QVERIFY(ts->contains(SharedTxWorker::triple("w5", n + 2)));
+
+        foreach (SharedTxWorker *w, workers) delete w;
+    }
+
+    void sharedTxCommit() {
+        // Committing while another thread is still adding: every add
+        // that succeeds must be committed, and every one after the
+        // commit must fail rather than being lost
+        for (int round = 0; round < 20; ++round) {
+            QString tag = QString("r%1").arg(round);
+            Transaction *t = ts->startTransaction();
+            SharedTxAdder adder(t, tag);
+            adder.start();
+            while (t->getChanges().size() < 10) QThread::yieldCurrentThread();
+            t->commit();
+            adder.wait();
+            QVERIFY(!adder.failed());
+            int added = adder.added();
+            QCOMPARE(t->getCommittedChanges().size(), added);
+            QVERIFY(ts->contains(SharedTxWorker::triple(tag, added - 1)));
+            QVERIFY(!ts->contains(SharedTxWorker::triple(tag, added)));
+            try {
+                t->commit();
+                QVERIFY2(0, "second commit succeeded, should have failed");
+            } catch (const RDFTransactionError &) {
+                QVERIFY(1);
+            }
+            delete t;
+        }
+    }
+
+    void savepoints() {
+        Node fred(store.expand(":fred"));
+        Node age(store.expand(":age"));
+        Triple age42(fred, age, Node::fromVariant(QVariant(42)));
+        Triple age43(fred, age, Node::fromVariant(QVariant(43)));
+        Triple name(fred, Uri("http://xmlns.com/foaf/0.1/name"),
+                    Node("Fred Jenkins"));
+        Triple knows(fred, Uri("http://xmlns.com/foaf/0.1/knows"),
+                     store.expand(":alice"));
+        Transaction *t = ts->startTransaction();
+        QVERIFY(t->add(age42));
+        t->commit();
+        delete t;
+
+        t = ts->startTransaction();
+        QVERIFY(t->add(name));
+        int outer = t->savepoint();
+        QVERIFY(t->remove(age42));
+        QVERIFY(t->add(age43));
+        int inner = t->savepoint();
+        QVERIFY(t->add(knows));
+        QVERIFY(t->remove(name));
+        QCOMPARE(t->getChanges().size(), 5);
+
+        // Rolling back to the inner savepoint keeps what came before
+        t->rollbackTo(inner);
+        QCOMPARE(t->getChanges().size(), 3);
+        QVERIFY(t->contains(age43));
+        QVERIFY(t->contains(name));
+        QVERIFY(!t->contains(knows));
+
+        // and it may be rolled back to again
+        QVERIFY(t->add(knows));
+        t->rollbackTo(inner);
+        QVERIFY(!t->contains(knows));
+
+        // Rolling back to the outer one restores the removed triple
+        // and discards the inner savepoint
+        t->rollbackTo(outer);
+        QCOMPARE(t->getChanges().size(), 1);
+        QVERIFY(t->contains(age42));
+        QVERIFY(!t->contains(age43));
+        QVERIFY(t->contains(name));
+        try {
+            t->rollbackTo(inner);
+            QVERIFY2(0, "rollbackTo succeeded with discarded savepoint, should have failed");
+        } catch (const RDFTransactionError &) {
+            QVERIFY(1);
+        }
+
+        // The transaction is still usable, and commits only what was
+        // kept
+        QVERIFY(t->add(knows));
+        t->commit();
+        QVERIFY(t->getCommittedChanges() ==
+                ChangeSet() << Change(AddTriple, name)
+                            << Change(AddTriple, knows));
+        delete t;
+        QCOMPARE(ts->size(), 3);
+        QVERIFY(ts->contains(age42));
+        QVERIFY(ts->contains(name));
+        QVERIFY(ts->contains(knows));
+    }
+
+    void statistics() {
+        ts->resetStatistics();
+        ts->setStatisticsEnabled(true);
+
+        Transaction *t = ts->startTransaction();
+        int added = 0;
+        QVERIFY(addThings(t, added));
+        t->commit();
+        delete t;
+        ts->size();
+
+        Statistics s = ts->getStatistics();
+        QCOMPARE(s.getOperationCount("start"), quint64(1));
+        QCOMPARE(s.getOperationCount("commit"), quint64(1));
+        QCOMPARE(s.getOperationCount("size"), quint64(1));
+        QVERIFY(s.getOperationCount("transaction add") > 0);
+        QCOMPARE(s.getTiming("transaction").getCount(), quint64(1));
+        QVERIFY(s.getTiming("transaction mutex wait").getCount() > 0);
+        QVERIFY(s.getTiming("store write hold").getCount() > 0);
+        QCOMPARE(s.getSize("commit").getCount(), quint64(1));
+
+        ts->setStatisticsEnabled(false);
+        t = ts->startTransaction();
+        t->rollback();
+        delete t;
+        QCOMPARE(ts->getStatistics().getOperationCount("start"), quint64(1));
+        ts->resetStatistics();
+        QVERIFY(ts->getStatistics().getOperations().isEmpty());
+    }
+
+    void connectionPool() {
+        Triple kept(store.expand(":fred"), store.expand(":in"),
+                    Node("pool"));
+        Triple dropped(store.expand(":alice"), store.expand(":in"),
+                       Node("pool"));
+
+        ConnectionPool pool(ts, 2);
+        pool.setStatisticsEnabled(true);
+        QCOMPARE(pool.getMaxConnections(), 2);
+
+        Connection *c1 = pool.acquire();
+        Connection *c2 = pool.acquire();
+        QVERIFY(c1 != c2);
+        QCOMPARE(pool.getActiveConnections(), 2);
+        QCOMPARE(pool.getIdleConnections(), 0);
+
+        // Release rolls back rather than committing, and the
+        // connection is then reused
+        QVERIFY(c1->add(dropped));
+        pool.release(c1);
+        QVERIFY(!ts->contains(dropped));
+        QCOMPARE(pool.getActiveConnections(), 1);
+        QCOMPARE(pool.getIdleConnections(), 1);
+        QCOMPARE(pool.acquire(), c1);
+
+        try {
+            pool.release(0);
+            QVERIFY2(0, "release succeeded with unknown connection, should have failed");
+        } catch (const RDFException &) {
+            QVERIFY(1);
+        }
+
+        // With both connections in use, a worker must wait for one
+        PoolWorker w(&pool, kept);
+        w.start();
+        QVERIFY(!w.wait(100));
+        QVERIFY(!ts->contains(kept));
+        pool.release(c2);
+        QVERIFY(w.wait());
+        QVERIFY(!w.failed());
+        QVERIFY(ts->contains(kept));
+        QCOMPARE(pool.getActiveConnections(), 1);
+
+        // The thread connection is the same on each call and is
+        // reclaimed on release
+        pool.release(c1);
+        Connection *tc = pool.getThreadConnection();
+        QCOMPARE(pool.getThreadConnection(), tc);
+        QCOMPARE(pool.getActiveConnections(), 1);
+        pool.releaseThreadConnection();
+        QCOMPARE(pool.getActiveConnections(), 0);
+        QCOMPARE(pool.getIdleConnections(), 2);
+
+        // A connection whose transaction was abandoned by a failed
+        // operation still goes back to the pool when dropped, even
+        // while that failure is propagating
+        try {
+            PooledConnection pc(&pool);
+            pc->add(Triple(Node(), store.expand(":in"),
+                           Node("this_statement_is_incomplete")));
+            QVERIFY2(0, "add succeeded with incomplete triple, should have failed");
+        } catch (const RDFException &) {
+            QVERIFY(1);
+        }
+        QCOMPARE(pool.getActiveConnections(), 0);
+        QCOMPARE(pool.getIdleConnections(), 2);
+        {
+            PooledConnection pc(&pool);
+            QVERIFY(pc->add(dropped));
+        }
+        QVERIFY(!ts->contains(dropped));
+
+        Statistics s = pool.getStatistics();
+        QCOMPARE(s.getOperationCount("create"), quint64(2));
+        QCOMPARE(s.getOperationCount("acquire"), quint64(7));
+        QCOMPARE(s.getOperationCount("release"), quint64(7));
+        QCOMPARE(s.getSize("active").getMax(), quint64(2));
+    }
+
     void consecutiveTxInThread() {
 	Transaction *t = ts->startTransaction();
 	t->commit();
@@ -308,6 +1071,90 @@ private slots:
 				    Node::fromVariant(QVariant(42)))));
     }
 
+    void matchVisitor() {
+	Transaction *t = ts->startTransaction();
+	int added = 0;
+	QVERIFY(addThings(t, added));
+
+        // the visitor sees the transaction's changes through the
+        // transaction, but not through the store
+        int seen = 0;
+        t->match(Triple(), [&](const Triple &) { ++seen; return true; });
+        QCOMPARE(seen, added);
+
+        seen = 0;
+        ts->match(Triple(), [&](const Triple &) { ++seen; return true; });
+        QCOMPARE(seen, 0);
+
+        t->commit();
+        delete t;
+
+        seen = 0;
+        ts->match(Triple(), [&](const Triple &) { ++seen; return true; });
+        QCOMPARE(seen, added);
+    }
+
+    void counts() {
+	Transaction *t = ts->startTransaction();
+	int added = 0;
+	QVERIFY(addThings(t, added));
+
+        QCOMPARE(t->size(), added);
+        QCOMPARE(t->count(Triple(store.expand(":fred"), Node(), Node())),
+                 t->match(Triple(store.expand(":fred"), Node(), Node())).size());
+        QCOMPARE(ts->size(), 0);
+
+        t->commit();
+        delete t;
+        QCOMPARE(ts->size(), added);
+    }
+
+    void bulkAddsAndRemoves() {
+        Triples tt;
+        for (int i = 0; i < 10; ++i) {
+            tt.push_back(Triple(store.expand(QString(":item%1").arg(i)),
+                                store.expand("rdf:value"),
+                                Node::fromVariant(i)));
+        }
+
+        Transaction *t = ts->startTransaction();
+        QCOMPARE(t->addAll(tt), 10);
+        QCOMPARE(t->addAll(tt), 0);
+        QCOMPARE(t->getChanges().size(), 10);
+        QCOMPARE(ts->match(Triple()).size(), 0);
+        t->commit();
+        delete t;
+        QCOMPARE(ts->match(Triple()).size(), 10);
+
+        // removals are recorded too, so that rollback restores them
+        Triples first;
+        for (int i = 0; i < 4; ++i) first.push_back(tt[i]);
+        t = ts->startTransaction();
+        QCOMPARE(t->removeAll(first), 4);
+        QCOMPARE(t->match(Triple()).size(), 6);
+        QCOMPARE(ts->match(Triple()).size(), 10);
+        t->rollback();
+        delete t;
+        QCOMPARE(ts->match(Triple()).size(), 10);
+
+        // a change set that the store refuses leaves the transaction
+        // as it was
+        t = ts->startTransaction();
+        ChangeSet cs;
+        cs.push_back(Change(RemoveTriple, tt[0]));
+        cs.push_back(Change(AddTriple, tt[1]));
+        try {
+            t->change(cs);
+            QVERIFY(0);
+        } catch (const RDFException &) {
+            QVERIFY(1);
+        }
+        QVERIFY(t->getChanges().empty());
+        QVERIFY(t->contains(tt[0]));
+        t->commit();
+        delete t;
+    }
+
     void simpleConnection() {
 
 	Connection *c = new Connection(ts);
@@ -368,6 +1215,213 @@ private slots:
         QCOMPARE(triples.size(), 0);
     }
 
+    void pendingChangesStayOutOfStore() {
+	Transaction *t = ts->startTransaction();
+	int added = 0;
+	QVERIFY(addThings(t, added));
+
+        // Reads directly on the store, on the TransactionalStore and
+        // through the transaction, interleaved: only the transaction
+        // sees its changes, and the underlying store is never touched
+        for (int i = 0; i < 3; ++i) {
+            QCOMPARE(store.size(), 0);
+            QCOMPARE(ts->size(), 0);
+            QCOMPARE(t->size(), added);
+            QCOMPARE(t->count(Triple(store.expand(":fred"), Node(), Node())), added);
+            QVERIFY(!ts->contains(Triple(store.expand(":fred"),
+                                         store.expand(":age"),
+                                         Node::fromVariant(QVariant(42)))));
+            QVERIFY(t->contains(Triple(store.expand(":fred"),
+                                       store.expand(":age"),
+                                       Node::fromVariant(QVariant(42)))));
+        }
+
+	t->commit();
+	delete t;
+        QCOMPARE(store.size(), added);
+
+        // and a removal pending in a transaction is not seen outside
+        // it, while a re-addition of what it removed undoes it
+        t = ts->startTransaction();
+        Triple age(store.expand(":fred"), store.expand(":age"),
+                   Node::fromVariant(QVariant(42)));
+        QVERIFY(t->remove(age));
+        QVERIFY(!t->contains(age));
+        QVERIFY(ts->contains(age));
+        QCOMPARE(t->size(), added - 1);
+        QVERIFY(!t->remove(age));
+        QVERIFY(t->add(age));
+        QVERIFY(!t->add(age));
+        QVERIFY(t->remove(age));
+        t->commit();
+        delete t;
+        QVERIFY(!ts->contains(age));
+        QCOMPARE(store.size(), added - 1);
+    }
+
+    void autoTransaction() {
+        // Each direct write is made in a transaction of its own,
+        // committed before it returns
+        BasicStore bs;
+        TransactionalStore ats(&bs, TransactionalStore::AutoTransaction);
+        Triple fred(store.expand(":fred"), store.expand(":age"),
+                    Node::fromVariant(QVariant(42)));
+        Triple alice(store.expand(":alice"), store.expand(":age"),
+                     Node::fromVariant(QVariant(39)));
+        Triples tt;
+        tt.push_back(alice);
+
+        QVERIFY(ats.add(fred));
+        QVERIFY(bs.contains(fred));
+        QCOMPARE(ats.addAll(tt), 1);
+        QVERIFY(bs.contains(alice));
+        QVERIFY(ats.remove(fred));
+        QVERIFY(!bs.contains(fred));
+        ats.change(ChangeSet() << Change(AddTriple, fred));
+        QVERIFY(bs.contains(fred));
+        ats.revert(ChangeSet() << Change(AddTriple, fred));
+        QVERIFY(!bs.contains(fred));
+        QCOMPARE(ats.removeAll(tt), 1);
+        QCOMPARE(bs.size(), 0);
+    }
+
+    void notifiedWhenSyncFails() {
+        // The commit is in the store even if the log can't be synced,
+        // and listeners must hear of it just as they would have if
+        // the sync had succeeded
+#ifndef Q_OS_LINUX
+        QSKIP("Needs a journal file that cannot be synced");
+#else
+        // fsync fails on /dev/null, though writing to it does not
+        QFile::remove("sync-fail.dqs");
+        QFile::remove("sync-fail.dqs.journal");
+        QVERIFY(QFile::link("/dev/null", "sync-fail.dqs.journal"));
+        {
+            ChangeJournal log("sync-fail.dqs");
+            BasicStore bs;
+            TransactionalStore wts(&bs, &log);
+            CommitListener listener;
+            connect(&wts, SIGNAL(transactionCommitted(const ChangeSet &)),
+                    &listener, SLOT(committed(const ChangeSet &)),
+                    Qt::DirectConnection);
+
+            Triple triple(store.expand(":fred"), store.expand(":synced"),
+                          Node("never"));
+            Transaction *t = wts.startTransaction();
+            QVERIFY(t->add(triple));
+            try {
+                t->commit();
+                QVERIFY2(0, "commit succeeded with unsyncable log, should have failed");
+            } catch (const RDFException &) {
+                QVERIFY(1);
+            }
+            QCOMPARE(t->getCommittedChanges().size(), 1);
+            delete t;
+            QVERIFY(bs.contains(triple));
+            QCOMPARE(listener.sizes.size(), 1);
+            QVERIFY(listener.changes ==
+                    ChangeSet() << Change(AddTriple, triple));
+        }
+        QFile::remove("sync-fail.dqs.journal");
+#endif
+    }
+
+    void writeAheadLog() {
+
+        QFile::remove("wal-test.dqs");
+        QFile::remove("wal-test.dqs.journal");
+
+        Triples committed;
+        {
+            ChangeJournal log("wal-test.dqs");
+            BasicStore bs;
+            TransactionalStore wts(&bs, &log);
+
+            Transaction *t = wts.startTransaction();
+            int added = 0;
+            QVERIFY(addThings(t, added));
+            t->commit();
+            delete t;
+
+            // rolled back, so must not be logged
+            t = wts.startTransaction();
+            t->add(Triple(store.expand(":rolled"), store.expand(":back"),
+                          Node("nothing")));
+            t->rollback();
+            delete t;
+
+            t = wts.startTransaction();
+            t->remove(Triple(store.expand(":fred"),
+                             Uri("http://xmlns.com/foaf/0.1/knows"),
+                             Node()));
+            t->commit();
+            delete t;
+
+            QCOMPARE(log.getEntryCount(), 2);
+            committed = bs.match(Triple());
+        }
+
+        // As if after a crash: the log alone restores an empty store
+        ChangeJournal log("wal-test.dqs");
+        BasicStore recovered;
+        TransactionalStore rts(&recovered, &log);
+        QCOMPARE(recovered.size(), committed.size());
+        foreach (Triple t, committed) QVERIFY(recovered.contains(t));
+        QVERIFY(!recovered.contains(Triple(store.expand(":rolled"),
+                                           store.expand(":back"),
+                                           Node("nothing"))));
+    }
+
+    void compactWriteAheadLog() {
+
+        QFile::remove("wal-compact.dqs");
+        QFile::remove("wal-compact.dqs.journal");
+
+        Triple pending(store.expand(":pending"), store.expand(":in"),
+                       Node("compact"));
+        Triples committed;
+        {
+            ChangeJournal log("wal-compact.dqs");
+            BasicStore bs;
+            TransactionalStore wts(&bs, &log);
+
+            Transaction *t = wts.startTransaction();
+            int added = 0;
+            QVERIFY(addThings(t, added));
+            t->commit();
+            delete t;
+            QCOMPARE(log.getEntryCount(), 1);
+
+            // a transaction still in train has no part in the snapshot
+            t = wts.startTransaction();
+            QVERIFY(t->add(pending));
+            wts.compact();
+            QCOMPARE(log.getEntryCount(), 0);
+            t->rollback();
+            delete t;
+
+            committed = bs.match(Triple());
+        }
+
+        ChangeJournal log("wal-compact.dqs");
+        BasicStore *recovered = log.load();
+        QCOMPARE(recovered->size(), committed.size());
+        foreach (Triple t, committed) QVERIFY(recovered->contains(t));
+        QVERIFY(!recovered->contains(pending));
+        delete recovered;
+
+        // only a store with a write-ahead log can be compacted
+        try {
+            ts->compact();
+            QVERIFY2(0, "compact succeeded without a write-ahead log, should have failed");
+        } catch (const RDFException &) {
+            QVERIFY(1);
+        }
+
+        QFile::remove("wal-compact.dqs");
+        QFile::remove("wal-compact.dqs.journal");
+    }
+
 private:
     BasicStore store;
     TransactionalStore *ts;
@@ -36,6 +36,10 @@
 #include "TestTransactionalStore.h"
 #include "TestImportOptions.h"
 #include "TestObjectMapper.h"
+#include "TestPerformance.h"
+#include "TestSnapshotStore.h"
+#include "TestChangeJournal.h"
+#include "TestLiveMatch.h"
 #include <QtTest>
 
 int main(int argc, char *argv[])
@@ -64,6 +68,28 @@ int main(int argc, char *argv[])
     if (QTest::qExec(&tom, argc, argv) == 0) ++good;
     else ++bad;
 
+    // The benchmarks take minutes and load the whole machine, so
+    // they run only when asked for
+    if (!qgetenv("DATAQUAY_BENCHMARKS").isEmpty()) {
+        Dataquay::TestPerformance tp;
+        if (QTest::qExec(&tp, argc, argv) == 0) ++good;
+        else ++bad;
+    } else {
+        std::cerr << "Skipping benchmarks (set DATAQUAY_BENCHMARKS to run them)" << std::endl;
+    }
+
+    Dataquay::TestSnapshotStore tss;
+    if (QTest::qExec(&tss, argc, argv) == 0) ++good;
+    else ++bad;
+
+    Dataquay::TestChangeJournal tcj;
+    if (QTest::qExec(&tcj, argc, argv) == 0) ++good;
+    else ++bad;
+
+    Dataquay::TestLiveMatch tlm;
+    if (QTest::qExec(&tlm, argc, argv) == 0) ++good;
+    else ++bad;
+
     if (bad > 0) {
 	std::cerr << "\n********* " << bad << " test suite(s) failed!\n" << std::endl;
 	return 1;
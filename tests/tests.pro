@@ -25,7 +25,7 @@ MOC_DIR = o
 
 LIBS += -L.. -ldataquay	$${EXTRALIBS}
 
-HEADERS += TestBasicStore.h TestDatatypes.h TestTransactionalStore.h TestImportOptions.h TestObjectMapper.h
+HEADERS += TestBasicStore.h TestDatatypes.h TestTransactionalStore.h TestImportOptions.h TestObjectMapper.h TestPerformance.h TestSnapshotStore.h TestChangeJournal.h TestLiveMatch.h
 SOURCES += TestDatatypes.cpp main.cpp
 
 exists(../../platform-dataquay.pri) {